@@ -104,6 +104,7 @@ void Usage(char *exec)
    reg_print_info(exec, "\t--kld\t\t\tKLD. Used for all time points");
    reg_print_info(exec, "\t-kld <tp>\t\tKLD. Used for the specified timepoint");
    reg_print_info(exec, "\t* For the Kullback–Leibler divergence, reference and floating are expected to be probabilities");
+   reg_print_info(exec, "\t-noAppPW\t\tNMI. Fill the histograms using a Parzen window instead of smoothing them");
    reg_print_info(exec, "\t-rr\t\t\tIntensities are thresholded between the 2 and 98% ile");
    reg_print_info(exec, "*** Options for setting the weights for each timepoint for each similarity");
    reg_print_info(exec, "*** Note, the options above should be used first and will set a default weight of 1");
@@ -124,10 +125,16 @@ void Usage(char *exec)
    reg_print_info(exec, "\t-nopy\t\t\tDo not use a pyramidal approach");
    reg_print_info(exec, "\t-noConj\t\t\tTo not use the conjuage gradient optimisation but a simple gradient ascent");
    reg_print_info(exec, "\t-pert <int>\t\tTo add perturbation step(s) after each optimisation scheme");
+   reg_print_info(exec, "\t-incNMI\t\t\tOnly update the NMI histogram where control points moved (F3D only)");
+   reg_print_info(exec, "\t-lowMem\t\t\tCompute the deformation field and the gradients by tiles of slices (F3D only)");
+   reg_print_info(exec, "\t-maxMem <int>\t\tUse tiles of slices when the estimated memory usage exceeds <int> MB (F3D only)");
    reg_print_info(exec, "");
    reg_print_info(exec, "*** F3D2 options:");
    reg_print_info(exec, "\t-vel \t\t\tUse a velocity field integration to generate the deformation");
    reg_print_info(exec, "\t-nogce \t\t\tDo not use the gradient accumulation through exponentiation");
+   reg_print_info(exec, "\t-gridExp \t\tExponentiate the velocity field at the control point resolution");
+   reg_print_info(exec, "\t\t\t\tFaster, but the deformation and its gradient only approximate the dense");
+   reg_print_info(exec, "\t\t\t\texponentiation: a few percent for smooth fields, more for rough or large ones");
    reg_print_info(exec, "\t-fmask <filename>\tFilename of a mask image in the floating space");
    reg_print_info(exec, "");
 
@@ -261,7 +268,8 @@ int main(int argc, char **argv)
    {
       if((strcmp(argv[i],"-ref")==0) || (strcmp(argv[i],"-target")==0) || (strcmp(argv[i],"--ref")==0))
       {
-         referenceImage=reg_io_ReadImageFile(argv[++i]);
+         // The input images are only copied, they can be memory mapped
+         referenceImage=reg_io_MapImageFile(argv[++i]);
          if(referenceImage==NULL)
          {
             reg_print_msg_error("Error when reading the reference image:");
@@ -271,7 +279,7 @@ int main(int argc, char **argv)
       }
       if((strcmp(argv[i],"-flo")==0) || (strcmp(argv[i],"-source")==0) || (strcmp(argv[i],"--flo")==0))
       {
-         floatingImage=reg_io_ReadImageFile(argv[++i]);
+         floatingImage=reg_io_MapImageFile(argv[++i]);
          if(floatingImage==NULL)
          {
             reg_print_msg_error("Error when reading the floating image:");
@@ -423,6 +431,10 @@ int main(int argc, char **argv)
          for(int t=0; t<floatingImage->nt; ++t)
             REG->UseNMISetFloatingBinNumber(t,bin);
       }
+      else if(strcmp(argv[i],"-noAppPW")==0 || strcmp(argv[i],"--noAppPW")==0)
+      {
+         REG->DoNotApproximateParzenWindow();
+      }
       else if((strcmp(argv[i],"-rbn")==0) || (strcmp(argv[i],"-tbn")==0))
       {
          int tp=atoi(argv[++i]);
@@ -776,6 +788,18 @@ int main(int argc, char **argv)
       {
          REG->NoGridRefinement();
       }
+      else if(strcmp(argv[i], "-incNMI")==0 || strcmp(argv[i], "--incNMI")==0)
+      {
+         REG->UseIncrementalNMI();
+      }
+      else if(strcmp(argv[i], "-lowMem")==0 || strcmp(argv[i], "--lowMem")==0)
+      {
+         REG->UseTiledExecution();
+      }
+      else if(strcmp(argv[i], "-maxMem")==0 || strcmp(argv[i], "--maxMem")==0)
+      {
+         REG->SetMaximalMemoryUsage((size_t)atoi(argv[++i]));
+      }
       else if(strcmp(argv[i], "-nogce")==0 || strcmp(argv[i], "--nogce")==0)
       {
          REG->DoNotUseGradientCumulativeExp();
@@ -784,6 +808,10 @@ int main(int argc, char **argv)
       {
          REG->UseBCHUpdate(atoi(argv[++i]));
       }
+      else if(strcmp(argv[i], "-gridExp")==0 || strcmp(argv[i], "--gridExp")==0)
+      {
+         REG->UseGridSquaring();
+      }
 
       else if(strcmp(argv[i], "-omp")==0 || strcmp(argv[i], "--omp")==0)
       {
@@ -931,8 +959,8 @@ int main(int argc, char **argv)
 
    // Clean the allocated images
    if(refLocalWeightSim!=NULL) nifti_image_free(refLocalWeightSim);
-   if(referenceImage!=NULL) nifti_image_free(referenceImage);
-   if(floatingImage!=NULL) nifti_image_free(floatingImage);
+   if(referenceImage!=NULL) reg_io_FreeImage(referenceImage);
+   if(floatingImage!=NULL) reg_io_FreeImage(floatingImage);
    if(inputCCPImage!=NULL) nifti_image_free(inputCCPImage);
    if(referenceMaskImage!=NULL) nifti_image_free(referenceMaskImage);
    if(floatingMaskImage!=NULL) nifti_image_free(floatingMaskImage);
@@ -30,6 +30,10 @@ typedef struct
    int interpolation;
    float paddingValue;
    float PSF_Algorithm;
+   int batchNumber;
+   char **batchFloatingNames;
+   char **batchResultNames;
+   int slabSliceNumber;
 } PARAM;
 typedef struct
 {
@@ -43,6 +47,7 @@ typedef struct
    bool outputBlankXZFlag;
    bool isTensor;
    bool usePSF;
+   bool usePSFCache;
 } FLAG;
 
 
@@ -62,11 +67,15 @@ void Usage(char *exec)
    printf("\t-trans <filename>\n\t\tFilename of the file containing the transformation parametrisation (from reg_aladin, reg_f3d or reg_transform)\n");
    printf("\t-res <filename>\n\t\tFilename of the resampled image [none]\n");
    printf("\t-blank <filename>\n\t\tFilename of the resampled blank grid [none]\n");
-   printf("\t-inter <int>\n\t\tInterpolation order (0, 1, 3, 4)[3] (0=NN, 1=LIN; 3=CUB, 4=SINC)\n");
+   printf("\t-inter <int>\n\t\tInterpolation order (0, 1, 3, 4, 5, 6)[3] (0=NN, 1=LIN; 3=CUB, 4=SINC, 5=LABEL with linear weights, 6=LABEL with cubic weights)\n");
+   printf("\t-LAB\n\t\tLabel resampling: the label with the largest sum of linear weights is kept, same as -inter 5\n");
    printf("\t-pad <int>\n\t\tInterpolation padding value [0]\n");
    printf("\t-tensor\n\t\tThe last six timepoints of the floating image are considered to be tensor order as XX, XY, YY, XZ, YZ, ZZ [off]\n");
    printf("\t-psf\n\t\tPerform the resampling in two steps to resample an image to a lower resolution [off]\n");
    printf("\t-psf_alg <0/1>\n\t\tMinimise the matrix metric (0) or the determinant (1) when estimating the PSF [0]\n");
+   printf("\t-batch <filename> <filename>\n\t\tAdditional floating image and filename of its resampled image. The image is resampled with the same transformation as the floating image and the interpolation weights are shared. It has to be in the floating image space. Can be used several times [none]\n");
+   printf("\t-psf_cache\n\t\tShare the PSF between voxels with similar Jacobian matrices. Faster but approximated [off]\n");
+   printf("\t-slab <int>\n\t\tThe resampled image is generated and written slab by slab, each slab containing the specified number of slices. Only the floating image and one slab are kept in memory. Requires a nifti output and an affine or a cubic spline transformation [off]\n");
    printf("\t-voff\n\t\tTurns verbose off [on]\n");
 #if defined (_OPENMP)
    int defaultOpenMPValue=omp_get_num_procs();
@@ -80,6 +89,59 @@ void Usage(char *exec)
    return;
 }
 
+/* Create the warped image of a floating image in the reference space */
+nifti_image *createWarpedImage(nifti_image *referenceImage,
+                               nifti_image *floatingImage,
+                               float paddingValue,
+                               bool allocate=true)
+{
+   nifti_image *warpedImage = nifti_copy_nim_info(referenceImage);
+   warpedImage->dim[0]=warpedImage->ndim=floatingImage->dim[0];
+   warpedImage->dim[4]=warpedImage->nt=floatingImage->dim[4];
+   warpedImage->dim[5]=warpedImage->nu=floatingImage->dim[5];
+   warpedImage->cal_min=floatingImage->cal_min;
+   warpedImage->cal_max=floatingImage->cal_max;
+   warpedImage->scl_slope=floatingImage->scl_slope;
+   warpedImage->scl_inter=floatingImage->scl_inter;
+   if(paddingValue!=paddingValue &&
+         (floatingImage->datatype!=NIFTI_TYPE_FLOAT32 ||
+          floatingImage->datatype!=NIFTI_TYPE_FLOAT64)){
+      warpedImage->datatype = NIFTI_TYPE_FLOAT32;
+      reg_tools_changeDatatype<float>(floatingImage);
+   }
+   else warpedImage->datatype = floatingImage->datatype;
+   warpedImage->intent_code=floatingImage->intent_code;
+   memset(warpedImage->intent_name, 0, 16);
+   strcpy(warpedImage->intent_name,floatingImage->intent_name);
+   warpedImage->intent_p1=floatingImage->intent_p1;
+   warpedImage->intent_p2=floatingImage->intent_p2;
+   warpedImage->nbyper = floatingImage->nbyper;
+   warpedImage->nvox = (size_t)warpedImage->dim[1] * warpedImage->dim[2] *
+         warpedImage->dim[3] * warpedImage->dim[4] * warpedImage->dim[5];
+   if(allocate)
+      warpedImage->data = (void *)calloc(warpedImage->nvox, warpedImage->nbyper);
+   return warpedImage;
+}
+
+/* Set the header of the slab [firstSlice, firstSlice+sliceNumber[ of an image */
+void setSlabHeader(nifti_image *slabImage,
+                   nifti_image *image,
+                   int firstSlice,
+                   int sliceNumber)
+{
+   slabImage->dim[3]=slabImage->nz=sliceNumber;
+   slabImage->nvox = (size_t)slabImage->nx * slabImage->ny *
+         slabImage->nz * slabImage->nt * slabImage->nu;
+   // The origin is moved to the first slice of the slab
+   for(int i=0; i<3; ++i)
+   {
+      slabImage->qto_xyz.m[i][3]=image->qto_xyz.m[i][3]+firstSlice*image->qto_xyz.m[i][2];
+      slabImage->sto_xyz.m[i][3]=image->sto_xyz.m[i][3]+firstSlice*image->sto_xyz.m[i][2];
+   }
+   slabImage->qto_ijk=nifti_mat44_inverse(slabImage->qto_xyz);
+   slabImage->sto_ijk=nifti_mat44_inverse(slabImage->sto_xyz);
+}
+
 int main(int argc, char **argv)
 {
    PARAM *param = (PARAM *)calloc(1,sizeof(PARAM));
@@ -88,6 +150,8 @@ int main(int argc, char **argv)
    param->interpolation=3; // Cubic spline interpolation used by default
    param->paddingValue=0;
    param->PSF_Algorithm=0;
+   param->batchFloatingNames=(char **)calloc(argc,sizeof(char *));
+   param->batchResultNames=(char **)calloc(argc,sizeof(char *));
    bool verbose=true;
 
 #if defined (_OPENMP)
@@ -192,6 +256,10 @@ int main(int argc, char **argv)
       {
          param->interpolation=4;
       }
+      else if(strcmp(argv[i], "-LAB") == 0)
+      {
+         param->interpolation=5;
+      }
       else if(strcmp(argv[i], "-pad") == 0 ||
               (strcmp(argv[i],"--pad")==0))
       {
@@ -236,6 +304,24 @@ int main(int argc, char **argv)
       {
          param->PSF_Algorithm=(float)atof(argv[++i]);
       }
+      else if((strcmp(argv[i], "-batch") == 0 ||
+               strcmp(argv[i],"--batch")==0) && i+2<argc)
+      {
+         param->batchFloatingNames[param->batchNumber]=argv[++i];
+         param->batchResultNames[param->batchNumber]=argv[++i];
+         param->batchNumber++;
+      }
+      else if(strcmp(argv[i], "-psf_cache") == 0 ||
+              (strcmp(argv[i],"--psf_cache")==0))
+      {
+         flag->usePSF=true;
+         flag->usePSFCache=true;
+      }
+      else if(strcmp(argv[i], "-slab") == 0 ||
+              (strcmp(argv[i],"--slab")==0))
+      {
+         param->slabSliceNumber=atoi(argv[++i]);
+      }
       else
       {
          fprintf(stderr,"Err:\tParameter %s unknown.\n",argv[i]);
@@ -250,6 +336,28 @@ int main(int argc, char **argv)
       PetitUsage(argv[0]);
       return EXIT_FAILURE;
    }
+   if(param->batchNumber>0 && (!flag->outputResultFlag || flag->usePSF || flag->isTensor ||
+                               param->interpolation==5 || param->interpolation==6))
+   {
+      fprintf(stderr,"[NiftyReg ERROR] The -batch option requires -res and is not compatible with -psf, -tensor and the label resampling.\n");
+      PetitUsage(argv[0]);
+      return EXIT_FAILURE;
+   }
+   if((param->interpolation==5 || param->interpolation==6) && (flag->usePSF || flag->isTensor))
+   {
+      fprintf(stderr,"[NiftyReg ERROR] The label resampling (-inter 5, -inter 6 and -LAB) is not compatible with -psf and -tensor.\n");
+      PetitUsage(argv[0]);
+      return EXIT_FAILURE;
+   }
+   if(param->slabSliceNumber>0 &&(!flag->outputResultFlag || flag->usePSF || flag->isTensor ||
+                                   param->batchNumber>0 || flag->outputBlankFlag ||
+                                   flag->outputBlankXYFlag || flag->outputBlankYZFlag ||
+                                   flag->outputBlankXZFlag))
+   {
+      fprintf(stderr,"[NiftyReg ERROR] The -slab option requires -res and is not compatible with -psf, -tensor, -batch and -blank.\n");
+      PetitUsage(argv[0]);
+      return EXIT_FAILURE;
+   }
 
    /* Read the reference image */
    nifti_image *referenceImage = reg_io_ReadImageHeader(param->referenceImageName);
@@ -319,93 +427,266 @@ int main(int argc, char **argv)
       reg_mat44_eye(&inputAffineTransformation);
    }
 
-   // Create a deformation field
-   nifti_image *deformationFieldImage = nifti_copy_nim_info(referenceImage);
-   deformationFieldImage->dim[0]=deformationFieldImage->ndim=5;
-   deformationFieldImage->dim[1]=deformationFieldImage->nx=referenceImage->nx;
-   deformationFieldImage->dim[2]=deformationFieldImage->ny=referenceImage->ny;
-   deformationFieldImage->dim[3]=deformationFieldImage->nz=referenceImage->nz;
-   deformationFieldImage->dim[4]=deformationFieldImage->nt=1;
-   deformationFieldImage->pixdim[4]=deformationFieldImage->dt=1.0;
-   deformationFieldImage->dim[5]=deformationFieldImage->nu=referenceImage->nz>1?3:2;
-   deformationFieldImage->dim[6]=deformationFieldImage->nv=1;
-   deformationFieldImage->dim[7]=deformationFieldImage->nw=1;
-   deformationFieldImage->nvox =(size_t)deformationFieldImage->nx*
-         deformationFieldImage->ny*deformationFieldImage->nz*
-         deformationFieldImage->nt*deformationFieldImage->nu;
-   deformationFieldImage->scl_slope=1.f;
-   deformationFieldImage->scl_inter=0.f;
-   if(inputTransformationImage!=NULL)
+   // An affine transformation can be applied without the deformation field
+   bool affineTransformationOnly = inputTransformationImage==NULL;
+
+   switch(param->interpolation)
    {
-      deformationFieldImage->datatype = inputTransformationImage->datatype;
-      deformationFieldImage->nbyper = inputTransformationImage->nbyper;
+   case 0:
+   case 1:
+   case 4:
+   case 5:
+   case 6:
+      break;
+   default:
+      param->interpolation=3;
+      break;
    }
-   else
+
+   /* ********************************* */
+   /* WARP THE FLOATING IMAGE SLAB-WISE */
+   /* ********************************* */
+   if(param->slabSliceNumber>0)
    {
-      deformationFieldImage->datatype = NIFTI_TYPE_FLOAT32;
-      deformationFieldImage->nbyper = sizeof(float);
-   }
-   deformationFieldImage->data = (void *)calloc(deformationFieldImage->nvox, deformationFieldImage->nbyper);
+      if(inputTransformationImage!=NULL &&
+            (inputTransformationImage->intent_p1!=CUB_SPLINE_GRID ||
+             inputTransformationImage->nz==1 ||
+             inputTransformationImage->num_ext>0))
+      {
+         fprintf(stderr,"[NiftyReg ERROR] The -slab option only supports affine transformations and 3D cubic spline grids without affine extension.\n");
+         return EXIT_FAILURE;
+      }
+      // Only the header of the warped image is written, its data are streamed
+      nifti_image *warpedImage = createWarpedImage(referenceImage,
+                                                   floatingImage,
+                                                   param->paddingValue,
+                                                   false);
+      memset(warpedImage->descrip, 0, 80);
+      strcpy (warpedImage->descrip,"Warped image using NiftyReg (reg_resample)");
+      znzFile outputFile=reg_io_OpenImageFileForWriting(warpedImage,param->outputResultName);
 
-   // Initialise the deformation field with an identity transformation
-   reg_tools_multiplyValueToImage(deformationFieldImage,deformationFieldImage,0.f);
-   reg_getDeformationFromDisplacement(deformationFieldImage);
-   deformationFieldImage->intent_p1=DEF_FIELD;
+      // A slab of a 3D image must contain at least two slices to be
+      // resampled as a 3D image. A last single slice is appended to the
+      // previous slab, hence the extra slice in the slab buffers
+      int slabSize=param->slabSliceNumber<referenceImage->nz?
+               param->slabSliceNumber:referenceImage->nz;
+      if(referenceImage->nz>1 && slabSize<2) slabSize=2;
+      int maxSlabSize=slabSize<referenceImage->nz?slabSize+1:slabSize;
 
-   // Compute the transformation to apply
-   if(inputTransformationImage!=NULL)
-   {
-      switch(static_cast<int>(inputTransformationImage->intent_p1))
+      // Every volume of the floating image is resampled independently
+      nifti_image *floatingVolume = nifti_copy_nim_info(floatingImage);
+      floatingVolume->dim[0]=floatingVolume->ndim=floatingImage->nz>1?3:2;
+      floatingVolume->dim[4]=floatingVolume->nt=1;
+      floatingVolume->dim[5]=floatingVolume->nu=1;
+      floatingVolume->nvox=(size_t)floatingVolume->nx*
+            floatingVolume->ny*floatingVolume->nz;
+
+      nifti_image *warpedSlab = nifti_copy_nim_info(warpedImage);
+      warpedSlab->dim[0]=warpedSlab->ndim=referenceImage->nz>1?3:2;
+      warpedSlab->dim[4]=warpedSlab->nt=1;
+      warpedSlab->dim[5]=warpedSlab->nu=1;
+      setSlabHeader(warpedSlab,referenceImage,0,maxSlabSize);
+      warpedSlab->data = (void *)calloc(warpedSlab->nvox, warpedSlab->nbyper);
+
+      // The deformation field is only required by the spline and the label resampling
+      nifti_image *deformationFieldSlab = NULL;
+      if(!affineTransformationOnly || param->interpolation==5 || param->interpolation==6)
       {
-      case LIN_SPLINE_GRID:
-      case CUB_SPLINE_GRID:
-         reg_spline_getDeformationField(inputTransformationImage,
-                                        deformationFieldImage,
+         deformationFieldSlab = nifti_copy_nim_info(referenceImage);
+         deformationFieldSlab->dim[0]=deformationFieldSlab->ndim=5;
+         deformationFieldSlab->dim[4]=deformationFieldSlab->nt=1;
+         deformationFieldSlab->pixdim[4]=deformationFieldSlab->dt=1.0;
+         deformationFieldSlab->dim[5]=deformationFieldSlab->nu=referenceImage->nz>1?3:2;
+         deformationFieldSlab->dim[6]=deformationFieldSlab->nv=1;
+         deformationFieldSlab->dim[7]=deformationFieldSlab->nw=1;
+         deformationFieldSlab->scl_slope=1.f;
+         deformationFieldSlab->scl_inter=0.f;
+         if(inputTransformationImage!=NULL)
+         {
+            deformationFieldSlab->datatype = inputTransformationImage->datatype;
+            deformationFieldSlab->nbyper = inputTransformationImage->nbyper;
+         }
+         else
+         {
+            deformationFieldSlab->datatype = NIFTI_TYPE_FLOAT32;
+            deformationFieldSlab->nbyper = sizeof(float);
+         }
+         deformationFieldSlab->intent_p1=DEF_FIELD;
+         setSlabHeader(deformationFieldSlab,referenceImage,0,maxSlabSize);
+         deformationFieldSlab->data = (void *)calloc(deformationFieldSlab->nvox, deformationFieldSlab->nbyper);
+      }
+
+      // The volumes are in the outer loop so that the file is written sequentially
+      size_t volumeNumber=(size_t)warpedImage->nt*warpedImage->nu;
+      for(size_t t=0; t<volumeNumber; ++t)
+      {
+         floatingVolume->data=(void *)(static_cast<char *>(floatingImage->data) +
+                                       t*floatingVolume->nvox*floatingVolume->nbyper);
+         int sliceNumber=0;
+         for(int firstSlice=0; firstSlice<referenceImage->nz; firstSlice+=sliceNumber)
+         {
+            sliceNumber=slabSize<referenceImage->nz-firstSlice?
+                     slabSize:referenceImage->nz-firstSlice;
+            if(referenceImage->nz-firstSlice-sliceNumber==1)
+               ++sliceNumber;
+            setSlabHeader(warpedSlab,referenceImage,firstSlice,sliceNumber);
+            if(deformationFieldSlab!=NULL)
+            {
+               setSlabHeader(deformationFieldSlab,referenceImage,firstSlice,sliceNumber);
+               if(inputTransformationImage!=NULL)
+                  reg_spline_getDeformationFieldSlab(inputTransformationImage,
+                                                     deformationFieldSlab,
+                                                     firstSlice);
+               else reg_affine_getDeformationField(&inputAffineTransformation,
+                                                   deformationFieldSlab,
+                                                   false,
+                                                   NULL);
+            }
+            if(param->interpolation==5 || param->interpolation==6)
+               reg_resampleLabelImage(floatingVolume,
+                                      warpedSlab,
+                                      deformationFieldSlab,
+                                      NULL,
+                                      param->interpolation==5?1:3,
+                                      param->paddingValue);
+            else if(affineTransformationOnly)
+               reg_resampleImage_affine(floatingVolume,
+                                        warpedSlab,
+                                        &inputAffineTransformation,
                                         NULL,
-                                        false,
-                                        true);
-         break;
-      case DISP_VEL_FIELD:
-         reg_getDeformationFromDisplacement(inputTransformationImage);
-      case DEF_VEL_FIELD:
+                                        param->interpolation,
+                                        param->paddingValue);
+            else reg_resampleImage(floatingVolume,
+                                   warpedSlab,
+                                   deformationFieldSlab,
+                                   NULL,
+                                   param->interpolation,
+                                   param->paddingValue);
+            reg_io_WriteImageData(outputFile,
+                                  warpedSlab->data,
+                                  warpedSlab->nvox*warpedSlab->nbyper);
+         }
+      }
+      reg_io_CloseImageFile(outputFile);
+      if(verbose)
+         printf("[NiftyReg] Resampled image has been saved: %s\n", param->outputResultName);
+
+      floatingVolume->data=NULL;
+      nifti_image_free(floatingVolume);
+      nifti_image_free(warpedSlab);
+      nifti_image_free(warpedImage);
+      if(deformationFieldSlab!=NULL)
+         nifti_image_free(deformationFieldSlab);
+      if(inputTransformationImage!=NULL)
+         nifti_image_free(inputTransformationImage);
+      nifti_image_free(referenceImage);
+      nifti_image_free(floatingImage);
+      free(flag);
+      free(param->batchFloatingNames);
+      free(param->batchResultNames);
+      free(param);
+      return EXIT_SUCCESS;
+   }
+
+   // The deformation field is not required when the floating image is
+   // directly resampled using an affine transformation
+   bool useDeformationField = !affineTransformationOnly ||
+         param->interpolation==5 || param->interpolation==6 ||
+         flag->usePSF || param->batchNumber>0 ||
+         ((floatingImage->dim[4]==6 || floatingImage->dim[4]==7) && flag->isTensor==true) ||
+         flag->outputBlankFlag || flag->outputBlankXYFlag ||
+         flag->outputBlankYZFlag || flag->outputBlankXZFlag;
+   nifti_image *deformationFieldImage = NULL;
+   if(useDeformationField)
+   {
+      // Create a deformation field
+      deformationFieldImage = nifti_copy_nim_info(referenceImage);
+      deformationFieldImage->dim[0]=deformationFieldImage->ndim=5;
+      deformationFieldImage->dim[1]=deformationFieldImage->nx=referenceImage->nx;
+      deformationFieldImage->dim[2]=deformationFieldImage->ny=referenceImage->ny;
+      deformationFieldImage->dim[3]=deformationFieldImage->nz=referenceImage->nz;
+      deformationFieldImage->dim[4]=deformationFieldImage->nt=1;
+      deformationFieldImage->pixdim[4]=deformationFieldImage->dt=1.0;
+      deformationFieldImage->dim[5]=deformationFieldImage->nu=referenceImage->nz>1?3:2;
+      deformationFieldImage->dim[6]=deformationFieldImage->nv=1;
+      deformationFieldImage->dim[7]=deformationFieldImage->nw=1;
+      deformationFieldImage->nvox =(size_t)deformationFieldImage->nx*
+            deformationFieldImage->ny*deformationFieldImage->nz*
+            deformationFieldImage->nt*deformationFieldImage->nu;
+      deformationFieldImage->scl_slope=1.f;
+      deformationFieldImage->scl_inter=0.f;
+      if(inputTransformationImage!=NULL)
+      {
+         deformationFieldImage->datatype = inputTransformationImage->datatype;
+         deformationFieldImage->nbyper = inputTransformationImage->nbyper;
+      }
+      else
+      {
+         deformationFieldImage->datatype = NIFTI_TYPE_FLOAT32;
+         deformationFieldImage->nbyper = sizeof(float);
+      }
+      deformationFieldImage->data = (void *)calloc(deformationFieldImage->nvox, deformationFieldImage->nbyper);
+
+      // Initialise the deformation field with an identity transformation
+      reg_tools_multiplyValueToImage(deformationFieldImage,deformationFieldImage,0.f);
+      reg_getDeformationFromDisplacement(deformationFieldImage);
+      deformationFieldImage->intent_p1=DEF_FIELD;
+
+      // Compute the transformation to apply
+      if(inputTransformationImage!=NULL)
+      {
+         switch(static_cast<int>(inputTransformationImage->intent_p1))
          {
-            nifti_image *tempFlowField = nifti_copy_nim_info(deformationFieldImage);
-            tempFlowField->data = (void *)malloc(tempFlowField->nvox*tempFlowField->nbyper);
-            memcpy(tempFlowField->data,deformationFieldImage->data,
-                   tempFlowField->nvox*tempFlowField->nbyper);
+         case LIN_SPLINE_GRID:
+         case CUB_SPLINE_GRID:
+            reg_spline_getDeformationField(inputTransformationImage,
+                                           deformationFieldImage,
+                                           NULL,
+                                           false,
+                                           true);
+            break;
+         case DISP_VEL_FIELD:
+            reg_getDeformationFromDisplacement(inputTransformationImage);
+         case DEF_VEL_FIELD:
+            {
+               nifti_image *tempFlowField = nifti_copy_nim_info(deformationFieldImage);
+               tempFlowField->data = (void *)malloc(tempFlowField->nvox*tempFlowField->nbyper);
+               memcpy(tempFlowField->data,deformationFieldImage->data,
+                      tempFlowField->nvox*tempFlowField->nbyper);
+               reg_defField_compose(inputTransformationImage,
+                                    tempFlowField,
+                                    NULL);
+               tempFlowField->intent_p1=inputTransformationImage->intent_p1;
+               tempFlowField->intent_p2=inputTransformationImage->intent_p2;
+               reg_defField_getDeformationFieldFromFlowField(tempFlowField,
+                                                             deformationFieldImage,
+                                                             false);
+               nifti_image_free(tempFlowField);
+            }
+            break;
+         case SPLINE_VEL_GRID:
+            reg_spline_getDefFieldFromVelocityGrid(inputTransformationImage,
+                                                   deformationFieldImage,
+                                                   false);
+            break;
+         case DISP_FIELD:
+            reg_getDeformationFromDisplacement(inputTransformationImage);
+         default:
             reg_defField_compose(inputTransformationImage,
-                                 tempFlowField,
+                                 deformationFieldImage,
                                  NULL);
-            tempFlowField->intent_p1=inputTransformationImage->intent_p1;
-            tempFlowField->intent_p2=inputTransformationImage->intent_p2;
-            reg_defField_getDeformationFieldFromFlowField(tempFlowField,
-                                                          deformationFieldImage,
-                                                          false);
-            nifti_image_free(tempFlowField);
+            break;
          }
-         break;
-      case SPLINE_VEL_GRID:
-         reg_spline_getDefFieldFromVelocityGrid(inputTransformationImage,
-                                                deformationFieldImage,
-                                                false);
-         break;
-      case DISP_FIELD:
-         reg_getDeformationFromDisplacement(inputTransformationImage);
-      default:
-         reg_defField_compose(inputTransformationImage,
-                              deformationFieldImage,
-                              NULL);
-         break;
+         nifti_image_free(inputTransformationImage);
+         inputTransformationImage=NULL;
+      }
+      else
+      {
+         reg_affine_getDeformationField(&inputAffineTransformation,
+                                        deformationFieldImage,
+                                        false,
+                                        NULL);
       }
-      nifti_image_free(inputTransformationImage);
-      inputTransformationImage=NULL;
-   }
-   else
-   {
-      reg_affine_getDeformationField(&inputAffineTransformation,
-                                     deformationFieldImage,
-                                     false,
-                                     NULL);
    }
 
 
@@ -414,45 +695,9 @@ int main(int argc, char **argv)
    /* ************************* */
    if(flag->outputResultFlag)
    {
-      switch(param->interpolation)
-      {
-      case 0:
-         param->interpolation=0;
-         break;
-      case 1:
-         param->interpolation=1;
-         break;
-      case 4:
-         param->interpolation=4;
-         break;
-      default:
-         param->interpolation=3;
-         break;
-      }
-      nifti_image *warpedImage = nifti_copy_nim_info(referenceImage);
-      warpedImage->dim[0]=warpedImage->ndim=floatingImage->dim[0];
-      warpedImage->dim[4]=warpedImage->nt=floatingImage->dim[4];
-      warpedImage->dim[5]=warpedImage->nu=floatingImage->dim[5];
-      warpedImage->cal_min=floatingImage->cal_min;
-      warpedImage->cal_max=floatingImage->cal_max;
-      warpedImage->scl_slope=floatingImage->scl_slope;
-      warpedImage->scl_inter=floatingImage->scl_inter;
-      if(param->paddingValue!=param->paddingValue &&
-            (floatingImage->datatype!=NIFTI_TYPE_FLOAT32 ||
-             floatingImage->datatype!=NIFTI_TYPE_FLOAT64)){
-         warpedImage->datatype = NIFTI_TYPE_FLOAT32;
-         reg_tools_changeDatatype<float>(floatingImage);
-      }
-      else warpedImage->datatype = floatingImage->datatype;
-      warpedImage->intent_code=floatingImage->intent_code;
-      memset(warpedImage->intent_name, 0, 16);
-      strcpy(warpedImage->intent_name,floatingImage->intent_name);
-      warpedImage->intent_p1=floatingImage->intent_p1;
-      warpedImage->intent_p2=floatingImage->intent_p2;
-      warpedImage->nbyper = floatingImage->nbyper;
-      warpedImage->nvox = (size_t)warpedImage->dim[1] * warpedImage->dim[2] *
-            warpedImage->dim[3] * warpedImage->dim[4] * warpedImage->dim[5];
-      warpedImage->data = (void *)calloc(warpedImage->nvox, warpedImage->nbyper);
+      nifti_image *warpedImage = createWarpedImage(referenceImage,
+                                                   floatingImage,
+                                                   param->paddingValue);
 
       if((floatingImage->dim[4]==6 || floatingImage->dim[4]==7) && flag->isTensor==true)
       {
@@ -481,7 +726,17 @@ int main(int argc, char **argv)
                            );
       }
       else{
-         if(flag->usePSF){
+         if(param->interpolation==5 || param->interpolation==6)
+         {
+            // The label with the largest sum of weights is kept in every voxel
+            reg_resampleLabelImage(floatingImage,
+                                   warpedImage,
+                                   deformationFieldImage,
+                                   NULL,
+                                   param->interpolation==5?1:3,
+                                   param->paddingValue);
+         }
+         else if(flag->usePSF){
             // Compute first the Jacobian matrices
             mat33 *jacobian = (mat33 *)malloc(deformationFieldImage->nx *
                                               deformationFieldImage->ny *
@@ -498,12 +753,79 @@ int main(int argc, char **argv)
                                   param->interpolation,
                                   param->paddingValue,
                                   jacobian,
-                                  (char)round(param->PSF_Algorithm));
+                                  (char)round(param->PSF_Algorithm),
+                                  flag->usePSFCache);
 #ifndef NDEBUG
             reg_print_msg_debug("PSF resampling completed\n");
 #endif
             free(jacobian);
          }
+         else if(param->batchNumber>0)
+         {
+            // All the images are resampled using the same interpolation weights
+            int imageNumber=param->batchNumber+1;
+            nifti_image **floatingImages=(nifti_image **)malloc(imageNumber*sizeof(nifti_image *));
+            nifti_image **warpedImages=(nifti_image **)malloc(imageNumber*sizeof(nifti_image *));
+            floatingImages[0]=floatingImage;
+            warpedImages[0]=warpedImage;
+            for(int n=1; n<imageNumber; ++n)
+            {
+               floatingImages[n]=reg_io_ReadImageFile(param->batchFloatingNames[n-1]);
+               if(floatingImages[n]==NULL)
+               {
+                  fprintf(stderr,"[NiftyReg ERROR] Error when reading the floating image: %s\n",
+                          param->batchFloatingNames[n-1]);
+                  // Free the images that have already been allocated
+                  for(int i=1; i<n; ++i)
+                  {
+                     nifti_image_free(floatingImages[i]);
+                     nifti_image_free(warpedImages[i]);
+                  }
+                  free(floatingImages);
+                  free(warpedImages);
+                  nifti_image_free(warpedImage);
+                  nifti_image_free(deformationFieldImage);
+                  nifti_image_free(referenceImage);
+                  nifti_image_free(floatingImage);
+                  free(flag);
+                  free(param->batchFloatingNames);
+                  free(param->batchResultNames);
+                  free(param);
+                  return EXIT_FAILURE;
+               }
+               warpedImages[n]=createWarpedImage(referenceImage,
+                                                 floatingImages[n],
+                                                 param->paddingValue);
+            }
+            reg_resampleImageBatch(floatingImages,
+                                   warpedImages,
+                                   imageNumber,
+                                   deformationFieldImage,
+                                   NULL,
+                                   param->interpolation,
+                                   param->paddingValue);
+            for(int n=1; n<imageNumber; ++n)
+            {
+               memset(warpedImages[n]->descrip, 0, 80);
+               strcpy (warpedImages[n]->descrip,"Warped image using NiftyReg (reg_resample)");
+               reg_io_WriteImageFile(warpedImages[n],param->batchResultNames[n-1]);
+               if(verbose)
+                  printf("[NiftyReg] Resampled image has been saved: %s\n", param->batchResultNames[n-1]);
+               nifti_image_free(floatingImages[n]);
+               nifti_image_free(warpedImages[n]);
+            }
+            free(floatingImages);
+            free(warpedImages);
+         }
+         else if(affineTransformationOnly)
+         {
+            reg_resampleImage_affine(floatingImage,
+                                     warpedImage,
+                                     &inputAffineTransformation,
+                                     NULL,
+                                     param->interpolation,
+                                     param->paddingValue);
+         }
          else
          {
             reg_resampleImage(floatingImage,
@@ -623,9 +945,12 @@ int main(int argc, char **argv)
 
    nifti_image_free(referenceImage);
    nifti_image_free(floatingImage);
-   nifti_image_free(deformationFieldImage);
+   if(deformationFieldImage!=NULL)
+      nifti_image_free(deformationFieldImage);
 
    free(flag);
+   free(param->batchFloatingNames);
+   free(param->batchResultNames);
    free(param);
    return EXIT_SUCCESS;
 }
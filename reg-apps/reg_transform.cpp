@@ -47,6 +47,7 @@ typedef struct
    bool halfTransFlag;
    bool invertAffFlag;
    bool invertNRRFlag;
+   bool fastInvertNRRFlag;
    bool flirtAff2NRFlag;
    bool makeAffFlag;
    bool aff2rigFlag;
@@ -121,6 +122,11 @@ void Usage(char *exec)
    printf("\t\tNote that the cubic b-spline grid parametrisations can not be inverted without approximation,\n");
    printf("\t\tas a result, they are converted into deformation fields before inversion.\n\n");
 
+   printf("\t-invNrrFast <filename1> <filename2> <filename3>\n");
+   printf("\t\tSame as -invNrr but the deformation and displacement fields are inverted using a faster\n");
+   printf("\t\tmultiresolution fixed-point scheme. A convergence report is displayed for every level.\n");
+   printf("\t\tOnly 3D deformation and displacement fields are supported.\n\n");
+
    printf("\t-half <filename1> <filename2>\n");
    printf("\t\tThe input transformation is halfed and stored using the same transformation type.\n");
    printf("\t\tfilename1 - Input transformation file name\n");
@@ -286,6 +292,14 @@ int main(int argc, char **argv)
          param->input2TransName=argv[++i];
          param->outputTransName=argv[++i];
       }
+      else if(strcmp(argv[i],"-invNrrFast")==0 || strcmp(argv[i],"--invNrrFast")==0)
+      {
+         flag->invertNRRFlag=true;
+         flag->fastInvertNRRFlag=true;
+         param->inputTransName=argv[++i];
+         param->input2TransName=argv[++i];
+         param->outputTransName=argv[++i];
+      }
       else if(strcmp(argv[i],"-makeAff")==0 || strcmp(argv[i],"--makeAff")==0)
       {
          flag->makeAffFlag=true;
@@ -1348,13 +1362,17 @@ int main(int argc, char **argv)
       switch(reg_round(inputTransImage->intent_p1))
       {
       case DEF_FIELD:
-         reg_defFieldInvert(inputTransImage,outputTransImage,1.0e-6f);
+         if(flag->fastInvertNRRFlag)
+            reg_defFieldInvertMultigrid(inputTransImage,outputTransImage,1.0e-3f,50,true);
+         else reg_defFieldInvert(inputTransImage,outputTransImage,1.0e-6f);
        memset(outputTransImage->descrip, 0, 80);
        strcpy(outputTransImage->descrip, "Deformation field from NiftyReg (reg_transform -invNrr)");
          break;
       case DISP_FIELD:
          reg_getDeformationFromDisplacement(inputTransImage);
-         reg_defFieldInvert(inputTransImage,outputTransImage,1.0e-6f);
+         if(flag->fastInvertNRRFlag)
+            reg_defFieldInvertMultigrid(inputTransImage,outputTransImage,1.0e-3f,50,true);
+         else reg_defFieldInvert(inputTransImage,outputTransImage,1.0e-6f);
        reg_getDisplacementFromDeformation(outputTransImage);
        memset(outputTransImage->descrip, 0, 80);
        strcpy(outputTransImage->descrip, "Displacement field from NiftyReg (reg_transform -invNrr)");
@@ -0,0 +1,298 @@
+#include "_reg_ReadWriteGzip.h"
+#include "_reg_maths.h"
+#include "zlib.h"
+
+// Size of the header of a member: fixed fields, extra field length and a
+// subfield with the identifier 'NR' that contains the member size
+#define REG_GZIP_HEADER_SIZE 20
+// Size of the trailer of a member: CRC32 and uncompressed size
+#define REG_GZIP_TRAILER_SIZE 8
+
+/* *************************************************************** */
+static void reg_io_writeLittleEndian32(unsigned char *buffer, size_t value)
+{
+   buffer[0]=(unsigned char)(value & 0xff);
+   buffer[1]=(unsigned char)((value>>8) & 0xff);
+   buffer[2]=(unsigned char)((value>>16) & 0xff);
+   buffer[3]=(unsigned char)((value>>24) & 0xff);
+}
+/* *************************************************************** */
+static size_t reg_io_readLittleEndian32(const unsigned char *buffer)
+{
+   return (size_t)buffer[0] | ((size_t)buffer[1]<<8) |
+         ((size_t)buffer[2]<<16) | ((size_t)buffer[3]<<24);
+}
+/* *************************************************************** */
+static bool reg_io_isBlockGzipHeader(const unsigned char *buffer)
+{
+   return buffer[0]==0x1f && buffer[1]==0x8b && buffer[2]==8 &&
+         (buffer[3] & 4) && buffer[10]==8 && buffer[11]==0 &&
+         buffer[12]=='N' && buffer[13]=='R' && buffer[14]==4 && buffer[15]==0;
+}
+/* *************************************************************** */
+/* Compress an array into a single gzip member and return the size of the
+ * member, or zero if the output buffer is too small */
+static size_t reg_io_deflateMember(const unsigned char *input,
+                                   size_t inputSize,
+                                   unsigned char *output,
+                                   size_t outputCapacity)
+{
+   if(outputCapacity<REG_GZIP_HEADER_SIZE+REG_GZIP_TRAILER_SIZE)
+      return 0;
+   // The raw deflate stream is written after the member header
+   z_stream stream;
+   memset(&stream,0,sizeof(z_stream));
+   if(deflateInit2(&stream,Z_DEFAULT_COMPRESSION,Z_DEFLATED,-MAX_WBITS,
+                   8,Z_DEFAULT_STRATEGY)!=Z_OK)
+      return 0;
+   stream.next_in=(Bytef *)input;
+   stream.avail_in=(uInt)inputSize;
+   stream.next_out=output+REG_GZIP_HEADER_SIZE;
+   stream.avail_out=(uInt)(outputCapacity-REG_GZIP_HEADER_SIZE-REG_GZIP_TRAILER_SIZE);
+   int status=deflate(&stream,Z_FINISH);
+   size_t streamSize=stream.total_out;
+   deflateEnd(&stream);
+   if(status!=Z_STREAM_END)
+      return 0;
+   size_t memberSize=REG_GZIP_HEADER_SIZE+streamSize+REG_GZIP_TRAILER_SIZE;
+
+   // Member header, the modification time is not saved and the OS is unknown
+   memset(output,0,REG_GZIP_HEADER_SIZE);
+   output[0]=0x1f;
+   output[1]=0x8b;
+   output[2]=8; // deflate
+   output[3]=4; // FEXTRA
+   output[9]=255;
+   output[10]=8; // XLEN
+   output[12]='N';
+   output[13]='R';
+   output[14]=4; // LEN
+   reg_io_writeLittleEndian32(&output[16],memberSize);
+
+   // Member trailer
+   uLong crc=crc32(0L,Z_NULL,0);
+   crc=crc32(crc,(const Bytef *)input,(uInt)inputSize);
+   reg_io_writeLittleEndian32(&output[memberSize-8],(size_t)crc);
+   reg_io_writeLittleEndian32(&output[memberSize-4],inputSize);
+   return memberSize;
+}
+/* *************************************************************** */
+/* Decompress a gzip member written by reg_io_deflateMember */
+static bool reg_io_inflateMember(const unsigned char *member,
+                                 size_t memberSize,
+                                 unsigned char *output,
+                                 size_t outputSize)
+{
+   z_stream stream;
+   memset(&stream,0,sizeof(z_stream));
+   if(inflateInit2(&stream,-MAX_WBITS)!=Z_OK)
+      return false;
+   stream.next_in=(Bytef *)(member+REG_GZIP_HEADER_SIZE);
+   stream.avail_in=(uInt)(memberSize-REG_GZIP_HEADER_SIZE-REG_GZIP_TRAILER_SIZE);
+   stream.next_out=output;
+   stream.avail_out=(uInt)outputSize;
+   int status=inflate(&stream,Z_FINISH);
+   bool success=status==Z_STREAM_END && stream.total_out==outputSize;
+   inflateEnd(&stream);
+   if(!success)
+      return false;
+   uLong crc=crc32(0L,Z_NULL,0);
+   crc=crc32(crc,(const Bytef *)output,(uInt)outputSize);
+   return (size_t)crc==reg_io_readLittleEndian32(&member[memberSize-8]);
+}
+/* *************************************************************** */
+bool reg_io_isBlockGzipFile(const char *filename)
+{
+   FILE *file=fopen(filename,"rb");
+   if(file==NULL)
+      return false;
+   unsigned char header[REG_GZIP_HEADER_SIZE];
+   bool isBlockGzip=fread(header,1,REG_GZIP_HEADER_SIZE,file)==REG_GZIP_HEADER_SIZE &&
+         reg_io_isBlockGzipHeader(header);
+   fclose(file);
+   return isBlockGzip;
+}
+/* *************************************************************** */
+void reg_io_writeBlockGzipFile(const char *filename,
+                               const void *header,
+                               size_t headerSize,
+                               const void *data,
+                               size_t dataSize)
+{
+   FILE *file=fopen(filename,"wb");
+   if(file==NULL)
+   {
+      reg_print_fct_error("reg_io_writeBlockGzipFile");
+      reg_print_msg_error("The output file can not be created:");
+      reg_print_msg_error(filename);
+      reg_exit();
+   }
+
+   // The header is saved in its own member
+   size_t capacity=compressBound((uLong)headerSize)+REG_GZIP_HEADER_SIZE+REG_GZIP_TRAILER_SIZE;
+   unsigned char *buffer=(unsigned char *)malloc(capacity);
+   size_t memberSize=reg_io_deflateMember(static_cast<const unsigned char *>(header),
+                                          headerSize,buffer,capacity);
+   bool success=memberSize>0 && fwrite(buffer,1,memberSize,file)==memberSize;
+   free(buffer);
+
+   // The data blocks are compressed in parallel, one batch at a time
+   int blockNumber=(int)((dataSize+REG_GZIP_BLOCK_SIZE-1)/REG_GZIP_BLOCK_SIZE);
+   capacity=compressBound(REG_GZIP_BLOCK_SIZE)+REG_GZIP_HEADER_SIZE+REG_GZIP_TRAILER_SIZE;
+   buffer=(unsigned char *)malloc(REG_GZIP_BATCH_SIZE*capacity);
+   size_t memberSizes[REG_GZIP_BATCH_SIZE];
+   const unsigned char *dataPtr=static_cast<const unsigned char *>(data);
+   for(int firstBlock=0; firstBlock<blockNumber && success; firstBlock+=REG_GZIP_BATCH_SIZE)
+   {
+      int batchBlockNumber=blockNumber-firstBlock<REG_GZIP_BATCH_SIZE?
+               blockNumber-firstBlock:REG_GZIP_BATCH_SIZE;
+      int b;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(batchBlockNumber, firstBlock, dataPtr, dataSize, buffer, capacity, memberSizes) \
+   private(b)
+#endif
+      for(b=0; b<batchBlockNumber; ++b)
+      {
+         size_t blockStart=(size_t)(firstBlock+b)*REG_GZIP_BLOCK_SIZE;
+         size_t blockSize=dataSize-blockStart<REG_GZIP_BLOCK_SIZE?
+                  dataSize-blockStart:REG_GZIP_BLOCK_SIZE;
+         memberSizes[b]=reg_io_deflateMember(&dataPtr[blockStart],
+                                             blockSize,
+                                             &buffer[b*capacity],
+                                             capacity);
+      }
+      for(b=0; b<batchBlockNumber && success; ++b)
+         success=memberSizes[b]>0 &&
+               fwrite(&buffer[b*capacity],1,memberSizes[b],file)==memberSizes[b];
+   }
+   free(buffer);
+   fclose(file);
+   if(!success)
+   {
+      reg_print_fct_error("reg_io_writeBlockGzipFile");
+      reg_print_msg_error("The compressed data could not be written:");
+      reg_print_msg_error(filename);
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+/* Return the size of an open file using 64-bit offsets so that files
+ * larger than 2 GB are supported on every platform. The file position is
+ * reset to the start of the file */
+static bool reg_io_getFileSize(FILE *file, size_t &fileSize)
+{
+#ifdef _WIN32
+   if(_fseeki64(file,0,SEEK_END)!=0)
+      return false;
+   __int64 position=_ftelli64(file);
+   if(_fseeki64(file,0,SEEK_SET)!=0)
+      return false;
+#else
+   if(fseeko(file,0,SEEK_END)!=0)
+      return false;
+   off_t position=ftello(file);
+   if(fseeko(file,0,SEEK_SET)!=0)
+      return false;
+#endif
+   if(position<=0)
+      return false;
+   fileSize=(size_t)position;
+   return true;
+}
+/* *************************************************************** */
+bool reg_io_readBlockGzipFile(const char *filename,
+                              size_t headerSize,
+                              void *data,
+                              size_t dataSize)
+{
+   // The whole compressed file is loaded
+   FILE *file=fopen(filename,"rb");
+   if(file==NULL)
+      return false;
+   size_t fileSize;
+   if(!reg_io_getFileSize(file,fileSize))
+   {
+      fclose(file);
+      return false;
+   }
+   unsigned char *compressed=(unsigned char *)malloc(fileSize);
+   bool success=compressed!=NULL && fread(compressed,1,fileSize,file)==fileSize;
+   fclose(file);
+
+   // The members are indexed using the size saved in their header
+   size_t memberCapacity=fileSize/(REG_GZIP_HEADER_SIZE+REG_GZIP_TRAILER_SIZE);
+   size_t *memberStart=(size_t *)malloc(memberCapacity*sizeof(size_t));
+   size_t *memberSize=(size_t *)malloc(memberCapacity*sizeof(size_t));
+   size_t *outputStart=(size_t *)malloc(memberCapacity*sizeof(size_t));
+   size_t *outputSize=(size_t *)malloc(memberCapacity*sizeof(size_t));
+   int memberNumber=0;
+   size_t position=0, uncompressedPosition=0;
+   while(success && position<fileSize)
+   {
+      if(fileSize-position<REG_GZIP_HEADER_SIZE+REG_GZIP_TRAILER_SIZE ||
+            !reg_io_isBlockGzipHeader(&compressed[position]))
+      {
+         success=false;
+         break;
+      }
+      size_t currentSize=reg_io_readLittleEndian32(&compressed[position+16]);
+      if(currentSize<REG_GZIP_HEADER_SIZE+REG_GZIP_TRAILER_SIZE ||
+            currentSize>fileSize-position)
+      {
+         success=false;
+         break;
+      }
+      size_t currentOutputSize=reg_io_readLittleEndian32(&compressed[position+currentSize-4]);
+      // Only the members located after the header are decompressed
+      if(uncompressedPosition>=headerSize)
+      {
+         memberStart[memberNumber]=position;
+         memberSize[memberNumber]=currentSize;
+         outputStart[memberNumber]=uncompressedPosition-headerSize;
+         outputSize[memberNumber]=currentOutputSize;
+         if(outputStart[memberNumber]+currentOutputSize>dataSize)
+            success=false;
+         ++memberNumber;
+      }
+      else if(uncompressedPosition+currentOutputSize>headerSize)
+         success=false;
+      position+=currentSize;
+      uncompressedPosition+=currentOutputSize;
+   }
+   if(uncompressedPosition!=headerSize+dataSize)
+      success=false;
+
+   // The data members are decompressed in parallel
+   if(success)
+   {
+      unsigned char *dataPtr=static_cast<unsigned char *>(data);
+      int m;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(memberNumber, compressed, memberStart, memberSize, dataPtr, \
+   outputStart, outputSize, success) \
+   private(m)
+#endif
+      for(m=0; m<memberNumber; ++m)
+      {
+         if(!reg_io_inflateMember(&compressed[memberStart[m]],
+                                  memberSize[m],
+                                  &dataPtr[outputStart[m]],
+                                  outputSize[m]))
+         {
+#if defined (_OPENMP)
+#pragma omp critical
+#endif
+            success=false;
+         }
+      }
+   }
+   free(compressed);
+   free(memberStart);
+   free(memberSize);
+   free(outputStart);
+   free(outputSize);
+   return success;
+}
+/* *************************************************************** */
@@ -0,0 +1,62 @@
+/**
+ * @file _reg_ReadWriteGzip.h
+ * @brief Library that contains the functions used to read and write gzip
+ * files made of independent members, which can be compressed and
+ * decompressed in parallel
+ *
+ *  See the LICENSE.txt file in the nifty_reg root folder
+ *
+ */
+
+#ifndef _REG_READWRITEGZIP_H
+#define _REG_READWRITEGZIP_H
+
+#include <stdlib.h>
+
+/** Size in bytes of the uncompressed data stored in every gzip member */
+#define REG_GZIP_BLOCK_SIZE 1048576
+/** Number of members that are compressed concurrently before being saved */
+#define REG_GZIP_BATCH_SIZE 64
+
+/* *************************************************************** */
+/** The function checks if a file starts with a gzip member written by
+  * reg_io_writeBlockGzipFile, whose header stores the size of the member
+  * @param filename Filename of the file to check
+  * @return True if the members can be decompressed in parallel
+  */
+bool reg_io_isBlockGzipFile(const char *filename);
+/* *************************************************************** */
+/** The function compresses a header and a data array into a gzip file.
+  * The header is stored in a first member and the data are split into
+  * members of REG_GZIP_BLOCK_SIZE bytes that are compressed in parallel.
+  * Every member has its compressed size saved in an extra field of its
+  * header. The concatenated members form a valid gzip file that can be
+  * read by any gzip implementation.
+  * @param filename Filename of the output file
+  * @param header Array that contains the header
+  * @param headerSize Size of the header in bytes
+  * @param data Array that contains the data
+  * @param dataSize Size of the data in bytes
+  */
+void reg_io_writeBlockGzipFile(const char *filename,
+                               const void *header,
+                               size_t headerSize,
+                               const void *data,
+                               size_t dataSize);
+/* *************************************************************** */
+/** The function decompresses in parallel the data of a file written
+  * by reg_io_writeBlockGzipFile. The members that contain the header
+  * are skipped.
+  * @param filename Filename of the input file
+  * @param headerSize Size of the uncompressed header in bytes
+  * @param data Array that is filled with the uncompressed data
+  * @param dataSize Size of the data in bytes
+  * @return False if the file does not contain the expected members
+  */
+bool reg_io_readBlockGzipFile(const char *filename,
+                              size_t headerSize,
+                              void *data,
+                              size_t dataSize);
+/* *************************************************************** */
+
+#endif
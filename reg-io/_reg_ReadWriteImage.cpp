@@ -15,10 +15,23 @@
 #include "_reg_ReadWriteImage.h"
 #include "_reg_tools.h"
 #include "_reg_stringFormat.h"
+#include "_reg_ReadWriteGzip.h"
+#include <map>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Data arrays of the memory mapped images and the size of their mapping
+static std::map<void *, size_t> mappedImageData;
 
 /* *************************************************************** */
 void reg_hack_filename(nifti_image *image, const char *filename)
 {
+   // Nothing to do if the image could not be read
+   if(image==NULL) return;
    std::string name(filename);
    name.append("\0");
    // Free the char arrays if already allocated
@@ -66,6 +79,64 @@ int reg_io_checkFileFormat(const char *filename)
    return NR_NII_FORMAT;
 }
 /* *************************************************************** */
+/* Read a compressed nifti image whose data are decompressed in parallel.
+ * NULL is returned if the file was not written by reg_io_writeBlockGzipNifti */
+nifti_image *reg_io_readBlockGzipNifti(const char *filename)
+{
+   if(!reg_io_isBlockGzipFile(filename))
+      return NULL;
+   // The header and the extensions are stored in the first member
+   nifti_image *image=nifti_image_read(filename,false);
+   if(image==NULL)
+      return NULL;
+   if(image->nifti_type!=NIFTI_FTYPE_NIFTI1_1 ||
+         image->byteorder!=nifti_short_order())
+   {
+      nifti_image_free(image);
+      return NULL;
+   }
+   size_t dataSize=image->nvox*image->nbyper;
+   image->data=(void *)malloc(dataSize);
+   if(!reg_io_readBlockGzipFile(filename,image->iname_offset,image->data,dataSize))
+   {
+      nifti_image_free(image);
+      return NULL;
+   }
+   return image;
+}
+/* *************************************************************** */
+/* Write a compressed single file nifti image, its data are compressed in
+ * parallel. The uncompressed content matches the one of nifti_image_write */
+void reg_io_writeBlockGzipNifti(nifti_image *image)
+{
+   if(!valid_nifti_extensions(image))
+      image->num_ext=0;
+   nifti_set_iname_offset(image);
+   struct nifti_1_header nhdr=nifti_convert_nim2nhdr(image);
+
+   // The header, the extensions and the padding up to the data offset
+   char *header=(char *)calloc(image->iname_offset,sizeof(char));
+   memcpy(header,&nhdr,sizeof(nhdr));
+   size_t position=sizeof(nhdr);
+   if(image->num_ext>0)
+      header[position]=1;
+   position+=4;
+   for(int e=0; e<image->num_ext; ++e)
+   {
+      nifti1_extension *extension=&image->ext_list[e];
+      memcpy(&header[position],&extension->esize,sizeof(int));
+      memcpy(&header[position+sizeof(int)],&extension->ecode,sizeof(int));
+      memcpy(&header[position+2*sizeof(int)],extension->edata,extension->esize-8);
+      position+=extension->esize;
+   }
+   reg_io_writeBlockGzipFile(image->fname,
+                             header,
+                             image->iname_offset,
+                             image->data,
+                             image->nvox*image->nbyper);
+   free(header);
+}
+/* *************************************************************** */
 nifti_image *reg_io_ReadImageFile(const char *filename)
 {
    // First read the fileformat in order to use the correct library
@@ -78,7 +149,9 @@ nifti_image *reg_io_ReadImageFile(const char *filename)
    switch(fileFormat)
    {
    case NR_NII_FORMAT:
-      image=nifti_image_read(filename,true);
+      image=reg_io_readBlockGzipNifti(filename);
+      if(image==NULL)
+         image=nifti_image_read(filename,true);
       reg_hack_filename(image,filename);
       break;
    case NR_PNG_FORMAT:
@@ -94,7 +167,8 @@ nifti_image *reg_io_ReadImageFile(const char *filename)
       break;
 #endif
    }
-   reg_checkAndCorrectDimension(image);
+   if(image!=NULL)
+      reg_checkAndCorrectDimension(image);
 
    // Return the nifti image
    return image;
@@ -133,6 +207,70 @@ nifti_image *reg_io_ReadImageHeader(const char *filename)
    return image;
 }
 /* *************************************************************** */
+nifti_image *reg_io_MapImageFile(const char *filename)
+{
+#ifndef _WIN32
+   // Only the uncompressed single file nifti images are mapped
+   std::string b(filename);
+   if(reg_io_checkFileFormat(filename)==NR_NII_FORMAT &&
+         b.size()>4 && b.compare(b.size()-4,4,".nii")==0)
+   {
+      nifti_image *image=nifti_image_read(filename,false);
+      if(image==NULL)
+         return NULL;
+      if(image->nifti_type==NIFTI_FTYPE_NIFTI1_1 &&
+            image->byteorder==nifti_short_order() &&
+            image->nvox>0)
+      {
+         size_t mappedSize=(size_t)image->iname_offset+image->nvox*image->nbyper;
+         int fileDescriptor=open(filename,O_RDONLY);
+         struct stat fileStatus;
+         if(fileDescriptor>=0 &&
+               fstat(fileDescriptor,&fileStatus)==0 &&
+               (size_t)fileStatus.st_size>=mappedSize)
+         {
+            // A private mapping shares the page cache until a page is modified
+            void *mappedFile=mmap(NULL,mappedSize,PROT_READ|PROT_WRITE,
+                                  MAP_PRIVATE,fileDescriptor,0);
+            close(fileDescriptor);
+            if(mappedFile!=MAP_FAILED)
+            {
+               image->data=(void *)(static_cast<char *>(mappedFile)+image->iname_offset);
+               mappedImageData[image->data]=mappedSize;
+               reg_hack_filename(image,filename);
+               reg_checkAndCorrectDimension(image);
+#ifndef NDEBUG
+               reg_print_msg_debug("The image data is memory mapped");
+#endif
+               return image;
+            }
+         }
+         else if(fileDescriptor>=0)
+            close(fileDescriptor);
+      }
+      nifti_image_free(image);
+   }
+#endif
+   // The image is read if it can not be mapped
+   return reg_io_ReadImageFile(filename);
+}
+/* *************************************************************** */
+void reg_io_FreeImage(nifti_image *image)
+{
+   if(image==NULL)
+      return;
+#ifndef _WIN32
+   std::map<void *, size_t>::iterator it=mappedImageData.find(image->data);
+   if(it!=mappedImageData.end())
+   {
+      munmap(static_cast<char *>(image->data)-image->iname_offset,it->second);
+      mappedImageData.erase(it);
+      image->data=NULL;
+   }
+#endif
+   nifti_image_free(image);
+}
+/* *************************************************************** */
 void reg_io_WriteImageFile(nifti_image *image, const char *filename)
 {
    // First read the fileformat in order to use the correct library
@@ -162,7 +300,12 @@ void reg_io_WriteImageFile(nifti_image *image, const char *filename)
    {
    case NR_NII_FORMAT:
       nifti_set_filenames(image,filename,0,0);
-      nifti_image_write(image);
+      // The single file compressed images are compressed in parallel
+      if(image->nifti_type==NIFTI_FTYPE_NIFTI1_1 &&
+            nifti_is_gzfile(image->fname) &&
+            image->data!=NULL)
+         reg_io_writeBlockGzipNifti(image);
+      else nifti_image_write(image);
       break;
    case NR_PNG_FORMAT:
       reg_io_writePNGfile(image,filename);
@@ -180,6 +323,42 @@ void reg_io_WriteImageFile(nifti_image *image, const char *filename)
    return;
 }
 /* *************************************************************** */
+znzFile reg_io_OpenImageFileForWriting(nifti_image *image, const char *filename)
+{
+   if(reg_io_checkFileFormat(filename)!=NR_NII_FORMAT)
+   {
+      reg_print_fct_error("reg_io_OpenImageFileForWriting");
+      reg_print_msg_error("Only the nifti format can be written chunk by chunk");
+      reg_exit();
+   }
+   nifti_set_filenames(image,filename,0,0);
+   // The header is written and the file is left open at the data offset
+   znzFile file=nifti_image_write_hdr_img(image,2,"wb");
+   if(znz_isnull(file))
+   {
+      reg_print_fct_error("reg_io_OpenImageFileForWriting");
+      reg_print_msg_error("The output file can not be created:");
+      reg_print_msg_error(filename);
+      reg_exit();
+   }
+   return file;
+}
+/* *************************************************************** */
+void reg_io_WriteImageData(znzFile file, const void *data, size_t byteNumber)
+{
+   if(nifti_write_buffer(file,data,byteNumber)!=byteNumber)
+   {
+      reg_print_fct_error("reg_io_WriteImageData");
+      reg_print_msg_error("The image data could not be written");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+void reg_io_CloseImageFile(znzFile file)
+{
+   znzclose(file);
+}
+/* *************************************************************** */
 template <class DTYPE>
 void reg_io_diplayImageData1(nifti_image *image)
 {
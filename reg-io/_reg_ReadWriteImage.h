@@ -57,6 +57,27 @@ nifti_image *reg_io_ReadImageFile(const char *filename);
   */
 nifti_image *reg_io_ReadImageHeader(const char *filename);
 /* *************************************************************** */
+/** The function expects a filename and returns a nifti_image structure
+  * Uncompressed single file nifti images stored in the native byte order
+  * are memory mapped instead of being read: the data array points to a
+  * private copy-on-write mapping of the file so that the processes which
+  * map the same file share a single physical copy of its unmodified pages.
+  * The other images are read using reg_io_ReadImageFile.
+  * The data array of a mapped image can be modified in place but can not
+  * be freed or reallocated, for example by reg_tools_changeDatatype, and
+  * the image has to be released using reg_io_FreeImage
+  * @param filename Filename of the input images
+  * @return Image as a nifti image
+  */
+nifti_image *reg_io_MapImageFile(const char *filename);
+/* *************************************************************** */
+/** The function releases an image returned by reg_io_MapImageFile or
+  * by reg_io_ReadImageFile. The mapping is removed if the data array is
+  * memory mapped and the image is then freed using nifti_image_free
+  * @param image Nifti image to be freed
+  */
+void reg_io_FreeImage(nifti_image *image);
+/* *************************************************************** */
 /** The function expects a filename and nifti_image structure
   * The image will be converted to the format specified in the
   * filename before being saved
@@ -65,6 +86,28 @@ nifti_image *reg_io_ReadImageHeader(const char *filename);
   */
 void reg_io_WriteImageFile(nifti_image *image, const char *filename);
 /* *************************************************************** */
+/** The function writes the header of an image and leaves the file
+  * open so that the data can be written chunk by chunk, in the file
+  * order, using reg_io_WriteImageData. Only the nifti format is supported
+  * @param image Nifti image whose header is saved, its data array is not used
+  * @param filename Filename of the output image
+  * @return File handle positioned at the beginning of the data
+  */
+znzFile reg_io_OpenImageFileForWriting(nifti_image *image, const char *filename);
+/* *************************************************************** */
+/** The function appends a chunk of data to a file opened with
+  * reg_io_OpenImageFileForWriting
+  * @param file File handle returned by reg_io_OpenImageFileForWriting
+  * @param data Array that contains the chunk to write
+  * @param byteNumber Size of the chunk in bytes
+  */
+void reg_io_WriteImageData(znzFile file, const void *data, size_t byteNumber);
+/* *************************************************************** */
+/** The function closes a file opened with reg_io_OpenImageFileForWriting
+  * @param file File handle returned by reg_io_OpenImageFileForWriting
+  */
+void reg_io_CloseImageFile(znzFile file);
+/* *************************************************************** */
 /** The function expects a nifti_image structure
   * The image will be displayed on the standard output
   * @param Nifti image to be displayed
@@ -481,7 +481,9 @@ void reg_aladin<T>::GetDeformationField()
 template<class T>
 void reg_aladin<T>::GetWarpedImage(int interp, float padding)
 {
-  this->GetDeformationField();
+  // The CPU resampling kernel applies the affine transformation directly
+  if (this->platformCode != NR_PLATFORM_CPU)
+    this->GetDeformationField();
   this->resamplingKernel->template castTo<ResampleImageKernel>()->calculate(interp, padding);
 }
 /* *************************************************************** */
@@ -221,7 +221,8 @@ template <class T>
 void reg_aladin_sym<T>::GetWarpedImage(int interp, float padding)
 {
    reg_aladin<T>::GetWarpedImage(interp, padding);
-   this->GetBackwardDeformationField();
+   if (this->platformCode != NR_PLATFORM_CPU)
+      this->GetBackwardDeformationField();
    this->bResamplingKernel->template castTo<ResampleImageKernel>()->calculate(interp, padding);
 
 }
@@ -32,6 +32,7 @@ reg_base<T>::reg_base(int refTimePoint,int floTimePoint)
    this->perturbationNumber=0;
    this->useConjGradient=true;
    this->useApproxGradient=false;
+   this->approxParzenWindow=true;
 
    this->measure_ssd=NULL;
    this->measure_kld=NULL;
@@ -90,6 +91,13 @@ reg_base<T>::reg_base(int refTimePoint,int floTimePoint)
    this->deformationFieldImage=NULL;
    this->warImgGradient=NULL;
    this->voxelBasedMeasureGradient=NULL;
+   this->warImgGradientUpToDate=false;
+
+   this->useTiledExecution=false;
+   this->tiledExecutionVoxelNumber=TILED_EXECUTION_VOXEL_NUMBER;
+   this->maximalMemoryUsage=0;
+   this->tileSliceNumber=0;
+   this->currentTileFirstSlice=0;
 
    this->interpolation=1;
 
@@ -587,11 +595,22 @@ void reg_base<T>::AllocateDeformationField()
       reg_exit();
    }
    reg_base<T>::ClearDeformationField();
+   // In tiled execution mode, the field is allocated with an extra slice so
+   // that a single remaining slice can be merged with the last tile
+   this->tileSliceNumber=this->currentReference->nz;
+   this->currentTileFirstSlice=0;
+   int allocatedSliceNumber=this->currentReference->nz;
+   if(this->useTiledExecution)
+   {
+      this->tileSliceNumber=this->GetTileSliceNumber(this->currentReference);
+      if(this->tileSliceNumber+1<allocatedSliceNumber)
+         allocatedSliceNumber=this->tileSliceNumber+1;
+   }
    this->deformationFieldImage = nifti_copy_nim_info(this->currentReference);
    this->deformationFieldImage->dim[0]=this->deformationFieldImage->ndim=5;
    this->deformationFieldImage->dim[1]=this->deformationFieldImage->nx=this->currentReference->nx;
    this->deformationFieldImage->dim[2]=this->deformationFieldImage->ny=this->currentReference->ny;
-   this->deformationFieldImage->dim[3]=this->deformationFieldImage->nz=this->currentReference->nz;
+   this->deformationFieldImage->dim[3]=this->deformationFieldImage->nz=allocatedSliceNumber;
    this->deformationFieldImage->dim[4]=this->deformationFieldImage->nt=1;
    this->deformationFieldImage->pixdim[4]=this->deformationFieldImage->dt=1.0;
    if(this->currentReference->nz==1)
@@ -710,6 +729,61 @@ void reg_base<T>::ClearVoxelBasedMeasureGradient()
 #endif
 }
 /* *************************************************************** */
+template <class T>
+int reg_base<T>::GetTileSliceNumber(nifti_image *image)
+{
+   // A tile contains at least two slices so that the gradient is computed in 3D
+   int sliceNumber=(int)(this->tiledExecutionVoxelNumber/((size_t)image->nx*image->ny));
+   if(sliceNumber<2) sliceNumber=2;
+   if(sliceNumber>image->nz) sliceNumber=image->nz;
+   return sliceNumber;
+}
+/* *************************************************************** */
+template <class T>
+void reg_base<T>::SetCurrentTile(int firstSlice)
+{
+   int sliceNumber=this->tileSliceNumber;
+   if(firstSlice+sliceNumber>this->currentReference->nz)
+      sliceNumber=this->currentReference->nz-firstSlice;
+   if(this->currentReference->nz-firstSlice-sliceNumber==1)
+      ++sliceNumber;
+   this->currentTileFirstSlice=firstSlice;
+
+   // The image headers are resized to the current tile
+   nifti_image *tileImages[3]= {this->deformationFieldImage,
+                                this->warImgGradient,
+                                this->voxelBasedMeasureGradient
+                               };
+   for(int i=0; i<3; ++i)
+   {
+      if(tileImages[i]!=NULL)
+      {
+         tileImages[i]->dim[3]=sliceNumber;
+         nifti_update_dims_from_array(tileImages[i]);
+      }
+   }
+
+   // The measures are informed of the first voxel of the tile
+   size_t voxelOffset=(size_t)firstSlice*this->currentReference->nx*this->currentReference->ny;
+   if(this->measure_nmi!=NULL)
+      this->measure_nmi->SetVoxelBasedGradientOffset(voxelOffset);
+   if(this->measure_ssd!=NULL)
+      this->measure_ssd->SetVoxelBasedGradientOffset(voxelOffset);
+   if(this->measure_kld!=NULL)
+      this->measure_kld->SetVoxelBasedGradientOffset(voxelOffset);
+   if(this->measure_lncc!=NULL)
+      this->measure_lncc->SetVoxelBasedGradientOffset(voxelOffset);
+   if(this->measure_dti!=NULL)
+      this->measure_dti->SetVoxelBasedGradientOffset(voxelOffset);
+   if(this->measure_mind!=NULL)
+      this->measure_mind->SetVoxelBasedGradientOffset(voxelOffset);
+   if(this->measure_mindssc!=NULL)
+      this->measure_mindssc->SetVoxelBasedGradientOffset(voxelOffset);
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::SetCurrentTile");
+#endif
+}
+/* *************************************************************** */
 template<class T>
 void reg_base<T>::CheckParameters()
 {
@@ -899,6 +973,10 @@ void reg_base<T>::CheckParameters()
 		}
 	}
 
+	// The NMI histograms are filled using a Parzen window if required
+	if (this->measure_nmi != NULL)
+		this->measure_nmi->SetPartialVolumeHistogram(!this->approxParzenWindow);
+
 #ifndef NDEBUG
 	reg_print_fct_debug("reg_base<T>::CheckParameters");
 #endif
@@ -1223,14 +1301,21 @@ void reg_base<T>::GetVoxelBasedGradient()
    //   if(this->measure_dti!=NULL)
    //      this->measure_dti->GetVoxelBasedSimilarityMeasureGradient();
 
+   // The deformation field may only cover the current tile
+   int *tileMask = &this->currentMask[(size_t)this->currentTileFirstSlice *
+         this->currentReference->nx * this->currentReference->ny];
+
    for(int t=0; t<this->currentReference->nt; ++t){
-      reg_getImageGradient(this->currentFloating,
-                           this->warImgGradient,
-                           this->deformationFieldImage,
-                           this->currentMask,
-                           this->interpolation,
-                           this->warpedPaddingValue,
-                           t);
+      // The gradient might already have been computed when warping the floating image
+      if(t>0 || !this->warImgGradientUpToDate)
+         reg_getImageGradient(this->currentFloating,
+                              this->warImgGradient,
+                              this->deformationFieldImage,
+                              tileMask,
+                              this->interpolation,
+                              this->warpedPaddingValue,
+                              t);
+      this->warImgGradientUpToDate=false;
 
       // The gradient of the various measures of similarity are computed
       if(this->measure_nmi!=NULL)
@@ -1258,23 +1343,23 @@ void reg_base<T>::GetVoxelBasedGradient()
 }
 /* *************************************************************** */
 /* *************************************************************** */
-//template<class T>
-//void reg_base<T>::ApproximateParzenWindow()
-//{
-//    if(this->measure_nmi==NULL)
-//        this->measure_nmi=new reg_nmi;
-//    this->measure_nmi=approxParzenWindow = true;
-//    return;
-//}
-///* *************************************************************** */
-//template<class T>
-//void reg_base<T>::DoNotApproximateParzenWindow()
-//{
-//    if(this->measure_nmi==NULL)
-//        this->measure_nmi=new reg_nmi;
-//    this->measure_nmi=approxParzenWindow = false;
-//    return;
-//}
+template<class T>
+void reg_base<T>::ApproximateParzenWindow()
+{
+   this->approxParzenWindow = true;
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::ApproximateParzenWindow");
+#endif
+}
+/* *************************************************************** */
+template<class T>
+void reg_base<T>::DoNotApproximateParzenWindow()
+{
+   this->approxParzenWindow = false;
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_base<T>::DoNotApproximateParzenWindow");
+#endif
+}
 /* *************************************************************** */
 /* *************************************************************** */
 template<class T>
@@ -1455,12 +1540,48 @@ void reg_base<T>::SetLocalWeightSim(nifti_image *i)
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
-void reg_base<T>::WarpFloatingImage(int inter)
+void reg_base<T>::WarpFloatingImage(int inter, bool gradientRequired)
 {
+   this->warImgGradientUpToDate=false;
+
+   // When the gradient is not required, the transformation can be used to
+   // resample the floating image without storing the deformation field.
+   // In tiled execution mode, the field is never stored for the full image
+   if((gradientRequired==false || this->useTiledExecution) && this->measure_dti==NULL)
+   {
+      if(this->WarpFloatingImageWithoutField(inter))
+      {
+#ifndef NDEBUG
+         reg_print_fct_debug("reg_base<T>::WarpFloatingImage");
+#endif
+         return;
+      }
+   }
+   if(this->useTiledExecution)
+   {
+      reg_print_fct_error("reg_base<T>::WarpFloatingImage()");
+      reg_print_msg_error("The tiled execution mode requires a transformation that can be applied without deformation field");
+      reg_exit();
+   }
+
    // Compute the deformation field
    this->GetDeformationField();
 
-   if(this->measure_dti==NULL)
+   if(this->measure_dti==NULL && gradientRequired && this->warImgGradient!=NULL &&
+         inter==this->interpolation && (inter==1 || inter==3) &&
+         this->currentFloating->nt==1)
+   {
+      // The warped image and its gradient are computed in a single pass
+      reg_resampleImageAndGradient(this->currentFloating,
+                                   this->warped,
+                                   this->warImgGradient,
+                                   this->deformationFieldImage,
+                                   this->currentMask,
+                                   inter,
+                                   this->warpedPaddingValue);
+      this->warImgGradientUpToDate=true;
+   }
+   else if(this->measure_dti==NULL)
    {
       // Resample the floating image
       reg_resampleImage(this->currentFloating,
@@ -30,6 +30,9 @@
 #include "float.h"
 //#include "Platform.h"
 
+// Number of voxels of the deformation field tiles in tiled execution mode
+#define TILED_EXECUTION_VOXEL_NUMBER 1048576
+
 /// @brief Base registration class
 template <class T>
 class reg_base : public InterfaceOptimiser
@@ -85,6 +88,7 @@ protected:
    bool additive_mc_nmi;
    bool useConjGradient;
    bool useApproxGradient;
+   bool approxParzenWindow;
    bool verbose;
    bool usePyramid;
    int interpolation;
@@ -102,6 +106,20 @@ protected:
    nifti_image *warImgGradient;
    nifti_image *voxelBasedMeasureGradient;
    unsigned int currentLevel;
+   // Set when the warped image gradient of the first time point has been
+   // computed along with the warped image and is still up to date
+   bool warImgGradientUpToDate;
+
+   // In tiled execution mode, the deformation field, the warped image
+   // gradient and the voxel-based measure gradient only hold a tile of
+   // consecutive reference slices
+   bool useTiledExecution;
+   size_t tiledExecutionVoxelNumber;
+   // Memory budget in MB above which the tiled execution mode is used,
+   // 0 when no budget is set
+   size_t maximalMemoryUsage;
+   int tileSliceNumber;
+   int currentTileFirstSlice;
 
    mat33 *forwardJacobianMatrix;
 
@@ -124,13 +142,15 @@ protected:
    virtual void ClearWarpedGradient();
    virtual void AllocateVoxelBasedMeasureGradient();
    virtual void ClearVoxelBasedMeasureGradient();
+   int GetTileSliceNumber(nifti_image *);
+   void SetCurrentTile(int firstSlice);
    virtual T InitialiseCurrentLevel()
    {
       return 0.;
    }
    virtual void ClearCurrentInputImage();
 
-   virtual void WarpFloatingImage(int);
+   virtual void WarpFloatingImage(int, bool gradientRequired=true);
    virtual double ComputeSimilarityMeasure();
    virtual void GetVoxelBasedGradient();
    virtual void SmoothGradient()
@@ -144,6 +164,12 @@ protected:
    {
       return;  // Need to be filled
    }
+   // Returns true if the warped image has been computed without storing
+   // the deformation field
+   virtual bool WarpFloatingImageWithoutField(int)
+   {
+      return false;
+   }
    virtual void SetGradientImageToZero()
    {
       return;  // Need to be filled
@@ -237,8 +263,8 @@ public:
    void UseApproximatedGradient();
    void DoNotUseApproximatedGradient();
    // Measure of similarity related functions
-//    void ApproximateParzenWindow();
-//    void DoNotApproximateParzenWindow();
+   void ApproximateParzenWindow();
+   void DoNotApproximateParzenWindow();
    virtual void UseNMISetReferenceBinNumber(int,int);
    virtual void UseNMISetFloatingBinNumber(int,int);
    virtual void UseSSD(int timepoint, bool normalize);
@@ -278,6 +304,24 @@ public:
    void UseLinearInterpolation();
    void UseCubicSplineInterpolation();
    void SetLandmarkRegularisationParam(size_t, float *, float*, float);
+   /// @brief Compute the deformation field and the voxel-based gradients by
+   /// tiles of reference slices to reduce the memory usage
+   void UseTiledExecution()
+   {
+      this->useTiledExecution=true;
+   }
+   /// @brief Use the tiled execution mode when the estimated memory usage
+   /// with the full deformation field exceeds the provided budget, in MB.
+   /// The tiles are then reduced until the estimated usage fits the budget
+   void SetMaximalMemoryUsage(size_t megabytes)
+   {
+      this->maximalMemoryUsage=megabytes;
+   }
+   /// @brief Returns true if the tiled execution mode is used
+   bool GetTiledExecutionStatus()
+   {
+      return this->useTiledExecution;
+   }
 
    virtual void CheckParameters();
    void Run();
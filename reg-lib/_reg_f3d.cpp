@@ -39,6 +39,9 @@ reg_f3d<T>::reg_f3d(int refTimePoint,int floTimePoint)
    this->transformationGradient=NULL;
 
    this->gridRefinement=true;
+   this->useIncrementalNMI=false;
+   this->lastEvaluatedGrid=NULL;
+   this->lastEvaluatedGridSize=0;
 
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::reg_f3d");
@@ -55,6 +58,11 @@ reg_f3d<T>::~reg_f3d()
       nifti_image_free(this->controlPointGrid);
       this->controlPointGrid=NULL;
    }
+   if(this->lastEvaluatedGrid!=NULL)
+   {
+      free(this->lastEvaluatedGrid);
+      this->lastEvaluatedGrid=NULL;
+   }
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::~reg_f3d");
 #endif
@@ -207,6 +215,35 @@ void reg_f3d<T>::CheckParameters()
       }
       else this->similarityWeight=1.0 - penaltySum;
    }
+   // The tiled execution mode requires 3D images and measures of similarity
+   // whose voxel-based gradient can be computed tile by tile
+   if(this->useTiledExecution || this->maximalMemoryUsage>0)
+   {
+      bool tileSupport = this->inputReference->nz>1 &&
+            this->localWeightSimInput==NULL &&
+            this->GetSymmetricStatus()==false;
+      reg_measure *measures[7]= {this->measure_nmi,
+                                 this->measure_ssd,
+                                 this->measure_kld,
+                                 this->measure_lncc,
+                                 this->measure_dti,
+                                 this->measure_mind,
+                                 this->measure_mindssc
+                                };
+      for(int i=0; i<7; ++i)
+      {
+         if(measures[i]!=NULL && measures[i]->SupportsVoxelBasedGradientTiles()==false)
+            tileSupport=false;
+      }
+      if(tileSupport==false)
+      {
+         reg_print_fct_warn("reg_f3d<T>::CheckParameters()");
+         reg_print_msg_warn("The tiled execution mode is only supported for non-symmetric 3D registrations using the SSD or the NMI without Parzen window filling");
+         reg_print_msg_warn("The full deformation field is used instead");
+         this->useTiledExecution=false;
+         this->maximalMemoryUsage=0;
+      }
+   }
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::CheckParameters");
 #endif
@@ -271,6 +308,53 @@ void reg_f3d<T>::Initialise()
       if(this->controlPointGrid->nz>1)
          this->spacing[2] = this->controlPointGrid->dz / powf(2.0f, (float)(this->levelNumber-1));
    }
+
+   // The tiled execution mode is used when the estimated memory usage with
+   // the full deformation field exceeds the budget. The tiles are then
+   // halved until the estimated usage fits the budget or contain two slices
+   if(this->maximalMemoryUsage>0)
+   {
+      size_t memoryLimit=this->maximalMemoryUsage*1024*1024;
+      if(this->EstimateMemoryUsage(false)>memoryLimit)
+      {
+         this->useTiledExecution=true;
+         nifti_image *reference=this->referencePyramid[this->usePyramid?this->levelToPerform-1:0];
+         size_t minVoxelNumber=2*(size_t)reference->nx*reference->ny;
+         while(this->EstimateMemoryUsage(true)>memoryLimit &&
+               this->tiledExecutionVoxelNumber/2>=minVoxelNumber)
+            this->tiledExecutionVoxelNumber/=2;
+         if(this->EstimateMemoryUsage(true)>memoryLimit)
+         {
+            reg_print_fct_warn("reg_f3d<T>::Initialise()");
+            reg_print_msg_warn("The estimated memory usage exceeds the budget with the smallest tiles");
+         }
+      }
+   }
+
+   // The tiled execution mode requires the grid axes to be aligned with the
+   // reference image axes
+   if(this->useTiledExecution)
+   {
+      mat44 gridToReference;
+      if(this->controlPointGrid->sform_code>0)
+         gridToReference=this->controlPointGrid->sto_xyz;
+      else gridToReference=this->controlPointGrid->qto_xyz;
+      if(this->inputReference->sform_code>0)
+         gridToReference=reg_mat44_mul(&this->inputReference->sto_ijk, &gridToReference);
+      else gridToReference=reg_mat44_mul(&this->inputReference->qto_ijk, &gridToReference);
+      bool alignedGrid = this->controlPointGrid->num_ext==0;
+      for(int i=0; i<3; ++i)
+         for(int j=0; j<3; ++j)
+            if(i!=j && fabs(gridToReference.m[i][j])>1.e-4f)
+               alignedGrid=false;
+      if(alignedGrid==false)
+      {
+         reg_print_fct_warn("reg_f3d<T>::Initialise()");
+         reg_print_msg_warn("The tiled execution mode requires a control point grid aligned with the reference image");
+         reg_print_msg_warn("The full deformation field is used instead");
+         this->useTiledExecution=false;
+      }
+   }
 #ifdef NDEBUG
    if(this->verbose)
    {
@@ -399,6 +483,13 @@ void reg_f3d<T>::Initialise()
          reg_print_info(this->executableName, text.c_str());
          reg_print_info(this->executableName, "");
       }
+      text = stringFormat("Estimated memory usage: %i MB (%i MB in tiled execution mode)",
+              (int)ceil((double)this->EstimateMemoryUsage(false)/(1024.*1024.)),
+              (int)ceil((double)this->EstimateMemoryUsage(true)/(1024.*1024.)));
+      reg_print_info(this->executableName, text.c_str());
+      if(this->useTiledExecution)
+         reg_print_info(this->executableName, "\t* The tiled execution mode is used");
+      reg_print_info(this->executableName, "");
 #ifdef NDEBUG
    }
 #endif
@@ -413,12 +504,20 @@ void reg_f3d<T>::Initialise()
 template <class T>
 void reg_f3d<T>::GetDeformationField()
 {
-   reg_spline_getDeformationField(this->controlPointGrid,
-                                  this->deformationFieldImage,
-                                  this->currentMask,
-                                  false, //composition
-                                  true // bspline
-                                  );
+   // Only the current tile is computed in tiled execution mode
+   if(this->useTiledExecution)
+      reg_spline_getDeformationFieldSlab(this->controlPointGrid,
+                                         this->deformationFieldImage,
+                                         this->currentTileFirstSlice,
+                                         this->currentMask,
+                                         true // bspline
+                                         );
+   else reg_spline_getDeformationField(this->controlPointGrid,
+                                       this->deformationFieldImage,
+                                       this->currentMask,
+                                       false, //composition
+                                       true // bspline
+                                       );
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::GetDeformationField");
 #endif
@@ -426,6 +525,28 @@ void reg_f3d<T>::GetDeformationField()
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
+bool reg_f3d<T>::WarpFloatingImageWithoutField(int inter)
+{
+   // The B-spline transformation is evaluated and the floating image
+   // resampled slab by slab
+   if(this->controlPointGrid->nz==1 || this->controlPointGrid->num_ext>0)
+      return false;
+   reg_spline_getWarpedImage(this->controlPointGrid,
+                             this->currentFloating,
+                             this->warped,
+                             this->currentMask,
+                             inter,
+                             this->warpedPaddingValue,
+                             true // bspline
+                             );
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d<T>::WarpFloatingImageWithoutField");
+#endif
+   return true;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
 double reg_f3d<T>::ComputeJacobianBasedPenaltyTerm(int type)
 {
    if(this->jacobianLogWeight<=0) return 0.;
@@ -497,7 +618,11 @@ double reg_f3d<T>::ComputeBendingEnergyPenaltyTerm()
 {
    if(this->bendingEnergyWeight<=0) return 0.;
 
-   double value = reg_spline_approxBendingEnergy(this->controlPointGrid);
+   // No gradient is computed here, the weight is thus only applied to the
+   // returned value
+   double value = reg_spline_approxBendingEnergyStencil(this->controlPointGrid,
+                                                        NULL,
+                                                        1.f);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::ComputeBendingEnergyPenaltyTerm");
 #endif
@@ -541,6 +666,38 @@ double reg_f3d<T>::ComputeLandmarkDistancePenaltyTerm()
 template <class T>
 void reg_f3d<T>::GetSimilarityMeasureGradient()
 {
+   mat44 reorientation;
+   if(this->currentFloating->sform_code>0)
+      reorientation = this->currentFloating->sto_ijk;
+   else reorientation = this->currentFloating->qto_ijk;
+
+   // In tiled execution mode, the voxel-based gradient is computed, smoothed
+   // and accumulated onto the nodes one tile of slices at a time
+   if(this->useTiledExecution)
+   {
+      reg_tools_multiplyValueToImage(this->transformationGradient,
+                                     this->transformationGradient,
+                                     0.f);
+      for(int firstSlice=0; firstSlice<this->currentReference->nz;
+          firstSlice+=this->deformationFieldImage->nz)
+      {
+         this->SetCurrentTile(firstSlice);
+         this->GetDeformationField();
+         this->GetVoxelBasedGradient();
+         reg_voxelCentric2NodeCentric_slab(this->transformationGradient,
+                                           this->voxelBasedMeasureGradient,
+                                           firstSlice,
+                                           this->currentReference->nz,
+                                           this->similarityWeight,
+                                           &reorientation
+                                           );
+      }
+#ifndef NDEBUG
+      reg_print_fct_debug("reg_f3d<T>::GetSimilarityMeasureGradient");
+#endif
+      return;
+   }
+
    this->GetVoxelBasedGradient();
 
    int kernel_type=CUBIC_SPLINE_KERNEL;
@@ -583,10 +740,6 @@ void reg_f3d<T>::GetSimilarityMeasureGradient()
    }
 
    // The node based NMI gradient is extracted
-   mat44 reorientation;
-   if(this->currentFloating->sform_code>0)
-      reorientation = this->currentFloating->sto_ijk;
-   else reorientation = this->currentFloating->qto_ijk;
    reg_voxelCentric2NodeCentric(this->transformationGradient,
                                 this->voxelBasedMeasureGradient,
                                 this->similarityWeight,
@@ -605,9 +758,12 @@ void reg_f3d<T>::GetBendingEnergyGradient()
 {
    if(this->bendingEnergyWeight<=0) return;
 
-   reg_spline_approxBendingEnergyGradient(this->controlPointGrid,
-                                          this->transformationGradient,
-                                          this->bendingEnergyWeight);
+   // Only the gradient is required, the value is computed by
+   // ComputeBendingEnergyPenaltyTerm
+   reg_spline_approxBendingEnergyStencil(this->controlPointGrid,
+                                         this->transformationGradient,
+                                         this->bendingEnergyWeight,
+                                         false);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d<T>::GetBendingEnergyGradient");
 #endif
@@ -854,6 +1010,49 @@ void reg_f3d<T>::DisplayCurrentLevelParameters()
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
+void reg_f3d<T>::SetNMIModifiedTiles()
+{
+   if(this->useIncrementalNMI==false || this->measure_nmi==NULL)
+      return;
+
+   // Every NMI tile corresponds to a control point cell in the reference space
+   float tileSpacing[3];
+   tileSpacing[0]=this->controlPointGrid->dx / this->currentReference->dx;
+   tileSpacing[1]=this->controlPointGrid->dy / this->currentReference->dy;
+   tileSpacing[2]=1.f;
+   if(this->currentReference->nz>1)
+      tileSpacing[2]=this->controlPointGrid->dz / this->currentReference->dz;
+   this->measure_nmi->SetIncrementalTileSpacing(tileSpacing);
+
+   // The grid used for the previous evaluation is stored. When its size
+   // differs, the measure fills the whole histogram anyway
+   if(this->lastEvaluatedGrid==NULL ||
+         this->lastEvaluatedGridSize!=this->controlPointGrid->nvox)
+   {
+      if(this->lastEvaluatedGridSize!=this->controlPointGrid->nvox)
+      {
+         if(this->lastEvaluatedGrid!=NULL)
+            free(this->lastEvaluatedGrid);
+         this->lastEvaluatedGrid=NULL;
+      }
+      this->lastEvaluatedGridSize=this->controlPointGrid->nvox;
+      if(this->lastEvaluatedGrid==NULL)
+         this->lastEvaluatedGrid=(T *)malloc(this->lastEvaluatedGridSize*sizeof(T));
+      memcpy(this->lastEvaluatedGrid,this->controlPointGrid->data,
+             this->lastEvaluatedGridSize*sizeof(T));
+      return;
+   }
+
+   this->measure_nmi->SetModifiedControlPoints(this->controlPointGrid,
+                                               this->lastEvaluatedGrid);
+   memcpy(this->lastEvaluatedGrid,this->controlPointGrid->data,this->lastEvaluatedGridSize*sizeof(T));
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d<T>::SetNMIModifiedTiles");
+#endif
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template <class T>
 double reg_f3d<T>::GetObjectiveFunctionValue()
 {
    this->currentWJac = this->ComputeJacobianBasedPenaltyTerm(1); // 20 iterations
@@ -868,7 +1067,8 @@ double reg_f3d<T>::GetObjectiveFunctionValue()
    this->currentWMeasure = 0.0;
    if(this->similarityWeight>0)
    {
-      this->WarpFloatingImage(this->interpolation);
+      this->WarpFloatingImage(this->interpolation, false);
+      this->SetNMIModifiedTiles();
       this->currentWMeasure = this->ComputeSimilarityMeasure();
    }
 #ifndef NDEBUG
@@ -1025,7 +1225,22 @@ nifti_image **reg_f3d<T>::GetWarpedImage()
 
    reg_base<T>::AllocateWarped();
    reg_base<T>::AllocateDeformationField();
-   reg_base<T>::WarpFloatingImage(3); // cubic spline interpolation
+   // The result image is resampled through the dense deformation field. The
+   // slab-wise resampling without field, which is within the tolerance of
+   // reg_test_slab_resampling, is only used in tiled execution mode since
+   // the field is then never allocated for the full image
+   if(this->useTiledExecution)
+      reg_base<T>::WarpFloatingImage(3, false); // cubic spline interpolation
+   else
+   {
+      this->GetDeformationField();
+      reg_resampleImage(this->currentFloating,
+                        this->warped,
+                        this->deformationFieldImage,
+                        this->currentMask,
+                        3, // cubic spline interpolation
+                        this->warpedPaddingValue);
+   }
    reg_base<T>::ClearDeformationField();
 
    nifti_image **warpedImage= (nifti_image **)malloc(2*sizeof(nifti_image *));
@@ -1128,6 +1343,8 @@ void reg_f3d<T>::GetObjectiveFunctionGradient()
       if(this->similarityWeight>0)
       {
          this->WarpFloatingImage(this->interpolation);
+         // The NMI histograms of the gradient are filled from scratch and
+         // leave the incremental cache of the line search untouched
          this->GetSimilarityMeasureGradient();
       }
       else
@@ -1166,6 +1383,105 @@ void reg_f3d<T>::CorrectTransformation()
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template<class T>
+size_t reg_f3d<T>::EstimateMemoryUsage(bool tiledExecution)
+{
+   // The peak usage is reached at the last level to perform
+   int level = this->usePyramid?this->levelToPerform-1:0;
+   nifti_image *reference = this->referencePyramid[level];
+   nifti_image *floating = this->floatingPyramid[level];
+   int dim = reference->nz>1?3:2;
+   size_t sliceVoxelNumber = (size_t)reference->nx*reference->ny;
+   size_t voxelNumber = sliceVoxelNumber*reference->nz;
+
+   // Control point grid at the last level
+   size_t gridDim[3]= {1,1,1};
+   float gridSpacing[3]= {this->controlPointGrid->dx,
+                          this->controlPointGrid->dy,
+                          this->controlPointGrid->dz
+                         };
+   for(int i=0; i<dim; ++i)
+   {
+      if(this->gridRefinement)
+         gridSpacing[i] /= powf(2.0f, (float)(this->levelToPerform-1));
+      gridDim[i]=(size_t)reg_ceil(reference->dim[i+1]*reference->pixdim[i+1]/gridSpacing[i])+3;
+   }
+   size_t nodeNumber = gridDim[0]*gridDim[1]*gridDim[2];
+
+   size_t totalMemory=0;
+   // input images
+   totalMemory += this->inputReference->nvox * this->inputReference->nbyper;
+   totalMemory += this->inputFloating->nvox * this->inputFloating->nbyper;
+   // reference, floating, warped and mask images
+   totalMemory += reference->nvox * sizeof(T);
+   totalMemory += floating->nvox * sizeof(T);
+   totalMemory += voxelNumber * floating->nt * sizeof(T);
+   totalMemory += voxelNumber * sizeof(int);
+   // deformation field, warped image gradient and voxel-based measure gradient
+   if(tiledExecution && dim==3)
+   {
+      size_t sliceNumber = this->GetTileSliceNumber(reference)+1;
+      if(sliceNumber>(size_t)reference->nz) sliceNumber=reference->nz;
+      totalMemory += 3 * sliceVoxelNumber * sliceNumber * dim * sizeof(T);
+      // node accumulation buffers, see reg_voxelCentric2NodeCentric_slab
+      totalMemory += 3 * sliceNumber * gridDim[0] *
+            (reference->ny + gridDim[1]) * sizeof(double);
+   }
+   else
+   {
+      totalMemory += 3 * voxelNumber * dim * sizeof(T);
+      // density and mask arrays used by the gradient convolution
+      totalMemory += voxelNumber * (sizeof(float)+sizeof(bool));
+   }
+   // control point grid, transformation gradient and optimiser arrays
+   totalMemory += (this->useConjGradient?5:3) * nodeNumber * dim * sizeof(T);
+   // Jacobian matrices and determinants
+   if(this->jacobianLogWeight>0)
+   {
+      if(this->jacobianLogApproximation)
+         totalMemory += 10 * nodeNumber * sizeof(T);
+      else totalMemory += 10 * voxelNumber * sizeof(T);
+   }
+   return totalMemory;
+}
+/* *************************************************************** */
+template<class T>
+int reg_f3d<T>::CheckMemoryMB()
+{
+   if(!this->initialised) this->Initialise();
+
+   return (int)ceil((double)this->EstimateMemoryUsage(this->useTiledExecution) /
+                    (1024.*1024.));
+}
+/* *************************************************************** */
+template<class T>
+nifti_image *reg_f3d<T>::reg_test_getSimilarityMeasureGradient()
+{
+   if(!this->initialised) this->Initialise();
+
+   // The first level is initialised as done in reg_base<T>::Run()
+   this->currentLevel=0;
+   this->currentReference = this->referencePyramid[0];
+   this->currentFloating = this->floatingPyramid[0];
+   this->currentMask = this->maskPyramid[0];
+   this->AllocateWarped();
+   this->AllocateDeformationField();
+   this->AllocateWarpedGradient();
+   this->InitialiseCurrentLevel();
+   this->AllocateVoxelBasedMeasureGradient();
+   this->AllocateTransformationGradient();
+   this->InitialiseSimilarity();
+
+   // The node based gradient is computed for the current grid
+   this->WarpFloatingImage(this->interpolation);
+   this->GetSimilarityMeasureGradient();
+#ifndef NDEBUG
+   reg_print_fct_debug("reg_f3d<T>::reg_test_getSimilarityMeasureGradient");
+#endif
+   return this->transformationGradient;
+}
+/* *************************************************************** */
+/* *************************************************************** */
 
 template class reg_f3d<float>;
 #endif
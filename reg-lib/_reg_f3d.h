@@ -29,6 +29,9 @@ protected:
 
    nifti_image *transformationGradient;
    bool gridRefinement;
+   bool useIncrementalNMI;
+   T *lastEvaluatedGrid;
+   size_t lastEvaluatedGridSize;
 
    double currentWJac;
    double currentWBE;
@@ -58,6 +61,7 @@ protected:
    void GetSimilarityMeasureGradient();
 
    virtual void GetDeformationField();
+   virtual bool WarpFloatingImageWithoutField(int);
    virtual void DisplayCurrentLevelParameters();
 
    virtual double GetObjectiveFunctionValue();
@@ -69,6 +73,14 @@ protected:
    virtual void PrintCurrentObjFunctionValue(T);
 
    virtual void CorrectTransformation();
+   virtual void SetNMIModifiedTiles();
+   /// @brief Returns the estimated peak memory usage in bytes
+   size_t EstimateMemoryUsage(bool tiledExecution);
+
+   // Function used for testing
+   /// @brief Initialise the first level and return the node based
+   /// gradient of the measure of similarity for the current grid
+   nifti_image *reg_test_getSimilarityMeasureGradient();
 
    void (*funcProgressCallback)(float pcntProgress, void *params);
    void *paramsProgressCallback;
@@ -89,6 +101,12 @@ public:
    {
       this->gridRefinement=false;
    }
+   /// @brief Only re-bin the NMI histogram voxels from the control point
+   /// cells affected by a control point update during the line search
+   void UseIncrementalNMI()
+   {
+      this->useIncrementalNMI=true;
+   }
    // F3D2 specific options
    virtual void SetCompositionStepNumber(int)
    {
@@ -114,6 +132,10 @@ public:
    {
       return;
    }
+   virtual void UseGridSquaring()
+   {
+      return;
+   }
 
    // F3D_SYM specific options
    virtual void SetFloatingMask(nifti_image *)
@@ -129,11 +151,10 @@ public:
       return NULL;
    }
 
-   // F3D_gpu specific option
-   virtual int CheckMemoryMB()
-   {
-      return EXIT_SUCCESS;
-   }
+   /// @brief Returns the estimated peak memory usage in MB, for the tiled
+   /// execution mode when it is enabled and for the full deformation field
+   /// otherwise
+   virtual int CheckMemoryMB();
 
    virtual void CheckParameters();
    virtual void Initialise();
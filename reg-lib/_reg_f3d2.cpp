@@ -26,6 +26,7 @@ reg_f3d2<T>::reg_f3d2(int refTimePoint,int floTimePoint)
    this->BCHUpdate=false;
    this->useGradientCumulativeExp=true;
    this->BCHUpdateValue=0;
+   this->gridSquaring=false;
 
 #ifndef NDEBUG
    reg_print_msg_debug("reg_f3d2 constructor called");
@@ -67,6 +68,13 @@ void reg_f3d2<T>::DoNotUseGradientCumulativeExp()
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template <class T>
+void reg_f3d2<T>::UseGridSquaring()
+{
+   this->gridSquaring = true;
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template<class T>
 void reg_f3d2<T>::Initialise()
 {
@@ -95,25 +103,34 @@ void reg_f3d2<T>::GetDeformationField()
       updateStepNumber=false;
 #ifndef NDEBUG
    char text[255];
-   sprintf(text, "Velocity integration forward. Step number update=%i",updateStepNumber);
+   sprintf(text, "Velocity integration forward and backward. Step number update=%i",updateStepNumber);
    reg_print_msg_debug(text);
 #endif
-   // The forward transformation is computed using the scaling-and-squaring approach
-   reg_spline_getDefFieldFromVelocityGrid(this->controlPointGrid,
-                                          this->deformationFieldImage,
-                                          updateStepNumber
-                                          );
-#ifndef NDEBUG
-   sprintf(text, "Velocity integration backward. Step number update=%i",updateStepNumber);
-   reg_print_msg_debug(text);
-#endif
-   // The number of step number is copied over from the forward transformation
-   this->backwardControlPointGrid->intent_p2=this->controlPointGrid->intent_p2;
-   // The backward transformation is computed using the scaling-and-squaring approach
-   reg_spline_getDefFieldFromVelocityGrid(this->backwardControlPointGrid,
-                                          this->backwardDeformationFieldImage,
-                                          false
-                                          );
+   if(this->gridSquaring)
+   {
+      // The forward and backward transformations are computed using the
+      // scaling-and-squaring approach at the control point resolution
+      reg_spline_getDefFieldFromVelocityGridSquaring(this->controlPointGrid,
+                                                     this->deformationFieldImage,
+                                                     updateStepNumber
+                                                     );
+      // The number of step number is copied over from the forward transformation
+      this->backwardControlPointGrid->intent_p2=this->controlPointGrid->intent_p2;
+      reg_spline_getDefFieldFromVelocityGridSquaring(this->backwardControlPointGrid,
+                                                     this->backwardDeformationFieldImage,
+                                                     false
+                                                     );
+      return;
+   }
+   // The forward and backward transformations are computed concurrently using
+   // the scaling-and-squaring approach. The number of step number is copied
+   // over from the forward transformation
+   reg_spline_getDefFieldsFromVelocityGrids(this->controlPointGrid,
+                                            this->backwardControlPointGrid,
+                                            this->deformationFieldImage,
+                                            this->backwardDeformationFieldImage,
+                                            updateStepNumber
+                                            );
    return;
 }
 /* *************************************************************** */
@@ -179,8 +196,12 @@ void reg_f3d2<T>::ExponentiateGradient()
       tempDef[i]=nifti_copy_nim_info(this->deformationFieldImage);
       tempDef[i]->data=(void *)malloc(tempDef[i]->nvox*tempDef[i]->nbyper);
    }
-   // Generate all intermediate deformation fields
-   reg_spline_getIntermediateDefFieldFromVelGrid(this->backwardControlPointGrid,
+   // Generate all intermediate deformation fields using the same
+   // exponentiation as the one used to compute the objective function
+   if(this->gridSquaring)
+      reg_spline_getIntermediateDefFieldFromVelGridSquaring(this->backwardControlPointGrid,
+            tempDef);
+   else reg_spline_getIntermediateDefFieldFromVelGrid(this->backwardControlPointGrid,
          tempDef);
 
    // Remove the affine component
@@ -249,8 +270,12 @@ void reg_f3d2<T>::ExponentiateGradient()
       tempDef[i]=nifti_copy_nim_info(this->backwardDeformationFieldImage);
       tempDef[i]->data=(void *)malloc(tempDef[i]->nvox*tempDef[i]->nbyper);
    }
-   // Generate all intermediate deformation fields
-   reg_spline_getIntermediateDefFieldFromVelGrid(this->controlPointGrid,
+   // Generate all intermediate deformation fields using the same
+   // exponentiation as the one used to compute the objective function
+   if(this->gridSquaring)
+      reg_spline_getIntermediateDefFieldFromVelGridSquaring(this->controlPointGrid,
+            tempDef);
+   else reg_spline_getIntermediateDefFieldFromVelGrid(this->controlPointGrid,
          tempDef);
 
    // Remove the affine component
@@ -461,7 +486,7 @@ nifti_image **reg_f3d2<T>::GetWarpedImage()
    reg_f3d2<T>::AllocateDeformationField();
 
    // Warp the floating images into the reference spaces using a cubic spline interpolation
-   reg_f3d2<T>::WarpFloatingImage(3); // cubic spline interpolation
+   reg_f3d2<T>::WarpFloatingImage(3, false); // cubic spline interpolation
 
    // Clear the deformation field
    reg_f3d2<T>::ClearDeformationField();
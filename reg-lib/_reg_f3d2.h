@@ -23,6 +23,7 @@ protected:
    bool BCHUpdate;
    bool useGradientCumulativeExp;
    int BCHUpdateValue;
+   bool gridSquaring;
 
    virtual void GetDeformationField();
    virtual void GetInverseConsistencyErrorField(bool forceAll);
@@ -33,6 +34,7 @@ protected:
    virtual void UseBCHUpdate(int);
    virtual void UseGradientCumulativeExp();
    virtual void DoNotUseGradientCumulativeExp();
+   virtual void UseGridSquaring();
 
 public:
    reg_f3d2(int refTimePoint,int floTimePoint);
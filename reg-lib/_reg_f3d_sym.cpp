@@ -25,6 +25,7 @@ reg_f3d_sym<T>::reg_f3d_sym(int refTimePoint,int floTimePoint)
    this->backwardControlPointGrid=NULL;
    this->backwardWarped=NULL;
    this->backwardWarpedGradientImage=NULL;
+   this->backwardWarpedGradientUpToDate=false;
    this->backwardDeformationFieldImage=NULL;
    this->backwardVoxelBasedMeasureGradientImage=NULL;
    this->backwardTransformationGradient=NULL;
@@ -602,13 +603,33 @@ void reg_f3d_sym<T>::GetDeformationField()
 /* *************************************************************** */
 /* *************************************************************** */
 template <class T>
-void reg_f3d_sym<T>::WarpFloatingImage(int inter)
+void reg_f3d_sym<T>::WarpFloatingImage(int inter, bool gradientRequired)
 {
+   this->warImgGradientUpToDate=false;
+   this->backwardWarpedGradientUpToDate=false;
+
    // Compute the deformation fields
    this->GetDeformationField();
 
+   // The warped images and their gradients are computed in a single pass when possible
+   bool fusedGradient = this->measure_dti==NULL && gradientRequired &&
+         this->warImgGradient!=NULL && this->backwardWarpedGradientImage!=NULL &&
+         inter==this->interpolation && (inter==1 || inter==3) &&
+         this->currentFloating->nt==1 && this->currentReference->nt==1;
+
    // Resample the floating image
-   if(this->measure_dti==NULL)
+   if(fusedGradient)
+   {
+      reg_resampleImageAndGradient(this->currentFloating,
+                                   this->warped,
+                                   this->warImgGradient,
+                                   this->deformationFieldImage,
+                                   this->currentMask,
+                                   inter,
+                                   this->warpedPaddingValue);
+      this->warImgGradientUpToDate=true;
+   }
+   else if(this->measure_dti==NULL)
    {
       reg_resampleImage(this->currentFloating,
                         this->warped,
@@ -633,7 +654,18 @@ void reg_f3d_sym<T>::WarpFloatingImage(int inter)
    }
 
    // Resample the reference image
-   if(this->measure_dti==NULL)
+   if(fusedGradient)
+   {
+      reg_resampleImageAndGradient(this->currentReference,
+                                   this->backwardWarped,
+                                   this->backwardWarpedGradientImage,
+                                   this->backwardDeformationFieldImage,
+                                   this->currentFloatingMask,
+                                   inter,
+                                   this->warpedPaddingValue);
+      this->backwardWarpedGradientUpToDate=true;
+   }
+   else if(this->measure_dti==NULL)
    {
       reg_resampleImage(this->currentReference, // input image
                         this->backwardWarped, // warped input image
@@ -746,7 +778,10 @@ double reg_f3d_sym<T>::ComputeBendingEnergyPenaltyTerm()
 
    double forwardPenaltyTerm=reg_f3d<T>::ComputeBendingEnergyPenaltyTerm();
 
-   double value = reg_spline_approxBendingEnergy(this->backwardControlPointGrid);
+   // No gradient is computed here, see reg_f3d<T>
+   double value = reg_spline_approxBendingEnergyStencil(this->backwardControlPointGrid,
+                                                        NULL,
+                                                        1.f);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::ComputeBendingEnergyPenaltyTerm");
 #endif
@@ -828,21 +863,26 @@ void reg_f3d_sym<T>::GetVoxelBasedGradient()
 
 
    for(int t=0; t<this->currentReference->nt; ++t){
-      reg_getImageGradient(this->currentFloating,
-                           this->warImgGradient,
-                           this->deformationFieldImage,
-                           this->currentMask,
-                           this->interpolation,
-                           this->warpedPaddingValue,
-                           t);
-
-      reg_getImageGradient(this->currentReference,
-                           this->backwardWarpedGradientImage,
-                           this->backwardDeformationFieldImage,
-                           this->currentFloatingMask,
-                           this->interpolation,
-                           this->warpedPaddingValue,
-                           t);
+      // The gradients might already have been computed when warping the images
+      if(t>0 || !this->warImgGradientUpToDate)
+         reg_getImageGradient(this->currentFloating,
+                              this->warImgGradient,
+                              this->deformationFieldImage,
+                              this->currentMask,
+                              this->interpolation,
+                              this->warpedPaddingValue,
+                              t);
+
+      if(t>0 || !this->backwardWarpedGradientUpToDate)
+         reg_getImageGradient(this->currentReference,
+                              this->backwardWarpedGradientImage,
+                              this->backwardDeformationFieldImage,
+                              this->currentFloatingMask,
+                              this->interpolation,
+                              this->warpedPaddingValue,
+                              t);
+      this->warImgGradientUpToDate=false;
+      this->backwardWarpedGradientUpToDate=false;
 
       // The gradient of the various measures of similarity are computed
       if(this->measure_nmi!=NULL)
@@ -956,9 +996,12 @@ void reg_f3d_sym<T>::GetBendingEnergyGradient()
    if(this->bendingEnergyWeight<=0) return;
 
    reg_f3d<T>::GetBendingEnergyGradient();
-   reg_spline_approxBendingEnergyGradient(this->backwardControlPointGrid,
-                                          this->backwardTransformationGradient,
-                                          this->bendingEnergyWeight);
+   // Only the gradient is required, the value is computed by
+   // ComputeBendingEnergyPenaltyTerm
+   reg_spline_approxBendingEnergyStencil(this->backwardControlPointGrid,
+                                         this->backwardTransformationGradient,
+                                         this->bendingEnergyWeight,
+                                         false);
 #ifndef NDEBUG
    reg_print_fct_debug("reg_f3d_sym<T>::GetBendingEnergyGradient");
 #endif
@@ -1608,7 +1651,7 @@ double reg_f3d_sym<T>::GetObjectiveFunctionValue()
    this->currentWMeasure = 0.0;
    if(this->similarityWeight>0)
    {
-      this->WarpFloatingImage(this->interpolation);
+      this->WarpFloatingImage(this->interpolation, false);
       this->currentWMeasure = this->ComputeSimilarityMeasure();
    }
 
@@ -1776,7 +1819,7 @@ nifti_image **reg_f3d_sym<T>::GetWarpedImage()
    reg_f3d_sym<T>::AllocateWarped();
    reg_f3d_sym<T>::AllocateDeformationField();
 
-   reg_f3d_sym<T>::WarpFloatingImage(3); // cubic spline interpolation
+   reg_f3d_sym<T>::WarpFloatingImage(3, false); // cubic spline interpolation
 
    reg_f3d_sym<T>::ClearDeformationField();
 
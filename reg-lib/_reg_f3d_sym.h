@@ -31,6 +31,7 @@ protected:
    nifti_image *backwardDeformationFieldImage;
    nifti_image *backwardWarped;
    nifti_image *backwardWarpedGradientImage;
+   bool backwardWarpedGradientUpToDate;
    nifti_image *backwardVoxelBasedMeasureGradientImage;
    nifti_image *backwardTransformationGradient;
 
@@ -62,7 +63,7 @@ protected:
    virtual double ComputeJacobianBasedPenaltyTerm(int);
    virtual double ComputeLandmarkDistancePenaltyTerm();
    virtual void GetDeformationField();
-   virtual void WarpFloatingImage(int);
+   virtual void WarpFloatingImage(int, bool gradientRequired=true);
    virtual void GetVoxelBasedGradient();
    virtual void GetSimilarityMeasureGradient();
    virtual void GetObjectiveFunctionGradient();
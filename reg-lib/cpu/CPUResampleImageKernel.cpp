@@ -6,6 +6,7 @@ CPUResampleImageKernel::CPUResampleImageKernel(AladinContent *con, std::string n
    warpedImage = con->getCurrentWarped();
    deformationField = con->getCurrentDeformationField();
    mask = con->getCurrentReferenceMask();
+   transformationMatrix = con->getTransformationMatrix();
 }
 
 void CPUResampleImageKernel::calculate(int interp,
@@ -13,6 +14,17 @@ void CPUResampleImageKernel::calculate(int interp,
                                        bool *dti_timepoint,
                                        mat33 * jacMat)
 {
+   // The affine resampler does not require the deformation field
+   if(dti_timepoint==NULL && this->transformationMatrix!=NULL)
+   {
+      reg_resampleImage_affine(this->floatingImage,
+                               this->warpedImage,
+                               this->transformationMatrix,
+                               this->mask,
+                               interp,
+                               paddingValue);
+      return;
+   }
    reg_resampleImage(this->floatingImage,
                      this->warpedImage,
                      this->deformationField,
@@ -13,6 +13,7 @@ class CPUResampleImageKernel : public ResampleImageKernel
         nifti_image *warpedImage;
         nifti_image *deformationField;
         int *mask;
+        mat44 *transformationMatrix;
 
         void calculate(int interp, float paddingValue, bool *dti_timepoint = NULL, mat33 * jacMat = NULL);
 };
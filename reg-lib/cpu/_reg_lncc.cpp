@@ -20,18 +20,25 @@ reg_lncc::reg_lncc()
    : reg_measure()
 {
    this->forwardCorrelationImage=NULL;
-   this->referenceMeanImage=NULL;
-   this->referenceSdevImage=NULL;
    this->warpedFloatingMeanImage=NULL;
    this->warpedFloatingSdevImage=NULL;
    this->forwardMask = NULL;
+   this->forwardCachedMask = NULL;
 
    this->backwardCorrelationImage=NULL;
-   this->floatingMeanImage=NULL;
-   this->floatingSdevImage=NULL;
    this->warpedReferenceMeanImage=NULL;
    this->warpedReferenceSdevImage=NULL;
    this->backwardMask = NULL;
+   this->backwardCachedMask = NULL;
+
+   for(int i=0; i<255; ++i)
+   {
+      this->referenceMeanImage[i]=NULL;
+      this->referenceSdevImage[i]=NULL;
+      this->floatingMeanImage[i]=NULL;
+      this->floatingSdevImage[i]=NULL;
+   }
+   this->ClearCachedStatistics();
 
    // Gaussian kernel is used by default
    this->kernelType=GAUSSIAN_KERNEL;
@@ -49,12 +56,6 @@ reg_lncc::~reg_lncc()
    if(this->forwardCorrelationImage!=NULL)
       nifti_image_free(this->forwardCorrelationImage);
    this->forwardCorrelationImage=NULL;
-   if(this->referenceMeanImage!=NULL)
-      nifti_image_free(this->referenceMeanImage);
-   this->referenceMeanImage=NULL;
-   if(this->referenceSdevImage!=NULL)
-      nifti_image_free(this->referenceSdevImage);
-   this->referenceSdevImage=NULL;
    if(this->warpedFloatingMeanImage!=NULL)
       nifti_image_free(this->warpedFloatingMeanImage);
    this->warpedFloatingMeanImage=NULL;
@@ -64,16 +65,13 @@ reg_lncc::~reg_lncc()
    if(this->forwardMask!=NULL)
       free(this->forwardMask);
    this->forwardMask=NULL;
+   if(this->forwardCachedMask!=NULL)
+      free(this->forwardCachedMask);
+   this->forwardCachedMask=NULL;
 
    if(this->backwardCorrelationImage!=NULL)
       nifti_image_free(this->backwardCorrelationImage);
    this->backwardCorrelationImage=NULL;
-   if(this->floatingMeanImage!=NULL)
-      nifti_image_free(this->floatingMeanImage);
-   this->floatingMeanImage=NULL;
-   if(this->floatingSdevImage!=NULL)
-      nifti_image_free(this->floatingSdevImage);
-   this->floatingSdevImage=NULL;
    if(this->warpedReferenceMeanImage!=NULL)
       nifti_image_free(this->warpedReferenceMeanImage);
    this->warpedReferenceMeanImage=NULL;
@@ -83,6 +81,24 @@ reg_lncc::~reg_lncc()
    if(this->backwardMask!=NULL)
       free(this->backwardMask);
    this->backwardMask=NULL;
+   if(this->backwardCachedMask!=NULL)
+      free(this->backwardCachedMask);
+   this->backwardCachedMask=NULL;
+   for(int i=0; i<255; ++i)
+   {
+      if(this->referenceMeanImage[i]!=NULL)
+         nifti_image_free(this->referenceMeanImage[i]);
+      this->referenceMeanImage[i]=NULL;
+      if(this->referenceSdevImage[i]!=NULL)
+         nifti_image_free(this->referenceSdevImage[i]);
+      this->referenceSdevImage[i]=NULL;
+      if(this->floatingMeanImage[i]!=NULL)
+         nifti_image_free(this->floatingMeanImage[i]);
+      this->floatingMeanImage[i]=NULL;
+      if(this->floatingSdevImage[i]!=NULL)
+         nifti_image_free(this->floatingSdevImage[i]);
+      this->floatingSdevImage[i]=NULL;
+   }
 }
 /* *************************************************************** */
 /* *************************************************************** */
@@ -95,6 +111,8 @@ void reg_lncc::UpdateLocalStatImages(nifti_image *refImage,
                                      nifti_image *stdDevWarImage,
                                      int *refMask,
                                      int *combinedMask,
+                                     int *cachedMask,
+                                     bool *cachedTimepoint,
                                      int current_timepoint)
 {
    // Generate the foward mask to ignore all NaN values
@@ -109,19 +127,46 @@ void reg_lncc::UpdateLocalStatImages(nifti_image *refImage,
    reg_tools_removeNanFromMask(refImage, combinedMask);
    reg_tools_removeNanFromMask(warImage, combinedMask);
 
-   DTYPE *origRefPtr = static_cast<DTYPE *>(refImage->data);
+   // The reference image is constant within a level but the combined mask
+   // also depends on the warped image. The cached local statistics are only
+   // reused while the combined mask is unchanged
+   if(memcmp(combinedMask, cachedMask, voxelNumber*sizeof(int))!=0)
+   {
+      memcpy(cachedMask, combinedMask, voxelNumber*sizeof(int));
+      for(int i=0; i<255; ++i)
+         cachedTimepoint[i] = false;
+   }
+
    DTYPE *meanRefPtr = static_cast<DTYPE *>(meanRefImage->data);
    DTYPE *sdevRefPtr = static_cast<DTYPE *>(stdDevRefImage->data);
-   memcpy(meanRefPtr, &origRefPtr[current_timepoint*voxelNumber],
-         voxelNumber*refImage->nbyper);
-   memcpy(sdevRefPtr, &origRefPtr[current_timepoint*voxelNumber],
-         voxelNumber*refImage->nbyper);
 
-   reg_tools_multiplyImageToImage(stdDevRefImage, stdDevRefImage, stdDevRefImage);
-   reg_tools_kernelConvolution(meanRefImage, this->kernelStandardDeviation,
-                               this->kernelType, combinedMask);
-   reg_tools_kernelConvolution(stdDevRefImage, this->kernelStandardDeviation,
-                               this->kernelType, combinedMask);
+   if(!cachedTimepoint[current_timepoint])
+   {
+      DTYPE *origRefPtr = static_cast<DTYPE *>(refImage->data);
+      memcpy(meanRefPtr, &origRefPtr[current_timepoint*voxelNumber],
+            voxelNumber*refImage->nbyper);
+      memcpy(sdevRefPtr, &origRefPtr[current_timepoint*voxelNumber],
+            voxelNumber*refImage->nbyper);
+
+      reg_tools_multiplyImageToImage(stdDevRefImage, stdDevRefImage, stdDevRefImage);
+      reg_tools_kernelConvolution(meanRefImage, this->kernelStandardDeviation,
+                                  this->kernelType, combinedMask);
+      reg_tools_kernelConvolution(stdDevRefImage, this->kernelStandardDeviation,
+                                  this->kernelType, combinedMask);
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(voxelNumber, sdevRefPtr, meanRefPtr) \
+   private(voxel)
+#endif
+      for(voxel=0; voxel<voxelNumber; ++voxel)
+      {
+         // G*(I^2) - (G*I)^2
+         sdevRefPtr[voxel] = sqrt(sdevRefPtr[voxel] - reg_pow2(meanRefPtr[voxel]));
+         // Stabilise the computation
+         if(sdevRefPtr[voxel]<1.e-06) sdevRefPtr[voxel]=static_cast<DTYPE>(0);
+      }
+      cachedTimepoint[current_timepoint] = true;
+   }
 
    DTYPE *origWarPtr = static_cast<DTYPE *>(warImage->data);
    DTYPE *meanWarPtr = static_cast<DTYPE *>(meanWarImage->data);
@@ -138,16 +183,14 @@ void reg_lncc::UpdateLocalStatImages(nifti_image *refImage,
                                this->kernelType, combinedMask);
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-   shared(voxelNumber, sdevRefPtr, meanRefPtr, sdevWarPtr, meanWarPtr) \
+   shared(voxelNumber, sdevWarPtr, meanWarPtr) \
    private(voxel)
 #endif
    for(voxel=0; voxel<voxelNumber; ++voxel)
    {
       // G*(I^2) - (G*I)^2
-      sdevRefPtr[voxel] = sqrt(sdevRefPtr[voxel] - reg_pow2(meanRefPtr[voxel]));
       sdevWarPtr[voxel] = sqrt(sdevWarPtr[voxel] - reg_pow2(meanWarPtr[voxel]));
       // Stabilise the computation
-      if(sdevRefPtr[voxel]<1.e-06) sdevRefPtr[voxel]=static_cast<DTYPE>(0);
       if(sdevWarPtr[voxel]<1.e-06) sdevWarPtr[voxel]=static_cast<DTYPE>(0);
    }
 }
@@ -196,12 +239,6 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
    if(this->forwardCorrelationImage!=NULL)
       nifti_image_free(this->forwardCorrelationImage);
    this->forwardCorrelationImage=NULL;
-   if(this->referenceMeanImage!=NULL)
-      nifti_image_free(this->referenceMeanImage);
-   this->referenceMeanImage=NULL;
-   if(this->referenceSdevImage!=NULL)
-      nifti_image_free(this->referenceSdevImage);
-   this->referenceSdevImage=NULL;
    if(this->warpedFloatingMeanImage!=NULL)
       nifti_image_free(this->warpedFloatingMeanImage);
    this->warpedFloatingMeanImage=NULL;
@@ -211,12 +248,6 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
    if(this->backwardCorrelationImage!=NULL)
       nifti_image_free(this->backwardCorrelationImage);
    this->backwardCorrelationImage=NULL;
-   if(this->floatingMeanImage!=NULL)
-      nifti_image_free(this->floatingMeanImage);
-   this->floatingMeanImage=NULL;
-   if(this->floatingSdevImage!=NULL)
-      nifti_image_free(this->floatingSdevImage);
-   this->floatingSdevImage=NULL;
    if(this->warpedReferenceMeanImage!=NULL)
       nifti_image_free(this->warpedReferenceMeanImage);
    this->warpedReferenceMeanImage=NULL;
@@ -226,9 +257,31 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
    if(this->forwardMask!=NULL)
       free(this->forwardMask);
    this->forwardMask=NULL;
+   if(this->forwardCachedMask!=NULL)
+      free(this->forwardCachedMask);
+   this->forwardCachedMask=NULL;
    if(this->backwardMask!=NULL)
       free(this->backwardMask);
    this->backwardMask=NULL;
+   if(this->backwardCachedMask!=NULL)
+      free(this->backwardCachedMask);
+   this->backwardCachedMask=NULL;
+
+   for(int i=0; i<255; ++i)
+   {
+      if(this->referenceMeanImage[i]!=NULL)
+         nifti_image_free(this->referenceMeanImage[i]);
+      this->referenceMeanImage[i]=NULL;
+      if(this->referenceSdevImage[i]!=NULL)
+         nifti_image_free(this->referenceSdevImage[i]);
+      this->referenceSdevImage[i]=NULL;
+      if(this->floatingMeanImage[i]!=NULL)
+         nifti_image_free(this->floatingMeanImage[i]);
+      this->floatingMeanImage[i]=NULL;
+      if(this->floatingSdevImage[i]!=NULL)
+         nifti_image_free(this->floatingSdevImage[i]);
+      this->floatingSdevImage[i]=NULL;
+   }
 
    //
    size_t voxelNumber = (size_t)this->referenceImagePointer->nx *
@@ -242,14 +295,20 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
    this->forwardCorrelationImage->data=(void *)malloc(voxelNumber *
                                                       this->forwardCorrelationImage->nbyper);
 
-   // Allocate the required images to store mean and stdev of the reference image
-   this->referenceMeanImage=nifti_copy_nim_info(this->forwardCorrelationImage);
-   this->referenceMeanImage->data=(void *)malloc(this->referenceMeanImage->nvox *
-                                                 this->referenceMeanImage->nbyper);
-
-   this->referenceSdevImage=nifti_copy_nim_info(this->forwardCorrelationImage);
-   this->referenceSdevImage->data=(void *)malloc(this->referenceSdevImage->nvox *
-                                                 this->referenceSdevImage->nbyper);
+   // Allocate the required images to store mean and stdev of every active
+   // time point of the reference image
+   for(int i=0; i<this->referenceImagePointer->nt; ++i)
+   {
+      if(this->timePointWeight[i]>0.0)
+      {
+         this->referenceMeanImage[i]=nifti_copy_nim_info(this->forwardCorrelationImage);
+         this->referenceMeanImage[i]->data=(void *)malloc(this->referenceMeanImage[i]->nvox *
+                                                          this->referenceMeanImage[i]->nbyper);
+         this->referenceSdevImage[i]=nifti_copy_nim_info(this->forwardCorrelationImage);
+         this->referenceSdevImage[i]->data=(void *)malloc(this->referenceSdevImage[i]->nvox *
+                                                          this->referenceSdevImage[i]->nbyper);
+      }
+   }
 
    // Allocate the required images to store mean and stdev of the warped floating image
    this->warpedFloatingMeanImage=nifti_copy_nim_info(this->forwardCorrelationImage);
@@ -262,6 +321,11 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
 
    // Allocate the array to store the mask of the forward image
    this->forwardMask=(int *)malloc(voxelNumber*sizeof(int));
+   // Allocate the array to store the mask used to compute the cached
+   // reference local statistics
+   this->forwardCachedMask=(int *)malloc(voxelNumber*sizeof(int));
+   // The reference local statistics are recomputed at least once per level
+   this->ClearCachedStatistics();
    if(this->isSymmetric)
    {
       voxelNumber = (size_t)floatingImagePointer->nx *
@@ -274,14 +338,20 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
       this->backwardCorrelationImage->data=(void *)malloc(voxelNumber *
                                                           this->backwardCorrelationImage->nbyper);
 
-      // Allocate the required images to store mean and stdev of the floating image
-      this->floatingMeanImage=nifti_copy_nim_info(this->backwardCorrelationImage);
-      this->floatingMeanImage->data=(void *)malloc(this->floatingMeanImage->nvox *
-                                                   this->floatingMeanImage->nbyper);
-
-      this->floatingSdevImage=nifti_copy_nim_info(this->backwardCorrelationImage);
-      this->floatingSdevImage->data=(void *)malloc(this->floatingSdevImage->nvox *
-                                                   this->floatingSdevImage->nbyper);
+      // Allocate the required images to store mean and stdev of every active
+      // time point of the floating image
+      for(int i=0; i<this->floatingImagePointer->nt; ++i)
+      {
+         if(this->timePointWeight[i]>0.0)
+         {
+            this->floatingMeanImage[i]=nifti_copy_nim_info(this->backwardCorrelationImage);
+            this->floatingMeanImage[i]->data=(void *)malloc(this->floatingMeanImage[i]->nvox *
+                                                            this->floatingMeanImage[i]->nbyper);
+            this->floatingSdevImage[i]=nifti_copy_nim_info(this->backwardCorrelationImage);
+            this->floatingSdevImage[i]->data=(void *)malloc(this->floatingSdevImage[i]->nvox *
+                                                            this->floatingSdevImage[i]->nbyper);
+         }
+      }
 
       // Allocate the required images to store mean and stdev of the warped reference image
       this->warpedReferenceMeanImage=nifti_copy_nim_info(this->backwardCorrelationImage);
@@ -294,6 +364,7 @@ void reg_lncc::InitialiseMeasure(nifti_image *refImgPtr,
 
       // Allocate the array to store the mask of the backward image
       this->backwardMask=(int *)malloc(voxelNumber*sizeof(int));
+      this->backwardCachedMask=(int *)malloc(voxelNumber*sizeof(int));
    }
 #ifndef NDEBUG
    char text[255];
@@ -397,23 +468,27 @@ double reg_lncc::GetSimilarityMeasureValue()
          case NIFTI_TYPE_FLOAT32:
             this->UpdateLocalStatImages<float>(this->referenceImagePointer,
                this->warpedFloatingImagePointer,
-               this->referenceMeanImage,
+               this->referenceMeanImage[current_timepoint],
                this->warpedFloatingMeanImage,
-               this->referenceSdevImage,
+               this->referenceSdevImage[current_timepoint],
                this->warpedFloatingSdevImage,
                this->referenceMaskPointer,
                this->forwardMask,
+               this->forwardCachedMask,
+               this->forwardCachedTimepoint,
                current_timepoint);
             break;
          case NIFTI_TYPE_FLOAT64:
             this->UpdateLocalStatImages<double>(this->referenceImagePointer,
                this->warpedFloatingImagePointer,
-               this->referenceMeanImage,
+               this->referenceMeanImage[current_timepoint],
                this->warpedFloatingMeanImage,
-               this->referenceSdevImage,
+               this->referenceSdevImage[current_timepoint],
                this->warpedFloatingSdevImage,
                this->referenceMaskPointer,
                this->forwardMask,
+               this->forwardCachedMask,
+               this->forwardCachedTimepoint,
                current_timepoint);
             break;
          }
@@ -423,8 +498,8 @@ double reg_lncc::GetSimilarityMeasureValue()
 			{
 			case NIFTI_TYPE_FLOAT32:
 				tp_value += reg_getLNCCValue<float>(this->referenceImagePointer,
-					this->referenceMeanImage,
-					this->referenceSdevImage,
+					this->referenceMeanImage[current_timepoint],
+					this->referenceSdevImage[current_timepoint],
 					this->warpedFloatingImagePointer,
 					this->warpedFloatingMeanImage,
 					this->warpedFloatingSdevImage,
@@ -436,8 +511,8 @@ double reg_lncc::GetSimilarityMeasureValue()
 				break;
 			case NIFTI_TYPE_FLOAT64:
 				tp_value += reg_getLNCCValue<double>(this->referenceImagePointer,
-					this->referenceMeanImage,
-					this->referenceSdevImage,
+					this->referenceMeanImage[current_timepoint],
+					this->referenceSdevImage[current_timepoint],
 					this->warpedFloatingImagePointer,
 					this->warpedFloatingMeanImage,
 					this->warpedFloatingSdevImage,
@@ -456,23 +531,27 @@ double reg_lncc::GetSimilarityMeasureValue()
 				case NIFTI_TYPE_FLOAT32:
 					this->UpdateLocalStatImages<float>(this->floatingImagePointer,
 						this->warpedReferenceImagePointer,
-						this->floatingMeanImage,
+						this->floatingMeanImage[current_timepoint],
 						this->warpedReferenceMeanImage,
-						this->floatingSdevImage,
+						this->floatingSdevImage[current_timepoint],
 						this->warpedReferenceSdevImage,
 						this->floatingMaskPointer,
 						this->backwardMask,
+						this->backwardCachedMask,
+						this->backwardCachedTimepoint,
 						current_timepoint);
 					break;
 				case NIFTI_TYPE_FLOAT64:
 					this->UpdateLocalStatImages<double>(this->floatingImagePointer,
 						this->warpedReferenceImagePointer,
-						this->floatingMeanImage,
+						this->floatingMeanImage[current_timepoint],
 						this->warpedReferenceMeanImage,
-						this->floatingSdevImage,
+						this->floatingSdevImage[current_timepoint],
 						this->warpedReferenceSdevImage,
 						this->floatingMaskPointer,
 						this->backwardMask,
+						this->backwardCachedMask,
+						this->backwardCachedTimepoint,
 						current_timepoint);
 					break;
 				}
@@ -481,8 +560,8 @@ double reg_lncc::GetSimilarityMeasureValue()
 				{
 				case NIFTI_TYPE_FLOAT32:
 					tp_value += reg_getLNCCValue<float>(this->floatingImagePointer,
-						this->floatingMeanImage,
-						this->floatingSdevImage,
+						this->floatingMeanImage[current_timepoint],
+						this->floatingSdevImage[current_timepoint],
 						this->warpedReferenceImagePointer,
 						this->warpedReferenceMeanImage,
 						this->warpedReferenceSdevImage,
@@ -494,8 +573,8 @@ double reg_lncc::GetSimilarityMeasureValue()
 					break;
 				case NIFTI_TYPE_FLOAT64:
 					tp_value += reg_getLNCCValue<double>(this->floatingImagePointer,
-						this->floatingMeanImage,
-						this->floatingSdevImage,
+						this->floatingMeanImage[current_timepoint],
+						this->floatingSdevImage[current_timepoint],
 						this->warpedReferenceImagePointer,
 						this->warpedReferenceMeanImage,
 						this->warpedReferenceSdevImage,
@@ -690,23 +769,27 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
    case NIFTI_TYPE_FLOAT32:
       this->UpdateLocalStatImages<float>(this->referenceImagePointer,
                                          this->warpedFloatingImagePointer,
-                                         this->referenceMeanImage,
+                                         this->referenceMeanImage[current_timepoint],
                                          this->warpedFloatingMeanImage,
-                                         this->referenceSdevImage,
+                                         this->referenceSdevImage[current_timepoint],
                                          this->warpedFloatingSdevImage,
                                          this->referenceMaskPointer,
                                          this->forwardMask,
+                                         this->forwardCachedMask,
+                                         this->forwardCachedTimepoint,
                                          current_timepoint);
       break;
    case NIFTI_TYPE_FLOAT64:
       this->UpdateLocalStatImages<double>(this->referenceImagePointer,
                                           this->warpedFloatingImagePointer,
-                                          this->referenceMeanImage,
+                                          this->referenceMeanImage[current_timepoint],
                                           this->warpedFloatingMeanImage,
-                                          this->referenceSdevImage,
+                                          this->referenceSdevImage[current_timepoint],
                                           this->warpedFloatingSdevImage,
                                           this->referenceMaskPointer,
                                           this->forwardMask,
+                                          this->forwardCachedMask,
+                                          this->forwardCachedTimepoint,
                                           current_timepoint);
       break;
    }
@@ -716,8 +799,8 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
    {
    case NIFTI_TYPE_FLOAT32:
       reg_getVoxelBasedLNCCGradient<float>(this->referenceImagePointer,
-                                           this->referenceMeanImage,
-                                           this->referenceSdevImage,
+                                           this->referenceMeanImage[current_timepoint],
+                                           this->referenceSdevImage[current_timepoint],
                                            this->warpedFloatingImagePointer,
                                            this->warpedFloatingMeanImage,
                                            this->warpedFloatingSdevImage,
@@ -732,8 +815,8 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
       break;
    case NIFTI_TYPE_FLOAT64:
       reg_getVoxelBasedLNCCGradient<double>(this->referenceImagePointer,
-                                            this->referenceMeanImage,
-                                            this->referenceSdevImage,
+                                            this->referenceMeanImage[current_timepoint],
+                                            this->referenceSdevImage[current_timepoint],
                                             this->warpedFloatingImagePointer,
                                             this->warpedFloatingMeanImage,
                                             this->warpedFloatingSdevImage,
@@ -755,23 +838,27 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
       case NIFTI_TYPE_FLOAT32:
          this->UpdateLocalStatImages<float>(this->floatingImagePointer,
                                             this->warpedReferenceImagePointer,
-                                            this->floatingMeanImage,
+                                            this->floatingMeanImage[current_timepoint],
                                             this->warpedReferenceMeanImage,
-                                            this->floatingSdevImage,
+                                            this->floatingSdevImage[current_timepoint],
                                             this->warpedReferenceSdevImage,
                                             this->floatingMaskPointer,
                                             this->backwardMask,
+                                            this->backwardCachedMask,
+                                            this->backwardCachedTimepoint,
                                             current_timepoint);
          break;
       case NIFTI_TYPE_FLOAT64:
          this->UpdateLocalStatImages<double>(this->floatingImagePointer,
                                              this->warpedReferenceImagePointer,
-                                             this->floatingMeanImage,
+                                             this->floatingMeanImage[current_timepoint],
                                              this->warpedReferenceMeanImage,
-                                             this->floatingSdevImage,
+                                             this->floatingSdevImage[current_timepoint],
                                              this->warpedReferenceSdevImage,
                                              this->floatingMaskPointer,
                                              this->backwardMask,
+                                             this->backwardCachedMask,
+                                             this->backwardCachedTimepoint,
                                              current_timepoint);
          break;
       }
@@ -780,8 +867,8 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
       {
       case NIFTI_TYPE_FLOAT32:
          reg_getVoxelBasedLNCCGradient<float>(this->floatingImagePointer,
-                                              this->floatingMeanImage,
-                                              this->floatingSdevImage,
+                                              this->floatingMeanImage[current_timepoint],
+                                              this->floatingSdevImage[current_timepoint],
                                               this->warpedReferenceImagePointer,
                                               this->warpedReferenceMeanImage,
                                               this->warpedReferenceSdevImage,
@@ -796,8 +883,8 @@ void reg_lncc::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
          break;
       case NIFTI_TYPE_FLOAT64:
          reg_getVoxelBasedLNCCGradient<double>(this->floatingImagePointer,
-                                               this->floatingMeanImage,
-                                               this->floatingSdevImage,
+                                               this->floatingMeanImage[current_timepoint],
+                                               this->floatingSdevImage[current_timepoint],
                                                this->warpedReferenceImagePointer,
                                                this->warpedReferenceMeanImage,
                                                this->warpedReferenceSdevImage,
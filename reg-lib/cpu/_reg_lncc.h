@@ -43,27 +43,36 @@ public:
    void SetKernelStandardDeviation(int t, float stddev)
    {
       this->kernelStandardDeviation[t]=stddev;
+      this->ClearCachedStatistics();
    }
    /// @brief Stuff
    void SetKernelType(int t)
    {
       this->kernelType=t;
+      this->ClearCachedStatistics();
    }
 protected:
    float kernelStandardDeviation[255];
    nifti_image *forwardCorrelationImage;
-   nifti_image *referenceMeanImage;
-   nifti_image *referenceSdevImage;
+   /// Local mean and standard deviation of every time point of the reference image
+   nifti_image *referenceMeanImage[255];
+   nifti_image *referenceSdevImage[255];
    nifti_image *warpedFloatingMeanImage;
    nifti_image *warpedFloatingSdevImage;
    int *forwardMask;
+   /// Combined mask used to compute the cached reference local statistics
+   int *forwardCachedMask;
+   /// Flags the time points whose reference local statistics are up to date
+   bool forwardCachedTimepoint[255];
 
    nifti_image *backwardCorrelationImage;
-   nifti_image *floatingMeanImage;
-   nifti_image *floatingSdevImage;
+   nifti_image *floatingMeanImage[255];
+   nifti_image *floatingSdevImage[255];
    nifti_image *warpedReferenceMeanImage;
    nifti_image *warpedReferenceSdevImage;
    int *backwardMask;
+   int *backwardCachedMask;
+   bool backwardCachedTimepoint[255];
 
    int kernelType;
 
@@ -76,7 +85,15 @@ protected:
                               nifti_image *stdDevWarImage,
                               int *refMask,
                               int *mask,
+                              int *cachedMask,
+                              bool *cachedTimepoint,
                               int current_timepoint);
+   /// @brief Flags the local statistics of all time points as out of date
+   void ClearCachedStatistics()
+   {
+      for(int i=0; i<255; ++i)
+         this->forwardCachedTimepoint[i]=this->backwardCachedTimepoint[i]=false;
+   }
 };
 /* *************************************************************** */
 /* *************************************************************** */
@@ -12,6 +12,16 @@
 #include <cmath>
 #include "_reg_localTrans.h"
 #include "_reg_maths_eigen.h"
+#include "_reg_resampling.h"
+
+// Number of voxels evaluated at once by reg_spline_getWarpedImage
+#define SPLINE_WARP_SLAB_VOXEL_NUMBER 262144
+// Maximal number of deformation fields squared within a single parallel loop
+#define SQUARING_MAX_FIELD_NUMBER 2
+// Size of the voxel tiles processed by reg_defField_composeChain
+#define COMPOSE_TILE_SIZE 16
+// Minimal dimension of the coarsest level used by reg_defFieldInvertMultigrid
+#define INVERT_MULTIGRID_MIN_SIZE 16
 
 /* *************************************************************** */
 /* *************************************************************** */
@@ -919,6 +929,435 @@ void reg_cubic_spline_getDeformationField2D(nifti_image *splineControlPoint,
    return;
 }
 /* *************************************************************** */
+/** Fills the per-axis lookup tables used by the tile kernels: for every
+ * voxel along the axis, the index of its first control point and its four
+ * basis values, stored as basis[a*voxelNumber+voxel].
+ */
+template<class DTYPE>
+static void reg_getSplineBasisAxisLUT(int voxelNumber,
+                                      DTYPE gridVoxelSpacing,
+                                      bool bspline,
+                                      int *pre,
+                                      DTYPE *basis)
+{
+   DTYPE temp[4], relative;
+   for(int i=0; i<voxelNumber; ++i)
+   {
+      pre[i]=static_cast<int>(static_cast<DTYPE>(i)/gridVoxelSpacing);
+      relative=static_cast<DTYPE>(i)/gridVoxelSpacing-static_cast<DTYPE>(pre[i]);
+      if(relative<0) relative=0; //rounding error
+      if(bspline) get_BSplineBasisValues<DTYPE>(relative, temp);
+      else get_SplineBasisValues<DTYPE>(relative, temp);
+      for(int a=0; a<4; ++a)
+         basis[a*voxelNumber+i]=temp[a];
+   }
+}
+/* *************************************************************** */
+/** Evaluates one row of the deformation field along the x-axis. The 4x4
+ * control points along y and z are first collapsed into a single row of
+ * control points using the yz basis values, so that every voxel only
+ * requires four products per axis.
+ */
+template<class DTYPE>
+static void reg_cubic_spline_getDeformationFieldRow(DTYPE *controlPointPtr,
+                                                    size_t controlPointNumber,
+                                                    int *controlPointDim,
+                                                    int yPre,
+                                                    int zPre,
+                                                    DTYPE *yzBasis,
+                                                    int rowLength,
+                                                    int *xPre,
+                                                    DTYPE *xBasis,
+                                                    DTYPE *collapsed,
+                                                    int *maskPtr,
+                                                    DTYPE *fieldPtr,
+                                                    size_t fieldVoxelNumber,
+                                                    bool resetMaskedVoxels)
+{
+   const int cpNx=controlPointDim[0];
+   const int collapsedLength=xPre[rowLength-1]+4;
+   int i, x, a, b, c, n;
+   for(n=0; n<3; ++n)
+   {
+      DTYPE *cpPtr=&controlPointPtr[n*controlPointNumber];
+      DTYPE *colPtr=&collapsed[n*cpNx];
+      for(i=0; i<collapsedLength; ++i)
+         colPtr[i]=0;
+      for(c=0; c<4; ++c)
+      {
+         for(b=0; b<4; ++b)
+         {
+            DTYPE *rowPtr=&cpPtr[((size_t)(zPre+c)*controlPointDim[1]+yPre+b)*cpNx];
+            for(i=0; i<collapsedLength; ++i)
+               colPtr[i]+=yzBasis[c*4+b]*rowPtr[i];
+         }
+      }
+   }
+   for(x=0; x<rowLength; ++x)
+   {
+      for(n=0; n<3; ++n)
+      {
+         if(maskPtr[x]>-1)
+         {
+            DTYPE *colPtr=&collapsed[n*cpNx+xPre[x]];
+            DTYPE sum=0;
+            for(a=0; a<4; ++a)
+               sum+=xBasis[a*rowLength+x]*colPtr[a];
+            fieldPtr[n*fieldVoxelNumber+x]=sum;
+         }
+         else if(resetMaskedVoxels)
+            fieldPtr[n*fieldVoxelNumber+x]=0;
+      }
+   }
+}
+/* *************************************************************** */
+#ifdef _USE_RUNTIME_AVX
+/** AVX2 version of reg_cubic_spline_getDeformationFieldRow that evaluates
+ * eight voxels at once.
+ */
+NR_TARGET_AVX2
+static void reg_cubic_spline_getDeformationFieldRow_avx2(float *controlPointPtr,
+                                                         size_t controlPointNumber,
+                                                         int *controlPointDim,
+                                                         int yPre,
+                                                         int zPre,
+                                                         float *yzBasis,
+                                                         int rowLength,
+                                                         int *xPre,
+                                                         float *xBasis,
+                                                         float *collapsed,
+                                                         int *maskPtr,
+                                                         float *fieldPtr,
+                                                         size_t fieldVoxelNumber,
+                                                         bool resetMaskedVoxels)
+{
+   const int cpNx=controlPointDim[0];
+   const int collapsedLength=xPre[rowLength-1]+4;
+   int i, x, a, b, c, n;
+   // Collapse the control points along the y and z axes
+   for(n=0; n<3; ++n)
+   {
+      float *cpPtr=&controlPointPtr[n*controlPointNumber];
+      float *colPtr=&collapsed[n*cpNx];
+      for(i=0; i+8<=collapsedLength; i+=8)
+      {
+         __m256 sum=_mm256_setzero_ps();
+         for(c=0; c<4; ++c)
+         {
+            for(b=0; b<4; ++b)
+            {
+               float *rowPtr=&cpPtr[((size_t)(zPre+c)*controlPointDim[1]+yPre+b)*cpNx];
+               sum=_mm256_fmadd_ps(_mm256_set1_ps(yzBasis[c*4+b]),
+                                   _mm256_loadu_ps(&rowPtr[i]),
+                                   sum);
+            }
+         }
+         _mm256_storeu_ps(&colPtr[i], sum);
+      }
+      for(; i<collapsedLength; ++i)
+      {
+         float sum=0.f;
+         for(c=0; c<4; ++c)
+            for(b=0; b<4; ++b)
+               sum+=yzBasis[c*4+b]*cpPtr[((size_t)(zPre+c)*controlPointDim[1]+yPre+b)*cpNx+i];
+         colPtr[i]=sum;
+      }
+   }
+   // Evaluate the row eight voxels at a time
+   const __m256i minusOne=_mm256_set1_epi32(-1);
+   for(x=0; x+8<=rowLength; x+=8)
+   {
+      __m256i index=_mm256_loadu_si256((__m256i *)&xPre[x]);
+      __m256i active=_mm256_cmpgt_epi32(_mm256_loadu_si256((__m256i *)&maskPtr[x]), minusOne);
+      __m256 basis[4];
+      for(a=0; a<4; ++a)
+         basis[a]=_mm256_loadu_ps(&xBasis[a*rowLength+x]);
+      for(n=0; n<3; ++n)
+      {
+         float *colPtr=&collapsed[n*cpNx];
+         __m256 sum=_mm256_setzero_ps();
+         for(a=0; a<4; ++a)
+         {
+            __m256i shiftedIndex=_mm256_add_epi32(index, _mm256_set1_epi32(a));
+            sum=_mm256_fmadd_ps(basis[a],
+                                _mm256_i32gather_ps(colPtr, shiftedIndex, 4),
+                                sum);
+         }
+         if(resetMaskedVoxels)
+            _mm256_storeu_ps(&fieldPtr[n*fieldVoxelNumber+x],
+                             _mm256_and_ps(sum, _mm256_castsi256_ps(active)));
+         else _mm256_maskstore_ps(&fieldPtr[n*fieldVoxelNumber+x], active, sum);
+      }
+   }
+   for(; x<rowLength; ++x)
+   {
+      for(n=0; n<3; ++n)
+      {
+         if(maskPtr[x]>-1)
+         {
+            float *colPtr=&collapsed[n*cpNx+xPre[x]];
+            float sum=0.f;
+            for(a=0; a<4; ++a)
+               sum+=xBasis[a*rowLength+x]*colPtr[a];
+            fieldPtr[n*fieldVoxelNumber+x]=sum;
+         }
+         else if(resetMaskedVoxels)
+            fieldPtr[n*fieldVoxelNumber+x]=0.f;
+      }
+   }
+}
+/* *************************************************************** */
+/** AVX-512 version of reg_cubic_spline_getDeformationFieldRow that
+ * evaluates sixteen voxels at once.
+ */
+NR_TARGET_AVX512
+static void reg_cubic_spline_getDeformationFieldRow_avx512(float *controlPointPtr,
+                                                           size_t controlPointNumber,
+                                                           int *controlPointDim,
+                                                           int yPre,
+                                                           int zPre,
+                                                           float *yzBasis,
+                                                           int rowLength,
+                                                           int *xPre,
+                                                           float *xBasis,
+                                                           float *collapsed,
+                                                           int *maskPtr,
+                                                           float *fieldPtr,
+                                                           size_t fieldVoxelNumber,
+                                                           bool resetMaskedVoxels)
+{
+   const int cpNx=controlPointDim[0];
+   const int collapsedLength=xPre[rowLength-1]+4;
+   int i, x, a, b, c, n;
+   // Collapse the control points along the y and z axes
+   for(n=0; n<3; ++n)
+   {
+      float *cpPtr=&controlPointPtr[n*controlPointNumber];
+      float *colPtr=&collapsed[n*cpNx];
+      for(i=0; i+16<=collapsedLength; i+=16)
+      {
+         __m512 sum=_mm512_setzero_ps();
+         for(c=0; c<4; ++c)
+         {
+            for(b=0; b<4; ++b)
+            {
+               float *rowPtr=&cpPtr[((size_t)(zPre+c)*controlPointDim[1]+yPre+b)*cpNx];
+               sum=_mm512_fmadd_ps(_mm512_set1_ps(yzBasis[c*4+b]),
+                                   _mm512_loadu_ps(&rowPtr[i]),
+                                   sum);
+            }
+         }
+         _mm512_storeu_ps(&colPtr[i], sum);
+      }
+      for(; i<collapsedLength; ++i)
+      {
+         float sum=0.f;
+         for(c=0; c<4; ++c)
+            for(b=0; b<4; ++b)
+               sum+=yzBasis[c*4+b]*cpPtr[((size_t)(zPre+c)*controlPointDim[1]+yPre+b)*cpNx+i];
+         colPtr[i]=sum;
+      }
+   }
+   // Evaluate the row sixteen voxels at a time
+   const __m512i minusOne=_mm512_set1_epi32(-1);
+   for(x=0; x+16<=rowLength; x+=16)
+   {
+      __m512i index=_mm512_loadu_si512((void *)&xPre[x]);
+      __mmask16 active=_mm512_cmpgt_epi32_mask(_mm512_loadu_si512((void *)&maskPtr[x]), minusOne);
+      __m512 basis[4];
+      for(a=0; a<4; ++a)
+         basis[a]=_mm512_loadu_ps(&xBasis[a*rowLength+x]);
+      for(n=0; n<3; ++n)
+      {
+         float *colPtr=&collapsed[n*cpNx];
+         __m512 sum=_mm512_setzero_ps();
+         for(a=0; a<4; ++a)
+         {
+            __m512i shiftedIndex=_mm512_add_epi32(index, _mm512_set1_epi32(a));
+            sum=_mm512_fmadd_ps(basis[a],
+                                _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, shiftedIndex, colPtr, 4),
+                                sum);
+         }
+         if(resetMaskedVoxels)
+            _mm512_storeu_ps(&fieldPtr[n*fieldVoxelNumber+x],
+                             _mm512_maskz_mov_ps(active, sum));
+         else _mm512_mask_storeu_ps(&fieldPtr[n*fieldVoxelNumber+x], active, sum);
+      }
+   }
+   for(; x<rowLength; ++x)
+   {
+      for(n=0; n<3; ++n)
+      {
+         if(maskPtr[x]>-1)
+         {
+            float *colPtr=&collapsed[n*cpNx+xPre[x]];
+            float sum=0.f;
+            for(a=0; a<4; ++a)
+               sum+=xBasis[a*rowLength+x]*colPtr[a];
+            fieldPtr[n*fieldVoxelNumber+x]=sum;
+         }
+         else if(resetMaskedVoxels)
+            fieldPtr[n*fieldVoxelNumber+x]=0.f;
+      }
+   }
+}
+/* *************************************************************** */
+#endif // _USE_RUNTIME_AVX
+/* *************************************************************** */
+/** Tile-based evaluation of a cubic B-spline parametrised deformation
+ * field for any grid to voxel spacing ratio, restricted to the slices
+ * [firstSlice, lastSlice[. The basis values are tabulated once per axis and
+ * every row of voxels is evaluated by the AVX2, AVX-512 or scalar kernel.
+ * The field array only contains the slab and its components are
+ * fieldVoxelNumber values apart while the mask covers the image from the
+ * slice maskFirstSlice. Masked voxels are set to zero when resetMaskedVoxels
+ * is true and are left untouched otherwise.
+ */
+template<class DTYPE>
+static void reg_cubic_spline_getDeformationFieldSlab3D(nifti_image *splineControlPoint,
+                                                       int *fieldDim,
+                                                       float *gridVoxelSpacing,
+                                                       DTYPE *fieldPtr,
+                                                       size_t fieldVoxelNumber,
+                                                       int firstSlice,
+                                                       int lastSlice,
+                                                       int *mask,
+                                                       bool bspline,
+                                                       bool resetMaskedVoxels,
+                                                       NREG_SIMD_TYPE simd,
+                                                       int maskFirstSlice=0)
+{
+   // The vectorised kernels are only available in single precision
+   if(sizeof(DTYPE)!=sizeof(float))
+      simd=NO_SIMD;
+   int *controlPointDim=&splineControlPoint->dim[1];
+   size_t controlPointNumber=(size_t)splineControlPoint->nx*splineControlPoint->ny*splineControlPoint->nz;
+   DTYPE *controlPointPtr=static_cast<DTYPE *>(splineControlPoint->data);
+
+   // Tabulate the basis values along every axis
+   int *xPre=(int *)malloc(fieldDim[0]*sizeof(int));
+   int *yPre=(int *)malloc(fieldDim[1]*sizeof(int));
+   int *zPre=(int *)malloc(fieldDim[2]*sizeof(int));
+   DTYPE *xBasis=(DTYPE *)malloc(4*fieldDim[0]*sizeof(DTYPE));
+   DTYPE *yBasis=(DTYPE *)malloc(4*fieldDim[1]*sizeof(DTYPE));
+   DTYPE *zBasis=(DTYPE *)malloc(4*fieldDim[2]*sizeof(DTYPE));
+   reg_getSplineBasisAxisLUT<DTYPE>(fieldDim[0], gridVoxelSpacing[0], bspline, xPre, xBasis);
+   reg_getSplineBasisAxisLUT<DTYPE>(fieldDim[1], gridVoxelSpacing[1], bspline, yPre, yBasis);
+   reg_getSplineBasisAxisLUT<DTYPE>(fieldDim[2], gridVoxelSpacing[2], bspline, zPre, zBasis);
+
+   int rowNumber=(lastSlice-firstSlice)*fieldDim[1];
+   int row;
+#if defined (_OPENMP)
+#pragma omp parallel default(none) \
+   shared(fieldDim, controlPointDim, controlPointNumber, fieldVoxelNumber, \
+   controlPointPtr, fieldPtr, xPre, yPre, zPre, xBasis, yBasis, zBasis, mask, \
+   resetMaskedVoxels, simd, rowNumber, firstSlice, maskFirstSlice) \
+   private(row)
+#endif
+   {
+      DTYPE *collapsed=(DTYPE *)malloc(3*controlPointDim[0]*sizeof(DTYPE));
+      DTYPE yzBasis[16];
+      int x, y, z, b, c;
+      size_t maskIndex, fieldIndex;
+      bool activeRow;
+
+#if defined (_OPENMP)
+#pragma omp for
+#endif
+      for(row=0; row<rowNumber; ++row)
+      {
+         z=firstSlice+row/fieldDim[1];
+         y=row%fieldDim[1];
+         maskIndex=((size_t)(z-maskFirstSlice)*fieldDim[1]+y)*fieldDim[0];
+         fieldIndex=(size_t)row*fieldDim[0];
+         activeRow=false;
+         for(x=0; x<fieldDim[0]; ++x)
+         {
+            if(mask[maskIndex+x]>-1)
+            {
+               activeRow=true;
+               break;
+            }
+         }
+         if(activeRow==false)
+         {
+            if(resetMaskedVoxels)
+            {
+               for(x=0; x<fieldDim[0]; ++x)
+               {
+                  fieldPtr[fieldIndex+x]=0;
+                  fieldPtr[fieldVoxelNumber+fieldIndex+x]=0;
+                  fieldPtr[2*fieldVoxelNumber+fieldIndex+x]=0;
+               }
+            }
+            continue;
+         }
+         for(c=0; c<4; ++c)
+            for(b=0; b<4; ++b)
+               yzBasis[c*4+b]=yBasis[b*fieldDim[1]+y]*zBasis[c*fieldDim[2]+z];
+         switch(simd)
+         {
+#ifdef _USE_RUNTIME_AVX
+         case AVX512_SIMD:
+            reg_cubic_spline_getDeformationFieldRow_avx512(reinterpret_cast<float *>(controlPointPtr),
+                                                           controlPointNumber,
+                                                           controlPointDim,
+                                                           yPre[y],
+                                                           zPre[z],
+                                                           reinterpret_cast<float *>(yzBasis),
+                                                           fieldDim[0],
+                                                           xPre,
+                                                           reinterpret_cast<float *>(xBasis),
+                                                           reinterpret_cast<float *>(collapsed),
+                                                           &mask[maskIndex],
+                                                           reinterpret_cast<float *>(&fieldPtr[fieldIndex]),
+                                                           fieldVoxelNumber,
+                                                           resetMaskedVoxels);
+            break;
+         case AVX2_SIMD:
+            reg_cubic_spline_getDeformationFieldRow_avx2(reinterpret_cast<float *>(controlPointPtr),
+                                                         controlPointNumber,
+                                                         controlPointDim,
+                                                         yPre[y],
+                                                         zPre[z],
+                                                         reinterpret_cast<float *>(yzBasis),
+                                                         fieldDim[0],
+                                                         xPre,
+                                                         reinterpret_cast<float *>(xBasis),
+                                                         reinterpret_cast<float *>(collapsed),
+                                                         &mask[maskIndex],
+                                                         reinterpret_cast<float *>(&fieldPtr[fieldIndex]),
+                                                         fieldVoxelNumber,
+                                                         resetMaskedVoxels);
+            break;
+#endif
+         default:
+            reg_cubic_spline_getDeformationFieldRow<DTYPE>(controlPointPtr,
+                                                           controlPointNumber,
+                                                           controlPointDim,
+                                                           yPre[y],
+                                                           zPre[z],
+                                                           yzBasis,
+                                                           fieldDim[0],
+                                                           xPre,
+                                                           xBasis,
+                                                           collapsed,
+                                                           &mask[maskIndex],
+                                                           &fieldPtr[fieldIndex],
+                                                           fieldVoxelNumber,
+                                                           resetMaskedVoxels);
+         }
+      }
+      free(collapsed);
+   }
+   free(xPre);
+   free(yPre);
+   free(zPre);
+   free(xBasis);
+   free(yBasis);
+   free(zBasis);
+}
+/* *************************************************************** */
 template<class DTYPE>
 void reg_cubic_spline_getDeformationField3D(nifti_image *splineControlPoint,
                                             nifti_image *deformationField,
@@ -1230,7 +1669,37 @@ void reg_cubic_spline_getDeformationField3D(nifti_image *splineControlPoint,
 #endif // _USE_SSE
 
       // Assess if lookup table can be used
-      if(gridVoxelSpacing[0]==5. && gridVoxelSpacing[0]==5. && gridVoxelSpacing[0]==5. && force_no_lut==false){
+      bool useLUT = gridVoxelSpacing[0]==5. && gridVoxelSpacing[1]==5. &&
+            gridVoxelSpacing[2]==5. && force_no_lut==false;
+
+#ifdef _USE_RUNTIME_AVX
+      // The tile kernels handle any spacing ratio. They are bypassed when the
+      // per-voxel evaluation is explicitly requested
+      if(deformationField->datatype==NIFTI_TYPE_FLOAT32 && force_no_lut==false)
+      {
+         NREG_SIMD_TYPE simd=reg_getSIMDSupport();
+         if(simd==AVX2_SIMD || simd==AVX512_SIMD)
+         {
+            float spacing[3]={(float)gridVoxelSpacing[0],
+                              (float)gridVoxelSpacing[1],
+                              (float)gridVoxelSpacing[2]};
+            reg_cubic_spline_getDeformationFieldSlab3D<DTYPE>(splineControlPoint,
+                                                              &deformationField->dim[1],
+                                                              spacing,
+                                                              fieldPtrX,
+                                                              (size_t)deformationField->nx*deformationField->ny*deformationField->nz,
+                                                              0,
+                                                              deformationField->nz,
+                                                              mask,
+                                                              bspline,
+                                                              !useLUT,
+                                                              simd);
+            return;
+         }
+      }
+#endif // _USE_RUNTIME_AVX
+
+      if(useLUT){
 
           // Assign a single array that will contain all coefficients
          DTYPE *coefficients = (DTYPE *)malloc(125*64*sizeof(DTYPE));
@@ -1739,6 +2208,241 @@ void reg_spline_getDeformationField(nifti_image *splineControlPoint,
    return;
 }
 /* *************************************************************** */
+void reg_spline_getWarpedImage(nifti_image *splineControlPoint,
+                               nifti_image *floatingImage,
+                               nifti_image *warpedImage,
+                               int *mask,
+                               int interp,
+                               float paddingValue,
+                               bool bspline)
+{
+   // The other grids are applied through a full deformation field
+   if(splineControlPoint->nz==1 || warpedImage->nz<2 ||
+         splineControlPoint->intent_p1==LIN_SPLINE_GRID ||
+         splineControlPoint->num_ext>0)
+   {
+      nifti_image *deformationField=nifti_copy_nim_info(warpedImage);
+      deformationField->dim[0]=deformationField->ndim=5;
+      deformationField->dim[4]=deformationField->nt=1;
+      deformationField->pixdim[4]=deformationField->dt=1.0;
+      deformationField->dim[5]=deformationField->nu=warpedImage->nz>1?3:2;
+      deformationField->dim[6]=deformationField->nv=1;
+      deformationField->dim[7]=deformationField->nw=1;
+      deformationField->nvox=(size_t)deformationField->nx*deformationField->ny*
+            deformationField->nz*deformationField->nu;
+      deformationField->datatype=splineControlPoint->datatype;
+      deformationField->nbyper=splineControlPoint->nbyper;
+      deformationField->scl_slope=1.f;
+      deformationField->scl_inter=0.f;
+      deformationField->intent_p1=DEF_FIELD;
+      deformationField->data=calloc(deformationField->nvox, deformationField->nbyper);
+      reg_spline_getDeformationField(splineControlPoint,
+                                     deformationField,
+                                     mask,
+                                     false, // composition
+                                     bspline);
+      reg_resampleImage(floatingImage,
+                        warpedImage,
+                        deformationField,
+                        mask,
+                        interp,
+                        paddingValue);
+      nifti_image_free(deformationField);
+      return;
+   }
+   if(splineControlPoint->datatype!=NIFTI_TYPE_FLOAT32 &&
+         splineControlPoint->datatype!=NIFTI_TYPE_FLOAT64)
+   {
+      reg_print_fct_error("reg_spline_getWarpedImage");
+      reg_print_msg_error("Only single or double precision is implemented for the control point grid");
+      reg_exit();
+   }
+
+   bool MrPropre=false;
+   if(mask==NULL)
+   {
+      MrPropre=true;
+      mask=(int *)calloc(warpedImage->nx*warpedImage->ny*warpedImage->nz, sizeof(int));
+   }
+
+   // The slab thickness is bounded by the number of voxels to process at
+   // once. A slab contains at least two slices so that it is resampled in 3D
+   size_t sliceVoxelNumber=(size_t)warpedImage->nx*warpedImage->ny;
+   int slabThickness=(int)(SPLINE_WARP_SLAB_VOXEL_NUMBER/sliceVoxelNumber);
+   if(slabThickness<2) slabThickness=2;
+   if(slabThickness>warpedImage->nz) slabThickness=warpedImage->nz;
+   size_t volumeNumber=(size_t)warpedImage->nt*warpedImage->nu;
+   size_t warpedVoxelNumber=sliceVoxelNumber*warpedImage->nz;
+
+   // Headers describing the current slab of deformation and of warped
+   // intensities. The buffers allow for an extra slice to merge a single
+   // remaining slice with the last slab
+   nifti_image *slabField=nifti_copy_nim_info(warpedImage);
+   slabField->dim[0]=slabField->ndim=5;
+   slabField->dim[4]=slabField->nt=1;
+   slabField->dim[5]=slabField->nu=3;
+   slabField->datatype=splineControlPoint->datatype;
+   slabField->nbyper=splineControlPoint->nbyper;
+   slabField->data=malloc((slabThickness+1)*sliceVoxelNumber*3*slabField->nbyper);
+   nifti_image *slabWarped=nifti_copy_nim_info(warpedImage);
+   slabWarped->data=malloc((slabThickness+1)*sliceVoxelNumber*volumeNumber*slabWarped->nbyper);
+
+   float gridVoxelSpacing[3];
+   gridVoxelSpacing[0]=splineControlPoint->dx/warpedImage->dx;
+   gridVoxelSpacing[1]=splineControlPoint->dy/warpedImage->dy;
+   gridVoxelSpacing[2]=splineControlPoint->dz/warpedImage->dz;
+   NREG_SIMD_TYPE simd=reg_getSIMDSupport();
+
+   int thickness;
+   size_t slabVoxelNumber;
+   for(int firstSlice=0; firstSlice<warpedImage->nz; firstSlice+=thickness)
+   {
+      thickness=slabThickness;
+      if(firstSlice+thickness>warpedImage->nz)
+         thickness=warpedImage->nz-firstSlice;
+      if(warpedImage->nz-firstSlice-thickness==1)
+         ++thickness;
+      slabVoxelNumber=sliceVoxelNumber*thickness;
+      slabField->dim[3]=thickness;
+      nifti_update_dims_from_array(slabField);
+      slabWarped->dim[3]=thickness;
+      nifti_update_dims_from_array(slabWarped);
+
+      // Evaluate the transformation over the slab
+      if(splineControlPoint->datatype==NIFTI_TYPE_FLOAT32)
+         reg_cubic_spline_getDeformationFieldSlab3D<float>(splineControlPoint,
+                                                           &warpedImage->dim[1],
+                                                           gridVoxelSpacing,
+                                                           static_cast<float *>(slabField->data),
+                                                           slabVoxelNumber,
+                                                           firstSlice,
+                                                           firstSlice+thickness,
+                                                           mask,
+                                                           bspline,
+                                                           true,
+                                                           simd);
+      else reg_cubic_spline_getDeformationFieldSlab3D<double>(splineControlPoint,
+                                                              &warpedImage->dim[1],
+                                                              gridVoxelSpacing,
+                                                              static_cast<double *>(slabField->data),
+                                                              slabVoxelNumber,
+                                                              firstSlice,
+                                                              firstSlice+thickness,
+                                                              mask,
+                                                              bspline,
+                                                              true,
+                                                              simd);
+
+      // Resample the slab and copy it into the warped image
+      reg_resampleImage(floatingImage,
+                        slabWarped,
+                        slabField,
+                        &mask[firstSlice*sliceVoxelNumber],
+                        interp,
+                        paddingValue);
+      for(size_t v=0; v<volumeNumber; ++v)
+      {
+         memcpy(&static_cast<char *>(warpedImage->data)[(v*warpedVoxelNumber+firstSlice*sliceVoxelNumber)*warpedImage->nbyper],
+               &static_cast<char *>(slabWarped->data)[v*slabVoxelNumber*warpedImage->nbyper],
+               slabVoxelNumber*warpedImage->nbyper);
+      }
+   }
+   nifti_image_free(slabField);
+   nifti_image_free(slabWarped);
+
+   if(MrPropre==true)
+   {
+      free(mask);
+      mask=NULL;
+   }
+}
+/* *************************************************************** */
+void reg_spline_getDeformationFieldSlab(nifti_image *splineControlPoint,
+                                        nifti_image *deformationField,
+                                        int firstSlice,
+                                        int *mask,
+                                        bool bspline)
+{
+   if(splineControlPoint->nz==1 || deformationField->nu!=3 ||
+         splineControlPoint->intent_p1==LIN_SPLINE_GRID ||
+         splineControlPoint->num_ext>0)
+   {
+      reg_print_fct_error("reg_spline_getDeformationFieldSlab");
+      reg_print_msg_error("Only 3D cubic spline grids without affine extension are supported");
+      reg_exit();
+   }
+   if(splineControlPoint->datatype!=deformationField->datatype)
+   {
+      reg_print_fct_error("reg_spline_getDeformationFieldSlab");
+      reg_print_msg_error("The spline control point image and the deformation field image are expected to be the same type");
+      reg_exit();
+   }
+
+   // The basis tables cover the image up to the last slice of the slab
+   int fieldDim[3]= {deformationField->nx,
+                     deformationField->ny,
+                     firstSlice+deformationField->nz};
+   size_t slabVoxelNumber=(size_t)deformationField->nx*deformationField->ny*deformationField->nz;
+
+   // The temporary mask only covers the slab
+   bool MrPropre=false;
+   int maskFirstSlice=0;
+   if(mask==NULL)
+   {
+      MrPropre=true;
+      maskFirstSlice=firstSlice;
+      mask=(int *)calloc(slabVoxelNumber, sizeof(int));
+   }
+
+   float gridVoxelSpacing[3];
+   gridVoxelSpacing[0]=splineControlPoint->dx/deformationField->dx;
+   gridVoxelSpacing[1]=splineControlPoint->dy/deformationField->dy;
+   gridVoxelSpacing[2]=splineControlPoint->dz/deformationField->dz;
+   NREG_SIMD_TYPE simd=reg_getSIMDSupport();
+
+   switch(deformationField->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_cubic_spline_getDeformationFieldSlab3D<float>(splineControlPoint,
+                                                        fieldDim,
+                                                        gridVoxelSpacing,
+                                                        static_cast<float *>(deformationField->data),
+                                                        slabVoxelNumber,
+                                                        firstSlice,
+                                                        fieldDim[2],
+                                                        mask,
+                                                        bspline,
+                                                        true,
+                                                        simd,
+                                                        maskFirstSlice);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_cubic_spline_getDeformationFieldSlab3D<double>(splineControlPoint,
+                                                         fieldDim,
+                                                         gridVoxelSpacing,
+                                                         static_cast<double *>(deformationField->data),
+                                                         slabVoxelNumber,
+                                                         firstSlice,
+                                                         fieldDim[2],
+                                                         mask,
+                                                         bspline,
+                                                         true,
+                                                         simd,
+                                                         maskFirstSlice);
+      break;
+   default:
+      reg_print_fct_error("reg_spline_getDeformationFieldSlab");
+      reg_print_msg_error("Only single or double precision is implemented for deformation field");
+      reg_exit();
+   }
+
+   if(MrPropre==true)
+   {
+      free(mask);
+      mask=NULL;
+   }
+}
+/* *************************************************************** */
 /* *************************************************************** */
 template<class DTYPE>
 void reg_voxelCentric2NodeCentric_core(nifti_image *nodeImage,
@@ -1946,61 +2650,344 @@ void reg_voxelCentric2NodeCentric(nifti_image *nodeImage,
    }
 }
 /* *************************************************************** */
-/* *************************************************************** */
-template<class SplineTYPE>
-SplineTYPE GetValue(SplineTYPE *array, int *dim, int x, int y, int z)
-{
-   if(x<0 || x>= dim[1] || y<0 || y>= dim[2] || z<0 || z>= dim[3])
-      return 0.0;
-   return array[(z*dim[2]+y)*dim[1]+x];
-}
-/* *************************************************************** */
-template<class SplineTYPE>
-void SetValue(SplineTYPE *array, int *dim, int x, int y, int z, SplineTYPE value)
+/** Weights linking the nodes to the voxels along one axis. The voxel values
+ * are smoothed with a cubic spline kernel of the node spacing, normalised
+ * over the image extent as in reg_tools_kernelConvolution, and linearly
+ * interpolated at the node position nodeScale*node+nodeOffset. The weights of
+ * a node cover the voxels [start, start+bandWidth[ where
+ * bandWidth=2*radius+2, and are stored in weight[node*bandWidth+i].
+ */
+static void reg_getNodeAxisWeights(int nodeNumber,
+                                   float nodeScale,
+                                   float nodeOffset,
+                                   int voxelNumber,
+                                   double kernelSpacing,
+                                   int radius,
+                                   int *start,
+                                   double *weight)
 {
-   if(x<0 || x>= dim[1] || y<0 || y>= dim[2] || z<0 || z>= dim[3])
-      return;
-   array[(z*dim[2]+y)*dim[1]+x] = value;
+   int bandWidth=2*radius+2;
+   float *kernel=(float *)malloc((2*radius+1)*sizeof(float));
+   for(int i=-radius; i<=radius; ++i)
+   {
+      double relative = fabs((double)i/kernelSpacing);
+      if(relative<1.0) kernel[i+radius] = (float)(2.0/3.0 - relative*relative + 0.5*relative*relative*relative);
+      else if (relative<2.0) kernel[i+radius] = (float)(-(relative-2.0)*(relative-2.0)*(relative-2.0)/6.0);
+      else kernel[i+radius]=0;
+   }
+   memset(weight, 0, (size_t)nodeNumber*bandWidth*sizeof(double));
+   for(int n=0; n<nodeNumber; ++n)
+   {
+      float position=nodeScale*(float)n+nodeOffset;
+      int pre=static_cast<int>(reg_floor(position));
+      double basis[2];
+      basis[1]=position-(float)pre;
+      basis[0]=1.0-basis[1];
+      start[n]=pre-radius;
+      for(int a=0; a<2; ++a)
+      {
+         int voxel=pre+a;
+         if(voxel<0 || voxel>=voxelNumber) continue;
+         // Kernel normalisation at the voxel position
+         double kernelSum=0;
+         for(int u=voxel-radius; u<=voxel+radius; ++u)
+            if(u>-1 && u<voxelNumber)
+               kernelSum += kernel[u-voxel+radius];
+         for(int u=voxel-radius; u<=voxel+radius; ++u)
+            if(u>-1 && u<voxelNumber)
+               weight[n*bandWidth+u-start[n]] += basis[a]*kernel[u-voxel+radius]/kernelSum;
+      }
+   }
+   free(kernel);
 }
 /* *************************************************************** */
-template<class SplineTYPE>
-void reg_spline_refineControlPointGrid2D(nifti_image *splineControlPoint,
-                                         nifti_image *referenceImage)
+template<class DTYPE>
+void reg_voxelCentric2NodeCentric_slab_core(nifti_image *nodeImage,
+                                            nifti_image *voxelImage,
+                                            int firstSlice,
+                                            int sliceNumber,
+                                            float weight,
+                                            mat44 *voxelToMillimeter)
 {
-   // The input grid is first saved
-   SplineTYPE *oldGrid = (SplineTYPE *)malloc(splineControlPoint->nvox*splineControlPoint->nbyper);
-   SplineTYPE *gridPtrX = static_cast<SplineTYPE *>(splineControlPoint->data);
-   memcpy(oldGrid, gridPtrX, splineControlPoint->nvox*splineControlPoint->nbyper);
-   if(splineControlPoint->data!=NULL) free(splineControlPoint->data);
-   int oldDim[4];
-   oldDim[0]=splineControlPoint->dim[0];
-   oldDim[1]=splineControlPoint->dim[1];
-   oldDim[2]=splineControlPoint->dim[2];
-   oldDim[3]=splineControlPoint->dim[3];
-
-   splineControlPoint->dx = splineControlPoint->pixdim[1] = splineControlPoint->dx / 2.0f;
-   splineControlPoint->dy = splineControlPoint->pixdim[2] = splineControlPoint->dy / 2.0f;
-   splineControlPoint->dz = 1.0f;
-   if(referenceImage!=NULL)
+   int nodeDim[3]= {nodeImage->nx, nodeImage->ny, nodeImage->nz};
+   int voxelDim[3]= {voxelImage->nx, voxelImage->ny, sliceNumber};
+   int slabSliceNumber=voxelImage->nz;
+   size_t nodeNumber = (size_t)nodeDim[0]*nodeDim[1]*nodeDim[2];
+   size_t slabVoxelNumber = (size_t)voxelDim[0]*voxelDim[1]*slabSliceNumber;
+   DTYPE *nodePtr = static_cast<DTYPE *>(nodeImage->data);
+   DTYPE *voxelPtr = static_cast<DTYPE *>(voxelImage->data);
+
+   // The transformation between the grid and the image voxels is
+   // expected to be a scaling and a translation
+   mat44 transformation;
+   if(nodeImage->sform_code>0)
+      transformation=nodeImage->sto_xyz;
+   else transformation=nodeImage->qto_xyz;
+   if(voxelImage->sform_code>0)
+      transformation = reg_mat44_mul(&voxelImage->sto_ijk,&transformation);
+   else transformation = reg_mat44_mul(&voxelImage->qto_ijk,&transformation);
+   for(int i=0; i<3; ++i)
    {
-      splineControlPoint->dim[1]=splineControlPoint->nx=static_cast<int>(reg_ceil(referenceImage->nx*referenceImage->dx/splineControlPoint->dx)+3.f);
-      splineControlPoint->dim[2]=splineControlPoint->ny=static_cast<int>(reg_ceil(referenceImage->ny*referenceImage->dy/splineControlPoint->dy)+3.f);
+      for(int j=0; j<3; ++j)
+      {
+         if(i!=j && fabs(transformation.m[i][j])>1.e-4f)
+         {
+            reg_print_fct_error("reg_voxelCentric2NodeCentric_slab");
+            reg_print_msg_error("The grid axes are expected to be aligned with the image axes");
+            reg_exit();
+         }
+      }
    }
-   else
+
+   // The information has to be reoriented and weighted as in reg_voxelCentric2NodeCentric
+   mat33 reorientation;
+   if(voxelToMillimeter!=NULL)
+      reorientation=reg_mat44_to_mat33(voxelToMillimeter);
+   else reg_mat33_eye(&reorientation);
+   float ratio[3]= {nodeImage->dx,nodeImage->dy,nodeImage->dz};
+   for(int i=0; i<3; ++i)
    {
-      splineControlPoint->dim[1]=splineControlPoint->nx=(oldDim[1]-3)*2+3;
-      splineControlPoint->dim[2]=splineControlPoint->ny=(oldDim[2]-3)*2+3;
+      if(nodeImage->sform_code>0)
+      {
+         ratio[i] = sqrt(
+                  reg_pow2(nodeImage->sto_xyz.m[i][0]) +
+               reg_pow2(nodeImage->sto_xyz.m[i][1]) +
+               reg_pow2(nodeImage->sto_xyz.m[i][2]) );
+      }
+      ratio[i] /= voxelImage->pixdim[i+1];
+      weight *= ratio[i];
    }
-   splineControlPoint->dim[3]=splineControlPoint->nz=1;
 
-   splineControlPoint->nvox =
-         (size_t)splineControlPoint->nx*
-         (size_t)splineControlPoint->ny*
-         (size_t)splineControlPoint->nz*
-         (size_t)splineControlPoint->nt*
-         (size_t)splineControlPoint->nu;
+   // The smoothing and interpolation weights are tabulated along every axis
+   int radius[3], bandWidth[3];
+   int *start[3];
+   double *axisWeight[3];
+   for(int a=0; a<3; ++a)
+   {
+      double kernelSpacing = (double)nodeImage->pixdim[a+1]/(double)voxelImage->pixdim[a+1];
+      radius[a]=static_cast<int>(kernelSpacing*2.0f);
+      bandWidth[a]=2*radius[a]+2;
+      start[a]=(int *)malloc(nodeDim[a]*sizeof(int));
+      axisWeight[a]=(double *)malloc((size_t)nodeDim[a]*bandWidth[a]*sizeof(double));
+      reg_getNodeAxisWeights(nodeDim[a],
+                             transformation.m[a][a],
+                             transformation.m[a][3],
+                             voxelDim[a],
+                             kernelSpacing,
+                             radius[a],
+                             start[a],
+                             axisWeight[a]);
+   }
 
-   splineControlPoint->data = (void *)calloc(splineControlPoint->nvox, splineControlPoint->nbyper);
+   // The slab is first reduced along the x axis, then along the y axis
+   size_t lineNumber = (size_t)slabSliceNumber*voxelDim[1];
+   size_t planeNumber = (size_t)slabSliceNumber*nodeDim[1];
+   double *xReduced=(double *)malloc(3*lineNumber*nodeDim[0]*sizeof(double));
+   double *yReduced=(double *)malloc(3*planeNumber*nodeDim[0]*sizeof(double));
+#ifdef WIN32
+   long line, plane, index;
+   long lineNumberLong = lineNumber, planeNumberLong = planeNumber;
+   long nodePlaneNumber = (long)nodeDim[1]*nodeDim[2];
+#else
+   size_t line, plane, index;
+   size_t lineNumberLong = lineNumber, planeNumberLong = planeNumber;
+   size_t nodePlaneNumber = (size_t)nodeDim[1]*nodeDim[2];
+#endif
+   int c, i, u, first, last, w, j, k;
+   double sum, currentWeight, value[3];
+   double *weightPtr, *inputPtr, *outputPtr;
+   DTYPE *voxelLinePtr;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(lineNumberLong, slabVoxelNumber, voxelPtr, voxelDim, nodeDim, start, \
+   bandWidth, axisWeight, xReduced) \
+   private(line, c, i, u, first, last, sum, weightPtr, outputPtr, voxelLinePtr)
+#endif
+   for(line=0; line<lineNumberLong; ++line)
+   {
+      for(c=0; c<3; ++c)
+      {
+         voxelLinePtr = &voxelPtr[c*slabVoxelNumber+line*voxelDim[0]];
+         outputPtr = &xReduced[(c*lineNumberLong+line)*nodeDim[0]];
+         for(i=0; i<nodeDim[0]; ++i)
+         {
+            first = start[0][i]>0?start[0][i]:0;
+            last = start[0][i]+bandWidth[0];
+            last = last<voxelDim[0]?last:voxelDim[0];
+            weightPtr = &axisWeight[0][i*bandWidth[0]-start[0][i]];
+            sum=0;
+            for(u=first; u<last; ++u)
+               sum += weightPtr[u] * (double)voxelLinePtr[u];
+            outputPtr[i]=sum;
+         }
+      }
+   }
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(planeNumberLong, lineNumberLong, voxelDim, nodeDim, start, bandWidth, \
+   axisWeight, xReduced, yReduced) \
+   private(plane, w, j, c, i, u, first, last, currentWeight, inputPtr, outputPtr)
+#endif
+   for(plane=0; plane<planeNumberLong; ++plane)
+   {
+      w = plane/nodeDim[1];
+      j = plane%nodeDim[1];
+      first = start[1][j]>0?start[1][j]:0;
+      last = start[1][j]+bandWidth[1];
+      last = last<voxelDim[1]?last:voxelDim[1];
+      for(c=0; c<3; ++c)
+      {
+         outputPtr = &yReduced[(c*planeNumberLong+plane)*nodeDim[0]];
+         for(i=0; i<nodeDim[0]; ++i)
+            outputPtr[i]=0;
+         for(u=first; u<last; ++u)
+         {
+            currentWeight = axisWeight[1][j*bandWidth[1]+u-start[1][j]];
+            inputPtr = &xReduced[(c*lineNumberLong+(size_t)w*voxelDim[1]+u)*nodeDim[0]];
+            for(i=0; i<nodeDim[0]; ++i)
+               outputPtr[i] += currentWeight * inputPtr[i];
+         }
+      }
+   }
+
+   // The slices of the slab are accumulated onto the nodes
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(nodePlaneNumber, planeNumberLong, nodeNumber, nodeDim, start, bandWidth, \
+   axisWeight, yReduced, firstSlice, slabSliceNumber, reorientation, weight, nodePtr) \
+   private(index, k, j, i, c, u, first, last, currentWeight, value)
+#endif
+   for(index=0; index<nodePlaneNumber; ++index)
+   {
+      k = index/nodeDim[1];
+      j = index%nodeDim[1];
+      first = start[2][k]>firstSlice?start[2][k]:firstSlice;
+      last = start[2][k]+bandWidth[2];
+      last = last<firstSlice+slabSliceNumber?last:firstSlice+slabSliceNumber;
+      if(first>=last) continue;
+      for(i=0; i<nodeDim[0]; ++i)
+      {
+         value[0]=value[1]=value[2]=0;
+         for(u=first; u<last; ++u)
+         {
+            currentWeight = axisWeight[2][k*bandWidth[2]+u-start[2][k]];
+            for(c=0; c<3; ++c)
+               value[c] += currentWeight *
+                     yReduced[(c*planeNumberLong+(size_t)(u-firstSlice)*nodeDim[1]+j)*nodeDim[0]+i];
+         }
+         for(c=0; c<3; ++c)
+         {
+            nodePtr[c*nodeNumber+index*nodeDim[0]+i] += static_cast<DTYPE>(
+                     (reorientation.m[0][c] * value[0] +
+                      reorientation.m[1][c] * value[1] +
+                      reorientation.m[2][c] * value[2]) * weight);
+         }
+      }
+   }
+   free(xReduced);
+   free(yReduced);
+   for(int a=0; a<3; ++a)
+   {
+      free(start[a]);
+      free(axisWeight[a]);
+   }
+}
+/* *************************************************************** */
+extern "C++"
+void reg_voxelCentric2NodeCentric_slab(nifti_image *nodeImage,
+                                       nifti_image *voxelImage,
+                                       int firstSlice,
+                                       int sliceNumber,
+                                       float weight,
+                                       mat44 *voxelToMillimeter
+                                       )
+{
+   if(nodeImage->datatype!=voxelImage->datatype)
+   {
+      reg_print_fct_error("reg_voxelCentric2NodeCentric_slab");
+      reg_print_msg_error("Both input images do not have the same type");
+      reg_exit();
+   }
+   if(nodeImage->nz==1 || nodeImage->num_ext>0 ||
+         firstSlice<0 || firstSlice+voxelImage->nz>sliceNumber)
+   {
+      reg_print_fct_error("reg_voxelCentric2NodeCentric_slab");
+      reg_print_msg_error("Only 3D grids without affine extension and slabs within the image are supported");
+      reg_exit();
+   }
+
+   switch(nodeImage->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_voxelCentric2NodeCentric_slab_core<float>
+            (nodeImage, voxelImage, firstSlice, sliceNumber, weight, voxelToMillimeter);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_voxelCentric2NodeCentric_slab_core<double>
+            (nodeImage, voxelImage, firstSlice, sliceNumber, weight, voxelToMillimeter);
+      break;
+   default:
+      reg_print_fct_error("reg_voxelCentric2NodeCentric_slab");
+      reg_print_msg_error("Data type not supported");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+template<class SplineTYPE>
+SplineTYPE GetValue(SplineTYPE *array, int *dim, int x, int y, int z)
+{
+   if(x<0 || x>= dim[1] || y<0 || y>= dim[2] || z<0 || z>= dim[3])
+      return 0.0;
+   return array[(z*dim[2]+y)*dim[1]+x];
+}
+/* *************************************************************** */
+template<class SplineTYPE>
+void SetValue(SplineTYPE *array, int *dim, int x, int y, int z, SplineTYPE value)
+{
+   if(x<0 || x>= dim[1] || y<0 || y>= dim[2] || z<0 || z>= dim[3])
+      return;
+   array[(z*dim[2]+y)*dim[1]+x] = value;
+}
+/* *************************************************************** */
+template<class SplineTYPE>
+void reg_spline_refineControlPointGrid2D(nifti_image *splineControlPoint,
+                                         nifti_image *referenceImage)
+{
+   // The input grid is first saved
+   SplineTYPE *oldGrid = (SplineTYPE *)malloc(splineControlPoint->nvox*splineControlPoint->nbyper);
+   SplineTYPE *gridPtrX = static_cast<SplineTYPE *>(splineControlPoint->data);
+   memcpy(oldGrid, gridPtrX, splineControlPoint->nvox*splineControlPoint->nbyper);
+   if(splineControlPoint->data!=NULL) free(splineControlPoint->data);
+   int oldDim[4];
+   oldDim[0]=splineControlPoint->dim[0];
+   oldDim[1]=splineControlPoint->dim[1];
+   oldDim[2]=splineControlPoint->dim[2];
+   oldDim[3]=splineControlPoint->dim[3];
+
+   splineControlPoint->dx = splineControlPoint->pixdim[1] = splineControlPoint->dx / 2.0f;
+   splineControlPoint->dy = splineControlPoint->pixdim[2] = splineControlPoint->dy / 2.0f;
+   splineControlPoint->dz = 1.0f;
+   if(referenceImage!=NULL)
+   {
+      splineControlPoint->dim[1]=splineControlPoint->nx=static_cast<int>(reg_ceil(referenceImage->nx*referenceImage->dx/splineControlPoint->dx)+3.f);
+      splineControlPoint->dim[2]=splineControlPoint->ny=static_cast<int>(reg_ceil(referenceImage->ny*referenceImage->dy/splineControlPoint->dy)+3.f);
+   }
+   else
+   {
+      splineControlPoint->dim[1]=splineControlPoint->nx=(oldDim[1]-3)*2+3;
+      splineControlPoint->dim[2]=splineControlPoint->ny=(oldDim[2]-3)*2+3;
+   }
+   splineControlPoint->dim[3]=splineControlPoint->nz=1;
+
+   splineControlPoint->nvox =
+         (size_t)splineControlPoint->nx*
+         (size_t)splineControlPoint->ny*
+         (size_t)splineControlPoint->nz*
+         (size_t)splineControlPoint->nt*
+         (size_t)splineControlPoint->nu;
+
+   splineControlPoint->data = (void *)calloc(splineControlPoint->nvox, splineControlPoint->nbyper);
    gridPtrX = static_cast<SplineTYPE *>(splineControlPoint->data);
    SplineTYPE *gridPtrY = &gridPtrX[splineControlPoint->nx*splineControlPoint->ny];
    SplineTYPE *oldGridPtrX = &oldGrid[0];
@@ -2548,263 +3535,400 @@ void reg_spline_refineControlPointGrid(nifti_image *controlPointGrid,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/* Description of a deformation field interpolated by the composition
+ * kernels, the matrices and dimensions are extracted once per field */
 template <class DTYPE>
-void reg_defField_compose2D(nifti_image *deformationField,
-                            nifti_image *dfToUpdate,
-                            int *mask)
+struct reg_composedField
 {
-   size_t DFVoxelNumber=(size_t)deformationField->nx*deformationField->ny;
-#ifdef _WIN32
-   long i;
-   long warVoxelNumber=(size_t)dfToUpdate->nx*dfToUpdate->ny;
-#else
-   size_t i;
-   size_t warVoxelNumber=(size_t)dfToUpdate->nx*dfToUpdate->ny;
-#endif
-   DTYPE *defPtrX = static_cast<DTYPE *>(deformationField->data);
-   DTYPE *defPtrY = &defPtrX[DFVoxelNumber];
-
-   DTYPE *resPtrX = static_cast<DTYPE *>(dfToUpdate->data);
-   DTYPE *resPtrY = &resPtrX[warVoxelNumber];
-
-   mat44 *df_real2Voxel=NULL;
-   mat44 *df_voxel2Real=NULL;
-   if(deformationField->sform_code>0)
+   DTYPE *ptrX, *ptrY, *ptrZ;
+   mat44 real2Voxel;
+   mat44 *voxel2Real;
+   int dim[3];
+   int *fullDim;
+};
+/* *************************************************************** */
+template <class DTYPE>
+static void reg_defField_getComposedFields(nifti_image **deformationFields,
+                                           int fieldNumber,
+                                           reg_composedField<DTYPE> *fields)
+{
+   for(int f=0; f<fieldNumber; ++f)
    {
-      df_real2Voxel=&(dfToUpdate->sto_ijk);
-      df_voxel2Real=&(deformationField->sto_xyz);
+      nifti_image *field=deformationFields[f];
+      size_t voxelNumber=(size_t)field->nx*field->ny*field->nz;
+      fields[f].ptrX=static_cast<DTYPE *>(field->data);
+      fields[f].ptrY=&fields[f].ptrX[voxelNumber];
+      fields[f].ptrZ=field->nu>2?&fields[f].ptrY[voxelNumber]:NULL;
+      if(field->sform_code>0)
+      {
+         fields[f].real2Voxel=field->sto_ijk;
+         fields[f].voxel2Real=&field->sto_xyz;
+      }
+      else
+      {
+         fields[f].real2Voxel=field->qto_ijk;
+         fields[f].voxel2Real=&field->qto_xyz;
+      }
+      fields[f].dim[0]=field->nx;
+      fields[f].dim[1]=field->ny;
+      fields[f].dim[2]=field->nz;
+      fields[f].fullDim=field->dim;
    }
-   else
+}
+/* *************************************************************** */
+/* The 2D deformation field is linearly interpolated at the provided
+ * position, which is replaced by the interpolated position */
+template <class DTYPE>
+static inline void reg_defField_interpolate2D(const reg_composedField<DTYPE> &field,
+                                              DTYPE &realDefX,
+                                              DTYPE &realDefY)
+{
+   // Conversion from real to voxel in the deformation field
+   DTYPE voxelX = realDefX * field.real2Voxel.m[0][0]
+         + realDefY * field.real2Voxel.m[0][1]
+         + field.real2Voxel.m[0][3];
+   DTYPE voxelY = realDefX * field.real2Voxel.m[1][0]
+         + realDefY * field.real2Voxel.m[1][1]
+         + field.real2Voxel.m[1][3];
+
+   // Linear interpolation to compute the new deformation
+   int pre[2];
+   DTYPE relX[2], relY[2], defX, defY, basis;
+   pre[0]=(int)reg_floor(voxelX);
+   pre[1]=(int)reg_floor(voxelY);
+   relX[1]=voxelX-(DTYPE)pre[0];
+   relX[0]=1.f-relX[1];
+   relY[1]=voxelY-(DTYPE)pre[1];
+   relY[0]=1.f-relY[1];
+   realDefX=realDefY=0.f;
+   for(int b=0; b<2; ++b)
    {
-      df_real2Voxel=&(dfToUpdate->qto_ijk);
-      df_voxel2Real=&(deformationField->qto_xyz);
+      for(int a=0; a<2; ++a)
+      {
+         basis = relX[a] * relY[b];
+         if(pre[0]+a>-1 && pre[0]+a<field.dim[0] &&
+               pre[1]+b>-1 && pre[1]+b<field.dim[1])
+         {
+            // Uses the deformation field if voxel is in its space
+            size_t index=(pre[1]+b)*field.dim[0]+pre[0]+a;
+            defX = field.ptrX[index];
+            defY = field.ptrY[index];
+         }
+         else
+         {
+            // Uses a sliding effect
+            get_SlidedValues<DTYPE>(defX,
+                                    defY,
+                                    pre[0]+a,
+                                    pre[1]+b,
+                                    field.ptrX,
+                                    field.ptrY,
+                                    field.voxel2Real,
+                                    field.fullDim,
+                                    false // not a deformation field
+                                    );
+         }
+         realDefX += defX * basis;
+         realDefY += defY * basis;
+      }
    }
-
-   size_t index;
-   int a, b, pre[2];
-   DTYPE realDefX, realDefY, voxelX, voxelY;
-   DTYPE defX, defY, relX[2], relY[2], basis;
-#if defined (_OPENMP)
-#pragma omp parallel for default(none) \
-   shared(warVoxelNumber, mask, df_real2Voxel, df_voxel2Real, \
-   deformationField, defPtrX, defPtrY, resPtrX, resPtrY) \
-   private(i, a, b, index, pre,realDefX, realDefY, voxelX, voxelY, \
-   defX, defY, relX, relY, basis)
-#endif
-   for(i=0; i<warVoxelNumber; ++i)
+}
+/* *************************************************************** */
+/* The 3D deformation field is trilinearly interpolated at the provided
+ * position, which is replaced by the interpolated position. The weights
+ * are computed once for the three components */
+template <class DTYPE>
+static inline void reg_defField_interpolate3D(const reg_composedField<DTYPE> &field,
+                                              DTYPE *realDef)
+{
+   // Conversion from real to voxel in the deformation field
+   DTYPE voxel[3];
+   voxel[0] =
+         field.real2Voxel.m[0][0] * realDef[0] +
+         field.real2Voxel.m[0][1] * realDef[1] +
+         field.real2Voxel.m[0][2] * realDef[2] +
+         field.real2Voxel.m[0][3] ;
+   voxel[1] =
+         field.real2Voxel.m[1][0] * realDef[0] +
+         field.real2Voxel.m[1][1] * realDef[1] +
+         field.real2Voxel.m[1][2] * realDef[2] +
+         field.real2Voxel.m[1][3] ;
+   voxel[2] =
+         field.real2Voxel.m[2][0] * realDef[0] +
+         field.real2Voxel.m[2][1] * realDef[1] +
+         field.real2Voxel.m[2][2] * realDef[2] +
+         field.real2Voxel.m[2][3] ;
+
+   // Linear interpolation to compute the new deformation
+   int pre[3], currentX, currentY, currentZ;
+   DTYPE relX[2], relY[2], relZ[2], basis, tempBasis, defX, defY, defZ;
+   size_t tempIndex, index;
+   bool inY, inZ;
+   pre[0]=static_cast<int>reg_floor(voxel[0]);
+   pre[1]=static_cast<int>reg_floor(voxel[1]);
+   pre[2]=static_cast<int>reg_floor(voxel[2]);
+   relX[1]=voxel[0]-static_cast<DTYPE>(pre[0]);
+   relX[0]=1.-relX[1];
+   relY[1]=voxel[1]-static_cast<DTYPE>(pre[1]);
+   relY[0]=1.-relY[1];
+   relZ[1]=voxel[2]-static_cast<DTYPE>(pre[2]);
+   relZ[0]=1.-relZ[1];
+   realDef[0]=realDef[1]=realDef[2]=0.;
+   for(int c=0; c<2; ++c)
    {
-      if(mask[i]>-1)
+      currentZ = pre[2]+c;
+      tempIndex=currentZ*field.dim[0]*field.dim[1];
+      if(currentZ>-1 && currentZ<field.dim[2]) inZ=true;
+      else inZ=false;
+      for(int b=0; b<2; ++b)
       {
-         realDefX = resPtrX[i];
-         realDefY = resPtrY[i];
-
-         // Conversion from real to voxel in the deformation field
-         voxelX = realDefX * df_real2Voxel->m[0][0]
-               + realDefY * df_real2Voxel->m[0][1]
-               + df_real2Voxel->m[0][3];
-         voxelY = realDefX * df_real2Voxel->m[1][0]
-               + realDefY * df_real2Voxel->m[1][1]
-               + df_real2Voxel->m[1][3];
-
-         // Linear interpolation to compute the new deformation
-         pre[0]=(int)reg_floor(voxelX);
-         pre[1]=(int)reg_floor(voxelY);
-         relX[1]=voxelX-(DTYPE)pre[0];
-         relX[0]=1.f-relX[1];
-         relY[1]=voxelY-(DTYPE)pre[1];
-         relY[0]=1.f-relY[1];
-         realDefX=realDefY=0.f;
-         for(b=0; b<2; ++b)
+         currentY = pre[1]+b;
+         index=tempIndex+currentY*field.dim[0] + pre[0];
+         tempBasis= relY[b] * relZ[c];
+         if(currentY>-1 && currentY<field.dim[1]) inY=true;
+         else inY=false;
+         for(int a=0; a<2; ++a)
          {
-            for(a=0; a<2; ++a)
+            currentX = pre[0]+a;
+            if(currentX>-1 && currentX<field.dim[0] && inY && inZ)
             {
-               basis = relX[a] * relY[b];
-               if(pre[0]+a>-1 && pre[0]+a<deformationField->nx &&
-                     pre[1]+b>-1 && pre[1]+b<deformationField->ny)
-               {
-                  // Uses the deformation field if voxel is in its space
-                  index=(pre[1]+b)*deformationField->nx+pre[0]+a;
-                  defX = defPtrX[index];
-                  defY = defPtrY[index];
-               }
-               else
-               {
-                  // Uses a sliding effect
-                  get_SlidedValues<DTYPE>(defX,
-                                          defY,
-                                          pre[0]+a,
-                        pre[1]+b,
-                        defPtrX,
-                        defPtrY,
-                        df_voxel2Real,
-                        deformationField->dim,
-                        false // not a deformation field
-                        );
-               }
-               realDefX += defX * basis;
-               realDefY += defY * basis;
+               // Uses the deformation field if voxel is in its space
+               defX = field.ptrX[index];
+               defY = field.ptrY[index];
+               defZ = field.ptrZ[index];
             }
-         }
-         resPtrX[i]=realDefX;
-         resPtrY[i]=realDefY;
-      }// mask
-   }// loop over every voxel
+            else
+            {
+               // Uses a sliding effect
+               get_SlidedValues<DTYPE>(defX,
+                                       defY,
+                                       defZ,
+                                       currentX,
+                                       currentY,
+                                       currentZ,
+                                       field.ptrX,
+                                       field.ptrY,
+                                       field.ptrZ,
+                                       field.voxel2Real,
+                                       field.fullDim,
+                                       false // not a displacement field
+                                       );
+            }
+            ++index;
+            basis = relX[a] * tempBasis;
+            realDef[0] += defX * basis;
+            realDef[1] += defY * basis;
+            realDef[2] += defZ * basis;
+         } // a loop
+      } // b loop
+   } // c loop
+}
+/* *************************************************************** */
+// Returns the coordinates of the tiles of a 2D or 3D grid ordered along a
+// Z-order (Morton) curve so that consecutive tiles are spatially close.
+// The codes of the enclosing power of two grid are decoded in turn and the
+// tiles that are outside of the grid are skipped. The returned array holds
+// three coordinates per tile and has to be freed by the caller
+static int *reg_getZOrderTiles(int *tileNumber,
+                               int dimension,
+                               size_t *tileTotalNumber)
+{
+   int maxTileNumber=tileNumber[0];
+   *tileTotalNumber=1;
+   for(int d=0; d<dimension; ++d)
+   {
+      maxTileNumber=tileNumber[d]>maxTileNumber?tileNumber[d]:maxTileNumber;
+      *tileTotalNumber*=tileNumber[d];
+   }
+   int bitNumber=0;
+   while((1<<bitNumber)<maxTileNumber) ++bitNumber;
+   int *tiles=(int *)malloc(3*(*tileTotalNumber)*sizeof(int));
+   size_t codeNumber=(size_t)1<<(dimension*bitNumber);
+   size_t t=0;
+   for(size_t code=0; code<codeNumber; ++code)
+   {
+      int coord[3]= {0,0,0};
+      for(int b=0; b<bitNumber; ++b)
+         for(int d=0; d<dimension; ++d)
+            coord[d] |= static_cast<int>((code>>(b*dimension+d))&1)<<b;
+      bool inside=true;
+      for(int d=0; d<dimension; ++d)
+         if(coord[d]>=tileNumber[d]) inside=false;
+      if(inside)
+      {
+         tiles[3*t]=coord[0];
+         tiles[3*t+1]=coord[1];
+         tiles[3*t+2]=coord[2];
+         ++t;
+      }
+   }
+   return tiles;
 }
 /* *************************************************************** */
 template <class DTYPE>
-void reg_defField_compose3D(nifti_image *deformationField,
-                            nifti_image *dfToUpdate,
-                            int *mask)
+void reg_defField_composeChain2D(nifti_image **deformationFields,
+                                 int fieldNumber,
+                                 nifti_image *dfToUpdate,
+                                 int *mask)
 {
-   const int DefFieldDim[3]= {deformationField->nx,deformationField->ny,deformationField->nz};
-   const size_t DFVoxelNumber=(size_t)DefFieldDim[0]*DefFieldDim[1]*DefFieldDim[2];
+   reg_composedField<DTYPE> *fields=(reg_composedField<DTYPE> *)
+         malloc(fieldNumber*sizeof(reg_composedField<DTYPE>));
+   reg_defField_getComposedFields<DTYPE>(deformationFields,fieldNumber,fields);
+
+   int warDim[2]= {dfToUpdate->nx,dfToUpdate->ny};
+   size_t warVoxelNumber=(size_t)warDim[0]*warDim[1];
+   DTYPE *resPtrX = static_cast<DTYPE *>(dfToUpdate->data);
+   DTYPE *resPtrY = &resPtrX[warVoxelNumber];
+
+   // The voxels are processed by tiles visited along a Z-order curve
+   int tileNumber[3];
+   for(int d=0; d<2; ++d)
+      tileNumber[d]=(warDim[d]+COMPOSE_TILE_SIZE-1)/COMPOSE_TILE_SIZE;
+   tileNumber[2]=1;
+   size_t tileTotalNumber;
+   int *tiles=reg_getZOrderTiles(tileNumber,2,&tileTotalNumber);
 #ifdef _WIN32
-   long i;
-   long warVoxelNumber=(size_t)dfToUpdate->nx*
-         dfToUpdate->ny*dfToUpdate->nz;
+   long t;
+   long tileNumberLong=(long)tileTotalNumber;
 #else
-   size_t i;
-   size_t warVoxelNumber=(size_t)dfToUpdate->nx*
-         dfToUpdate->ny*dfToUpdate->nz;
+   size_t t;
+   size_t tileNumberLong=tileTotalNumber;
 #endif
 
-   DTYPE *defPtrX = static_cast<DTYPE *>(deformationField->data);
-   DTYPE *defPtrY = &defPtrX[DFVoxelNumber];
-   DTYPE *defPtrZ = &defPtrY[DFVoxelNumber];
+   int f, x, y, tileStart[2], tileEnd[2];
+   size_t index;
+   DTYPE realDefX, realDefY;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(tileNumberLong, tiles, warDim, mask, fields, fieldNumber, resPtrX, resPtrY) \
+   private(t, f, x, y, tileStart, tileEnd, index, realDefX, realDefY)
+#endif
+   for(t=0; t<tileNumberLong; ++t)
+   {
+      for(int d=0; d<2; ++d)
+      {
+         tileStart[d]=tiles[3*t+d]*COMPOSE_TILE_SIZE;
+         tileEnd[d]=tileStart[d]+COMPOSE_TILE_SIZE<warDim[d]?tileStart[d]+COMPOSE_TILE_SIZE:warDim[d];
+      }
+      for(y=tileStart[1]; y<tileEnd[1]; ++y)
+      {
+         index=(size_t)y*warDim[0]+tileStart[0];
+         for(x=tileStart[0]; x<tileEnd[0]; ++x)
+         {
+            if(mask[index]>-1)
+            {
+               realDefX = resPtrX[index];
+               realDefY = resPtrY[index];
+               // Every field of the chain is applied in turn
+               for(f=0; f<fieldNumber; ++f)
+                  reg_defField_interpolate2D<DTYPE>(fields[f], realDefX, realDefY);
+               resPtrX[index]=realDefX;
+               resPtrY[index]=realDefY;
+            }// mask
+            ++index;
+         } // x
+      } // y
+   }// loop over every tile
+   free(tiles);
+   free(fields);
+}
+/* *************************************************************** */
+template <class DTYPE>
+void reg_defField_composeChain3D(nifti_image **deformationFields,
+                                 int fieldNumber,
+                                 nifti_image *dfToUpdate,
+                                 int *mask)
+{
+   reg_composedField<DTYPE> *fields=(reg_composedField<DTYPE> *)
+         malloc(fieldNumber*sizeof(reg_composedField<DTYPE>));
+   reg_defField_getComposedFields<DTYPE>(deformationFields,fieldNumber,fields);
 
+   int warDim[3]= {dfToUpdate->nx,dfToUpdate->ny,dfToUpdate->nz};
+   size_t warVoxelNumber=(size_t)warDim[0]*warDim[1]*warDim[2];
    DTYPE *resPtrX = static_cast<DTYPE *>(dfToUpdate->data);
    DTYPE *resPtrY = &resPtrX[warVoxelNumber];
    DTYPE *resPtrZ = &resPtrY[warVoxelNumber];
 
+   // The voxels are processed by tiles so that the interpolated positions
+   // of neighbouring voxels, in every direction, are close in memory. The
+   // tiles are visited along a Z-order curve so that the consecutive tiles
+   // processed by a thread are also close
+   int tileNumber[3];
+   for(int d=0; d<3; ++d)
+      tileNumber[d]=(warDim[d]+COMPOSE_TILE_SIZE-1)/COMPOSE_TILE_SIZE;
+   size_t tileTotalNumber;
+   int *tiles=reg_getZOrderTiles(tileNumber,3,&tileTotalNumber);
 #ifdef _WIN32
-   __declspec(align(16))mat44 df_real2Voxel;
+   long t;
+   long tileNumberLong=(long)tileTotalNumber;
 #else
-   mat44 df_real2Voxel __attribute__((aligned(16)));
+   size_t t;
+   size_t tileNumberLong=tileTotalNumber;
 #endif
-   mat44 *df_voxel2Real=NULL;
-   if(deformationField->sform_code>0)
-   {
-      df_real2Voxel=deformationField->sto_ijk;
-      df_voxel2Real=&deformationField->sto_xyz;
-   }
-   else
-   {
-      df_real2Voxel=deformationField->qto_ijk;
-      df_voxel2Real=&deformationField->qto_xyz;
-   }
 
-   size_t tempIndex, index;
-   int a, b, c, currentX, currentY, currentZ, pre[3];
-   DTYPE realDef[3], voxel[3], basis, tempBasis;
-   DTYPE defX, defY, defZ, relX[2], relY[2], relZ[2];
-   bool inY, inZ;
+   int f, x, y, z, tileStart[3], tileEnd[3];
+   size_t index;
+   DTYPE realDef[3];
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
-   shared(warVoxelNumber, mask, df_real2Voxel, df_voxel2Real, DefFieldDim, \
-   defPtrX, defPtrY, defPtrZ, resPtrX, resPtrY, resPtrZ, deformationField) \
-   private(i, a, b, c, currentX, currentY, currentZ, index, tempIndex, pre, \
-   realDef, voxel, tempBasis, defX, defY, defZ, relX, relY, relZ, basis, inY, inZ)
+   shared(tileNumberLong, tiles, warDim, mask, fields, fieldNumber, \
+   resPtrX, resPtrY, resPtrZ) \
+   private(t, f, x, y, z, tileStart, tileEnd, index, realDef)
 #endif
-   for(i=0; i<warVoxelNumber; ++i)
+   for(t=0; t<tileNumberLong; ++t)
    {
-      if(mask[i]>-1)
+      for(int d=0; d<3; ++d)
+      {
+         tileStart[d]=tiles[3*t+d]*COMPOSE_TILE_SIZE;
+         tileEnd[d]=tileStart[d]+COMPOSE_TILE_SIZE<warDim[d]?tileStart[d]+COMPOSE_TILE_SIZE:warDim[d];
+      }
+      for(z=tileStart[2]; z<tileEnd[2]; ++z)
       {
-         // Conversion from real to voxel in the deformation field
-         realDef[0] = resPtrX[i];
-         realDef[1] = resPtrY[i];
-         realDef[2] = resPtrZ[i];
-         voxel[0] =
-               df_real2Voxel.m[0][0] * realDef[0] +
-               df_real2Voxel.m[0][1] * realDef[1] +
-               df_real2Voxel.m[0][2] * realDef[2] +
-               df_real2Voxel.m[0][3] ;
-         voxel[1] =
-               df_real2Voxel.m[1][0] * realDef[0] +
-               df_real2Voxel.m[1][1] * realDef[1] +
-               df_real2Voxel.m[1][2] * realDef[2] +
-               df_real2Voxel.m[1][3] ;
-         voxel[2] =
-               df_real2Voxel.m[2][0] * realDef[0] +
-               df_real2Voxel.m[2][1] * realDef[1] +
-               df_real2Voxel.m[2][2] * realDef[2] +
-               df_real2Voxel.m[2][3] ;
-         //reg_mat44_mul(df_real2Voxel, realDef, voxel);
-
-         // Linear interpolation to compute the new deformation
-         pre[0]=static_cast<int>reg_floor(voxel[0]);
-         pre[1]=static_cast<int>reg_floor(voxel[1]);
-         pre[2]=static_cast<int>reg_floor(voxel[2]);
-         relX[1]=voxel[0]-static_cast<DTYPE>(pre[0]);
-         relX[0]=1.-relX[1];
-         relY[1]=voxel[1]-static_cast<DTYPE>(pre[1]);
-         relY[0]=1.-relY[1];
-         relZ[1]=voxel[2]-static_cast<DTYPE>(pre[2]);
-         relZ[0]=1.-relZ[1];
-         realDef[0]=realDef[1]=realDef[2]=0.;
-         for(c=0; c<2; ++c)
+         for(y=tileStart[1]; y<tileEnd[1]; ++y)
          {
-            currentZ = pre[2]+c;
-            tempIndex=currentZ*DefFieldDim[0]*DefFieldDim[1];
-            if(currentZ>-1 && currentZ<DefFieldDim[2]) inZ=true;
-            else inZ=false;
-            for(b=0; b<2; ++b)
+            index=((size_t)z*warDim[1]+y)*warDim[0]+tileStart[0];
+            for(x=tileStart[0]; x<tileEnd[0]; ++x)
             {
-               currentY = pre[1]+b;
-               index=tempIndex+currentY*DefFieldDim[0] + pre[0];
-               tempBasis= relY[b] * relZ[c];
-               if(currentY>-1 && currentY<DefFieldDim[1]) inY=true;
-               else inY=false;
-               for(a=0; a<2; ++a)
+               if(mask[index]>-1)
                {
-                  currentX = pre[0]+a;
-                  if(currentX>-1 && currentX<DefFieldDim[0] && inY && inZ)
-                  {
-                     // Uses the deformation field if voxel is in its space
-                     defX = defPtrX[index];
-                     defY = defPtrY[index];
-                     defZ = defPtrZ[index];
-                  }
-                  else
-                  {
-                     // Uses a sliding effect
-                     get_SlidedValues<DTYPE>(defX,
-                                             defY,
-                                             defZ,
-                                             currentX,
-                                             currentY,
-                                             currentZ,
-                                             defPtrX,
-                                             defPtrY,
-                                             defPtrZ,
-                                             df_voxel2Real,
-                                             deformationField->dim,
-                                             false // not a displacement field
-                                             );
-                  }
-                  ++index;
-                  basis = relX[a] * tempBasis;
-                  realDef[0] += defX * basis;
-                  realDef[1] += defY * basis;
-                  realDef[2] += defZ * basis;
-               } // a loop
-            } // b loop
-         } // c loop
-         resPtrX[i] = realDef[0];
-         resPtrY[i] = realDef[1];
-         resPtrZ[i] = realDef[2];
-      }// mask
-   }// loop over every voxel
+                  realDef[0] = resPtrX[index];
+                  realDef[1] = resPtrY[index];
+                  realDef[2] = resPtrZ[index];
+                  // Every field of the chain is applied in turn
+                  for(f=0; f<fieldNumber; ++f)
+                     reg_defField_interpolate3D<DTYPE>(fields[f], realDef);
+                  resPtrX[index] = realDef[0];
+                  resPtrY[index] = realDef[1];
+                  resPtrZ[index] = realDef[2];
+               }// mask
+               ++index;
+            } // x
+         } // y
+      } // z
+   }// loop over every tile
+   free(tiles);
+   free(fields);
 }
 /* *************************************************************** */
-void reg_defField_compose(nifti_image *deformationField,
-                          nifti_image *dfToUpdate,
-                          int *mask)
+void reg_defField_composeChain(nifti_image **deformationFields,
+                               int fieldNumber,
+                               nifti_image *dfToUpdate,
+                               int *mask)
 {
-   if(deformationField->datatype != dfToUpdate->datatype)
+   for(int f=0; f<fieldNumber; ++f)
    {
-      reg_print_fct_error("reg_defField_compose");
-      reg_print_msg_error("Both deformation fields are expected to have the same type");
-      reg_exit();
+      if(deformationFields[f]->datatype != dfToUpdate->datatype)
+      {
+         reg_print_fct_error("reg_defField_composeChain");
+         reg_print_msg_error("All deformation fields are expected to have the same type");
+         reg_exit();
+      }
+      if(deformationFields[f]->nu != dfToUpdate->nu)
+      {
+         reg_print_fct_error("reg_defField_composeChain");
+         reg_print_msg_error("All deformation fields are expected to have the same dimension");
+         reg_exit();
+      }
    }
 
    bool freeMask=false;
@@ -2819,32 +3943,32 @@ void reg_defField_compose(nifti_image *deformationField,
 
    if(dfToUpdate->nu==2)
    {
-      switch(deformationField->datatype)
+      switch(dfToUpdate->datatype)
       {
       case NIFTI_TYPE_FLOAT32:
-         reg_defField_compose2D<float>(deformationField,dfToUpdate,mask);
+         reg_defField_composeChain2D<float>(deformationFields,fieldNumber,dfToUpdate,mask);
          break;
       case NIFTI_TYPE_FLOAT64:
-         reg_defField_compose2D<double>(deformationField,dfToUpdate,mask);
+         reg_defField_composeChain2D<double>(deformationFields,fieldNumber,dfToUpdate,mask);
          break;
       default:
-         reg_print_fct_error("reg_defField_compose");
+         reg_print_fct_error("reg_defField_composeChain");
          reg_print_msg_error("Deformation field pixel type unsupported");
          reg_exit();
       }
    }
    else
    {
-      switch(deformationField->datatype)
+      switch(dfToUpdate->datatype)
       {
       case NIFTI_TYPE_FLOAT32:
-         reg_defField_compose3D<float>(deformationField,dfToUpdate,mask);
+         reg_defField_composeChain3D<float>(deformationFields,fieldNumber,dfToUpdate,mask);
          break;
       case NIFTI_TYPE_FLOAT64:
-         reg_defField_compose3D<double>(deformationField,dfToUpdate,mask);
+         reg_defField_composeChain3D<double>(deformationFields,fieldNumber,dfToUpdate,mask);
          break;
       default:
-         reg_print_fct_error("reg_defField_compose");
+         reg_print_fct_error("reg_defField_composeChain");
          reg_print_msg_error("Deformation field pixel type unsupported");
          reg_exit();
       }
@@ -2853,6 +3977,19 @@ void reg_defField_compose(nifti_image *deformationField,
    if(freeMask==true) free(mask);
 }
 /* *************************************************************** */
+void reg_defField_compose(nifti_image *deformationField,
+                          nifti_image *dfToUpdate,
+                          int *mask)
+{
+   if(deformationField->datatype != dfToUpdate->datatype)
+   {
+      reg_print_fct_error("reg_defField_compose");
+      reg_print_msg_error("Both deformation fields are expected to have the same type");
+      reg_exit();
+   }
+   reg_defField_composeChain(&deformationField,1,dfToUpdate,mask);
+}
+/* *************************************************************** */
 /* *************************************************************** */
 /// @brief Internal data structure to pass user data into optimizer that get passed to cost_function
 struct ddata
@@ -3466,17 +4603,281 @@ void reg_defFieldInvert(nifti_image *inputDeformationField,
    }
 }
 /* *************************************************************** */
-/* *************************************************************** */
-//HAVE TO BE CHECKED
-template<class DTYPE>
-void reg_spline_cppComposition_2D(nifti_image *grid1,
-                                  nifti_image *grid2,
-                                  bool displacement1,
-                                  bool displacement2,
-                                  bool bspline)
+/* Creates an empty field with the geometry of the provided one at
+ * half its resolution. The first voxel keeps its position */
+static nifti_image *reg_defFieldInvert_halfResolution(nifti_image *field)
 {
-   // REMINDER Grid2(x)=Grid1(Grid2(x))
-
+   nifti_image *halfField=nifti_copy_nim_info(field);
+   for(int i=1; i<=3; ++i)
+   {
+      if(field->dim[i]>1)
+      {
+         halfField->dim[i]=(field->dim[i]+1)/2;
+         halfField->pixdim[i]=field->pixdim[i]*2.f;
+         for(int j=0; j<3; ++j)
+         {
+            halfField->qto_xyz.m[j][i-1]*=2.f;
+            halfField->sto_xyz.m[j][i-1]*=2.f;
+         }
+      }
+   }
+   halfField->nx=halfField->dim[1];
+   halfField->ny=halfField->dim[2];
+   halfField->nz=halfField->dim[3];
+   halfField->dx=halfField->pixdim[1];
+   halfField->dy=halfField->pixdim[2];
+   halfField->dz=halfField->pixdim[3];
+   halfField->qto_ijk=nifti_mat44_inverse(halfField->qto_xyz);
+   halfField->sto_ijk=nifti_mat44_inverse(halfField->sto_xyz);
+   halfField->nvox=(size_t)halfField->nx*halfField->ny*halfField->nz*
+         halfField->nt*halfField->nu;
+   halfField->data=(void *)malloc(halfField->nvox*halfField->nbyper);
+   return halfField;
+}
+/* *************************************************************** */
+/* Inverts the input field at the resolution of the output field. The
+ * initial positions are interpolated from the coarser inverse when it
+ * is provided and are approximated by 2x-phi(x) otherwise. The report
+ * receives the number of converged voxels, the sum and the maximum of
+ * the residuals and the total number of iterations */
+template <class DTYPE>
+static void reg_defFieldInvertMultigridLevel(nifti_image *inputDeformationField,
+                                             nifti_image *outputDeformationField,
+                                             nifti_image *coarseDeformationField,
+                                             float tolerance,
+                                             int maxIterationNumber,
+                                             double *report)
+{
+   reg_composedField<DTYPE> fields[2];
+   reg_defField_getComposedFields<DTYPE>(&inputDeformationField,1,&fields[0]);
+   if(coarseDeformationField!=NULL)
+      reg_defField_getComposedFields<DTYPE>(&coarseDeformationField,1,&fields[1]);
+   bool useCoarseField=coarseDeformationField!=NULL;
+
+   int outDim[3]= {outputDeformationField->nx,outputDeformationField->ny,outputDeformationField->nz};
+   size_t outVoxelNumber=(size_t)outDim[0]*outDim[1]*outDim[2];
+   DTYPE *outPtrX = static_cast<DTYPE *>(outputDeformationField->data);
+   DTYPE *outPtrY = &outPtrX[outVoxelNumber];
+   DTYPE *outPtrZ = &outPtrY[outVoxelNumber];
+   mat44 *outVoxel2Real;
+   if(outputDeformationField->sform_code>0)
+      outVoxel2Real=&(outputDeformationField->sto_xyz);
+   else outVoxel2Real=&(outputDeformationField->qto_xyz);
+
+   // The residuals are compared using their squared norms
+   double squaredTolerance=(double)tolerance*tolerance;
+
+   // The voxels are processed by tiles so that neighbouring voxels, which
+   // have close inverse positions, are refined by the same thread
+   int tileNumber[3];
+   for(int d=0; d<3; ++d)
+      tileNumber[d]=(outDim[d]+COMPOSE_TILE_SIZE-1)/COMPOSE_TILE_SIZE;
+#ifdef _WIN32
+   long t;
+   long tileTotalNumber=(long)tileNumber[0]*tileNumber[1]*tileNumber[2];
+#else
+   size_t t;
+   size_t tileTotalNumber=(size_t)tileNumber[0]*tileNumber[1]*tileNumber[2];
+#endif
+
+   int d, x, y, z, it, tileStart[3], tileEnd[3];
+   size_t index;
+   DTYPE position[3], current[3], residual[3], candidate[3], candidateResidual[3];
+   double norm, candidateNorm, step, tileReport[4];
+   report[0]=report[1]=report[2]=report[3]=0.;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(tileTotalNumber, tileNumber, outDim, outVoxel2Real, fields, useCoarseField, \
+   outPtrX, outPtrY, outPtrZ, squaredTolerance, maxIterationNumber, report) \
+   private(t, d, x, y, z, it, tileStart, tileEnd, index, position, current, residual, \
+   candidate, candidateResidual, norm, candidateNorm, step, tileReport)
+#endif
+   for(t=0; t<tileTotalNumber; ++t)
+   {
+      tileStart[0]=(int)(t%tileNumber[0])*COMPOSE_TILE_SIZE;
+      tileStart[1]=(int)((t/tileNumber[0])%tileNumber[1])*COMPOSE_TILE_SIZE;
+      tileStart[2]=(int)(t/((size_t)tileNumber[0]*tileNumber[1]))*COMPOSE_TILE_SIZE;
+      tileEnd[0]=tileStart[0]+COMPOSE_TILE_SIZE<outDim[0]?tileStart[0]+COMPOSE_TILE_SIZE:outDim[0];
+      tileEnd[1]=tileStart[1]+COMPOSE_TILE_SIZE<outDim[1]?tileStart[1]+COMPOSE_TILE_SIZE:outDim[1];
+      tileEnd[2]=tileStart[2]+COMPOSE_TILE_SIZE<outDim[2]?tileStart[2]+COMPOSE_TILE_SIZE:outDim[2];
+      tileReport[0]=tileReport[1]=tileReport[2]=tileReport[3]=0.;
+      for(z=tileStart[2]; z<tileEnd[2]; ++z)
+      {
+         for(y=tileStart[1]; y<tileEnd[1]; ++y)
+         {
+            index=((size_t)z*outDim[1]+y)*outDim[0]+tileStart[0];
+            for(x=tileStart[0]; x<tileEnd[0]; ++x)
+            {
+               // The real position of the voxel is the target of phi
+               for(d=0; d<3; ++d)
+               {
+                  position[d] = outVoxel2Real->m[d][0] * (DTYPE)x +
+                        outVoxel2Real->m[d][1] * (DTYPE)y +
+                        outVoxel2Real->m[d][2] * (DTYPE)z +
+                        outVoxel2Real->m[d][3];
+                  current[d] = position[d];
+               }
+               // Initial guess
+               if(useCoarseField)
+                  reg_defField_interpolate3D<DTYPE>(fields[1], current);
+               else
+               {
+                  reg_defField_interpolate3D<DTYPE>(fields[0], current);
+                  for(d=0; d<3; ++d)
+                     current[d] = 2.f * position[d] - current[d];
+               }
+               // Residual of the initial guess
+               norm=0.;
+               for(d=0; d<3; ++d)
+                  residual[d] = current[d];
+               reg_defField_interpolate3D<DTYPE>(fields[0], residual);
+               for(d=0; d<3; ++d)
+               {
+                  residual[d] -= position[d];
+                  norm += (double)residual[d]*residual[d];
+               }
+               // Fixed-point iterations, the step is halved when the
+               // residual does not decrease and doubled, up to 1, after
+               // an accepted update
+               step=1.;
+               for(it=0; it<maxIterationNumber && norm>squaredTolerance; ++it)
+               {
+                  candidateNorm=0.;
+                  for(d=0; d<3; ++d)
+                  {
+                     candidate[d] = current[d] - (DTYPE)step * residual[d];
+                     candidateResidual[d] = candidate[d];
+                  }
+                  reg_defField_interpolate3D<DTYPE>(fields[0], candidateResidual);
+                  for(d=0; d<3; ++d)
+                  {
+                     candidateResidual[d] -= position[d];
+                     candidateNorm += (double)candidateResidual[d]*candidateResidual[d];
+                  }
+                  if(candidateNorm<norm)
+                  {
+                     for(d=0; d<3; ++d)
+                     {
+                        current[d] = candidate[d];
+                        residual[d] = candidateResidual[d];
+                     }
+                     norm = candidateNorm;
+                     step = step<0.5?step*2.:1.;
+                  }
+                  else step *= 0.5;
+               }
+               outPtrX[index] = current[0];
+               outPtrY[index] = current[1];
+               outPtrZ[index] = current[2];
+               if(norm<=squaredTolerance) tileReport[0] += 1.;
+               norm=sqrt(norm);
+               tileReport[1] += norm;
+               if(norm>tileReport[2]) tileReport[2] = norm;
+               tileReport[3] += it;
+               ++index;
+            } // x
+         } // y
+      } // z
+#if defined (_OPENMP)
+#pragma omp critical
+#endif
+      {
+         report[0] += tileReport[0];
+         report[1] += tileReport[1];
+         if(tileReport[2]>report[2]) report[2] = tileReport[2];
+         report[3] += tileReport[3];
+      }
+   }// loop over every tile
+}
+/* *************************************************************** */
+void reg_defFieldInvertMultigrid(nifti_image *inputDeformationField,
+                                 nifti_image *outputDeformationField,
+                                 float tolerance,
+                                 int maxIterationNumber,
+                                 bool verbose)
+{
+   // Check the input image data types
+   if(inputDeformationField->datatype!=outputDeformationField->datatype)
+   {
+      reg_print_fct_error("reg_defFieldInvertMultigrid");
+      reg_print_msg_error("Both deformation fields are expected to have the same data type");
+      reg_exit();
+   }
+   if(inputDeformationField->nu!=3 || outputDeformationField->nu!=3)
+   {
+      reg_print_fct_error("reg_defFieldInvertMultigrid");
+      reg_print_msg_error("The function has only been implemented for 3D deformation field yet");
+      reg_exit();
+   }
+   if(inputDeformationField->datatype!=NIFTI_TYPE_FLOAT32 &&
+         inputDeformationField->datatype!=NIFTI_TYPE_FLOAT64)
+   {
+      reg_print_fct_error("reg_defFieldInvertMultigrid");
+      reg_print_msg_error("Deformation field pixel type unsupported");
+      reg_exit();
+   }
+
+   // The output grid is halved until its smallest dimension would fall
+   // below INVERT_MULTIGRID_MIN_SIZE
+   int levelNumber=1;
+   int minDim=outputDeformationField->nx;
+   if(outputDeformationField->ny>1 && outputDeformationField->ny<minDim)
+      minDim=outputDeformationField->ny;
+   if(outputDeformationField->nz>1 && outputDeformationField->nz<minDim)
+      minDim=outputDeformationField->nz;
+   while((minDim+1)/2>=INVERT_MULTIGRID_MIN_SIZE)
+   {
+      minDim=(minDim+1)/2;
+      ++levelNumber;
+   }
+   nifti_image **levelFields=(nifti_image **)malloc(levelNumber*sizeof(nifti_image *));
+   levelFields[0]=outputDeformationField;
+   for(int l=1; l<levelNumber; ++l)
+      levelFields[l]=reg_defFieldInvert_halfResolution(levelFields[l-1]);
+
+   // The levels are processed from the coarsest to the finest
+   double report[4];
+   for(int l=levelNumber-1; l>=0; --l)
+   {
+      nifti_image *coarseField=l<levelNumber-1?levelFields[l+1]:NULL;
+      if(inputDeformationField->datatype==NIFTI_TYPE_FLOAT32)
+         reg_defFieldInvertMultigridLevel<float>
+               (inputDeformationField,levelFields[l],coarseField,
+                tolerance,maxIterationNumber,report);
+      else
+         reg_defFieldInvertMultigridLevel<double>
+               (inputDeformationField,levelFields[l],coarseField,
+                tolerance,maxIterationNumber,report);
+      if(coarseField!=NULL)
+         nifti_image_free(coarseField);
+      if(verbose)
+      {
+         size_t voxelNumber=(size_t)levelFields[l]->nx*levelFields[l]->ny*levelFields[l]->nz;
+         char text[255];
+         sprintf(text, "Level %i/%i - %ix%ix%i voxels - %.2f%% converged - mean residual %g mm - max residual %g mm - mean iteration number %.2f",
+                 levelNumber-l, levelNumber,
+                 levelFields[l]->nx, levelFields[l]->ny, levelFields[l]->nz,
+                 100.*report[0]/(double)voxelNumber,
+                 report[1]/(double)voxelNumber,
+                 report[2],
+                 report[3]/(double)voxelNumber);
+         reg_print_info("reg_defFieldInvertMultigrid", text);
+      }
+   }
+   free(levelFields);
+}
+/* *************************************************************** */
+/* *************************************************************** */
+//HAVE TO BE CHECKED
+template<class DTYPE>
+void reg_spline_cppComposition_2D(nifti_image *grid1,
+                                  nifti_image *grid2,
+                                  bool displacement1,
+                                  bool displacement2,
+                                  bool bspline)
+{
+   // REMINDER Grid2(x)=Grid1(Grid2(x))
+
  #if _USE_SSE
    union
    {
@@ -3742,25 +5143,22 @@ void reg_spline_cppComposition_3D(nifti_image *grid1,
          for(x=0; x<grid2->nx; x++)
          {
             // Get the control point actual position
-            xReal = outCPPPtrX[index];
-            yReal = outCPPPtrY[index];
-            zReal = outCPPPtrZ[index];
-            initialPositionX=0;
-            initialPositionY=0;
-            initialPositionZ=0;
+            xReal = initialPositionX = outCPPPtrX[index];
+            yReal = initialPositionY = outCPPPtrY[index];
+            zReal = initialPositionZ = outCPPPtrZ[index];
             if(displacement2)
             {
-               xReal += initialPositionX =
+               xReal +=
                      matrix_voxel_to_real2->m[0][0]*x
                      + matrix_voxel_to_real2->m[0][1]*y
                      + matrix_voxel_to_real2->m[0][2]*z
                      + matrix_voxel_to_real2->m[0][3];
-               yReal += initialPositionY =
+               yReal +=
                      matrix_voxel_to_real2->m[1][0]*x
                      + matrix_voxel_to_real2->m[1][1]*y
                      + matrix_voxel_to_real2->m[1][2]*z
                      + matrix_voxel_to_real2->m[1][3];
-               zReal += initialPositionZ =
+               zReal +=
                      matrix_voxel_to_real2->m[2][0]*x
                      + matrix_voxel_to_real2->m[2][1]*y
                      + matrix_voxel_to_real2->m[2][2]*z
@@ -3884,11 +5282,12 @@ void reg_spline_cppComposition_3D(nifti_image *grid1,
                }
             }
  #endif
-            if(displacement2)
+            // The displacement of grid1 is added to the grid2 value
+            if(displacement1)
             {
-               xReal -= initialPositionX;
-               yReal -= initialPositionY;
-               zReal -= initialPositionZ;
+               xReal += initialPositionX;
+               yReal += initialPositionY;
+               zReal += initialPositionZ;
             }
             outCPPPtrX[index] = xReal;
             outCPPPtrY[index] = yReal;
@@ -3999,46 +5398,274 @@ void reg_spline_getFlowFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
    velocityFieldGrid->num_ext=oldNumExt;
 }
 /* *************************************************************** */
-void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
-                                                   nifti_image *deformationFieldImage,
-                                                   bool updateStepNumber)
+/* The scaled flow field is converted into a deformation field in a single
+ * pass. The result matches reg_tools_divideValueToImage applied to the
+ * flow field followed by reg_getDeformationFromDisplacement, the flow field
+ * is left unchanged */
+template <class DTYPE>
+static void reg_defField_scaleFlowField(nifti_image *flowFieldImage,
+                                        nifti_image *deformationFieldImage,
+                                        float scalingValue)
 {
-   // Check first if the velocity field is actually a velocity field
-   if(flowFieldImage->intent_p1 != DEF_VEL_FIELD)
+   if(flowFieldImage->scl_slope==0)
+      flowFieldImage->scl_slope=1.f;
+   double slope=flowFieldImage->scl_slope;
+   double inter=flowFieldImage->scl_inter;
+   size_t voxelNumber=(size_t)flowFieldImage->nx*flowFieldImage->ny*flowFieldImage->nz;
+   DTYPE *flowPtrX=static_cast<DTYPE *>(flowFieldImage->data);
+   DTYPE *flowPtrY=&flowPtrX[voxelNumber];
+   DTYPE *flowPtrZ=flowFieldImage->nu>2?&flowPtrY[voxelNumber]:NULL;
+   DTYPE *defPtrX=static_cast<DTYPE *>(deformationFieldImage->data);
+   DTYPE *defPtrY=&defPtrX[voxelNumber];
+   DTYPE *defPtrZ=flowFieldImage->nu>2?&defPtrY[voxelNumber]:NULL;
+
+   mat44 matrix;
+   if(flowFieldImage->sform_code>0)
+      matrix=flowFieldImage->sto_xyz;
+   else matrix=flowFieldImage->qto_xyz;
+
+   int x, y, z;
+   size_t index;
+   float xInit, yInit, zInit;
+   DTYPE xInit2D, yInit2D;
+   if(flowFieldImage->nu>2)
    {
-      reg_print_fct_error("reg_defField_getDeformationFieldFromFlowField");
-      reg_print_msg_error("The provide field is not a velocity field");
-      reg_exit();
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(flowFieldImage, matrix, slope, inter, scalingValue, flowPtrX, flowPtrY, flowPtrZ, \
+   defPtrX, defPtrY, defPtrZ) \
+   private(x, y, z, index, xInit, yInit, zInit)
+#endif
+      for(z=0; z<flowFieldImage->nz; z++)
+      {
+         index=(size_t)z*flowFieldImage->nx*flowFieldImage->ny;
+         for(y=0; y<flowFieldImage->ny; y++)
+         {
+            for(x=0; x<flowFieldImage->nx; x++)
+            {
+               xInit = matrix.m[0][0]*static_cast<float>(x)
+                     + matrix.m[0][1]*static_cast<float>(y)
+                     + matrix.m[0][2]*static_cast<float>(z)
+                     + matrix.m[0][3];
+               yInit = matrix.m[1][0]*static_cast<float>(x)
+                     + matrix.m[1][1]*static_cast<float>(y)
+                     + matrix.m[1][2]*static_cast<float>(z)
+                     + matrix.m[1][3];
+               zInit = matrix.m[2][0]*static_cast<float>(x)
+                     + matrix.m[2][1]*static_cast<float>(y)
+                     + matrix.m[2][2]*static_cast<float>(z)
+                     + matrix.m[2][3];
+               defPtrX[index] = (DTYPE)(((((double)flowPtrX[index]*slope+inter) /
+                                          (double)scalingValue)-inter)/slope) + static_cast<DTYPE>(xInit);
+               defPtrY[index] = (DTYPE)(((((double)flowPtrY[index]*slope+inter) /
+                                          (double)scalingValue)-inter)/slope) + static_cast<DTYPE>(yInit);
+               defPtrZ[index] = (DTYPE)(((((double)flowPtrZ[index]*slope+inter) /
+                                          (double)scalingValue)-inter)/slope) + static_cast<DTYPE>(zInit);
+               index++;
+            }
+         }
+      }
    }
-
-   // Remove the affine component from the flow field
-   nifti_image *affineOnly=NULL;
-   if(flowFieldImage->num_ext>0)
+   else
    {
-      if(flowFieldImage->ext_list[0].edata!=NULL)
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(flowFieldImage, matrix, slope, inter, scalingValue, flowPtrX, flowPtrY, \
+   defPtrX, defPtrY) \
+   private(x, y, index, xInit2D, yInit2D)
+#endif
+      for(y=0; y<flowFieldImage->ny; y++)
       {
-         // Create a field that contains the affine component only
-         affineOnly = nifti_copy_nim_info(deformationFieldImage);
-         affineOnly->data = (void *)calloc(affineOnly->nvox,affineOnly->nbyper);
-         reg_affine_getDeformationField(reinterpret_cast<mat44 *>(flowFieldImage->ext_list[0].edata),
-               affineOnly,
-               false);
-         reg_tools_substractImageToImage(flowFieldImage,affineOnly,flowFieldImage);
+         index=(size_t)y*flowFieldImage->nx;
+         for(x=0; x<flowFieldImage->nx; x++)
+         {
+            xInit2D = matrix.m[0][0]*(DTYPE)x
+                  + matrix.m[0][1]*(DTYPE)y
+                  + matrix.m[0][3];
+            yInit2D = matrix.m[1][0]*(DTYPE)x
+                  + matrix.m[1][1]*(DTYPE)y
+                  + matrix.m[1][3];
+            defPtrX[index] = (DTYPE)(((((double)flowPtrX[index]*slope+inter) /
+                                       (double)scalingValue)-inter)/slope) + xInit2D;
+            defPtrY[index] = (DTYPE)(((((double)flowPtrY[index]*slope+inter) /
+                                       (double)scalingValue)-inter)/slope) + yInit2D;
+            index++;
+         }
       }
    }
-   else reg_getDisplacementFromDeformation(flowFieldImage);
+}
+/* *************************************************************** */
+/* One squaring step of one or several 2D deformation fields that are all
+ * processed within a single parallel loop. Every input field is applied to
+ * itself and the result is saved in the output array */
+template <class DTYPE>
+static void reg_defField_squaring2D(nifti_image **fieldImages,
+                                    void **inputData,
+                                    void **outputData,
+                                    int fieldNumber)
+{
+   reg_composedField<DTYPE> fields[SQUARING_MAX_FIELD_NUMBER];
+   reg_defField_getComposedFields<DTYPE>(fieldImages,fieldNumber,fields);
+   DTYPE *outPtrX[SQUARING_MAX_FIELD_NUMBER], *outPtrY[SQUARING_MAX_FIELD_NUMBER];
+   size_t fieldStart[SQUARING_MAX_FIELD_NUMBER+1];
+   fieldStart[0]=0;
+   for(int f=0; f<fieldNumber; ++f)
+   {
+      // The input arrays are the interpolated fields
+      size_t voxelNumber=(size_t)fieldImages[f]->nx*fieldImages[f]->ny;
+      fields[f].ptrX=static_cast<DTYPE *>(inputData[f]);
+      fields[f].ptrY=&fields[f].ptrX[voxelNumber];
+      outPtrX[f]=static_cast<DTYPE *>(outputData[f]);
+      outPtrY[f]=&outPtrX[f][voxelNumber];
+      fieldStart[f+1]=fieldStart[f]+voxelNumber;
+   }
+#ifdef _WIN32
+   long i;
+   long totalVoxelNumber=(long)fieldStart[fieldNumber];
+#else
+   size_t i;
+   size_t totalVoxelNumber=fieldStart[fieldNumber];
+#endif
 
-   // Compute the number of scaling value to ensure unfolded transformation
+   size_t v;
+   int f;
+   DTYPE realDefX, realDefY;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(totalVoxelNumber, fieldStart, fields, outPtrX, outPtrY) \
+   private(i, f, v, realDefX, realDefY)
+#endif
+   for(i=0; i<totalVoxelNumber; ++i)
+   {
+      f=0;
+      while((size_t)i>=fieldStart[f+1]) ++f;
+      v=(size_t)i-fieldStart[f];
+      realDefX = fields[f].ptrX[v];
+      realDefY = fields[f].ptrY[v];
+      reg_defField_interpolate2D<DTYPE>(fields[f], realDefX, realDefY);
+      outPtrX[f][v]=realDefX;
+      outPtrY[f][v]=realDefY;
+   }// loop over every voxel of every field
+}
+/* *************************************************************** */
+/* One squaring step of one or several 3D deformation fields that are all
+ * processed within a single parallel loop. Every input field is applied to
+ * itself and the result is saved in the output array */
+template <class DTYPE>
+static void reg_defField_squaring3D(nifti_image **fieldImages,
+                                    void **inputData,
+                                    void **outputData,
+                                    int fieldNumber)
+{
+   reg_composedField<DTYPE> fields[SQUARING_MAX_FIELD_NUMBER];
+   reg_defField_getComposedFields<DTYPE>(fieldImages,fieldNumber,fields);
+   DTYPE *outPtrX[SQUARING_MAX_FIELD_NUMBER], *outPtrY[SQUARING_MAX_FIELD_NUMBER],
+         *outPtrZ[SQUARING_MAX_FIELD_NUMBER];
+   size_t fieldStart[SQUARING_MAX_FIELD_NUMBER+1];
+   fieldStart[0]=0;
+   for(int f=0; f<fieldNumber; ++f)
+   {
+      // The input arrays are the interpolated fields
+      size_t voxelNumber=(size_t)fieldImages[f]->nx*fieldImages[f]->ny*fieldImages[f]->nz;
+      fields[f].ptrX=static_cast<DTYPE *>(inputData[f]);
+      fields[f].ptrY=&fields[f].ptrX[voxelNumber];
+      fields[f].ptrZ=&fields[f].ptrY[voxelNumber];
+      outPtrX[f]=static_cast<DTYPE *>(outputData[f]);
+      outPtrY[f]=&outPtrX[f][voxelNumber];
+      outPtrZ[f]=&outPtrY[f][voxelNumber];
+      fieldStart[f+1]=fieldStart[f]+voxelNumber;
+   }
+#ifdef _WIN32
+   long i;
+   long totalVoxelNumber=(long)fieldStart[fieldNumber];
+#else
+   size_t i;
+   size_t totalVoxelNumber=fieldStart[fieldNumber];
+#endif
+
+   size_t v;
+   int f;
+   DTYPE realDef[3];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   shared(totalVoxelNumber, fieldStart, fields, outPtrX, outPtrY, outPtrZ) \
+   private(i, f, v, realDef)
+#endif
+   for(i=0; i<totalVoxelNumber; ++i)
+   {
+      f=0;
+      while((size_t)i>=fieldStart[f+1]) ++f;
+      v=(size_t)i-fieldStart[f];
+      realDef[0] = fields[f].ptrX[v];
+      realDef[1] = fields[f].ptrY[v];
+      realDef[2] = fields[f].ptrZ[v];
+      reg_defField_interpolate3D<DTYPE>(fields[f], realDef);
+      outPtrX[f][v] = realDef[0];
+      outPtrY[f][v] = realDef[1];
+      outPtrZ[f][v] = realDef[2];
+   }// loop over every voxel of every field
+}
+/* *************************************************************** */
+/* One squaring step of one or several deformation fields. The inputData
+ * arrays are applied to themselves and the results are saved in the
+ * outputData arrays */
+static void reg_defField_squaring(nifti_image **fieldImages,
+                                  void **inputData,
+                                  void **outputData,
+                                  int fieldNumber)
+{
+   if(fieldNumber<1 || fieldNumber>SQUARING_MAX_FIELD_NUMBER)
+   {
+      reg_print_fct_error("reg_defField_squaring");
+      reg_print_msg_error("Unsupported number of deformation fields");
+      reg_exit();
+   }
+   for(int f=1; f<fieldNumber; ++f)
+   {
+      if(fieldImages[f]->datatype!=fieldImages[0]->datatype ||
+            fieldImages[f]->nu!=fieldImages[0]->nu)
+      {
+         reg_print_fct_error("reg_defField_squaring");
+         reg_print_msg_error("All deformation fields are expected to have the same type and dimension");
+         reg_exit();
+      }
+   }
+   switch(fieldImages[0]->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      if(fieldImages[0]->nu==2)
+         reg_defField_squaring2D<float>(fieldImages,inputData,outputData,fieldNumber);
+      else reg_defField_squaring3D<float>(fieldImages,inputData,outputData,fieldNumber);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      if(fieldImages[0]->nu==2)
+         reg_defField_squaring2D<double>(fieldImages,inputData,outputData,fieldNumber);
+      else reg_defField_squaring3D<double>(fieldImages,inputData,outputData,fieldNumber);
+      break;
+   default:
+      reg_print_fct_error("reg_defField_squaring");
+      reg_print_msg_error("Deformation field pixel type unsupported");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+/* The number of squaring steps is computed from the largest displacement
+ * so that every scaled displacement remains small. The number of
+ * steps is saved in the intent_p2 field of the displacement image, whose
+ * sign defines the direction of the transformation */
+static int reg_getSquaringStepNumber(nifti_image *displacementImage,
+                                     bool updateStepNumber)
+{
    int squaringNumber = 1;
-   if(updateStepNumber || flowFieldImage->intent_p2==0)
+   if(updateStepNumber || displacementImage->intent_p2==0)
    {
       // Check the largest value
-      float extrema = fabsf(reg_tools_getMinValue(flowFieldImage, -1));
-      float temp = reg_tools_getMaxValue(flowFieldImage, -1);
+      float extrema = fabsf(reg_tools_getMinValue(displacementImage, -1));
+      float temp = reg_tools_getMaxValue(displacementImage, -1);
       extrema=extrema>temp?extrema:temp;
       // Check the values for scaling purpose
       float maxLength;
-      if(deformationFieldImage->nz>1)
+      if(displacementImage->nz>1)
          // 0.2888675 = sqrt(0.5^2/3)
          maxLength=0.28;
       // 0.3535533 = sqrt(0.5^2/2)
@@ -4052,58 +5679,144 @@ void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
       // The minimal number of step is set to 6 by default
       squaringNumber=squaringNumber<6?6:squaringNumber;
       // Set the number of squaring step in the flow field
-      if(fabs(flowFieldImage->intent_p2)!=squaringNumber)
+      if(fabs(displacementImage->intent_p2)!=squaringNumber)
       {
          char text[255];
          sprintf(text, "Changing from %i to %i squaring step (equivalent to scaling down by %i)",
-                static_cast<int>(reg_round(fabs(flowFieldImage->intent_p2))),
+                static_cast<int>(reg_round(fabs(displacementImage->intent_p2))),
                 abs(squaringNumber),
                 (int)pow(2.0f,squaringNumber));
          reg_print_msg_warn(text);
       }
       // Update the number of squaring step required
-      if(flowFieldImage->intent_p2>=0)
-         flowFieldImage->intent_p2 = squaringNumber;
-      else flowFieldImage->intent_p2 = -squaringNumber;
+      if(displacementImage->intent_p2>=0)
+         displacementImage->intent_p2 = squaringNumber;
+      else displacementImage->intent_p2 = -squaringNumber;
+   }
+   else squaringNumber=static_cast<int>(fabsf(displacementImage->intent_p2));
+   return squaringNumber;
+}
+/* *************************************************************** */
+/* The flow field is scaled down and converted into the initial deformation
+ * field of the scaling-and-squaring. The affine component, if any, is removed
+ * first and returned as a deformation field. The number of squaring steps
+ * is returned */
+static int reg_defField_initialiseSquaring(nifti_image *flowFieldImage,
+                                           nifti_image *deformationFieldImage,
+                                           bool updateStepNumber,
+                                           nifti_image **affineOnly)
+{
+   // Check first if the velocity field is actually a velocity field
+   if(flowFieldImage->intent_p1 != DEF_VEL_FIELD)
+   {
+      reg_print_fct_error("reg_defField_getDeformationFieldFromFlowField");
+      reg_print_msg_error("The provide field is not a velocity field");
+      reg_exit();
    }
-   else squaringNumber=static_cast<int>(fabsf(flowFieldImage->intent_p2));
 
-   // The displacement field is scaled
+   // Remove the affine component from the flow field
+   *affineOnly=NULL;
+   if(flowFieldImage->num_ext>0)
+   {
+      if(flowFieldImage->ext_list[0].edata!=NULL)
+      {
+         // Create a field that contains the affine component only
+         *affineOnly = nifti_copy_nim_info(deformationFieldImage);
+         (*affineOnly)->data = (void *)calloc((*affineOnly)->nvox,(*affineOnly)->nbyper);
+         reg_affine_getDeformationField(reinterpret_cast<mat44 *>(flowFieldImage->ext_list[0].edata),
+               *affineOnly,
+               false);
+         reg_tools_substractImageToImage(flowFieldImage,*affineOnly,flowFieldImage);
+      }
+   }
+   else reg_getDisplacementFromDeformation(flowFieldImage);
+
+   // Compute the number of scaling value to ensure unfolded transformation
+   int squaringNumber = reg_getSquaringStepNumber(flowFieldImage,
+                                                  updateStepNumber);
+
+   // The displacement field is scaled and converted into a deformation field
+   // that is directly saved in the output image
    float scalingValue = pow(2.0f,std::abs((float)squaringNumber));
    if(flowFieldImage->intent_p2<0)
       // backward deformation field is scaled down
-      reg_tools_divideValueToImage(flowFieldImage,
-                                   flowFieldImage,
-                                   -scalingValue); // (/-scalingValue)
-   else
-      // forward deformation field is scaled down
-      reg_tools_divideValueToImage(flowFieldImage,
-                                   flowFieldImage,
-                                   scalingValue); // (/scalingValue)
-
-   // Conversion from displacement to deformation
-   reg_getDeformationFromDisplacement(flowFieldImage);
-
-   // The computed scaled deformation field is copied over
-   memcpy(deformationFieldImage->data, flowFieldImage->data,
-          deformationFieldImage->nvox*deformationFieldImage->nbyper);
-
-   // The deformation field is squared
-   for(unsigned short i=0; i<squaringNumber; ++i)
-   {
-      // The deformation field is applied to itself
-      reg_defField_compose(deformationFieldImage,
-                           flowFieldImage,
-                           NULL);
-      // The computed scaled deformation field is copied over
-      memcpy(deformationFieldImage->data, flowFieldImage->data,
-             deformationFieldImage->nvox*deformationFieldImage->nbyper);
+      scalingValue = -scalingValue;
+   switch(flowFieldImage->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_defField_scaleFlowField<float>(flowFieldImage,deformationFieldImage,scalingValue);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_defField_scaleFlowField<double>(flowFieldImage,deformationFieldImage,scalingValue);
+      break;
+   default:
+      reg_print_fct_error("reg_defField_getDeformationFieldFromFlowField");
+      reg_print_msg_error("Only single or double floating precision have been implemented");
+      reg_exit();
+   }
+   return squaringNumber;
+}
+/* *************************************************************** */
+/* The scaled deformation fields are squared. The deformation field images
+ * and the flow field images are used alternately as input and output of
+ * every squaring step so that no copy is required between the steps. The
+ * final fields are saved in the deformation field images */
+static void reg_defField_squareFields(nifti_image **flowFieldImages,
+                                      nifti_image **deformationFieldImages,
+                                      int *squaringNumbers,
+                                      int fieldNumber)
+{
+   void *buffers[SQUARING_MAX_FIELD_NUMBER][2];
+   int current[SQUARING_MAX_FIELD_NUMBER];
+   int maxSquaringNumber=0;
+   for(int f=0; f<fieldNumber; ++f)
+   {
+      buffers[f][0]=deformationFieldImages[f]->data;
+      buffers[f][1]=flowFieldImages[f]->data;
+      current[f]=0;
+      maxSquaringNumber=squaringNumbers[f]>maxSquaringNumber?squaringNumbers[f]:maxSquaringNumber;
+   }
+   nifti_image *fieldImages[SQUARING_MAX_FIELD_NUMBER];
+   void *inputData[SQUARING_MAX_FIELD_NUMBER];
+   void *outputData[SQUARING_MAX_FIELD_NUMBER];
+   for(int i=0; i<maxSquaringNumber; ++i)
+   {
+      // Only the fields that still require a squaring step are processed
+      int activeNumber=0;
+      for(int f=0; f<fieldNumber; ++f)
+      {
+         if(i<squaringNumbers[f])
+         {
+            fieldImages[activeNumber]=deformationFieldImages[f];
+            inputData[activeNumber]=buffers[f][current[f]];
+            outputData[activeNumber]=buffers[f][1-current[f]];
+            current[f]=1-current[f];
+            ++activeNumber;
+         }
+      }
+      // The deformation fields are applied to themselves
+      reg_defField_squaring(fieldImages,inputData,outputData,activeNumber);
 #ifndef NDEBUG
       char text[255];
-      sprintf(text, "Squaring (composition) step %u/%u", i+1, squaringNumber);
+      sprintf(text, "Squaring (composition) step %i/%i", i+1, maxSquaringNumber);
       reg_print_msg_debug(text);
 #endif
    }
+   // The final fields are copied over if they are stored in the flow fields
+   for(int f=0; f<fieldNumber; ++f)
+   {
+      if(current[f]==1)
+         memcpy(deformationFieldImages[f]->data, flowFieldImages[f]->data,
+                deformationFieldImages[f]->nvox*deformationFieldImages[f]->nbyper);
+   }
+}
+/* *************************************************************** */
+/* The affine component of the transformation is restored and an additional
+ * affine transformation is composed if required */
+static void reg_defField_finaliseSquaring(nifti_image *flowFieldImage,
+                                          nifti_image *deformationFieldImage,
+                                          nifti_image *affineOnly)
+{
    // The affine conponent of the transformation is restored
    if(affineOnly!=NULL)
    {
@@ -4123,6 +5836,41 @@ void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
    }
 }
 /* *************************************************************** */
+void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
+                                                   nifti_image *deformationFieldImage,
+                                                   bool updateStepNumber)
+{
+   nifti_image *affineOnly=NULL;
+   int squaringNumber=reg_defField_initialiseSquaring(flowFieldImage,
+                                                      deformationFieldImage,
+                                                      updateStepNumber,
+                                                      &affineOnly);
+   // The deformation field is squared
+   reg_defField_squareFields(&flowFieldImage,
+                             &deformationFieldImage,
+                             &squaringNumber,
+                             1);
+   reg_defField_finaliseSquaring(flowFieldImage,
+                                 deformationFieldImage,
+                                 affineOnly);
+}
+/* *************************************************************** */
+/* An image is created to store the flow field of a velocity grid */
+static nifti_image *reg_spline_createFlowField(nifti_image *velocityFieldGrid,
+                                               nifti_image *deformationFieldImage)
+{
+   nifti_image *flowField = nifti_copy_nim_info(deformationFieldImage);
+   flowField->data = (void *)calloc(flowField->nvox,flowField->nbyper);
+   flowField->intent_code=NIFTI_INTENT_VECTOR;
+   memset(flowField->intent_name, 0, 16);
+   strcpy(flowField->intent_name,"NREG_TRANS");
+   flowField->intent_p1=DEF_VEL_FIELD;
+   flowField->intent_p2=velocityFieldGrid->intent_p2;
+   if(velocityFieldGrid->num_ext>0)
+      nifti_copy_extensions(flowField, velocityFieldGrid);
+   return flowField;
+}
+/* *************************************************************** */
 void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
                                             nifti_image *deformationFieldImage,
                                             bool updateStepNumber)
@@ -4144,15 +5892,8 @@ void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
    else if(velocityFieldGrid->intent_p1 == SPLINE_VEL_GRID)
    {
       // Create an image to store the flow field
-      nifti_image *flowField = nifti_copy_nim_info(deformationFieldImage);
-      flowField->data = (void *)calloc(flowField->nvox,flowField->nbyper);
-      flowField->intent_code=NIFTI_INTENT_VECTOR;
-      memset(flowField->intent_name, 0, 16);
-      strcpy(flowField->intent_name,"NREG_TRANS");
-      flowField->intent_p1=DEF_VEL_FIELD;
-      flowField->intent_p2=velocityFieldGrid->intent_p2;
-      if(velocityFieldGrid->num_ext>0)
-         nifti_copy_extensions(flowField, velocityFieldGrid);
+      nifti_image *flowField = reg_spline_createFlowField(velocityFieldGrid,
+                                                          deformationFieldImage);
 
       // Generate the velocity field
       reg_spline_getFlowFieldFromVelocityGrid(velocityFieldGrid,
@@ -4175,6 +5916,265 @@ void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
    return;
 }
 /* *************************************************************** */
+void reg_spline_getDefFieldsFromVelocityGrids(nifti_image *forwardVelocityGrid,
+                                              nifti_image *backwardVelocityGrid,
+                                              nifti_image *forwardDeformationField,
+                                              nifti_image *backwardDeformationField,
+                                              bool updateStepNumber)
+{
+   // Both fields are exponentiated jointly only if both are velocity grids
+   // that are integrated into fields of identical type
+   if(forwardVelocityGrid->intent_p1 != SPLINE_VEL_GRID ||
+         backwardVelocityGrid->intent_p1 != SPLINE_VEL_GRID ||
+         forwardDeformationField->datatype != backwardDeformationField->datatype ||
+         forwardDeformationField->nu != backwardDeformationField->nu)
+   {
+      reg_spline_getDefFieldFromVelocityGrid(forwardVelocityGrid,
+                                             forwardDeformationField,
+                                             updateStepNumber);
+      backwardVelocityGrid->intent_p2=forwardVelocityGrid->intent_p2;
+      reg_spline_getDefFieldFromVelocityGrid(backwardVelocityGrid,
+                                             backwardDeformationField,
+                                             false);
+      return;
+   }
+   // Clean any extension in the deformation fields as it is unexpected
+   nifti_free_extensions(forwardDeformationField);
+   nifti_free_extensions(backwardDeformationField);
+
+   nifti_image *flowFields[2];
+   nifti_image *deformationFields[2]= {forwardDeformationField, backwardDeformationField};
+   nifti_image *affineOnly[2];
+   int squaringNumbers[2];
+
+   // The forward flow field is generated and scaled first as it defines the
+   // number of squaring steps
+   flowFields[0] = reg_spline_createFlowField(forwardVelocityGrid,
+                                              forwardDeformationField);
+   reg_spline_getFlowFieldFromVelocityGrid(forwardVelocityGrid,
+                                           flowFields[0]);
+   squaringNumbers[0]=reg_defField_initialiseSquaring(flowFields[0],
+                                                      forwardDeformationField,
+                                                      updateStepNumber,
+                                                      &affineOnly[0]);
+   forwardVelocityGrid->intent_p2=flowFields[0]->intent_p2;
+
+   // The number of step number is copied over from the forward transformation
+   backwardVelocityGrid->intent_p2=forwardVelocityGrid->intent_p2;
+   flowFields[1] = reg_spline_createFlowField(backwardVelocityGrid,
+                                              backwardDeformationField);
+   reg_spline_getFlowFieldFromVelocityGrid(backwardVelocityGrid,
+                                           flowFields[1]);
+   squaringNumbers[1]=reg_defField_initialiseSquaring(flowFields[1],
+                                                      backwardDeformationField,
+                                                      false,
+                                                      &affineOnly[1]);
+   backwardVelocityGrid->intent_p2=flowFields[1]->intent_p2;
+
+   // Both deformation fields are squared concurrently
+   reg_defField_squareFields(flowFields,
+                             deformationFields,
+                             squaringNumbers,
+                             2);
+   for(int f=0; f<2; ++f)
+   {
+      reg_defField_finaliseSquaring(flowFields[f],
+                                    deformationFields[f],
+                                    affineOnly[f]);
+      nifti_image_free(flowFields[f]);
+   }
+}
+/* *************************************************************** */
+/** Generates a dense deformation field from a squared cubic B-Spline grid.
+ * The grid is not necessarily aligned with the field voxels, as for the
+ * symmetric grids, hence the field is generated by composition with an
+ * identity transformation.
+ */
+static void reg_spline_getDefFieldFromSquaredGrid(nifti_image *squaredGrid,
+                                                  nifti_image *deformationFieldImage)
+{
+   reg_tools_multiplyValueToImage(deformationFieldImage, deformationFieldImage, 0.f);
+   deformationFieldImage->intent_p1=DISP_FIELD;
+   reg_getDeformationFromDisplacement(deformationFieldImage);
+   reg_spline_getDeformationField(squaredGrid,
+                                  deformationFieldImage,
+                                  NULL, // mask
+                                  true, // composition
+                                  true // bspline
+                                  );
+   deformationFieldImage->intent_p1=DEF_FIELD;
+   deformationFieldImage->intent_p2=0;
+}
+/* *************************************************************** */
+/** Exponentiates a velocity grid by squaring its control point positions
+ * and returns the squared cubic B-Spline grid, to be freed by the caller.
+ * When intermediateFields is not NULL, the dense deformation fields of the
+ * scaled grid and of every squared grid are stored in it.
+ */
+static nifti_image *reg_spline_squareVelocityGrid(nifti_image *velocityFieldGrid,
+                                                  bool updateStepNumber,
+                                                  nifti_image **intermediateFields)
+{
+   // Create the grids used to store the squared transformation and its
+   // values at the control point positions. All grids hold displacements
+   // so that the rounding errors are not doubled at every squaring step
+   nifti_image *squaredGrid = nifti_copy_nim_info(velocityFieldGrid);
+   nifti_free_extensions(squaredGrid);
+   squaredGrid->data = (void *)malloc(squaredGrid->nvox*squaredGrid->nbyper);
+   memcpy(squaredGrid->data, velocityFieldGrid->data,
+          squaredGrid->nvox*squaredGrid->nbyper);
+   nifti_image *positionGrid = nifti_copy_nim_info(squaredGrid);
+   positionGrid->data = (void *)malloc(positionGrid->nvox*positionGrid->nbyper);
+   positionGrid->intent_p1=CUB_SPLINE_GRID;
+   positionGrid->intent_p2=0;
+   nifti_image *composedGrid = nifti_copy_nim_info(positionGrid);
+   composedGrid->data = (void *)malloc(composedGrid->nvox*composedGrid->nbyper);
+
+   // The control point positions are converted into displacements as the
+   // cubic B-Spline reproduces the identity transformation
+   reg_getDisplacementFromDeformation(squaredGrid);
+
+   // Compute the number of scaling value to ensure unfolded transformation
+   int squaringNumber = reg_getSquaringStepNumber(squaredGrid,
+                                                  updateStepNumber);
+   velocityFieldGrid->intent_p2=squaredGrid->intent_p2;
+
+   // The displacement grid is scaled
+   float scalingValue = pow(2.0f,std::abs((float)squaringNumber));
+   if(squaredGrid->intent_p2<0)
+      // backward transformation is scaled down
+      scalingValue = -scalingValue;
+   reg_tools_divideValueToImage(squaredGrid,
+                                squaredGrid,
+                                scalingValue);
+
+   // The control point grid is squared. With T the transformation, c its
+   // control point positions and p the initial control point positions,
+   // the grid of T(T) is approximated by 2c + T(T(p)) - 2T(p). The linear
+   // part of the displacement is thus exactly doubled and only the
+   // non-linear residual is approximated at the control point positions
+   for(int i=0; i<=squaringNumber; ++i)
+   {
+      // The intermediate deformation field is generated from the current grid
+      if(intermediateFields!=NULL)
+      {
+         memcpy(composedGrid->data, squaredGrid->data,
+                composedGrid->nvox*composedGrid->nbyper);
+         reg_getDeformationFromDisplacement(composedGrid);
+         reg_spline_getDefFieldFromSquaredGrid(composedGrid,
+                                               intermediateFields[i]);
+      }
+      if(i==squaringNumber) break;
+      // T(p)-p is computed at the control point positions
+      memset(positionGrid->data, 0,
+             positionGrid->nvox*positionGrid->nbyper);
+      reg_spline_cppComposition(squaredGrid,
+                                positionGrid,
+                                true, // displacement
+                                true, // displacement
+                                true // bspline
+                                );
+      // T(T(p))-p is computed at the control point positions
+      memcpy(composedGrid->data, positionGrid->data,
+             composedGrid->nvox*composedGrid->nbyper);
+      reg_spline_cppComposition(squaredGrid,
+                                composedGrid,
+                                true, // displacement
+                                true, // displacement
+                                true // bspline
+                                );
+      // The control point displacements are updated
+      reg_tools_multiplyValueToImage(squaredGrid,squaredGrid,2.f);
+      reg_tools_addImageToImage(squaredGrid,composedGrid,squaredGrid);
+      reg_tools_multiplyValueToImage(positionGrid,positionGrid,2.f);
+      reg_tools_substractImageToImage(squaredGrid,positionGrid,squaredGrid);
+#ifndef NDEBUG
+      char text[255];
+      sprintf(text, "Grid squaring (composition) step %i/%i", i+1, squaringNumber);
+      reg_print_msg_debug(text);
+#endif
+   }
+   nifti_image_free(positionGrid);
+   nifti_image_free(composedGrid);
+
+   // The squared grid is converted back into control point positions
+   reg_getDeformationFromDisplacement(squaredGrid);
+   squaredGrid->intent_p1=CUB_SPLINE_GRID;
+   squaredGrid->intent_p2=0;
+   return squaredGrid;
+}
+/* *************************************************************** */
+void reg_spline_getDefFieldFromVelocityGridSquaring(nifti_image *velocityFieldGrid,
+                                                    nifti_image *deformationFieldImage,
+                                                    bool updateStepNumber)
+{
+   // The grid squaring is only used for velocity grids without affine
+   // initialisation, the dense scaling-and-squaring is used otherwise
+   bool affineInitialisation=false;
+   if(velocityFieldGrid->num_ext>0)
+      affineInitialisation=velocityFieldGrid->ext_list[0].edata!=NULL;
+   if(velocityFieldGrid->intent_p1 != SPLINE_VEL_GRID || affineInitialisation)
+   {
+      reg_spline_getDefFieldFromVelocityGrid(velocityFieldGrid,
+                                             deformationFieldImage,
+                                             updateStepNumber);
+      return;
+   }
+   // Clean any extension in the deformation field as it is unexpected
+   nifti_free_extensions(deformationFieldImage);
+
+   // The velocity grid is squared
+   nifti_image *squaredGrid = reg_spline_squareVelocityGrid(velocityFieldGrid,
+                                                            updateStepNumber,
+                                                            NULL);
+
+   // The dense deformation field is only generated from the squared grid
+   reg_spline_getDefFieldFromSquaredGrid(squaredGrid,
+                                         deformationFieldImage);
+   nifti_image_free(squaredGrid);
+   // If required an affine component is composed
+   if(velocityFieldGrid->num_ext>1)
+   {
+      reg_affine_getDeformationField(reinterpret_cast<mat44 *>(velocityFieldGrid->ext_list[1].edata),
+            deformationFieldImage,
+            true);
+   }
+}
+/* *************************************************************** */
+void reg_spline_getIntermediateDefFieldFromVelGridSquaring(nifti_image *velocityFieldGrid,
+                                                           nifti_image **deformationFieldImage)
+{
+   // The grid squaring is only used for velocity grids without affine
+   // initialisation, the dense scaling-and-squaring is used otherwise
+   bool affineInitialisation=false;
+   if(velocityFieldGrid->num_ext>0)
+      affineInitialisation=velocityFieldGrid->ext_list[0].edata!=NULL;
+   if(velocityFieldGrid->intent_p1 != SPLINE_VEL_GRID || affineInitialisation)
+   {
+      reg_spline_getIntermediateDefFieldFromVelGrid(velocityFieldGrid,
+                                                    deformationFieldImage);
+      return;
+   }
+
+   // The velocity grid is squared using its current number of squaring steps
+   // and every intermediate grid is converted into a dense deformation field
+   nifti_image *squaredGrid = reg_spline_squareVelocityGrid(velocityFieldGrid,
+                                                            false,
+                                                            deformationFieldImage);
+   nifti_image_free(squaredGrid);
+   int squaringNumber = static_cast<int>(fabsf(velocityFieldGrid->intent_p2));
+   // If required an affine component is composed
+   if(velocityFieldGrid->num_ext>1)
+   {
+      for(int i=0; i<=squaringNumber; ++i)
+      {
+         reg_affine_getDeformationField(reinterpret_cast<mat44 *>(velocityFieldGrid->ext_list[1].edata),
+               deformationFieldImage[i],
+               true);
+      }
+   }
+}
+/* *************************************************************** */
 /* *************************************************************** */
 void reg_spline_getIntermediateDefFieldFromVelGrid(nifti_image *velocityFieldGrid,
                                                    nifti_image **deformationFieldImage)
@@ -4239,13 +6239,12 @@ void reg_spline_getIntermediateDefFieldFromVelGrid(nifti_image *velocityFieldGri
       // The deformation field is squared
       for(unsigned short i=0; i<squaringNumber; ++i)
       {
-         // The computed scaled deformation field is copied over
-         memcpy(deformationFieldImage[i+1]->data, deformationFieldImage[i]->data,
-               deformationFieldImage[i]->nvox*deformationFieldImage[i]->nbyper);
-         // The deformation field is applied to itself
-         reg_defField_compose(deformationFieldImage[i], // to apply
-                              deformationFieldImage[i+1], // to update
-               NULL);
+         // The deformation field is applied to itself and the result is
+         // directly saved in the next intermediate field
+         reg_defField_squaring(&deformationFieldImage[i],
+                               &deformationFieldImage[i]->data, // to apply
+                               &deformationFieldImage[i+1]->data, // to update
+                               1);
    #ifndef NDEBUG
          char text[255];
          sprintf(text, "Squaring (composition) step %u/%u", i+1, squaringNumber);
@@ -69,6 +69,57 @@ void reg_spline_getDeformationField(nifti_image *controlPointGridImage,
                                     bool bspline = true,
                                     bool force_no_lut = false);
 /* *************************************************************** */
+/** @brief Resample a floating image using a cubic B-spline parametrised
+ * transformation without storing the full deformation field. The
+ * transformation is evaluated slab by slab and every slab is resampled
+ * straight away, which reduces both the memory footprint and the memory
+ * traffic compared to reg_spline_getDeformationField followed by
+ * reg_resampleImage. Only 3D cubic spline grids without affine
+ * extension are evaluated slab by slab, the other grids are applied
+ * through a full deformation field.
+ * @param controlPointGridImage Control point grid that contains the deformation
+ * parametrisation
+ * @param floatingImage Image to resample
+ * @param warpedImage Output image, defined in the reference space, that will
+ * be populated with the resampled intensities
+ * @param mask Array that contains the a mask. Any voxel with a positive value is included
+ * into the mask
+ * @param interp Interpolation order as used in reg_resampleImage
+ * @param paddingValue Value assigned to the voxels outside of the mask or
+ * warped outside of the floating image
+ * @param bspline A cubic B-Spline scheme is used if the value is set to true,
+ * a cubic spline scheme is used otherwise (interpolant spline).
+ */
+extern "C++"
+void reg_spline_getWarpedImage(nifti_image *controlPointGridImage,
+                               nifti_image *floatingImage,
+                               nifti_image *warpedImage,
+                               int *mask,
+                               int interp,
+                               float paddingValue,
+                               bool bspline = true);
+/* *************************************************************** */
+/** @brief Compute a slab of the deformation field parametrised by a 3D
+ * cubic spline grid. Only 3D cubic spline grids without affine
+ * extension are supported.
+ * @param controlPointGridImage Control point grid that contains the deformation
+ * parametrisation
+ * @param deformationField Header of the reference image whose dimension along
+ * z is the number of slices of the slab. Its data array is filled with the
+ * deformation of the slices [firstSlice, firstSlice+deformationField->nz[
+ * @param firstSlice Index of the first reference slice of the slab
+ * @param mask Array that contains the mask of the full reference image. The
+ * voxels outside of the mask are set to zero
+ * @param bspline A cubic B-Spline scheme is used if the value is set to true,
+ * a cubic spline scheme is used otherwise (interpolant spline).
+ */
+extern "C++"
+void reg_spline_getDeformationFieldSlab(nifti_image *controlPointGridImage,
+                                        nifti_image *deformationField,
+                                        int firstSlice,
+                                        int *mask = NULL,
+                                        bool bspline = true);
+/* *************************************************************** */
 /** @brief Upsample an image from voxel space to node space using
  * millimiter correspendences.
  * @param nodeImage This image is a coarse representation of the
@@ -89,6 +140,32 @@ void reg_voxelCentric2NodeCentric(nifti_image *nodeImage,
                                   mat44 *voxelToMillimeter = NULL
       );
 /* *************************************************************** */
+/** @brief Accumulate a slab of a voxel-based gradient onto the nodes.
+ * Calling this function for every slab of an image is equivalent to
+ * smoothing the full image along every axis with a cubic spline kernel of
+ * the node spacing, as done in reg_f3d, and calling
+ * reg_voxelCentric2NodeCentric with update set to true. The grid axes
+ * have to be aligned with the image axes and affine extensions are not
+ * supported.
+ * @param nodeImage Grid of control point whose values are incremented
+ * @param voxelImage Header of the reference image whose dimension along z
+ * is the number of slices of the slab and that contains the dense values
+ * of the slices [firstSlice, firstSlice+voxelImage->nz[
+ * @param firstSlice Index of the first reference slice of the slab
+ * @param sliceNumber Number of slices of the full reference image
+ * @param weight The values from used to update the node image
+ * will be multiplied by the weight
+ * @param voxelToMillimeter Orientation used to reorient the values
+ */
+extern "C++"
+void reg_voxelCentric2NodeCentric_slab(nifti_image *nodeImage,
+                                       nifti_image *voxelImage,
+                                       int firstSlice,
+                                       int sliceNumber,
+                                       float weight,
+                                       mat44 *voxelToMillimeter = NULL
+      );
+/* *************************************************************** */
 /** @brief Refine a grid of control points
  * @param referenceImage Image that defined the space of the reference
  * image
@@ -139,6 +216,25 @@ void reg_defField_compose(nifti_image *deformationField,
                           nifti_image *dfToUpdate,
                           int *mask);
 /* *************************************************************** */
+/** @brief Preforms the composition of a chain of deformation fields
+ * in a single pass: dfToUpdate(x) <= fieldN(...field1(dfToUpdate(x))).
+ * No intermediate field is generated and the voxels are processed by
+ * tiles, visited along a Z-order curve, to improve the memory locality.
+ * @param deformationFields Array of images that contain the deformation
+ * fields that will be applied, in order
+ * @param fieldNumber Number of deformation fields in the chain
+ * @param dfToUpdate Image that contains the deformation field that
+ * is being updated
+ * @param mask Mask overlaid on the dfToUpdate field where only voxel
+ * within the mask will be updated. All positive values in the maks
+ * are considered as belonging to the mask.
+ */
+extern "C++"
+void reg_defField_composeChain(nifti_image **deformationFields,
+                               int fieldNumber,
+                               nifti_image *dfToUpdate,
+                               int *mask);
+/* *************************************************************** */
 /** @brief Compute the inverse of a deformation field
  * @author Marcel van Herk (CMIC / NKI / AVL)
  * @param inputDeformationField Image that contains the deformation
@@ -153,6 +249,31 @@ void reg_defFieldInvert(nifti_image *inputDeformationField,
                         nifti_image *outputDeformationField,
                         float tolerance);
 /* *************************************************************** */
+/** @brief Compute the inverse of a deformation field using a
+ * multiresolution fixed-point scheme. The inverse is first estimated
+ * on a coarse version of the output grid and upsampled to initialise
+ * the next finer level, where every voxel position y is refined using
+ * y = y - (phi(y) - x) until the residual falls below the tolerance.
+ * It is considerably faster than reg_defFieldInvert for dense fields.
+ * Only 3D deformation fields are supported.
+ * @param inputDeformationField Image that contains the deformation
+ * field to invert.
+ * @param outputDeformationField Image that will contains the inverse
+ * of the input deformation field
+ * @param tolerance Maximal residual distance, in mm, between phi(y)
+ * and the position of the output voxel
+ * @param maxIterationNumber Maximal number of fixed-point iterations
+ * performed per voxel and per level
+ * @param verbose A convergence report is printed for every level
+ * when set to true
+ */
+extern "C++"
+void reg_defFieldInvertMultigrid(nifti_image *inputDeformationField,
+                                 nifti_image *outputDeformationField,
+                                 float tolerance,
+                                 int maxIterationNumber,
+                                 bool verbose = false);
+/* *************************************************************** */
 extern "C++"
 void reg_defField_getDeformationFieldFromFlowField(nifti_image *flowFieldImage,
                                                    nifti_image *deformationFieldImage,
@@ -171,10 +292,60 @@ void reg_spline_getDefFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
                                             nifti_image *deformationFieldImage,
                                             bool updateStepNumber);
 /* *************************************************************** */
+/** @brief The forward and backward deformation fields are computed
+ * by integrating a pair of velocity grids. Both flow fields are
+ * exponentiated concurrently, the number of squaring steps of the
+ * forward grid is used for the backward grid.
+ * @param forwardVelocityGrid Velocity grid of the forward transformation
+ * @param backwardVelocityGrid Velocity grid of the backward transformation
+ * @param forwardDeformationField Deformation field image that will be
+ * filled using the exponentiation of the forward velocity field
+ * @param backwardDeformationField Deformation field image that will be
+ * filled using the exponentiation of the backward velocity field
+ * @param updateStepNumber The number of squaring steps is updated if true
+ */
+extern "C++"
+void reg_spline_getDefFieldsFromVelocityGrids(nifti_image *forwardVelocityGrid,
+                                              nifti_image *backwardVelocityGrid,
+                                              nifti_image *forwardDeformationField,
+                                              nifti_image *backwardDeformationField,
+                                              bool updateStepNumber);
+/* *************************************************************** */
+/** @brief The deformation field is computed by integrating a velocity
+ * grid at the control point resolution. The scaling-and-squaring is
+ * performed by composing the control point grid with itself and the
+ * deformation field is only generated from the final grid. The
+ * dense integration is used for grids with an affine initialisation.
+ * @param velocityFieldGrid Image that contains a velocity field
+ * parametrised using a grid of control points
+ * @param deformationFieldImage Deformation field image that will
+ * be filled using the exponentiation of the velocity field.
+ * @param updateStepNumber The number of squaring steps is updated if true
+ */
+extern "C++"
+void reg_spline_getDefFieldFromVelocityGridSquaring(nifti_image *velocityFieldGrid,
+                                                    nifti_image *deformationFieldImage,
+                                                    bool updateStepNumber);
+/* *************************************************************** */
 extern "C++"
 void reg_spline_getIntermediateDefFieldFromVelGrid(nifti_image *velocityFieldGrid,
                                                    nifti_image **deformationFieldImage);
 /* *************************************************************** */
+/** @brief Generates the intermediate deformation fields of the grid
+ * squaring exponentiation, as used by reg_spline_getDefFieldFromVelocityGridSquaring.
+ * The last field is the deformation field returned by that function, so
+ * gradients resampled through these fields match the objective value.
+ * Velocity grids with an affine initialisation use the dense fields from
+ * reg_spline_getIntermediateDefFieldFromVelGrid instead.
+ * @param velocityFieldGrid Image that contains the velocity field
+ * parametrisation. Its number of squaring steps is not updated.
+ * @param deformationFieldImage Array of |intent_p2|+1 deformation fields
+ * that are filled from the scaled grid and from every squared grid
+ */
+extern "C++"
+void reg_spline_getIntermediateDefFieldFromVelGridSquaring(nifti_image *velocityFieldGrid,
+                                                           nifti_image **deformationFieldImage);
+/* *************************************************************** */
 extern "C++"
 void reg_spline_getFlowFieldFromVelocityGrid(nifti_image *velocityFieldGrid,
                                              nifti_image *flowField);
@@ -11,6 +11,10 @@
 
 #include "_reg_localTrans_regul.h"
 
+// Number of control points along the x-axis processed at once by the
+// stencil-based bending energy
+#define BENDING_ENERGY_BLOCK_SIZE 64
+
 /* *************************************************************** */
 /* *************************************************************** */
 template<class DTYPE>
@@ -540,6 +544,461 @@ void reg_spline_approxBendingEnergyGradient(nifti_image *splineControlPoint,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/* The bending energy is a quadratic form of the control point
+ * displacements. Its gradient is therefore the convolution of the
+ * displacements with a 5x5(x5) stencil, obtained by composing the 3x3(x3)
+ * second order basis values with themselves. The displacements are
+ * copied into a buffer padded with two layers of zeros so that both
+ * stencils are applied without boundary checks. The nodes located on
+ * the grid faces are then corrected for the neighbours that fall
+ * outside of the grid, which are ignored by the approximation */
+template<class DTYPE>
+double reg_spline_approxBendingEnergyStencil2D(nifti_image *splineControlPoint,
+                                               nifti_image *gradientImage,
+                                               float weight,
+                                               bool computeValue)
+{
+   int nx = splineControlPoint->nx;
+   int ny = splineControlPoint->ny;
+   size_t nodeNumber = (size_t)nx*ny;
+   int paddedDim[2] = {nx+4, ny+4};
+   size_t paddedNodeNumber = (size_t)paddedDim[0]*paddedDim[1];
+   int a, b, d, i, k, s, x, y, blockStart, blockEnd, xStart, xEnd;
+
+   // get the constant basis values, the cross derivative is counted twice
+   DTYPE basis[3][9];
+   set_second_order_bspline_basis_values(basis[0], basis[1], basis[2]);
+   double basisWeight[3] = {1., 1., 2.};
+
+   // Offsets of the 3x3 neighbours in the padded buffer
+   int neighbourOffset[9];
+   i=0;
+   for(b=-1; b<2; ++b)
+      for(a=-1; a<2; ++a)
+         neighbourOffset[i++] = b*paddedDim[0]+a;
+
+   // Weights of every pair of neighbours and the resulting 5x5 stencil
+   DTYPE pairWeight[81];
+   double stencilValue[25]= {0.};
+   for(a=0; a<9; ++a)
+   {
+      for(b=0; b<9; ++b)
+      {
+         double value = 0.;
+         for(k=0; k<3; ++k)
+            value += basisWeight[k] * basis[k][a] * basis[k][b];
+         pairWeight[a*9+b] = (DTYPE)value;
+         stencilValue[(a/3+b/3)*5 + a%3+b%3] += value;
+      }
+   }
+   // The stencil is stored by rows of five weights along the x-axis
+   DTYPE stencil[25];
+   int stencilOffset[5], stencilNumber=0;
+   for(i=0; i<5; ++i)
+   {
+      if(stencilValue[i*5]!=0. || stencilValue[i*5+1]!=0. || stencilValue[i*5+2]!=0. ||
+            stencilValue[i*5+3]!=0. || stencilValue[i*5+4]!=0.)
+      {
+         for(a=0; a<5; ++a)
+            stencil[stencilNumber*5+a] = (DTYPE)stencilValue[i*5+a];
+         stencilOffset[stencilNumber] = (i-2)*paddedDim[0];
+         ++stencilNumber;
+      }
+   }
+
+   // Copy the displacements into the padded buffer
+   DTYPE *splinePtrX = static_cast<DTYPE *>(splineControlPoint->data);
+   DTYPE *splinePtrY = &splinePtrX[nodeNumber];
+   DTYPE *displacement = (DTYPE *)calloc(2*paddedNodeNumber, sizeof(DTYPE));
+   mat44 matrix;
+   if(splineControlPoint->sform_code>0)
+      matrix=splineControlPoint->sto_xyz;
+   else matrix=splineControlPoint->qto_xyz;
+   size_t index, paddedIndex;
+   float xInit, yInit;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+   shared(nx, ny, paddedDim, paddedNodeNumber, matrix, splinePtrX, splinePtrY, displacement) \
+   private(x, y, index, paddedIndex, xInit, yInit)
+#endif
+   for(y=0; y<ny; ++y)
+   {
+      index = (size_t)y*nx;
+      paddedIndex = (size_t)(y+2)*paddedDim[0]+2;
+      for(x=0; x<nx; ++x)
+      {
+         xInit = matrix.m[0][0]*static_cast<float>(x)
+               + matrix.m[0][1]*static_cast<float>(y)
+               + matrix.m[0][3];
+         yInit = matrix.m[1][0]*static_cast<float>(x)
+               + matrix.m[1][1]*static_cast<float>(y)
+               + matrix.m[1][3];
+         displacement[paddedIndex] = splinePtrX[index] - static_cast<DTYPE>(xInit);
+         displacement[paddedNodeNumber+paddedIndex] = splinePtrY[index] - static_cast<DTYPE>(yInit);
+         ++index;
+         ++paddedIndex;
+      }
+   }
+
+   DTYPE *gradientPtr[2] = {NULL, NULL};
+   if(gradientImage!=NULL)
+   {
+      gradientPtr[0] = static_cast<DTYPE *>(gradientImage->data);
+      gradientPtr[1] = &gradientPtr[0][nodeNumber];
+   }
+   DTYPE approxRatio = (DTYPE)weight / (DTYPE)nodeNumber;
+
+   // The value and the gradient are computed in a single sweep over blocks of nodes
+   DTYPE *rowPtr, *neighbourPtr, *weightPtr;
+   DTYPE derivative[BENDING_ENERGY_BLOCK_SIZE], gradientValue[BENDING_ENERGY_BLOCK_SIZE];
+   bool interiorRow;
+   double constraintValue=0.0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+   shared(nx, ny, paddedDim, paddedNodeNumber, displacement, gradientImage, gradientPtr, \
+   basis, basisWeight, neighbourOffset, pairWeight, stencil, stencilOffset, stencilNumber, \
+   approxRatio, computeValue) \
+   private(a, d, i, k, s, x, blockStart, blockEnd, xStart, xEnd, rowPtr, neighbourPtr, \
+   weightPtr, derivative, gradientValue, interiorRow) \
+   reduction(+:constraintValue)
+#endif
+   for(y=0; y<ny; ++y)
+   {
+      interiorRow = y>0 && y<ny-1;
+      for(blockStart=0; blockStart<nx; blockStart+=BENDING_ENERGY_BLOCK_SIZE)
+      {
+         blockEnd = blockStart+BENDING_ENERGY_BLOCK_SIZE<nx?blockStart+BENDING_ENERGY_BLOCK_SIZE:nx;
+         for(d=0; d<2; ++d)
+         {
+            // Pointer to the first node of the row
+            rowPtr = &displacement[d*paddedNodeNumber + (size_t)(y+2)*paddedDim[0] + 2];
+            // The value is only computed at the nodes that are not on the boundary
+            if(computeValue && interiorRow)
+            {
+               xStart = blockStart>1?blockStart:1;
+               xEnd = blockEnd<nx-1?blockEnd:nx-1;
+               for(k=0; k<3; ++k)
+               {
+                  for(x=xStart; x<xEnd; ++x)
+                     derivative[x-blockStart] = 0;
+                  for(i=0; i<9; i+=3)
+                  {
+                     weightPtr = &basis[k][i];
+                     // The rows of the cross derivatives can be null
+                     if(weightPtr[0]==0 && weightPtr[1]==0 && weightPtr[2]==0) continue;
+                     neighbourPtr = &rowPtr[neighbourOffset[i+1]];
+                     for(x=xStart; x<xEnd; ++x)
+                        derivative[x-blockStart] +=
+                              weightPtr[0] * neighbourPtr[x-1] +
+                              weightPtr[1] * neighbourPtr[x] +
+                              weightPtr[2] * neighbourPtr[x+1];
+                  }
+                  for(x=xStart; x<xEnd; ++x)
+                     constraintValue += basisWeight[k] * double(derivative[x-blockStart]*derivative[x-blockStart]);
+               }
+            }
+            if(gradientImage!=NULL)
+            {
+               for(x=blockStart; x<blockEnd; ++x)
+                  gradientValue[x-blockStart] = 0;
+               for(s=0; s<stencilNumber; ++s)
+               {
+                  neighbourPtr = &rowPtr[stencilOffset[s]];
+                  weightPtr = &stencil[s*5];
+                  for(x=blockStart; x<blockEnd; ++x)
+                     gradientValue[x-blockStart] +=
+                           weightPtr[0] * neighbourPtr[x-2] +
+                           weightPtr[1] * neighbourPtr[x-1] +
+                           weightPtr[2] * neighbourPtr[x] +
+                           weightPtr[3] * neighbourPtr[x+1] +
+                           weightPtr[4] * neighbourPtr[x+2];
+               }
+               // Removes the contribution of the neighbours outside of the grid
+               for(x=blockStart; x<blockEnd; ++x)
+               {
+                  if(interiorRow && x>0 && x<nx-1) continue;
+                  for(a=0; a<9; ++a)
+                  {
+                     if(x+a%3-1<0 || x+a%3-1>=nx || y+a/3-1<0 || y+a/3-1>=ny)
+                     {
+                        for(i=0; i<9; ++i)
+                           gradientValue[x-blockStart] -= pairWeight[a*9+i] *
+                                 rowPtr[x+neighbourOffset[a]+neighbourOffset[i]];
+                     }
+                  }
+               }
+               for(x=blockStart; x<blockEnd; ++x)
+                  gradientPtr[d][(size_t)y*nx+x] += approxRatio * gradientValue[x-blockStart];
+            }
+         }
+      }
+   }
+   free(displacement);
+   return constraintValue / (double)splineControlPoint->nvox;
+}
+/* *************************************************************** */
+template<class DTYPE>
+double reg_spline_approxBendingEnergyStencil3D(nifti_image *splineControlPoint,
+                                               nifti_image *gradientImage,
+                                               float weight,
+                                               bool computeValue)
+{
+   int nx = splineControlPoint->nx;
+   int ny = splineControlPoint->ny;
+   int nz = splineControlPoint->nz;
+   size_t nodeNumber = (size_t)nx*ny*nz;
+   int paddedDim[3] = {nx+4, ny+4, nz+4};
+   size_t paddedNodeNumber = (size_t)paddedDim[0]*paddedDim[1]*paddedDim[2];
+   int a, b, c, d, i, k, s, x, y, z, blockStart, blockEnd, xStart, xEnd;
+
+   // get the constant basis values, the cross derivatives are counted twice
+   DTYPE basis[6][27];
+   set_second_order_bspline_basis_values(basis[0], basis[1], basis[2],
+                                         basis[3], basis[4], basis[5]);
+   double basisWeight[6] = {1., 1., 1., 2., 2., 2.};
+
+   // Offsets of the 3x3x3 neighbours in the padded buffer
+   int neighbourOffset[27];
+   i=0;
+   for(c=-1; c<2; ++c)
+      for(b=-1; b<2; ++b)
+         for(a=-1; a<2; ++a)
+            neighbourOffset[i++] = (c*paddedDim[1]+b)*paddedDim[0]+a;
+
+   // Weights of every pair of neighbours and the resulting 5x5x5 stencil
+   DTYPE *pairWeight = (DTYPE *)malloc(729*sizeof(DTYPE));
+   double stencilValue[125]= {0.};
+   for(a=0; a<27; ++a)
+   {
+      for(b=0; b<27; ++b)
+      {
+         double value = 0.;
+         for(k=0; k<6; ++k)
+            value += basisWeight[k] * basis[k][a] * basis[k][b];
+         pairWeight[a*27+b] = (DTYPE)value;
+         stencilValue[((a/9+b/9)*5 + (a/3)%3+(b/3)%3)*5 + a%3+b%3] += value;
+      }
+   }
+   // The stencil is stored by rows of five weights along the x-axis
+   DTYPE stencil[125];
+   int stencilOffset[25], stencilNumber=0;
+   for(i=0; i<25; ++i)
+   {
+      if(stencilValue[i*5]!=0. || stencilValue[i*5+1]!=0. || stencilValue[i*5+2]!=0. ||
+            stencilValue[i*5+3]!=0. || stencilValue[i*5+4]!=0.)
+      {
+         for(a=0; a<5; ++a)
+            stencil[stencilNumber*5+a] = (DTYPE)stencilValue[i*5+a];
+         stencilOffset[stencilNumber] = ((i/5-2)*paddedDim[1]+i%5-2)*paddedDim[0];
+         ++stencilNumber;
+      }
+   }
+
+   // Copy the displacements into the padded buffer
+   DTYPE *splinePtrX = static_cast<DTYPE *>(splineControlPoint->data);
+   DTYPE *splinePtrY = &splinePtrX[nodeNumber];
+   DTYPE *splinePtrZ = &splinePtrY[nodeNumber];
+   DTYPE *displacement = (DTYPE *)calloc(3*paddedNodeNumber, sizeof(DTYPE));
+   mat44 matrix;
+   if(splineControlPoint->sform_code>0)
+      matrix=splineControlPoint->sto_xyz;
+   else matrix=splineControlPoint->qto_xyz;
+   size_t index, paddedIndex;
+   float xInit, yInit, zInit;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+   shared(nx, ny, nz, paddedDim, paddedNodeNumber, matrix, \
+   splinePtrX, splinePtrY, splinePtrZ, displacement) \
+   private(x, y, z, index, paddedIndex, xInit, yInit, zInit)
+#endif
+   for(z=0; z<nz; ++z)
+   {
+      for(y=0; y<ny; ++y)
+      {
+         index = ((size_t)z*ny+y)*nx;
+         paddedIndex = ((size_t)(z+2)*paddedDim[1]+y+2)*paddedDim[0]+2;
+         for(x=0; x<nx; ++x)
+         {
+            xInit = matrix.m[0][0]*static_cast<float>(x)
+                  + matrix.m[0][1]*static_cast<float>(y)
+                  + matrix.m[0][2]*static_cast<float>(z)
+                  + matrix.m[0][3];
+            yInit = matrix.m[1][0]*static_cast<float>(x)
+                  + matrix.m[1][1]*static_cast<float>(y)
+                  + matrix.m[1][2]*static_cast<float>(z)
+                  + matrix.m[1][3];
+            zInit = matrix.m[2][0]*static_cast<float>(x)
+                  + matrix.m[2][1]*static_cast<float>(y)
+                  + matrix.m[2][2]*static_cast<float>(z)
+                  + matrix.m[2][3];
+            displacement[paddedIndex] = splinePtrX[index] - static_cast<DTYPE>(xInit);
+            displacement[paddedNodeNumber+paddedIndex] = splinePtrY[index] - static_cast<DTYPE>(yInit);
+            displacement[2*paddedNodeNumber+paddedIndex] = splinePtrZ[index] - static_cast<DTYPE>(zInit);
+            ++index;
+            ++paddedIndex;
+         }
+      }
+   }
+
+   DTYPE *gradientPtr[3] = {NULL, NULL, NULL};
+   if(gradientImage!=NULL)
+   {
+      gradientPtr[0] = static_cast<DTYPE *>(gradientImage->data);
+      gradientPtr[1] = &gradientPtr[0][nodeNumber];
+      gradientPtr[2] = &gradientPtr[1][nodeNumber];
+   }
+   DTYPE approxRatio = (DTYPE)weight / (DTYPE)nodeNumber;
+
+   // The value and the gradient are computed in a single sweep over blocks
+   // of nodes, every row of the grid being processed by a single thread
+#ifdef _WIN32
+   long r;
+   long rowNumber = (long)ny*nz;
+#else
+   size_t r;
+   size_t rowNumber = (size_t)ny*nz;
+#endif
+   DTYPE *rowPtr, *neighbourPtr, *weightPtr;
+   DTYPE derivative[BENDING_ENERGY_BLOCK_SIZE], gradientValue[BENDING_ENERGY_BLOCK_SIZE];
+   bool interiorRow;
+   double constraintValue=0.0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+   shared(nx, ny, nz, rowNumber, paddedDim, paddedNodeNumber, displacement, gradientImage, \
+   gradientPtr, basis, basisWeight, neighbourOffset, pairWeight, stencil, stencilOffset, \
+   stencilNumber, approxRatio, computeValue) \
+   private(r, a, d, i, k, s, x, y, z, blockStart, blockEnd, xStart, xEnd, rowPtr, \
+   neighbourPtr, weightPtr, derivative, gradientValue, interiorRow) \
+   reduction(+:constraintValue)
+#endif
+   for(r=0; r<rowNumber; ++r)
+   {
+      y = (int)(r%ny);
+      z = (int)(r/ny);
+      interiorRow = y>0 && y<ny-1 && z>0 && z<nz-1;
+      for(blockStart=0; blockStart<nx; blockStart+=BENDING_ENERGY_BLOCK_SIZE)
+      {
+         blockEnd = blockStart+BENDING_ENERGY_BLOCK_SIZE<nx?blockStart+BENDING_ENERGY_BLOCK_SIZE:nx;
+         for(d=0; d<3; ++d)
+         {
+            // Pointer to the first node of the row
+            rowPtr = &displacement[d*paddedNodeNumber +
+                  ((size_t)(z+2)*paddedDim[1]+y+2)*paddedDim[0] + 2];
+            // The value is only computed at the nodes that are not on the boundary
+            if(computeValue && interiorRow)
+            {
+               xStart = blockStart>1?blockStart:1;
+               xEnd = blockEnd<nx-1?blockEnd:nx-1;
+               for(k=0; k<6; ++k)
+               {
+                  for(x=xStart; x<xEnd; ++x)
+                     derivative[x-blockStart] = 0;
+                  for(i=0; i<27; i+=3)
+                  {
+                     weightPtr = &basis[k][i];
+                     // The rows of the cross derivatives can be null
+                     if(weightPtr[0]==0 && weightPtr[1]==0 && weightPtr[2]==0) continue;
+                     neighbourPtr = &rowPtr[neighbourOffset[i+1]];
+                     for(x=xStart; x<xEnd; ++x)
+                        derivative[x-blockStart] +=
+                              weightPtr[0] * neighbourPtr[x-1] +
+                              weightPtr[1] * neighbourPtr[x] +
+                              weightPtr[2] * neighbourPtr[x+1];
+                  }
+                  for(x=xStart; x<xEnd; ++x)
+                     constraintValue += basisWeight[k] * double(derivative[x-blockStart]*derivative[x-blockStart]);
+               }
+            }
+            if(gradientImage!=NULL)
+            {
+               for(x=blockStart; x<blockEnd; ++x)
+                  gradientValue[x-blockStart] = 0;
+               for(s=0; s<stencilNumber; ++s)
+               {
+                  neighbourPtr = &rowPtr[stencilOffset[s]];
+                  weightPtr = &stencil[s*5];
+                  for(x=blockStart; x<blockEnd; ++x)
+                     gradientValue[x-blockStart] +=
+                           weightPtr[0] * neighbourPtr[x-2] +
+                           weightPtr[1] * neighbourPtr[x-1] +
+                           weightPtr[2] * neighbourPtr[x] +
+                           weightPtr[3] * neighbourPtr[x+1] +
+                           weightPtr[4] * neighbourPtr[x+2];
+               }
+               // Removes the contribution of the neighbours outside of the grid
+               for(x=blockStart; x<blockEnd; ++x)
+               {
+                  if(interiorRow && x>0 && x<nx-1) continue;
+                  for(a=0; a<27; ++a)
+                  {
+                     if(x+a%3-1<0 || x+a%3-1>=nx ||
+                           y+(a/3)%3-1<0 || y+(a/3)%3-1>=ny ||
+                           z+a/9-1<0 || z+a/9-1>=nz)
+                     {
+                        for(i=0; i<27; ++i)
+                           gradientValue[x-blockStart] -= pairWeight[a*27+i] *
+                                 rowPtr[x+neighbourOffset[a]+neighbourOffset[i]];
+                     }
+                  }
+               }
+               for(x=blockStart; x<blockEnd; ++x)
+                  gradientPtr[d][((size_t)z*ny+y)*nx+x] += approxRatio * gradientValue[x-blockStart];
+            }
+         }
+      }
+   }
+   free(pairWeight);
+   free(displacement);
+   return constraintValue / (double)splineControlPoint->nvox;
+}
+/* *************************************************************** */
+extern "C++"
+double reg_spline_approxBendingEnergyStencil(nifti_image *splineControlPoint,
+                                             nifti_image *gradientImage,
+                                             float weight,
+                                             bool computeValue)
+{
+   if(gradientImage!=NULL && splineControlPoint->datatype != gradientImage->datatype)
+   {
+      reg_print_fct_error("reg_spline_approxBendingEnergyStencil");
+      reg_print_msg_error("The input images are expected to have the same type");
+      reg_exit();
+   }
+   if(splineControlPoint->nz==1)
+   {
+      switch(splineControlPoint->datatype)
+      {
+      case NIFTI_TYPE_FLOAT32:
+         return reg_spline_approxBendingEnergyStencil2D<float>
+               (splineControlPoint, gradientImage, weight, computeValue);
+      case NIFTI_TYPE_FLOAT64:
+         return reg_spline_approxBendingEnergyStencil2D<double>
+               (splineControlPoint, gradientImage, weight, computeValue);
+      default:
+         reg_print_fct_error("reg_spline_approxBendingEnergyStencil");
+         reg_print_msg_error("Only implemented for single or double precision images");
+         reg_exit();
+      }
+   }
+   else
+   {
+      switch(splineControlPoint->datatype)
+      {
+      case NIFTI_TYPE_FLOAT32:
+         return reg_spline_approxBendingEnergyStencil3D<float>
+               (splineControlPoint, gradientImage, weight, computeValue);
+      case NIFTI_TYPE_FLOAT64:
+         return reg_spline_approxBendingEnergyStencil3D<double>
+               (splineControlPoint, gradientImage, weight, computeValue);
+      default:
+         reg_print_fct_error("reg_spline_approxBendingEnergyStencil");
+         reg_print_msg_error("Only implemented for single or double precision images");
+         reg_exit();
+      }
+   }
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template <class DTYPE>
 double reg_spline_approxLinearEnergyValue2D(nifti_image *splineControlPoint)
 {
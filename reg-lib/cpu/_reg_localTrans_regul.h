@@ -41,6 +41,30 @@ void reg_spline_approxBendingEnergyGradient(nifti_image *controlPointGridImage,
                                             float weight
                                             );
 /* *************************************************************** */
+/** @brief Compute the approximated bending energy and its gradient in a
+ * single sweep over the control point grid. As the bending energy is a
+ * quadratic form of the control point displacements, its gradient is
+ * obtained by applying a precomputed 5x5x5 stencil to the displacements.
+ * The value is computed on the displacements and can thus differ from
+ * reg_spline_approxBendingEnergy by rounding errors.
+ * @param controlPointGridImage Control point grid that contains the deformation
+ * parametrisation
+ * @param gradientImage Image of identical size that the control
+ * point grid image. The gradient of the bending-energy will be added
+ * at every control point position. The gradient is not computed when
+ * set to NULL.
+ * @param weight Scalar which will be multiplied by the bending-energy gradient
+ * @param computeValue The value is not computed, and zero is returned,
+ * when set to false
+ * @return The normalised bending energy. Normalised by the number of voxel
+ */
+extern "C++"
+double reg_spline_approxBendingEnergyStencil(nifti_image *controlPointGridImage,
+                                             nifti_image *gradientImage,
+                                             float weight,
+                                             bool computeValue = true
+                                             );
+/* *************************************************************** */
 /** @brief Compute and return the linear elastic energy terms.
  * @param controlPointGridImage Image that contains the transformation
  * parametrisation
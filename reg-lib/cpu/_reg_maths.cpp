@@ -5,6 +5,9 @@
 //STD
 #include <map>
 #include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #define mat(i,j,dim) mat[i*dim+j]
 
@@ -963,6 +966,56 @@ void reg_mat33_disp(mat33 *mat, char * title){
         mat->m[2][0], mat->m[2][1], mat->m[2][2]);
 }
 /* *************************************************************** */
+static int maximalSIMDSupport=AVX512_SIMD;
+/* *************************************************************** */
+NREG_SIMD_TYPE reg_getSIMDSupport()
+{
+   static int simdSupport=-1;
+   if(simdSupport<0)
+   {
+      int support=NO_SIMD;
+#if _USE_SSE
+      support=SSE_SIMD;
+#ifdef _USE_RUNTIME_AVX
+#ifdef __GNUC__
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      {
+         support=AVX2_SIMD;
+         if(__builtin_cpu_supports("avx512f"))
+            support=AVX512_SIMD;
+      }
+#else
+      int cpuInfo[4];
+      __cpuid(cpuInfo,1);
+      // Check that the OS saves the AVX registers before querying AVX2
+      bool osUsesXSAVE=(cpuInfo[2] & (1<<27))!=0;
+      bool cpuHasFMA=(cpuInfo[2] & (1<<12))!=0;
+      if(osUsesXSAVE && cpuHasFMA && (_xgetbv(0) & 0x6)==0x6)
+      {
+         __cpuidex(cpuInfo,7,0);
+         if(cpuInfo[1] & (1<<5))
+         {
+            support=AVX2_SIMD;
+            if((cpuInfo[1] & (1<<16)) && (_xgetbv(0) & 0xe6)==0xe6)
+               support=AVX512_SIMD;
+         }
+      }
+#endif
+#endif
+#endif
+      simdSupport=support;
+   }
+   if(simdSupport>maximalSIMDSupport)
+      return (NREG_SIMD_TYPE)maximalSIMDSupport;
+   return (NREG_SIMD_TYPE)simdSupport;
+}
+/* *************************************************************** */
+void reg_setMaximalSIMDSupport(NREG_SIMD_TYPE maximalSupport)
+{
+   maximalSIMDSupport=maximalSupport;
+}
+/* *************************************************************** */
 //is it square distance or just distance?
 // Helper function: Get the square of the Euclidean distance
 double get_square_distance3D(float * first_point3D, float * second_point3D) {
@@ -31,6 +31,19 @@
 #ifdef __SSE3__
 #include <pmmintrin.h>
 #endif
+// The AVX kernels are compiled independently of the global compilation
+// flags and are only called when the running CPU supports them
+#if defined(__GNUC__) || defined(_MSC_VER)
+#include <immintrin.h>
+#define _USE_RUNTIME_AVX
+#ifdef __GNUC__
+#define NR_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define NR_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#else
+#define NR_TARGET_AVX2
+#define NR_TARGET_AVX512
+#endif
+#endif
 #endif
 
 typedef enum
@@ -44,6 +57,14 @@ typedef enum
    LIN_SPLINE_GRID
 } NREG_TRANS_TYPE;
 
+typedef enum
+{
+   NO_SIMD,
+   SSE_SIMD,
+   AVX2_SIMD,
+   AVX512_SIMD
+} NREG_SIMD_TYPE;
+
 /* *************************************************************** */
 #define reg_pow2(a) ((a)*(a))
 #define reg_ceil(a) (ceil(a))
@@ -119,6 +140,19 @@ inline int fabs(int _x)
 }
 #endif // If on windows...
 /* *************************************************************** */
+/** @brief Returns the most advanced SIMD instruction set that is both
+ * enabled in the build and supported by the CPU running the code. The
+ * detection is only performed on the first call.
+ */
+extern "C++"
+NREG_SIMD_TYPE reg_getSIMDSupport();
+/** @brief Limits the instruction set returned by reg_getSIMDSupport, the
+ * detected support is returned if it is below the specified limit. This is
+ * used to compare the vectorised kernels with their scalar counterpart.
+ */
+extern "C++"
+void reg_setMaximalSIMDSupport(NREG_SIMD_TYPE maximalSupport);
+/* *************************************************************** */
 extern "C++" template <class T>
 void reg_LUdecomposition(T *inputMatrix,
                          size_t dim,
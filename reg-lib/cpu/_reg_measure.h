@@ -67,6 +67,19 @@ public:
    }
    /// @brief Here
    virtual void GetDiscretisedValue(nifti_image *, float *, int , int) {}
+   /// @brief Returns true if the forward voxel based gradient can be computed
+   /// over a subset of consecutive reference voxels
+   virtual bool SupportsVoxelBasedGradientTiles()
+   {
+      return false;
+   }
+   /// @brief Set the index of the first reference voxel covered by the
+   /// warped gradient and forward voxel based gradient images. The images
+   /// only contain a tile of the reference image when the offset is positive
+   void SetVoxelBasedGradientOffset(size_t offset)
+   {
+      this->voxelBasedGradientOffset=offset;
+   }
    void SetTimepointWeight(int timepoint, double weight)
    {
       this->timePointWeight[timepoint]=weight;
@@ -102,10 +115,12 @@ protected:
 
    double timePointWeight[255];
    int referenceTimePoint;
+   size_t voxelBasedGradientOffset;
    /// @brief Measure class constructor
    reg_measure()
    {
       memset(this->timePointWeight,0,255*sizeof(double) );
+      this->voxelBasedGradientOffset=0;
 #ifndef NDEBUG
       printf("[NiftyReg DEBUG] reg_measure constructor called\n");
 #endif
@@ -46,6 +46,11 @@ public:
    virtual double GetSimilarityMeasureValue();
    /// @brief Compute the voxel based gradient
    virtual void GetVoxelBasedSimilarityMeasureGradient(int current_timepoint);
+   /// @brief The descriptors are computed over the full image
+   virtual bool SupportsVoxelBasedGradientTiles()
+   {
+      return false;
+   }
    /// @brief
    void SetDescriptorOffset(int);
    int GetDescriptorOffset();
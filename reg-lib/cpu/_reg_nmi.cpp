@@ -26,6 +26,16 @@ reg_nmi::reg_nmi()
    this->backwardJointHistogramLog=NULL;
    this->backwardEntropyValues=NULL;
 
+   this->incrementalUpdate=false;
+   this->incrementalCacheValid=false;
+   this->modifiedTiles=NULL;
+   this->forwardVoxelBinIndex=NULL;
+   this->forwardJointHistogramRaw=NULL;
+
+   this->usePVHistogram=false;
+   this->forwardPVBuffer=NULL;
+   this->backwardPVBuffer=NULL;
+
    for(int i=0; i<255; ++i)
    {
       this->referenceBinNumber[i]=68;
@@ -40,6 +50,8 @@ reg_nmi::reg_nmi()
 reg_nmi::~reg_nmi()
 {
    this->ClearHistogram();
+   this->ClearIncrementalCache();
+   this->ClearPVBuffers();
 #ifndef NDEBUG
    reg_print_msg_debug("reg_nmi destructor called");
 #endif
@@ -122,6 +134,149 @@ void reg_nmi::ClearHistogram()
 #endif
 }
 /* *************************************************************** */
+void reg_nmi::ClearIncrementalCache()
+{
+   if(this->modifiedTiles!=NULL)
+      free(this->modifiedTiles);
+   this->modifiedTiles=NULL;
+   if(this->forwardVoxelBinIndex!=NULL)
+   {
+      for(int i=0; i<255; ++i)
+      {
+         if(this->forwardVoxelBinIndex[i]!=NULL)
+            free(this->forwardVoxelBinIndex[i]);
+      }
+      free(this->forwardVoxelBinIndex);
+   }
+   this->forwardVoxelBinIndex=NULL;
+   if(this->forwardJointHistogramRaw!=NULL)
+   {
+      for(int i=0; i<255; ++i)
+      {
+         if(this->forwardJointHistogramRaw[i]!=NULL)
+            free(this->forwardJointHistogramRaw[i]);
+      }
+      free(this->forwardJointHistogramRaw);
+   }
+   this->forwardJointHistogramRaw=NULL;
+   this->incrementalCacheValid=false;
+}
+/* *************************************************************** */
+void reg_nmi::ClearPVBuffers()
+{
+   _reg_nmiPVBuffer *buffers[2]= {this->forwardPVBuffer, this->backwardPVBuffer};
+   for(int b=0; b<2; ++b)
+   {
+      if(buffers[b]==NULL)
+         continue;
+      for(int i=0; i<255; ++i)
+      {
+         if(buffers[b][i].refFirstBin!=NULL)
+            free(buffers[b][i].refFirstBin);
+         if(buffers[b][i].refWeight[0]!=NULL)
+            free(buffers[b][i].refWeight[0]);
+      }
+      delete [] buffers[b];
+   }
+   this->forwardPVBuffer=NULL;
+   this->backwardPVBuffer=NULL;
+}
+/* *************************************************************** */
+void reg_nmi::SetIncrementalTileSpacing(float *spacing)
+{
+   // Any change of the tile size invalidates the stored histograms
+   if(this->incrementalUpdate==false ||
+         this->incrementalTileSpacing[0]!=spacing[0] ||
+         this->incrementalTileSpacing[1]!=spacing[1] ||
+         this->incrementalTileSpacing[2]!=spacing[2])
+   {
+      this->ClearIncrementalCache();
+      this->incrementalTileSpacing[0]=spacing[0];
+      this->incrementalTileSpacing[1]=spacing[1];
+      this->incrementalTileSpacing[2]=spacing[2];
+   }
+   this->incrementalUpdate=true;
+}
+/* *************************************************************** */
+void reg_nmi::SetModifiedTiles(int *first, int *last)
+{
+   // All tiles are updated anyway when no previous histogram is stored
+   if(this->incrementalCacheValid==false)
+      return;
+   int start[3], end[3];
+   for(int i=0; i<3; ++i)
+   {
+      start[i]=first[i]<0?0:first[i];
+      end[i]=last[i]<this->incrementalTileNumber[i]?last[i]:this->incrementalTileNumber[i]-1;
+   }
+   for(int z=start[2]; z<=end[2]; ++z)
+      for(int y=start[1]; y<=end[1]; ++y)
+         for(int x=start[0]; x<=end[0]; ++x)
+            this->modifiedTiles[(z*this->incrementalTileNumber[1]+y) *
+                  this->incrementalTileNumber[0]+x]=1;
+}
+/* *************************************************************** */
+template <class DTYPE>
+void reg_setNMIModifiedControlPoints(reg_nmi *measure,
+                                     nifti_image *controlPointGrid,
+                                     DTYPE *previousGrid)
+{
+   // A control point at position (x,y,z) influences the cells from
+   // (x-3,y-3,z-3) to (x,y,z)
+   size_t nodeNumber=(size_t)controlPointGrid->nx *
+         controlPointGrid->ny *
+         controlPointGrid->nz;
+   DTYPE *gridPtr=static_cast<DTYPE *>(controlPointGrid->data);
+   int first[3], last[3];
+   size_t index=0;
+   for(int z=0; z<controlPointGrid->nz; ++z)
+   {
+      for(int y=0; y<controlPointGrid->ny; ++y)
+      {
+         for(int x=0; x<controlPointGrid->nx; ++x)
+         {
+            bool moved=false;
+            for(int c=0; c<controlPointGrid->nu; ++c)
+            {
+               if(gridPtr[index+c*nodeNumber]!=previousGrid[index+c*nodeNumber])
+                  moved=true;
+            }
+            if(moved)
+            {
+               first[0]=x-3;
+               first[1]=y-3;
+               first[2]=z-3;
+               last[0]=x;
+               last[1]=y;
+               last[2]=z;
+               measure->SetModifiedTiles(first,last);
+            }
+            ++index;
+         }
+      }
+   }
+}
+/* *************************************************************** */
+void reg_nmi::SetModifiedControlPoints(nifti_image *controlPointGrid,
+                                       void *previousGridData)
+{
+   switch(controlPointGrid->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_setNMIModifiedControlPoints<float>
+            (this,controlPointGrid,static_cast<float *>(previousGridData));
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_setNMIModifiedControlPoints<double>
+            (this,controlPointGrid,static_cast<double *>(previousGridData));
+      break;
+   default:
+      reg_print_fct_error("reg_nmi::SetModifiedControlPoints()");
+      reg_print_msg_error("Unsupported datatype");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
 /* *************************************************************** */
 void reg_nmi::InitialiseMeasure(nifti_image *refImgPtr,
                                 nifti_image *floImgPtr,
@@ -150,6 +305,7 @@ void reg_nmi::InitialiseMeasure(nifti_image *refImgPtr,
 
    // Clear all allocated arrays
    this->ClearHistogram();
+   this->ClearIncrementalCache();
    // Extract the number of time point
    int timepoint=this->referenceTimePoint;
    // Reference and floating are resampled between 2 and bin-3
@@ -263,6 +419,509 @@ PrecisionTYPE GetBasisSplineDerivativeValue(PrecisionTYPE ori)
 }
 /* *************************************************************** */
 /* *************************************************************** */
+// Fill a joint histogram by calling contribution(voxel,histogram) for every
+// voxel. With several threads, every thread fills its own private histogram.
+// Each histogram is padded to a multiple of the cache line size and the
+// buffer is aligned on a cache line so that two threads never write into the
+// same line. The private histograms are then combined using a tree reduction.
+template <class CONTRIBUTION>
+static void reg_fillJointHistogram(size_t voxelNumber,
+                                   size_t jointBinNumber,
+                                   const CONTRIBUTION &contribution,
+                                   double *jointHistogram)
+{
+   int threadNumber=1;
+#if defined (_OPENMP)
+   threadNumber=omp_get_max_threads();
+#endif
+   // With a single thread, the histogram is directly filled
+   if(threadNumber==1)
+   {
+      memset(jointHistogram,0,jointBinNumber*sizeof(double));
+      for(size_t voxel=0; voxel<voxelNumber; ++voxel)
+         contribution(voxel,jointHistogram);
+      return;
+   }
+
+   size_t histogramStride=NMI_CACHE_LINE_DOUBLE *
+         ((jointBinNumber+NMI_CACHE_LINE_DOUBLE-1)/NMI_CACHE_LINE_DOUBLE);
+   double *buffer=(double *)malloc((threadNumber*histogramStride+NMI_CACHE_LINE_DOUBLE)*
+                                   sizeof(double));
+   double *privateHistogram=(double *)
+         (((size_t)buffer+NMI_CACHE_LINE_DOUBLE*sizeof(double)-1) &
+          ~(NMI_CACHE_LINE_DOUBLE*sizeof(double)-1));
+
+#if defined (_OPENMP)
+#ifdef WIN32
+   long voxel;
+   long voxelNumberLong=(long)voxelNumber;
+#else
+   size_t voxel;
+   size_t voxelNumberLong=voxelNumber;
+#endif
+#pragma omp parallel default(none) \
+   private(voxel) \
+   shared(voxelNumberLong,contribution,privateHistogram,histogramStride,jointBinNumber)
+   {
+      int tid=omp_get_thread_num();
+      int activeThreadNumber=omp_get_num_threads();
+      double *localHistogram=&privateHistogram[tid*histogramStride];
+      memset(localHistogram,0,jointBinNumber*sizeof(double));
+#pragma omp for
+      for(voxel=0; voxel<voxelNumberLong; ++voxel)
+         contribution((size_t)voxel,localHistogram);
+      // Tree reduction of the private histograms into the first one. The
+      // implicit barrier of the for loop ensures all histograms are filled
+      for(int step=1; step<activeThreadNumber; step*=2)
+      {
+         if(tid%(2*step)==0 && tid+step<activeThreadNumber)
+         {
+            double *otherHistogram=&privateHistogram[(tid+step)*histogramStride];
+            for(size_t b=0; b<jointBinNumber; ++b)
+               localHistogram[b]+=otherHistogram[b];
+         }
+#pragma omp barrier
+      }
+   }
+#endif // _OPENMP
+   memcpy(jointHistogram,privateHistogram,jointBinNumber*sizeof(double));
+   free(buffer);
+}
+/* *************************************************************** */
+// Increments the joint bin defined by the intensities of all channels
+template <class DTYPE>
+struct reg_jointBinContribution
+{
+   int channelNumber;
+   DTYPE **channelPtr;
+   unsigned int *binNumber;
+   unsigned int *binStride;
+   int *mask;
+
+   void operator()(size_t voxel, double *histogram) const
+   {
+      if(mask[voxel]>-1)
+      {
+         size_t index=0;
+         int c=0;
+         for(; c<channelNumber; ++c)
+         {
+            DTYPE value=channelPtr[c][voxel];
+            if(value!=value || value<0 || value>=binNumber[c])
+               break;
+            index+=static_cast<int>(value)*binStride[c];
+         }
+         if(c==channelNumber)
+            ++histogram[index];
+      }
+   }
+};
+/* *************************************************************** */
+template <class DTYPE>
+void reg_getJointHistogram(int channelNumber,
+                           DTYPE **channelPtr,
+                           unsigned int *binNumber,
+                           size_t voxelNumber,
+                           int *mask,
+                           double *jointHistogram)
+{
+   // Compute the number of bins and the stride associated with each channel
+   unsigned int binStride[255];
+   size_t jointBinNumber=1;
+   for(int c=0; c<channelNumber; ++c)
+   {
+      binStride[c]=(unsigned int)jointBinNumber;
+      jointBinNumber*=binNumber[c];
+   }
+
+   reg_jointBinContribution<DTYPE> contribution;
+   contribution.channelNumber=channelNumber;
+   contribution.channelPtr=channelPtr;
+   contribution.binNumber=binNumber;
+   contribution.binStride=binStride;
+   contribution.mask=mask;
+   reg_fillJointHistogram(voxelNumber,jointBinNumber,contribution,jointHistogram);
+}
+template void reg_getJointHistogram<float>(int,float **,unsigned int *,size_t,int *,double *);
+template void reg_getJointHistogram<double>(int,double **,unsigned int *,size_t,int *,double *);
+/* *************************************************************** */
+/* *************************************************************** */
+// The histogram smoothing kernels below convolve the joint histogram with
+// a 3-tap cubic B-spline kernel along both axes, normalise it and compute
+// the marginal histograms. The tmp buffer must hold at least
+// refBinNumber*(floBinNumber+1) values; its last row is used as a row of
+// zeros so that the floating axis boundaries need no test.
+static double reg_smoothNormaliseHistogram_scalar(double *pro,
+                                                  double *tmp,
+                                                  int refBinNumber,
+                                                  int floBinNumber)
+{
+   const double k0=GetBasisSplineValue(0.);
+   const double k1=GetBasisSplineValue(-1.);
+   const int R=refBinNumber;
+   const int F=floBinNumber;
+   // Histogram is first smooth along the reference axis
+   for(int f=0; f<F; ++f)
+   {
+      double *src=&pro[f*R];
+      double *dst=&tmp[f*R];
+      if(R==1)
+      {
+         dst[0]=k0*src[0];
+         continue;
+      }
+      dst[0]=k0*src[0]+k1*src[1];
+      for(int r=1; r<R-1; ++r)
+         dst[r]=k0*src[r]+k1*(src[r-1]+src[r+1]);
+      dst[R-1]=k1*src[R-2]+k0*src[R-1];
+   }
+   // Histogram is then smooth along the warped floating axis
+   double *zeroRow=&tmp[R*F];
+   memset(zeroRow,0,R*sizeof(double));
+   double activeVoxel=0.;
+   for(int f=0; f<F; ++f)
+   {
+      double *cur=&tmp[f*R];
+      double *prev=f>0?cur-R:zeroRow;
+      double *next=f<F-1?cur+R:zeroRow;
+      double *dst=&pro[f*R];
+      for(int r=0; r<R; ++r)
+      {
+         dst[r]=k0*cur[r]+k1*(prev[r]+next[r]);
+         activeVoxel+=dst[r];
+      }
+   }
+   // Normalise the histogram and marginalise over both axes
+   double *refMarginal=&pro[R*F];
+   double *floMarginal=&pro[R*F+R];
+   memset(refMarginal,0,(R+F)*sizeof(double));
+   const double norm=1./activeVoxel;
+   for(int f=0; f<F; ++f)
+   {
+      double *row=&pro[f*R];
+      double sum=0.;
+      for(int r=0; r<R; ++r)
+      {
+         row[r]*=norm;
+         refMarginal[r]+=row[r];
+         sum+=row[r];
+      }
+      floMarginal[f]=sum;
+   }
+   return activeVoxel;
+}
+/* *************************************************************** */
+#if _USE_SSE
+static double reg_smoothNormaliseHistogram_sse(double *pro,
+                                               double *tmp,
+                                               int refBinNumber,
+                                               int floBinNumber)
+{
+   const double k0=GetBasisSplineValue(0.);
+   const double k1=GetBasisSplineValue(-1.);
+   const __m128d k0_sse=_mm_set1_pd(k0);
+   const __m128d k1_sse=_mm_set1_pd(k1);
+   const int R=refBinNumber;
+   const int F=floBinNumber;
+   int r;
+   // Histogram is first smooth along the reference axis
+   for(int f=0; f<F; ++f)
+   {
+      double *src=&pro[f*R];
+      double *dst=&tmp[f*R];
+      if(R==1)
+      {
+         dst[0]=k0*src[0];
+         continue;
+      }
+      dst[0]=k0*src[0]+k1*src[1];
+      for(r=1; r+2<R; r+=2)
+      {
+         __m128d value=_mm_mul_pd(k0_sse,_mm_loadu_pd(&src[r]));
+         value=_mm_add_pd(value,_mm_mul_pd(k1_sse,
+                                            _mm_add_pd(_mm_loadu_pd(&src[r-1]),
+                                                       _mm_loadu_pd(&src[r+1]))));
+         _mm_storeu_pd(&dst[r],value);
+      }
+      for(; r<R-1; ++r)
+         dst[r]=k0*src[r]+k1*(src[r-1]+src[r+1]);
+      dst[R-1]=k1*src[R-2]+k0*src[R-1];
+   }
+   // Histogram is then smooth along the warped floating axis
+   double *zeroRow=&tmp[R*F];
+   memset(zeroRow,0,R*sizeof(double));
+   __m128d sum_sse=_mm_setzero_pd();
+   double activeVoxel=0.;
+   for(int f=0; f<F; ++f)
+   {
+      double *cur=&tmp[f*R];
+      double *prev=f>0?cur-R:zeroRow;
+      double *next=f<F-1?cur+R:zeroRow;
+      double *dst=&pro[f*R];
+      for(r=0; r+2<=R; r+=2)
+      {
+         __m128d value=_mm_mul_pd(k0_sse,_mm_loadu_pd(&cur[r]));
+         value=_mm_add_pd(value,_mm_mul_pd(k1_sse,
+                                            _mm_add_pd(_mm_loadu_pd(&prev[r]),
+                                                       _mm_loadu_pd(&next[r]))));
+         _mm_storeu_pd(&dst[r],value);
+         sum_sse=_mm_add_pd(sum_sse,value);
+      }
+      for(; r<R; ++r)
+      {
+         dst[r]=k0*cur[r]+k1*(prev[r]+next[r]);
+         activeVoxel+=dst[r];
+      }
+   }
+   double sum_array[2];
+   _mm_storeu_pd(sum_array,sum_sse);
+   activeVoxel+=sum_array[0]+sum_array[1];
+   // Normalise the histogram and marginalise over both axes
+   double *refMarginal=&pro[R*F];
+   double *floMarginal=&pro[R*F+R];
+   memset(refMarginal,0,(R+F)*sizeof(double));
+   const double norm=1./activeVoxel;
+   const __m128d norm_sse=_mm_set1_pd(norm);
+   for(int f=0; f<F; ++f)
+   {
+      double *row=&pro[f*R];
+      __m128d rowSum_sse=_mm_setzero_pd();
+      double rowSum=0.;
+      for(r=0; r+2<=R; r+=2)
+      {
+         __m128d value=_mm_mul_pd(norm_sse,_mm_loadu_pd(&row[r]));
+         _mm_storeu_pd(&row[r],value);
+         _mm_storeu_pd(&refMarginal[r],_mm_add_pd(_mm_loadu_pd(&refMarginal[r]),value));
+         rowSum_sse=_mm_add_pd(rowSum_sse,value);
+      }
+      for(; r<R; ++r)
+      {
+         row[r]*=norm;
+         refMarginal[r]+=row[r];
+         rowSum+=row[r];
+      }
+      _mm_storeu_pd(sum_array,rowSum_sse);
+      floMarginal[f]=rowSum+sum_array[0]+sum_array[1];
+   }
+   return activeVoxel;
+}
+#endif // _USE_SSE
+/* *************************************************************** */
+#ifdef _USE_RUNTIME_AVX
+NR_TARGET_AVX2
+static double reg_smoothNormaliseHistogram_avx2(double *pro,
+                                                double *tmp,
+                                                int refBinNumber,
+                                                int floBinNumber)
+{
+   const double k0=GetBasisSplineValue(0.);
+   const double k1=GetBasisSplineValue(-1.);
+   const __m256d k0_avx=_mm256_set1_pd(k0);
+   const __m256d k1_avx=_mm256_set1_pd(k1);
+   const int R=refBinNumber;
+   const int F=floBinNumber;
+   int r;
+   // Histogram is first smooth along the reference axis
+   for(int f=0; f<F; ++f)
+   {
+      double *src=&pro[f*R];
+      double *dst=&tmp[f*R];
+      if(R==1)
+      {
+         dst[0]=k0*src[0];
+         continue;
+      }
+      dst[0]=k0*src[0]+k1*src[1];
+      for(r=1; r+4<R; r+=4)
+      {
+         __m256d value=_mm256_mul_pd(k0_avx,_mm256_loadu_pd(&src[r]));
+         value=_mm256_add_pd(value,_mm256_mul_pd(k1_avx,
+                                                  _mm256_add_pd(_mm256_loadu_pd(&src[r-1]),
+                                                                _mm256_loadu_pd(&src[r+1]))));
+         _mm256_storeu_pd(&dst[r],value);
+      }
+      for(; r<R-1; ++r)
+         dst[r]=k0*src[r]+k1*(src[r-1]+src[r+1]);
+      dst[R-1]=k1*src[R-2]+k0*src[R-1];
+   }
+   // Histogram is then smooth along the warped floating axis
+   double *zeroRow=&tmp[R*F];
+   memset(zeroRow,0,R*sizeof(double));
+   __m256d sum_avx=_mm256_setzero_pd();
+   double activeVoxel=0.;
+   for(int f=0; f<F; ++f)
+   {
+      double *cur=&tmp[f*R];
+      double *prev=f>0?cur-R:zeroRow;
+      double *next=f<F-1?cur+R:zeroRow;
+      double *dst=&pro[f*R];
+      for(r=0; r+4<=R; r+=4)
+      {
+         __m256d value=_mm256_mul_pd(k0_avx,_mm256_loadu_pd(&cur[r]));
+         value=_mm256_add_pd(value,_mm256_mul_pd(k1_avx,
+                                                  _mm256_add_pd(_mm256_loadu_pd(&prev[r]),
+                                                                _mm256_loadu_pd(&next[r]))));
+         _mm256_storeu_pd(&dst[r],value);
+         sum_avx=_mm256_add_pd(sum_avx,value);
+      }
+      for(; r<R; ++r)
+      {
+         dst[r]=k0*cur[r]+k1*(prev[r]+next[r]);
+         activeVoxel+=dst[r];
+      }
+   }
+   double sum_array[4];
+   _mm256_storeu_pd(sum_array,sum_avx);
+   activeVoxel+=sum_array[0]+sum_array[1]+sum_array[2]+sum_array[3];
+   // Normalise the histogram and marginalise over both axes
+   double *refMarginal=&pro[R*F];
+   double *floMarginal=&pro[R*F+R];
+   memset(refMarginal,0,(R+F)*sizeof(double));
+   const double norm=1./activeVoxel;
+   const __m256d norm_avx=_mm256_set1_pd(norm);
+   for(int f=0; f<F; ++f)
+   {
+      double *row=&pro[f*R];
+      __m256d rowSum_avx=_mm256_setzero_pd();
+      double rowSum=0.;
+      for(r=0; r+4<=R; r+=4)
+      {
+         __m256d value=_mm256_mul_pd(norm_avx,_mm256_loadu_pd(&row[r]));
+         _mm256_storeu_pd(&row[r],value);
+         _mm256_storeu_pd(&refMarginal[r],_mm256_add_pd(_mm256_loadu_pd(&refMarginal[r]),value));
+         rowSum_avx=_mm256_add_pd(rowSum_avx,value);
+      }
+      for(; r<R; ++r)
+      {
+         row[r]*=norm;
+         refMarginal[r]+=row[r];
+         rowSum+=row[r];
+      }
+      _mm256_storeu_pd(sum_array,rowSum_avx);
+      floMarginal[f]=rowSum+sum_array[0]+sum_array[1]+sum_array[2]+sum_array[3];
+   }
+   return activeVoxel;
+}
+#endif // _USE_RUNTIME_AVX
+/* *************************************************************** */
+// Normalise a joint histogram that does not require any smoothing and
+// compute its marginal histograms
+static double reg_normaliseHistogram(double *pro,
+                                     int refBinNumber,
+                                     int floBinNumber)
+{
+   const int jointBinNumber=refBinNumber*floBinNumber;
+   double activeVoxel=0.;
+   for(int i=0; i<jointBinNumber; ++i)
+      activeVoxel+=pro[i];
+   double *refMarginal=&pro[jointBinNumber];
+   double *floMarginal=&pro[jointBinNumber+refBinNumber];
+   memset(refMarginal,0,(refBinNumber+floBinNumber)*sizeof(double));
+   if(activeVoxel<=0)
+      return activeVoxel;
+   const double norm=1./activeVoxel;
+   for(int f=0; f<floBinNumber; ++f)
+   {
+      double *row=&pro[f*refBinNumber];
+      double rowSum=0.;
+      for(int r=0; r<refBinNumber; ++r)
+      {
+         row[r]*=norm;
+         refMarginal[r]+=row[r];
+         rowSum+=row[r];
+      }
+      floMarginal[f]=rowSum;
+   }
+   return activeVoxel;
+}
+/* *************************************************************** */
+void reg_getNMIEntropies(double *jointHistoProPtr,
+                         double *jointHistoLogPtr,
+                         double *entropyValues,
+                         int referenceBinNumber,
+                         int floatingBinNumber,
+                         bool smoothHistogram,
+                         NREG_SIMD_TYPE simd)
+{
+   // Smooth and normalise the histogram using the best available kernel
+   double activeVoxel;
+   if(smoothHistogram==false)
+      simd=NO_SIMD;
+   switch(simd)
+   {
+#ifdef _USE_RUNTIME_AVX
+   case AVX512_SIMD:
+   case AVX2_SIMD:
+      activeVoxel=reg_smoothNormaliseHistogram_avx2(jointHistoProPtr,
+                                                    jointHistoLogPtr,
+                                                    referenceBinNumber,
+                                                    floatingBinNumber);
+      break;
+#endif
+#if _USE_SSE
+   case SSE_SIMD:
+      activeVoxel=reg_smoothNormaliseHistogram_sse(jointHistoProPtr,
+                                                   jointHistoLogPtr,
+                                                   referenceBinNumber,
+                                                   floatingBinNumber);
+      break;
+#endif
+   default:
+      if(smoothHistogram)
+         activeVoxel=reg_smoothNormaliseHistogram_scalar(jointHistoProPtr,
+                                                         jointHistoLogPtr,
+                                                         referenceBinNumber,
+                                                         floatingBinNumber);
+      else activeVoxel=reg_normaliseHistogram(jointHistoProPtr,
+                                              referenceBinNumber,
+                                              floatingBinNumber);
+   }
+   entropyValues[3]=activeVoxel;
+   const int jointBinNumber=referenceBinNumber*floatingBinNumber;
+   // Set the log values to zero
+   memset(jointHistoLogPtr,0,(jointBinNumber+referenceBinNumber+floatingBinNumber)*sizeof(double));
+   // Compute the entropy of the reference image
+   double referenceEntropy=0.;
+   for(int r=0; r<referenceBinNumber; ++r)
+   {
+      double valPro=jointHistoProPtr[jointBinNumber+r];
+      if(valPro>0)
+      {
+         double valLog=log(valPro);
+         referenceEntropy -= valPro * valLog;
+         jointHistoLogPtr[jointBinNumber+r]=valLog;
+      }
+   }
+   entropyValues[0]=referenceEntropy;
+   // Compute the entropy of the warped floating image
+   double warpedEntropy=0.;
+   for(int f=0; f<floatingBinNumber; ++f)
+   {
+      double valPro=jointHistoProPtr[jointBinNumber+referenceBinNumber+f];
+      if(valPro>0)
+      {
+         double valLog=log(valPro);
+         warpedEntropy -= valPro * valLog;
+         jointHistoLogPtr[jointBinNumber+referenceBinNumber+f]=valLog;
+      }
+   }
+   entropyValues[1]=warpedEntropy;
+   // Compute the joint entropy
+   double jointEntropy=0.;
+   for(int i=0; i<jointBinNumber; ++i)
+   {
+      double valPro=jointHistoProPtr[i];
+      if(valPro>0)
+      {
+         double valLog=log(valPro);
+         jointEntropy -= valPro * valLog;
+         jointHistoLogPtr[i]=valLog;
+      }
+   }
+   entropyValues[2]=jointEntropy;
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template <class DTYPE>
 void reg_getNMIValue(nifti_image *referenceImage,
                      nifti_image *warpedImage,
@@ -299,154 +958,499 @@ void reg_getNMIValue(nifti_image *referenceImage,
          // Empty the joint histogram
          memset(jointHistoProPtr,0,totalBinNumber[t]*sizeof(double));
          // Fill the joint histograms using an approximation
-         DTYPE *refPtr = &refImagePtr[t*voxelNumber];
-         DTYPE *warPtr = &warImagePtr[t*voxelNumber];
-         for(size_t voxel=0; voxel<voxelNumber; ++voxel)
-         {
-            if(referenceMask[voxel]>-1)
-            {
-               DTYPE refValue=refPtr[voxel];
-               DTYPE warValue=warPtr[voxel];
-               if(refValue==refValue && warValue==warValue &&
-                     refValue>=0 && warValue>=0 &&
-                     refValue<referenceBinNumber[t] &&
-                     warValue<floatingBinNumber[t])
-               {
-                  ++jointHistoProPtr[static_cast<int>(refValue) +
-                        static_cast<int>(warValue) * referenceBinNumber[t]];
-               }
-            }
-         }
-         // Convolve the histogram with a cubic B-spline kernel
-         double kernel[3];
-         kernel[0]=kernel[2]=GetBasisSplineValue(-1.);
-         kernel[1]=GetBasisSplineValue(0.);
-         // Histogram is first smooth along the reference axis
-         memset(jointHistoLogPtr,0,totalBinNumber[t]*sizeof(double));
-         for(int f=0; f<floatingBinNumber[t]; ++f)
-         {
-            for(int r=0; r<referenceBinNumber[t]; ++r)
-            {
-               double value=0.0;
-               int index = r-1;
-               double *ptrHisto = &jointHistoProPtr[index+referenceBinNumber[t]*f];
+         DTYPE *channelPtr[2];
+         channelPtr[0] = &refImagePtr[t*voxelNumber];
+         channelPtr[1] = &warImagePtr[t*voxelNumber];
+         unsigned int channelBinNumber[2];
+         channelBinNumber[0] = referenceBinNumber[t];
+         channelBinNumber[1] = floatingBinNumber[t];
+         reg_getJointHistogram<DTYPE>(2,
+                                      channelPtr,
+                                      channelBinNumber,
+                                      voxelNumber,
+                                      referenceMask,
+                                      jointHistoProPtr);
+         // Smooth the histogram and compute the entropies
+         reg_getNMIEntropies(jointHistoProPtr,
+                             jointHistoLogPtr,
+                             entropyValues[t],
+                             referenceBinNumber[t],
+                             floatingBinNumber[t]);
+      } // if active time point
+   } // iterate over all time point in the reference image
+}
+/* *************************************************************** */
+template void reg_getNMIValue<float>(nifti_image *,nifti_image *,double *,unsigned short *,unsigned short *,unsigned short *,double **,double **,double **,int *);
+template void reg_getNMIValue<double>(nifti_image *,nifti_image *,double *,unsigned short *,unsigned short *,unsigned short *,double **,double **,double **,int *);
+/* *************************************************************** */
+/* *************************************************************** */
+template <class DTYPE>
+inline int reg_getNMIVoxelBin(DTYPE refValue,
+                              DTYPE warValue,
+                              unsigned int referenceBinNumber,
+                              unsigned int floatingBinNumber)
+{
+   if(refValue!=refValue || refValue<0 || refValue>=referenceBinNumber)
+      return -1;
+   if(warValue!=warValue || warValue<0 || warValue>=floatingBinNumber)
+      return -1;
+   return static_cast<int>(refValue)+static_cast<int>(warValue)*referenceBinNumber;
+}
+/* *************************************************************** */
+template <class DTYPE>
+void reg_updateNMIJointHistogram(nifti_image *referenceImage,
+                                 nifti_image *warpedImage,
+                                 int t,
+                                 unsigned int referenceBinNumber,
+                                 unsigned int floatingBinNumber,
+                                 int *referenceMask,
+                                 float *tileSpacing,
+                                 int *tileNumber,
+                                 unsigned char *modifiedTiles,
+                                 bool fullUpdate,
+                                 int *voxelBinIndex,
+                                 double *jointHistogramRaw)
+{
+   size_t voxelNumber = (size_t)referenceImage->nx *
+         referenceImage->ny *
+         referenceImage->nz;
+   DTYPE *refImagePtr = &static_cast<DTYPE *>(referenceImage->data)[t*voxelNumber];
+   DTYPE *warImagePtr = &static_cast<DTYPE *>(warpedImage->data)[t*voxelNumber];
 
-               for(int it=0; it<3; it++)
-               {
-                  if(-1<index && index<referenceBinNumber[t])
-                  {
-                     value += *ptrHisto * kernel[it];
-                  }
-                  ++ptrHisto;
-                  ++index;
-               }
-               jointHistoLogPtr[r+referenceBinNumber[t]*f] = value;
-            }
-         }
-         // Histogram is then smooth along the warped floating axis
-         for(int r=0; r<referenceBinNumber[t]; ++r)
+   if(fullUpdate)
+   {
+      // The whole histogram is filled and the bin of every voxel is stored
+      DTYPE *channelPtr[2];
+      channelPtr[0] = refImagePtr;
+      channelPtr[1] = warImagePtr;
+      unsigned int channelBinNumber[2];
+      channelBinNumber[0] = referenceBinNumber;
+      channelBinNumber[1] = floatingBinNumber;
+      reg_getJointHistogram<DTYPE>(2,
+                                   channelPtr,
+                                   channelBinNumber,
+                                   voxelNumber,
+                                   referenceMask,
+                                   jointHistogramRaw);
+#ifdef WIN32
+      long voxel;
+      long voxelNumberLong=(long)voxelNumber;
+#else
+      size_t voxel;
+      size_t voxelNumberLong=voxelNumber;
+#endif
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   private(voxel) \
+   shared(voxelNumberLong,referenceMask,voxelBinIndex,refImagePtr,warImagePtr, \
+   referenceBinNumber,floatingBinNumber)
+#endif
+      for(voxel=0; voxel<voxelNumberLong; ++voxel)
+      {
+         if(referenceMask[voxel]>-1)
+            voxelBinIndex[voxel]=reg_getNMIVoxelBin<DTYPE>(refImagePtr[voxel],
+                                                           warImagePtr[voxel],
+                                                           referenceBinNumber,
+                                                           floatingBinNumber);
+         else voxelBinIndex[voxel]=-1;
+      }
+      return;
+   }
+
+   // Compute the first voxel of every tile along each axis. The tile index is
+   // computed as the control point cell index in reg_spline_getDeformationField
+   int imageDim[3]= {referenceImage->nx, referenceImage->ny, referenceImage->nz};
+   std::vector<int> tileStart[3];
+   for(int a=0; a<3; ++a)
+   {
+      tileStart[a].resize(tileNumber[a]+1);
+      DTYPE spacing=static_cast<DTYPE>(tileSpacing[a]);
+      int v=0;
+      for(int tile=0; tile<=tileNumber[a]; ++tile)
+      {
+         while(v<imageDim[a] &&
+               static_cast<int>(static_cast<DTYPE>(v)/spacing)<tile)
+            ++v;
+         tileStart[a][tile]=v;
+      }
+   }
+   // List the tiles to update
+   std::vector<int> tileList;
+   for(int i=0; i<tileNumber[0]*tileNumber[1]*tileNumber[2]; ++i)
+      if(modifiedTiles[i]>0)
+         tileList.push_back(i);
+   int listSize=(int)tileList.size();
+   int *tileListPtr=listSize>0?&tileList[0]:NULL;
+   int *tileStartX=&tileStart[0][0];
+   int *tileStartY=&tileStart[1][0];
+   int *tileStartZ=&tileStart[2][0];
+   int *tileNumberPtr=tileNumber;
+   int refDimX=imageDim[0], refDimY=imageDim[1];
+
+   // Only the voxels from the modified tiles are binned again
+   int i, x, y, z, tileX, tileY, tileZ, oldBin, newBin;
+   size_t index;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   private(i, x, y, z, tileX, tileY, tileZ, oldBin, newBin, index) \
+   shared(listSize, tileListPtr, tileStartX, tileStartY, tileStartZ, tileNumberPtr, \
+   refDimX, refDimY, referenceMask, voxelBinIndex, refImagePtr, warImagePtr, \
+   referenceBinNumber, floatingBinNumber, jointHistogramRaw) \
+   schedule(dynamic)
+#endif
+   for(i=0; i<listSize; ++i)
+   {
+      tileX=tileListPtr[i]%tileNumberPtr[0];
+      tileY=(tileListPtr[i]/tileNumberPtr[0])%tileNumberPtr[1];
+      tileZ=tileListPtr[i]/(tileNumberPtr[0]*tileNumberPtr[1]);
+      for(z=tileStartZ[tileZ]; z<tileStartZ[tileZ+1]; ++z)
+      {
+         for(y=tileStartY[tileY]; y<tileStartY[tileY+1]; ++y)
          {
-            for(int f=0; f<floatingBinNumber[t]; ++f)
+            index=((size_t)z*refDimY+y)*refDimX+tileStartX[tileX];
+            for(x=tileStartX[tileX]; x<tileStartX[tileX+1]; ++x)
             {
-               double value=0.;
-               int index = f-1;
-               double *ptrHisto = &jointHistoLogPtr[r+referenceBinNumber[t]*index];
-
-               for(int it=0; it<3; it++)
+               if(referenceMask[index]>-1)
                {
-                  if(-1<index && index<floatingBinNumber[t])
+                  oldBin=voxelBinIndex[index];
+                  newBin=reg_getNMIVoxelBin<DTYPE>(refImagePtr[index],
+                                                   warImagePtr[index],
+                                                   referenceBinNumber,
+                                                   floatingBinNumber);
+                  if(newBin!=oldBin)
                   {
-                     value += *ptrHisto * kernel[it];
+                     if(oldBin>-1)
+                     {
+#if defined (_OPENMP)
+#pragma omp atomic
+#endif
+                        jointHistogramRaw[oldBin]-=1.;
+                     }
+                     if(newBin>-1)
+                     {
+#if defined (_OPENMP)
+#pragma omp atomic
+#endif
+                        jointHistogramRaw[newBin]+=1.;
+                     }
+                     voxelBinIndex[index]=newBin;
                   }
-                  ptrHisto+=referenceBinNumber[t];
-                  ++index;
                }
-               jointHistoProPtr[r+referenceBinNumber[t]*f] = value;
+               ++index;
             }
          }
-         // Normalise the histogram
-         double activeVoxel=0.f;
-         for(int i=0; i<totalBinNumber[t]; ++i)
-            activeVoxel+=jointHistoProPtr[i];
-         entropyValues[t][3]=activeVoxel;
-         for(int i=0; i<totalBinNumber[t]; ++i)
-            jointHistoProPtr[i]/=activeVoxel;
-         // Marginalise over the reference axis
-         for(int r=0; r<referenceBinNumber[t]; ++r)
+      }
+   }
+}
+/* *************************************************************** */
+void reg_nmi::UpdateForwardJointHistograms()
+{
+   size_t voxelNumber = (size_t)this->referenceImagePointer->nx *
+         this->referenceImagePointer->ny *
+         this->referenceImagePointer->nz;
+   // The first evaluation fills the whole histograms and allocates the cache
+   bool fullUpdate=!this->incrementalCacheValid;
+   if(fullUpdate)
+   {
+      this->ClearIncrementalCache();
+      int imageDim[3]= {this->referenceImagePointer->nx,
+                        this->referenceImagePointer->ny,
+                        this->referenceImagePointer->nz
+                       };
+      for(int a=0; a<3; ++a)
+      {
+         if(this->referenceImagePointer->datatype==NIFTI_TYPE_FLOAT64)
+            this->incrementalTileNumber[a]=static_cast<int>(
+                     static_cast<double>(imageDim[a]-1)/static_cast<double>(this->incrementalTileSpacing[a]))+1;
+         else this->incrementalTileNumber[a]=static_cast<int>(
+                     static_cast<float>(imageDim[a]-1)/this->incrementalTileSpacing[a])+1;
+      }
+      this->modifiedTiles=(unsigned char *)calloc(this->incrementalTileNumber[0] *
+            this->incrementalTileNumber[1] *
+            this->incrementalTileNumber[2], sizeof(unsigned char));
+      this->forwardVoxelBinIndex=(int **)calloc(255,sizeof(int *));
+      this->forwardJointHistogramRaw=(double **)calloc(255,sizeof(double *));
+   }
+   for(int t=0; t<this->referenceTimePoint; ++t)
+   {
+      if(this->timePointWeight[t]>0.0)
+      {
+         int jointBinNumber=this->referenceBinNumber[t]*this->floatingBinNumber[t];
+         if(fullUpdate)
          {
-            double sum=0.;
-            int index=r;
-            for(int f=0; f<floatingBinNumber[t]; ++f)
-            {
-               sum+=jointHistoProPtr[index];
-               index+=referenceBinNumber[t];
-            }
-            jointHistoProPtr[referenceBinNumber[t]*
-                  floatingBinNumber[t]+r]=sum;
+            this->forwardVoxelBinIndex[t]=(int *)malloc(voxelNumber*sizeof(int));
+            this->forwardJointHistogramRaw[t]=(double *)malloc(jointBinNumber*sizeof(double));
          }
-         // Marginalise over the warped floating axis
-         for(int f=0; f<floatingBinNumber[t]; ++f)
+         switch(this->referenceImagePointer->datatype)
          {
-            double sum=0.;
-            int index=referenceBinNumber[t]*f;
-            for(int r=0; r<referenceBinNumber[t]; ++r)
-            {
-               sum+=jointHistoProPtr[index];
-               ++index;
-            }
-            jointHistoProPtr[referenceBinNumber[t]*
-                  floatingBinNumber[t]+referenceBinNumber[t]+f]=sum;
+         case NIFTI_TYPE_FLOAT32:
+            reg_updateNMIJointHistogram<float>
+                  (this->referenceImagePointer,
+                   this->warpedFloatingImagePointer,
+                   t,
+                   this->referenceBinNumber[t],
+                   this->floatingBinNumber[t],
+                   this->referenceMaskPointer,
+                   this->incrementalTileSpacing,
+                   this->incrementalTileNumber,
+                   this->modifiedTiles,
+                   fullUpdate,
+                   this->forwardVoxelBinIndex[t],
+                   this->forwardJointHistogramRaw[t]);
+            break;
+         case NIFTI_TYPE_FLOAT64:
+            reg_updateNMIJointHistogram<double>
+                  (this->referenceImagePointer,
+                   this->warpedFloatingImagePointer,
+                   t,
+                   this->referenceBinNumber[t],
+                   this->floatingBinNumber[t],
+                   this->referenceMaskPointer,
+                   this->incrementalTileSpacing,
+                   this->incrementalTileNumber,
+                   this->modifiedTiles,
+                   fullUpdate,
+                   this->forwardVoxelBinIndex[t],
+                   this->forwardJointHistogramRaw[t]);
+            break;
+         default:
+            reg_print_fct_error("reg_nmi::UpdateForwardJointHistograms()");
+            reg_print_msg_error("Unsupported datatype");
+            reg_exit();
          }
-         // Set the log values to zero
-         memset(jointHistoLogPtr,0,totalBinNumber[t]*sizeof(double));
-         // Compute the entropy of the reference image
-         double referenceEntropy=0.;
-         for(int r=0; r<referenceBinNumber[t]; ++r)
+         // The stored histogram is left untouched by the smoothing
+         memset(this->forwardJointHistogramPro[t],0,this->totalBinNumber[t]*sizeof(double));
+         memcpy(this->forwardJointHistogramPro[t],
+                this->forwardJointHistogramRaw[t],
+                jointBinNumber*sizeof(double));
+         reg_getNMIEntropies(this->forwardJointHistogramPro[t],
+                             this->forwardJointHistogramLog[t],
+                             this->forwardEntropyValues[t],
+                             this->referenceBinNumber[t],
+                             this->floatingBinNumber[t]);
+      }
+   }
+   memset(this->modifiedTiles,0,this->incrementalTileNumber[0] *
+          this->incrementalTileNumber[1] *
+          this->incrementalTileNumber[2]*sizeof(unsigned char));
+   this->incrementalCacheValid=true;
+}
+/* *************************************************************** */
+/* *************************************************************** */
+// Compute the first three cubic B-spline Parzen window weights and
+// derivatives of an intensity, the last ones are deduced from their sums.
+// Returns the first bin index or NMI_PV_UNUSED_BIN if the window misses the
+// histogram.
+static inline int reg_getNMIParzenWeights(double value,
+                                          int binNumber,
+                                          float *weight,
+                                          float *derivative)
+{
+   double valueFloor=reg_floor(value);
+   int first=static_cast<int>(valueFloor)-1;
+   if(first+3<0 || first>=binNumber)
+      return NMI_PV_UNUSED_BIN;
+   double f=value-valueFloor;
+   double mf=1.-f;
+   weight[0]=static_cast<float>(mf*mf*mf/6.);
+   weight[1]=static_cast<float>((3.*f*f*f-6.*f*f+4.)/6.);
+   weight[2]=static_cast<float>((-3.*f*f*f+3.*f*f+3.*f+1.)/6.);
+   if(derivative!=NULL)
+   {
+      derivative[0]=static_cast<float>(-0.5*mf*mf);
+      derivative[1]=static_cast<float>((1.5*f-2.)*f);
+      derivative[2]=static_cast<float>(-1.5*f*f+f+0.5);
+   }
+   return first;
+}
+/* *************************************************************** */
+// Expand the three stored taps of a voxel window into four, the last tap
+// being deduced from the sum of the window
+static inline void reg_getNMIPVTaps(float * const *stored,
+                                    size_t voxel,
+                                    double sum,
+                                    double *taps)
+{
+   taps[0]=stored[0][voxel];
+   taps[1]=stored[1][voxel];
+   taps[2]=stored[2][voxel];
+   taps[3]=sum-taps[0]-taps[1]-taps[2];
+}
+/* *************************************************************** */
+// Spreads the stored Parzen window weights of a voxel over its 4x4 bins
+struct reg_pvBinContribution
+{
+   _reg_nmiPVBuffer *pvBuffer;
+   unsigned short referenceBinNumber;
+   unsigned short floatingBinNumber;
+
+   void operator()(size_t voxel, double *histogram) const
+   {
+      int refFirst=pvBuffer->refFirstBin[voxel];
+      if(refFirst==NMI_PV_UNUSED_BIN)
+         return;
+      int warFirst=pvBuffer->warFirstBin[voxel];
+      double refWeight[4], warWeight[4];
+      reg_getNMIPVTaps(pvBuffer->refWeight,voxel,1.,refWeight);
+      reg_getNMIPVTaps(pvBuffer->warWeight,voxel,1.,warWeight);
+      for(int w=0; w<4; ++w)
+      {
+         int warBin=warFirst+w;
+         if(warBin<0 || warBin>=floatingBinNumber || warWeight[w]==0)
+            continue;
+         double *histoPtr=&histogram[warBin*referenceBinNumber];
+         for(int r=0; r<4; ++r)
          {
-            double valPro=jointHistoProPtr[referenceBinNumber[t]*floatingBinNumber[t]+r];
-            if(valPro>0)
-            {
-               double valLog=log(valPro);
-               referenceEntropy -= valPro * valLog;
-               jointHistoLogPtr[referenceBinNumber[t]*floatingBinNumber[t]+r]=valLog;
-            }
+            int refBin=refFirst+r;
+            if(refBin>-1 && refBin<referenceBinNumber)
+               histoPtr[refBin]+=refWeight[r]*warWeight[w];
          }
-         entropyValues[t][0]=referenceEntropy;
-         // Compute the entropy of the warped floating image
-         double warpedEntropy=0.;
-         for(int f=0; f<floatingBinNumber[t]; ++f)
+      }
+   }
+};
+/* *************************************************************** */
+template <class DTYPE>
+void reg_getNMIPVHistogram(nifti_image *referenceImage,
+                           nifti_image *warpedImage,
+                           int current_timepoint,
+                           unsigned short referenceBinNumber,
+                           unsigned short floatingBinNumber,
+                           int *referenceMask,
+                           _reg_nmiPVBuffer *pvBuffer,
+                           double *jointHistogram)
+{
+   if(referenceBinNumber<4 || floatingBinNumber<4)
+   {
+      reg_print_fct_error("reg_getNMIPVHistogram");
+      reg_print_msg_error("At least 4 bins are required along each axis");
+      reg_exit();
+   }
+   // The first bins are stored as 16-bit integers
+   if(referenceBinNumber>SHRT_MAX || floatingBinNumber>SHRT_MAX)
+   {
+      reg_print_fct_error("reg_getNMIPVHistogram");
+      reg_print_msg_error("The bin number is too large for the Parzen window histogram");
+      reg_exit();
+   }
+#ifdef WIN32
+   long voxel;
+   long voxelNumber = (long)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+#else
+   size_t voxel;
+   size_t voxelNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+#endif
+   DTYPE *refPtr = &static_cast<DTYPE *>(referenceImage->data)[current_timepoint*voxelNumber];
+   DTYPE *warPtr = &static_cast<DTYPE *>(warpedImage->data)[current_timepoint*voxelNumber];
+
+   // Compute and store the Parzen window weights of every voxel
+   short *refFirstBin=pvBuffer->refFirstBin;
+   short *warFirstBin=pvBuffer->warFirstBin;
+   float **refWeight=pvBuffer->refWeight;
+   float **warWeight=pvBuffer->warWeight;
+   float **warDerivative=pvBuffer->warDerivative;
+   int refBin, warBin, k;
+   float refW[3], warW[3], warD[3];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   private(voxel, refBin, warBin, k, refW, warW, warD) \
+   shared(voxelNumber, referenceMask, refPtr, warPtr, referenceBinNumber, floatingBinNumber, \
+   refFirstBin, warFirstBin, refWeight, warWeight, warDerivative)
+#endif
+   for(voxel=0; voxel<voxelNumber; ++voxel)
+   {
+      refBin=warBin=NMI_PV_UNUSED_BIN;
+      if(referenceMask[voxel]>-1 && refPtr[voxel]==refPtr[voxel] && warPtr[voxel]==warPtr[voxel])
+      {
+         refBin=reg_getNMIParzenWeights(refPtr[voxel],referenceBinNumber,refW,NULL);
+         warBin=reg_getNMIParzenWeights(warPtr[voxel],floatingBinNumber,warW,warD);
+      }
+      if(refBin==NMI_PV_UNUSED_BIN || warBin==NMI_PV_UNUSED_BIN)
+      {
+         refFirstBin[voxel]=NMI_PV_UNUSED_BIN;
+         warFirstBin[voxel]=NMI_PV_UNUSED_BIN;
+         continue;
+      }
+      refFirstBin[voxel]=static_cast<short>(refBin);
+      warFirstBin[voxel]=static_cast<short>(warBin);
+      for(k=0; k<3; ++k)
+      {
+         refWeight[k][voxel]=refW[k];
+         warWeight[k][voxel]=warW[k];
+         warDerivative[k][voxel]=warD[k];
+      }
+   }
+
+   // Accumulate the stored weights into the joint histogram
+   reg_pvBinContribution contribution;
+   contribution.pvBuffer=pvBuffer;
+   contribution.referenceBinNumber=referenceBinNumber;
+   contribution.floatingBinNumber=floatingBinNumber;
+   reg_fillJointHistogram((size_t)voxelNumber,
+                          (size_t)referenceBinNumber*floatingBinNumber,
+                          contribution,
+                          jointHistogram);
+}
+template void reg_getNMIPVHistogram<float>(nifti_image *,nifti_image *,int,unsigned short,unsigned short,int *,_reg_nmiPVBuffer *,double *);
+template void reg_getNMIPVHistogram<double>(nifti_image *,nifti_image *,int,unsigned short,unsigned short,int *,_reg_nmiPVBuffer *,double *);
+/* *************************************************************** */
+void reg_nmi::UpdatePVJointHistograms(nifti_image *refImage,
+                                      nifti_image *warImage,
+                                      int *refMask,
+                                      unsigned short *refBinNumber,
+                                      unsigned short *warBinNumber,
+                                      _reg_nmiPVBuffer *pvBuffer,
+                                      double **jointHistogramPro,
+                                      double **jointHistogramLog,
+                                      double **entropyValues)
+{
+   size_t voxelNumber = (size_t)refImage->nx*refImage->ny*refImage->nz;
+   for(int t=0; t<refImage->nt; ++t)
+   {
+      if(this->timePointWeight[t]>0.0)
+      {
+         // The weights are stored in a single block per time point
+         if(pvBuffer[t].voxelNumber!=voxelNumber)
          {
-            double valPro=jointHistoProPtr[referenceBinNumber[t]*floatingBinNumber[t]+
-                  referenceBinNumber[t]+f];
-            if(valPro>0)
+            if(pvBuffer[t].refFirstBin!=NULL) free(pvBuffer[t].refFirstBin);
+            if(pvBuffer[t].refWeight[0]!=NULL) free(pvBuffer[t].refWeight[0]);
+            pvBuffer[t].voxelNumber=voxelNumber;
+            pvBuffer[t].refFirstBin=(short *)malloc(2*voxelNumber*sizeof(short));
+            pvBuffer[t].warFirstBin=&pvBuffer[t].refFirstBin[voxelNumber];
+            float *weightPtr=(float *)malloc(9*voxelNumber*sizeof(float));
+            for(int k=0; k<3; ++k)
             {
-               double valLog=log(valPro);
-               warpedEntropy -= valPro * valLog;
-               jointHistoLogPtr[referenceBinNumber[t]*floatingBinNumber[t]+
-                     referenceBinNumber[t]+f]=valLog;
+               pvBuffer[t].refWeight[k]=&weightPtr[k*voxelNumber];
+               pvBuffer[t].warWeight[k]=&weightPtr[(3+k)*voxelNumber];
+               pvBuffer[t].warDerivative[k]=&weightPtr[(6+k)*voxelNumber];
             }
          }
-         entropyValues[t][1]=warpedEntropy;
-         // Compute the joint entropy
-         double jointEntropy=0.;
-         for(int i=0; i<referenceBinNumber[t]*floatingBinNumber[t]; ++i)
+         memset(jointHistogramPro[t],0,this->totalBinNumber[t]*sizeof(double));
+         switch(refImage->datatype)
          {
-            double valPro=jointHistoProPtr[i];
-            if(valPro>0)
-            {
-               double valLog=log(valPro);
-               jointEntropy -= valPro * valLog;
-               jointHistoLogPtr[i]=valLog;
-            }
+         case NIFTI_TYPE_FLOAT32:
+            reg_getNMIPVHistogram<float>(refImage,warImage,t,refBinNumber[t],warBinNumber[t],
+                                         refMask,&pvBuffer[t],jointHistogramPro[t]);
+            break;
+         case NIFTI_TYPE_FLOAT64:
+            reg_getNMIPVHistogram<double>(refImage,warImage,t,refBinNumber[t],warBinNumber[t],
+                                          refMask,&pvBuffer[t],jointHistogramPro[t]);
+            break;
+         default:
+            reg_print_fct_error("reg_nmi::UpdatePVJointHistograms()");
+            reg_print_msg_error("Unsupported datatype");
+            reg_exit();
          }
-         entropyValues[t][2]=jointEntropy;
-      } // if active time point
-   } // iterate over all time point in the reference image
+         // The Parzen window histogram does not need to be smoothed
+         reg_getNMIEntropies(jointHistogramPro[t],
+                             jointHistogramLog[t],
+                             entropyValues[t],
+                             refBinNumber[t],
+                             warBinNumber[t],
+                             false);
+      }
+   }
 }
 /* *************************************************************** */
-template void reg_getNMIValue<float>(nifti_image *,nifti_image *,double *,unsigned short *,unsigned short *,unsigned short *,double **,double **,double **,int *);
-template void reg_getNMIValue<double>(nifti_image *,nifti_image *,double *,unsigned short *,unsigned short *,unsigned short *,double **,double **,double **,int *);
-/* *************************************************************** */
 /* *************************************************************** */
 double reg_nmi::GetSimilarityMeasureValue()
 {
@@ -457,7 +1461,23 @@ double reg_nmi::GetSimilarityMeasureValue()
       reg_print_msg_error("Both input images are exepected to have the same type");
       reg_exit();
    }
-   switch(this->referenceImagePointer->datatype)
+   if(this->usePVHistogram)
+   {
+      if(this->forwardPVBuffer==NULL)
+         this->forwardPVBuffer=new _reg_nmiPVBuffer[255];
+      this->UpdatePVJointHistograms(this->referenceImagePointer,
+                                    this->warpedFloatingImagePointer,
+                                    this->referenceMaskPointer,
+                                    this->referenceBinNumber,
+                                    this->floatingBinNumber,
+                                    this->forwardPVBuffer,
+                                    this->forwardJointHistogramPro,
+                                    this->forwardJointHistogramLog,
+                                    this->forwardEntropyValues);
+   }
+   else if(this->incrementalUpdate)
+      this->UpdateForwardJointHistograms();
+   else switch(this->referenceImagePointer->datatype)
    {
    case NIFTI_TYPE_FLOAT32:
       reg_getNMIValue<float>
@@ -502,7 +1522,21 @@ double reg_nmi::GetSimilarityMeasureValue()
          reg_print_msg_error("Both input images are exepected to have the same type");
          reg_exit();
       }
-      switch(this->floatingImagePointer->datatype)
+      if(this->usePVHistogram)
+      {
+         if(this->backwardPVBuffer==NULL)
+            this->backwardPVBuffer=new _reg_nmiPVBuffer[255];
+         this->UpdatePVJointHistograms(this->floatingImagePointer,
+                                       this->warpedReferenceImagePointer,
+                                       this->floatingMaskPointer,
+                                       this->floatingBinNumber,
+                                       this->referenceBinNumber,
+                                       this->backwardPVBuffer,
+                                       this->backwardJointHistogramPro,
+                                       this->backwardJointHistogramLog,
+                                       this->backwardEntropyValues);
+      }
+      else switch(this->floatingImagePointer->datatype)
       {
       case NIFTI_TYPE_FLOAT32:
          reg_getNMIValue<float>
@@ -673,7 +1707,8 @@ void reg_getVoxelBasedNMIGradient3D(nifti_image *referenceImage,
                                     nifti_image *measureGradientImage,
                                     int *referenceMask,
                                     int current_timepoint,
-                           double timepoint_weight
+                           double timepoint_weight,
+                                    size_t voxelOffset
                                     )
 {
    if(current_timepoint<0 || current_timepoint>=referenceImage->nt){
@@ -682,18 +1717,23 @@ void reg_getVoxelBasedNMIGradient3D(nifti_image *referenceImage,
       reg_exit();
    }
    //
+   // The gradient images may only cover a tile of the reference image
+   // that starts at the voxelOffset-th voxel
 #ifdef WIN32
    long i;
-   long voxelNumber = (long)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+   long voxelNumber = (long)measureGradientImage->nx*measureGradientImage->ny*measureGradientImage->nz;
+   long referenceVoxelNumber = (long)referenceImage->nx*referenceImage->ny*referenceImage->nz;
 #else
    size_t i;
-   size_t voxelNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+   size_t voxelNumber = (size_t)measureGradientImage->nx*measureGradientImage->ny*measureGradientImage->nz;
+   size_t referenceVoxelNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
 #endif
    // Pointers to the image data
    DTYPE *refImagePtr = static_cast<DTYPE *>(referenceImage->data);
-   DTYPE *refPtr = &refImagePtr[current_timepoint*voxelNumber];
+   DTYPE *refPtr = &refImagePtr[current_timepoint*referenceVoxelNumber+voxelOffset];
    DTYPE *warImagePtr = static_cast<DTYPE *>(warpedImage->data);
-   DTYPE *warPtr = &warImagePtr[current_timepoint*voxelNumber];
+   DTYPE *warPtr = &warImagePtr[current_timepoint*referenceVoxelNumber+voxelOffset];
+   referenceMask = &referenceMask[voxelOffset];
 
    // Pointers to the spatial gradient of the warped image
    DTYPE *warGradPtrX = static_cast<DTYPE *>(warImgGradient->data);
@@ -784,9 +1824,151 @@ void reg_getVoxelBasedNMIGradient3D(nifti_image *referenceImage,
 }
 /* *************************************************************** */
 template void reg_getVoxelBasedNMIGradient3D<float>
-(nifti_image *,nifti_image *,unsigned short *,unsigned short *,double **,double **,nifti_image *,nifti_image *,int *, int, double);
+(nifti_image *,nifti_image *,unsigned short *,unsigned short *,double **,double **,nifti_image *,nifti_image *,int *, int, double, size_t);
 template void reg_getVoxelBasedNMIGradient3D<double>
-(nifti_image *,nifti_image *,unsigned short *,unsigned short *,double **,double **,nifti_image *,nifti_image *,int *, int, double);
+(nifti_image *,nifti_image *,unsigned short *,unsigned short *,double **,double **,nifti_image *,nifti_image *,int *, int, double, size_t);
+/* *************************************************************** */
+template <class DTYPE>
+void reg_getVoxelBasedNMIPVGradient(_reg_nmiPVBuffer *pvBuffer,
+                                    unsigned short referenceBinNumber,
+                                    unsigned short floatingBinNumber,
+                                    double *jointHistogramLog,
+                                    double *entropyValues,
+                                    nifti_image *warImgGradient,
+                                    nifti_image *measureGradientImage,
+                                    double timepoint_weight)
+{
+#ifdef WIN32
+   long i;
+   long voxelNumber = (long)pvBuffer->voxelNumber;
+#else
+   size_t i;
+   size_t voxelNumber = pvBuffer->voxelNumber;
+#endif
+   int dimNumber = measureGradientImage->nz>1?3:2;
+   // Pointers to the spatial gradient of the warped image
+   DTYPE *warGradPtrX = static_cast<DTYPE *>(warImgGradient->data);
+   DTYPE *warGradPtrY = &warGradPtrX[voxelNumber];
+   DTYPE *warGradPtrZ = dimNumber==3?&warGradPtrY[voxelNumber]:NULL;
+   // Pointers to the measure of similarity gradient
+   DTYPE *measureGradPtrX = static_cast<DTYPE *>(measureGradientImage->data);
+   DTYPE *measureGradPtrY = &measureGradPtrX[voxelNumber];
+   DTYPE *measureGradPtrZ = dimNumber==3?&measureGradPtrY[voxelNumber]:NULL;
+
+   double nmi = (entropyValues[0]+entropyValues[1])/entropyValues[2];
+   double normalisation = timepoint_weight / (entropyValues[2]*entropyValues[3]);
+   double *refLogPtr = &jointHistogramLog[referenceBinNumber*floatingBinNumber];
+   double *warLogPtr = &refLogPtr[referenceBinNumber];
+   short *refFirstBin=pvBuffer->refFirstBin;
+   short *warFirstBin=pvBuffer->warFirstBin;
+   float **refWeight=pvBuffer->refWeight;
+   float **warDerivative=pvBuffer->warDerivative;
+   int r, w, refBin, warBin;
+   double deriv, refLog, grad, refW[4], warD[4];
+   // The derivative of the NMI with respect to the warped intensity is
+   // computed once per voxel from the stored weights and then scaled by
+   // every component of the spatial gradient
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+   private(i, r, w, refBin, warBin, deriv, refLog, grad, refW, warD) \
+   shared(voxelNumber, refFirstBin, warFirstBin, refWeight, warDerivative, \
+   jointHistogramLog, refLogPtr, warLogPtr, referenceBinNumber, floatingBinNumber, \
+   nmi, normalisation, warGradPtrX, warGradPtrY, warGradPtrZ, \
+   measureGradPtrX, measureGradPtrY, measureGradPtrZ)
+#endif // _OPENMP
+   for(i=0; i<voxelNumber; ++i)
+   {
+      if(refFirstBin[i]==NMI_PV_UNUSED_BIN)
+         continue;
+      reg_getNMIPVTaps(refWeight,i,1.,refW);
+      reg_getNMIPVTaps(warDerivative,i,0.,warD);
+      deriv=0.;
+      for(r=0; r<4; ++r)
+      {
+         refBin=refFirstBin[i]+r;
+         if(refW[r]==0 || refBin<0 || refBin>=referenceBinNumber)
+            continue;
+         refLog=refLogPtr[refBin];
+         for(w=0; w<4; ++w)
+         {
+            warBin=warFirstBin[i]+w;
+            if(warBin<0 || warBin>=floatingBinNumber)
+               continue;
+            deriv += refW[r] * warD[w] *
+                  (refLog + warLogPtr[warBin] -
+                   nmi * jointHistogramLog[refBin+warBin*referenceBinNumber]);
+         }
+      }
+      deriv *= normalisation;
+      grad=warGradPtrX[i];
+      if(grad==grad)
+         measureGradPtrX[i] += (DTYPE)(deriv * grad);
+      grad=warGradPtrY[i];
+      if(grad==grad)
+         measureGradPtrY[i] += (DTYPE)(deriv * grad);
+      if(warGradPtrZ!=NULL)
+      {
+         grad=warGradPtrZ[i];
+         if(grad==grad)
+            measureGradPtrZ[i] += (DTYPE)(deriv * grad);
+      }
+   }
+}
+/* *************************************************************** */
+template void reg_getVoxelBasedNMIPVGradient<float>
+(_reg_nmiPVBuffer *,unsigned short,unsigned short,double *,double *,nifti_image *,nifti_image *,double);
+template void reg_getVoxelBasedNMIPVGradient<double>
+(_reg_nmiPVBuffer *,unsigned short,unsigned short,double *,double *,nifti_image *,nifti_image *,double);
+/* *************************************************************** */
+void reg_nmi::GetVoxelBasedPVGradient(int current_timepoint)
+{
+   int t=current_timepoint;
+   switch(this->referenceImagePointer->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_getVoxelBasedNMIPVGradient<float>(&this->forwardPVBuffer[t],
+                                            this->referenceBinNumber[t],
+                                            this->floatingBinNumber[t],
+                                            this->forwardJointHistogramLog[t],
+                                            this->forwardEntropyValues[t],
+                                            this->warpedFloatingGradientImagePointer,
+                                            this->forwardVoxelBasedGradientImagePointer,
+                                            this->timePointWeight[t]);
+      if(this->isSymmetric)
+         reg_getVoxelBasedNMIPVGradient<float>(&this->backwardPVBuffer[t],
+                                               this->floatingBinNumber[t],
+                                               this->referenceBinNumber[t],
+                                               this->backwardJointHistogramLog[t],
+                                               this->backwardEntropyValues[t],
+                                               this->warpedReferenceGradientImagePointer,
+                                               this->backwardVoxelBasedGradientImagePointer,
+                                               this->timePointWeight[t]);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_getVoxelBasedNMIPVGradient<double>(&this->forwardPVBuffer[t],
+                                             this->referenceBinNumber[t],
+                                             this->floatingBinNumber[t],
+                                             this->forwardJointHistogramLog[t],
+                                             this->forwardEntropyValues[t],
+                                             this->warpedFloatingGradientImagePointer,
+                                             this->forwardVoxelBasedGradientImagePointer,
+                                             this->timePointWeight[t]);
+      if(this->isSymmetric)
+         reg_getVoxelBasedNMIPVGradient<double>(&this->backwardPVBuffer[t],
+                                                this->floatingBinNumber[t],
+                                                this->referenceBinNumber[t],
+                                                this->backwardJointHistogramLog[t],
+                                                this->backwardEntropyValues[t],
+                                                this->warpedReferenceGradientImagePointer,
+                                                this->backwardVoxelBasedGradientImagePointer,
+                                                this->timePointWeight[t]);
+      break;
+   default:
+      reg_print_fct_error("reg_nmi::GetVoxelBasedPVGradient()");
+      reg_print_msg_error("Unsupported datatype");
+      reg_exit();
+   }
+}
 /* *************************************************************** */
 void reg_nmi::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
 {
@@ -807,8 +1989,27 @@ void reg_nmi::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
       reg_exit();
    }
 
-   // Call compute similarity measure to calculate joint histogram
-   this->GetSimilarityMeasureValue();
+   // Call compute similarity measure to calculate joint histogram. When the
+   // gradient is computed tile by tile, the histogram from the first tile
+   // is reused
+   if(this->voxelBasedGradientOffset==0)
+   {
+      // The warped image used for the gradient is not resampled as the one
+      // of the line search. Its histograms are thus fully filled without
+      // altering the incremental cache, which still matches the last
+      // evaluation of the line search
+      bool incremental=this->incrementalUpdate;
+      this->incrementalUpdate=false;
+      this->GetSimilarityMeasureValue();
+      this->incrementalUpdate=incremental;
+   }
+
+   // The Parzen window weights stored during the value computation are used
+   if(this->usePVHistogram)
+   {
+      this->GetVoxelBasedPVGradient(current_timepoint);
+      return;
+   }
 
    // Compute the gradient of the nmi for the forward transformation
    if(this->referenceImagePointer->nz>1)  // 3D input images
@@ -826,7 +2027,8 @@ void reg_nmi::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                                this->forwardVoxelBasedGradientImagePointer,
                                                this->referenceMaskPointer,
                                                current_timepoint,
-                                    this->timePointWeight[current_timepoint]);
+                                    this->timePointWeight[current_timepoint],
+                                    this->voxelBasedGradientOffset);
          break;
       case NIFTI_TYPE_FLOAT64:
          reg_getVoxelBasedNMIGradient3D<double>(this->referenceImagePointer,
@@ -839,7 +2041,8 @@ void reg_nmi::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
                                                 this->forwardVoxelBasedGradientImagePointer,
                                                 this->referenceMaskPointer,
                                     current_timepoint,
-                                    this->timePointWeight[current_timepoint]);
+                                    this->timePointWeight[current_timepoint],
+                                    this->voxelBasedGradientOffset);
          break;
       default:
          reg_print_fct_error("reg_nmi::GetVoxelBasedSimilarityMeasureGradient()");
@@ -976,5 +2179,309 @@ void reg_nmi::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
 }
 /* *************************************************************** */
 /* *************************************************************** */
+template <class DTYPE>
+void reg_getMultiChannelNMIValue_core(nifti_image *referenceImages,
+                                      nifti_image *warpedImages,
+                                      unsigned int *reference_bins,
+                                      unsigned int *warped_bins,
+                                      double *probaJointHistogram,
+                                      double *logJointHistogram,
+                                      double *entropies,
+                                      int *mask)
+{
+   size_t voxelNumber = (size_t)referenceImages->nx *
+         referenceImages->ny *
+         referenceImages->nz;
+   int referenceChannelNumber = referenceImages->nt * referenceImages->nu;
+   int warpedChannelNumber = warpedImages->nt * warpedImages->nu;
+   int channelNumber = referenceChannelNumber + warpedChannelNumber;
+   if(channelNumber>255)
+   {
+      reg_print_fct_error("reg_getMultiChannelNMIValue");
+      reg_print_msg_error("The number of channels is limited to 255");
+      reg_exit();
+   }
+   // Gather the pointers to all channels, reference channels first
+   DTYPE *channelPtr[255];
+   unsigned int binNumber[255];
+   size_t referenceBinNumber=1, warpedBinNumber=1;
+   DTYPE *refImagePtr = static_cast<DTYPE *>(referenceImages->data);
+   DTYPE *warImagePtr = static_cast<DTYPE *>(warpedImages->data);
+   for(int c=0; c<referenceChannelNumber; ++c)
+   {
+      channelPtr[c] = &refImagePtr[c*voxelNumber];
+      binNumber[c] = reference_bins[c];
+      referenceBinNumber *= reference_bins[c];
+   }
+   for(int c=0; c<warpedChannelNumber; ++c)
+   {
+      channelPtr[referenceChannelNumber+c] = &warImagePtr[c*voxelNumber];
+      binNumber[referenceChannelNumber+c] = warped_bins[c];
+      warpedBinNumber *= warped_bins[c];
+   }
+   size_t jointBinNumber = referenceBinNumber * warpedBinNumber;
+   size_t totalBinNumber = jointBinNumber + referenceBinNumber + warpedBinNumber;
+
+   // Fill the joint histogram using the parallel histogram engine
+   memset(probaJointHistogram,0,totalBinNumber*sizeof(double));
+   reg_getJointHistogram<DTYPE>(channelNumber,
+                                channelPtr,
+                                binNumber,
+                                voxelNumber,
+                                mask,
+                                probaJointHistogram);
+
+   // Convolve the histogram with a cubic B-spline kernel along every axis,
+   // the log histogram is used as a temporary buffer
+   double kernel[2];
+   kernel[0]=GetBasisSplineValue(0.);
+   kernel[1]=GetBasisSplineValue(-1.);
+   size_t stride=1;
+   for(int c=0; c<channelNumber; ++c)
+   {
+      size_t lastBin=binNumber[c]-1;
+      for(size_t i=0; i<jointBinNumber; ++i)
+      {
+         size_t coord=(i/stride)%binNumber[c];
+         double value=kernel[0]*probaJointHistogram[i];
+         if(coord>0)
+            value += kernel[1]*probaJointHistogram[i-stride];
+         if(coord<lastBin)
+            value += kernel[1]*probaJointHistogram[i+stride];
+         logJointHistogram[i]=value;
+      }
+      memcpy(probaJointHistogram,logJointHistogram,jointBinNumber*sizeof(double));
+      stride*=binNumber[c];
+   }
+
+   // Normalise the histogram
+   double activeVoxel=0.;
+   for(size_t i=0; i<jointBinNumber; ++i)
+      activeVoxel+=probaJointHistogram[i];
+   entropies[3]=activeVoxel;
+   for(size_t i=0; i<jointBinNumber; ++i)
+      probaJointHistogram[i]/=activeVoxel;
+
+   // Marginalise over the reference and warped channels
+   double *referenceMarginal=&probaJointHistogram[jointBinNumber];
+   double *warpedMarginal=&probaJointHistogram[jointBinNumber+referenceBinNumber];
+   for(size_t i=0; i<jointBinNumber; ++i)
+   {
+      referenceMarginal[i%referenceBinNumber]+=probaJointHistogram[i];
+      warpedMarginal[i/referenceBinNumber]+=probaJointHistogram[i];
+   }
+
+   // Compute the log values and the entropies
+   memset(logJointHistogram,0,totalBinNumber*sizeof(double));
+   double referenceEntropy=0., warpedEntropy=0., jointEntropy=0.;
+   for(size_t i=0; i<totalBinNumber; ++i)
+   {
+      double valPro=probaJointHistogram[i];
+      if(valPro>0)
+      {
+         double valLog=log(valPro);
+         logJointHistogram[i]=valLog;
+         if(i<jointBinNumber)
+            jointEntropy -= valPro * valLog;
+         else if(i<jointBinNumber+referenceBinNumber)
+            referenceEntropy -= valPro * valLog;
+         else warpedEntropy -= valPro * valLog;
+      }
+   }
+   entropies[0]=referenceEntropy;
+   entropies[1]=warpedEntropy;
+   entropies[2]=jointEntropy;
+}
+/* *************************************************************** */
+void reg_getMultiChannelNMIValue(nifti_image *referenceImages,
+                                 nifti_image *warpedImages,
+                                 unsigned int *reference_bins,
+                                 unsigned int *warped_bins,
+                                 double *probaJointHistogram,
+                                 double *logJointHistogram,
+                                 double *entropies,
+                                 int *mask,
+                                 bool approx)
+{
+   if(referenceImages->datatype!=warpedImages->datatype)
+   {
+      reg_print_fct_error("reg_getMultiChannelNMIValue");
+      reg_print_msg_error("Both input images are exepected to have the same type");
+      reg_exit();
+   }
+   if(!approx)
+      reg_print_msg_warn("Only the approximated multi-channel joint histogram is implemented");
+   switch(referenceImages->datatype)
+   {
+   case NIFTI_TYPE_FLOAT32:
+      reg_getMultiChannelNMIValue_core<float>
+            (referenceImages,warpedImages,reference_bins,warped_bins,
+             probaJointHistogram,logJointHistogram,entropies,mask);
+      break;
+   case NIFTI_TYPE_FLOAT64:
+      reg_getMultiChannelNMIValue_core<double>
+            (referenceImages,warpedImages,reference_bins,warped_bins,
+             probaJointHistogram,logJointHistogram,entropies,mask);
+      break;
+   default:
+      reg_print_fct_error("reg_getMultiChannelNMIValue");
+      reg_print_msg_error("Unsupported datatype");
+      reg_exit();
+   }
+}
+/* *************************************************************** */
+reg_multichannel_nmi::reg_multichannel_nmi()
+   : reg_measure()
+{
+   this->forwardJointHistogramProp=NULL;
+   this->forwardJointHistogramLog=NULL;
+   this->forwardEntropyValues=NULL;
+   this->backwardJointHistogramProp=NULL;
+   this->backwardJointHistogramLog=NULL;
+   this->backwardEntropyValues=NULL;
+   for(int i=0; i<255; ++i)
+   {
+      this->referenceBinNumber[i]=68;
+      this->floatingBinNumber[i]=68;
+      this->totalBinNumber[i]=0;
+   }
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_multichannel_nmi constructor called");
+#endif
+}
+/* *************************************************************** */
+reg_multichannel_nmi::~reg_multichannel_nmi()
+{
+   if(this->forwardJointHistogramProp!=NULL)
+      free(this->forwardJointHistogramProp);
+   if(this->forwardJointHistogramLog!=NULL)
+      free(this->forwardJointHistogramLog);
+   if(this->forwardEntropyValues!=NULL)
+      free(this->forwardEntropyValues);
+   if(this->backwardJointHistogramProp!=NULL)
+      free(this->backwardJointHistogramProp);
+   if(this->backwardJointHistogramLog!=NULL)
+      free(this->backwardJointHistogramLog);
+   if(this->backwardEntropyValues!=NULL)
+      free(this->backwardEntropyValues);
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_multichannel_nmi destructor called");
+#endif
+}
+/* *************************************************************** */
+void reg_multichannel_nmi::InitialiseMeasure(nifti_image *refImgPtr,
+                                             nifti_image *floImgPtr,
+                                             int *maskRefPtr,
+                                             nifti_image *warFloImgPtr,
+                                             nifti_image *warFloGraPtr,
+                                             nifti_image *forVoxBasedGraPtr,
+                                             nifti_image *forwardLocalWeightPtr,
+                                             int *maskFloPtr,
+                                             nifti_image *warRefImgPtr,
+                                             nifti_image *warRefGraPtr,
+                                             nifti_image *bckVoxBasedGraPtr)
+{
+   // Set the pointers using the parent class function
+   reg_measure::InitialiseMeasure(refImgPtr,
+                                  floImgPtr,
+                                  maskRefPtr,
+                                  warFloImgPtr,
+                                  warFloGraPtr,
+                                  forVoxBasedGraPtr,
+                                  forwardLocalWeightPtr,
+                                  maskFloPtr,
+                                  warRefImgPtr,
+                                  warRefGraPtr,
+                                  bckVoxBasedGraPtr);
+
+   // All channels contribute to the joint histogram. They are rescaled
+   // between 2 and bin-3 as done for the single channel NMI
+   size_t referenceBins=1, floatingBins=1;
+   for(int i=0; i<this->referenceTimePoint; ++i)
+   {
+      reg_intensityRescale(this->referenceImagePointer,
+                           i,
+                           2.f,
+                           this->referenceBinNumber[i]-3);
+      reg_intensityRescale(this->floatingImagePointer,
+                           i,
+                           2.f,
+                           this->floatingBinNumber[i]-3);
+      referenceBins*=this->referenceBinNumber[i];
+      floatingBins*=this->floatingBinNumber[i];
+   }
+   size_t totalBins=referenceBins*floatingBins+referenceBins+floatingBins;
+
+   // Create the joint histograms
+   if(this->forwardJointHistogramProp!=NULL)
+      free(this->forwardJointHistogramProp);
+   if(this->forwardJointHistogramLog!=NULL)
+      free(this->forwardJointHistogramLog);
+   if(this->forwardEntropyValues!=NULL)
+      free(this->forwardEntropyValues);
+   this->forwardJointHistogramProp=(double *)calloc(totalBins,sizeof(double));
+   this->forwardJointHistogramLog=(double *)calloc(totalBins,sizeof(double));
+   this->forwardEntropyValues=(double *)calloc(4,sizeof(double));
+   if(this->isSymmetric)
+   {
+      if(this->backwardJointHistogramProp!=NULL)
+         free(this->backwardJointHistogramProp);
+      if(this->backwardJointHistogramLog!=NULL)
+         free(this->backwardJointHistogramLog);
+      if(this->backwardEntropyValues!=NULL)
+         free(this->backwardEntropyValues);
+      this->backwardJointHistogramProp=(double *)calloc(totalBins,sizeof(double));
+      this->backwardJointHistogramLog=(double *)calloc(totalBins,sizeof(double));
+      this->backwardEntropyValues=(double *)calloc(4,sizeof(double));
+   }
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_multichannel_nmi::InitialiseMeasure().");
+#endif
+}
+/* *************************************************************** */
+double reg_multichannel_nmi::GetSimilarityMeasureValue()
+{
+   unsigned int referenceBins[255], floatingBins[255];
+   for(int i=0; i<this->referenceTimePoint; ++i)
+   {
+      referenceBins[i]=this->referenceBinNumber[i];
+      floatingBins[i]=this->floatingBinNumber[i];
+   }
+
+   reg_getMultiChannelNMIValue(this->referenceImagePointer,
+                               this->warpedFloatingImagePointer,
+                               referenceBins,
+                               floatingBins,
+                               this->forwardJointHistogramProp,
+                               this->forwardJointHistogramLog,
+                               this->forwardEntropyValues,
+                               this->referenceMaskPointer,
+                               true);
+   double nmi_value=(this->forwardEntropyValues[0] +
+                     this->forwardEntropyValues[1]) /
+                    this->forwardEntropyValues[2];
+
+   if(this->isSymmetric)
+   {
+      reg_getMultiChannelNMIValue(this->floatingImagePointer,
+                                  this->warpedReferenceImagePointer,
+                                  floatingBins,
+                                  referenceBins,
+                                  this->backwardJointHistogramProp,
+                                  this->backwardJointHistogramLog,
+                                  this->backwardEntropyValues,
+                                  this->floatingMaskPointer,
+                                  true);
+      nmi_value+=(this->backwardEntropyValues[0] +
+                  this->backwardEntropyValues[1]) /
+                 this->backwardEntropyValues[2];
+   }
+#ifndef NDEBUG
+   reg_print_msg_debug("reg_multichannel_nmi::GetSimilarityMeasureValue called");
+#endif
+   return nmi_value;
+}
+/* *************************************************************** */
+/* *************************************************************** */
 
 #endif // _REG_NMI
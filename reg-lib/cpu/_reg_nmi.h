@@ -14,10 +14,46 @@
 
 #include "_reg_measure.h"
 #include <vector>
+#include <climits>
 #if defined (_OPENMP)
 #include "omp.h"
 #endif
 
+/// Number of double values stored in a cache line, used to pad the
+/// per-thread private histograms
+#define NMI_CACHE_LINE_DOUBLE 8
+
+/* *************************************************************** */
+/// Value of the first bin of a voxel that is not used by the Parzen window
+/// histogram
+#define NMI_PV_UNUSED_BIN SHRT_MIN
+/// @brief Cubic B-spline Parzen window weights of every voxel, stored as a
+/// structure of arrays. Each voxel contributes to 4x4 consecutive bins
+/// starting at (refFirstBin, warFirstBin) and the bins that fall outside of
+/// the histogram are skipped; NMI_PV_UNUSED_BIN flags a voxel that is not
+/// used. The four weights of a window sum to one and their derivatives,
+/// taken with respect to the warped intensity, sum to zero: only the first
+/// three are stored. A voxel thus requires 2x2 bytes for the bins and 9x4
+/// bytes for the weights and derivatives, 40 bytes in total.
+struct _reg_nmiPVBuffer
+{
+   size_t voxelNumber;
+   short *refFirstBin;
+   short *warFirstBin;
+   float *refWeight[3];
+   float *warWeight[3];
+   float *warDerivative[3];
+
+   _reg_nmiPVBuffer()
+      : voxelNumber(0),
+        refFirstBin(NULL),
+        warFirstBin(NULL)
+   {
+      for(int i=0; i<3; ++i)
+         refWeight[i]=warWeight[i]=warDerivative[i]=NULL;
+   }
+};
+
 /* *************************************************************** */
 /* *************************************************************** */
 /// @brief NMI measure of similarity classe
@@ -41,6 +77,13 @@ public:
    double GetSimilarityMeasureValue();
    /// @brief Compute the voxel based nmi gradient
    void GetVoxelBasedSimilarityMeasureGradient(int current_timepoint);
+   /// @brief The histograms are computed when the first tile is processed
+   /// and the gradient of 3D images is then computed tile by tile. The
+   /// partial volume filling requires the full image.
+   bool SupportsVoxelBasedGradientTiles()
+   {
+      return !this->usePVHistogram;
+   }
    void SetRefAndFloatBinNumbers(unsigned short refBinNumber,
                                  unsigned short floBinNumber,
                                  int timepoint)
@@ -64,6 +107,33 @@ public:
    {
       return this->floatingBinNumber;
    }
+   /// @brief Enable the incremental update of the forward joint histograms.
+   /// The reference space is divided into tiles of the provided size, in
+   /// voxel, and only the voxels of the tiles flagged as modified are
+   /// binned again when the measure is evaluated.
+   void SetIncrementalTileSpacing(float *spacing);
+   /// @brief Flag a box of tiles, first and last tile included, as modified
+   /// since the previous evaluation of the measure
+   void SetModifiedTiles(int *first, int *last);
+   /// @brief Flag the tiles influenced by every control point whose
+   /// position differs from the previous one. The previous positions are
+   /// stored with the size and the datatype of the control point grid
+   void SetModifiedControlPoints(nifti_image *controlPointGrid,
+                                 void *previousGridData);
+   /// @brief Returns the normalised forward joint histograms, followed
+   /// by the reference and floating marginal histograms
+   double **GetForwardJointHistogramPro()
+   {
+      return this->forwardJointHistogramPro;
+   }
+   /// @brief Fill the joint histograms using the cubic B-spline Parzen
+   /// window of every voxel instead of smoothing a binned histogram. The
+   /// voxel weights and their derivatives are stored when the measure value
+   /// is computed and reused by the gradient computation.
+   void SetPartialVolumeHistogram(bool pv)
+   {
+      this->usePVHistogram=pv;
+   }
    /// @brief reg_nmi class destructor
    ~reg_nmi();
 
@@ -78,10 +148,114 @@ protected:
    double **backwardJointHistogramLog;
    double **backwardEntropyValues;
 
+   bool incrementalUpdate;
+   bool incrementalCacheValid;
+   float incrementalTileSpacing[3];
+   int incrementalTileNumber[3];
+   unsigned char *modifiedTiles;
+   int **forwardVoxelBinIndex;
+   double **forwardJointHistogramRaw;
+
+   bool usePVHistogram;
+   _reg_nmiPVBuffer *forwardPVBuffer;
+   _reg_nmiPVBuffer *backwardPVBuffer;
+
    void ClearHistogram();
+   void ClearIncrementalCache();
+   void ClearPVBuffers();
+   void UpdateForwardJointHistograms();
+   void UpdatePVJointHistograms(nifti_image *refImage,
+                                nifti_image *warImage,
+                                int *refMask,
+                                unsigned short *refBinNumber,
+                                unsigned short *warBinNumber,
+                                _reg_nmiPVBuffer *pvBuffer,
+                                double **jointHistogramPro,
+                                double **jointHistogramLog,
+                                double **entropyValues);
+   void GetVoxelBasedPVGradient(int current_timepoint);
 };
 /* *************************************************************** */
 /* *************************************************************** */
+/** @brief Fill a joint histogram from several channels sharing the same
+ * voxel grid. Every channel is expected to be rescaled between 0 and its
+ * bin number. When OpenMP is used, every thread fills its own cache line
+ * aligned histogram and the private histograms are combined using a
+ * tree reduction.
+ * @param channelNumber Number of channels used to build the histogram
+ * @param channelPtr Array of pointers to the data of every channel
+ * @param binNumber Number of bins for every channel
+ * @param voxelNumber Number of voxels per channel
+ * @param mask Voxels with a negative mask value are ignored
+ * @param jointHistogram Output histogram of size the product of the bin
+ * numbers, the first channel varying the fastest
+ */
+extern "C++" template <class DTYPE>
+void reg_getJointHistogram(int channelNumber,
+                           DTYPE **channelPtr,
+                           unsigned int *binNumber,
+                           size_t voxelNumber,
+                           int *mask,
+                           double *jointHistogram);
+/* *************************************************************** */
+/** @brief Smooth a joint histogram with a cubic B-spline kernel, normalise
+ * it and compute its marginals, log values and entropies. The smoothing is
+ * performed using the SSE or AVX2 instructions when supported by the CPU.
+ * @param jointHistoProPtr Joint histogram to smooth, followed by space for
+ * the reference and floating marginal histograms
+ * @param jointHistoLogPtr Output log values, same layout as jointHistoProPtr
+ * @param entropyValues Output reference, floating and joint entropies,
+ * followed by the number of active voxels
+ * @param referenceBinNumber Number of bins along the reference axis
+ * @param floatingBinNumber Number of bins along the floating axis
+ * @param smoothHistogram The smoothing is skipped when false, for histograms
+ * already filled using a Parzen window
+ * @param simd Instruction set to use
+ */
+extern "C++"
+void reg_getNMIEntropies(double *jointHistoProPtr,
+                         double *jointHistoLogPtr,
+                         double *entropyValues,
+                         int referenceBinNumber,
+                         int floatingBinNumber,
+                         bool smoothHistogram = true,
+                         NREG_SIMD_TYPE simd = reg_getSIMDSupport());
+/* *************************************************************** */
+/** @brief Compute the cubic B-spline Parzen window weights of every voxel,
+ * store them in the provided buffer and use them to fill the joint
+ * histogram.
+ * @param referenceImage Reference image, rescaled between 2 and bin-3
+ * @param warpedImage Warped floating image
+ * @param current_timepoint Time point to consider
+ * @param referenceBinNumber Number of bins along the reference axis
+ * @param floatingBinNumber Number of bins along the warped axis
+ * @param referenceMask Voxels with a negative mask value are ignored
+ * @param pvBuffer Allocated buffer that receives the voxel weights
+ * @param jointHistogram Output histogram of size the product of bin numbers
+ */
+extern "C++" template <class DTYPE>
+void reg_getNMIPVHistogram(nifti_image *referenceImage,
+                           nifti_image *warpedImage,
+                           int current_timepoint,
+                           unsigned short referenceBinNumber,
+                           unsigned short floatingBinNumber,
+                           int *referenceMask,
+                           _reg_nmiPVBuffer *pvBuffer,
+                           double *jointHistogram);
+/* *************************************************************** */
+/** @brief Compute the voxel based NMI gradient from the Parzen window
+ * weights stored by reg_getNMIPVHistogram. Works for 2D and 3D images.
+ */
+extern "C++" template <class DTYPE>
+void reg_getVoxelBasedNMIPVGradient(_reg_nmiPVBuffer *pvBuffer,
+                                    unsigned short referenceBinNumber,
+                                    unsigned short floatingBinNumber,
+                                    double *jointHistogramLog,
+                                    double *entropyValues,
+                                    nifti_image *warImgGradient,
+                                    nifti_image *measureGradientImage,
+                                    double timepoint_weight);
+/* *************************************************************** */
 extern "C++" template <class DTYPE>
 void reg_getNMIValue(nifti_image *referenceImage,
                      nifti_image *warpedImage,
@@ -120,7 +294,8 @@ void reg_getVoxelBasedNMIGradient3D(nifti_image *referenceImage,
                                     nifti_image *nmiGradientImage,
                                     int *referenceMask,
                                     int current_timepoint,
-                                    double timepoint_weight
+                                    double timepoint_weight,
+                                    size_t voxelOffset = 0
                                    );
 /* *************************************************************** */
 /* *************************************************************** */
@@ -262,13 +437,23 @@ inline int previous(int current, int num_dims)
 class reg_multichannel_nmi : public reg_measure
 {
 public:
-   /// @brief reg_nmi class constructor
-   reg_multichannel_nmi() {}
-   /// @brief Returns the nmi value
-   double GetSimilarityMeasureValue()
-   {
-      return 0.;
-   }
+   /// @brief reg_multichannel_nmi class constructor
+   reg_multichannel_nmi();
+   /// @brief Initialise the reg_multichannel_nmi object
+   void InitialiseMeasure(nifti_image *refImgPtr,
+                          nifti_image *floImgPtr,
+                          int *maskRefPtr,
+                          nifti_image *warFloImgPtr,
+                          nifti_image *warFloGraPtr,
+                          nifti_image *forVoxBasedGraPtr,
+                          nifti_image *forwardLocalWeightPtr = NULL,
+                          int *maskFloPtr = NULL,
+                          nifti_image *warRefImgPtr = NULL,
+                          nifti_image *warRefGraPtr = NULL,
+                          nifti_image *bckVoxBasedGraPtr = NULL);
+   /// @brief Returns the nmi value computed from the joint histogram of
+   /// all reference and warped channels
+   double GetSimilarityMeasureValue();
    /// @brief Compute the voxel based nmi gradient
    void GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
    {
@@ -277,8 +462,8 @@ public:
       if(this->timePointWeight[current_timepoint]==0.0)
          return;;
    }
-   /// @brief reg_nmi class destructor
-   ~reg_multichannel_nmi() {}
+   /// @brief reg_multichannel_nmi class destructor
+   ~reg_multichannel_nmi();
 protected:
    unsigned short referenceBinNumber[255];
    unsigned short floatingBinNumber[255];
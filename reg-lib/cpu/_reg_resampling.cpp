@@ -16,9 +16,12 @@
 #include "_reg_maths.h"
 #include "_reg_maths_eigen.h"
 #include "_reg_tools.h"
+#include <map>
+#include <vector>
 
 #define SINC_KERNEL_RADIUS 3
 #define SINC_KERNEL_SIZE SINC_KERNEL_RADIUS*2
+#define SINC_KERNEL_OVERSAMPLING 1024
 
 /* *************************************************************** */
 void interpWindowedSincKernel(double relative, double *basis)
@@ -47,6 +50,73 @@ void interpWindowedSincKernel(double relative, double *basis)
         basis[i]/=sum;
 }
 
+/* *************************************************************** */
+/* The windowed sinc weights are tabulated for SINC_KERNEL_OVERSAMPLING
+ * relative positions between two voxels. Intermediate positions are
+ * linearly interpolated between two consecutive normalised rows, so the
+ * weights still sum to one. An oversampling of 0 uses the analytic kernel.
+ */
+static int sincKernelOversampling = SINC_KERNEL_OVERSAMPLING;
+static double *sincKernelTable = NULL;
+/* *************************************************************** */
+void reg_setWindowedSincOversampling(int oversampling)
+{
+    if(oversampling<0)
+    {
+        reg_print_fct_error("reg_setWindowedSincOversampling");
+        reg_print_msg_error("The oversampling factor is expected to be positive or null");
+        reg_exit();
+    }
+    if(sincKernelTable!=NULL)
+    {
+        free(sincKernelTable);
+        sincKernelTable=NULL;
+    }
+    sincKernelOversampling=oversampling;
+    if(sincKernelOversampling==0)
+        return;
+    sincKernelTable=(double *)malloc((sincKernelOversampling+1)*SINC_KERNEL_SIZE*sizeof(double));
+    for(int i=0; i<=sincKernelOversampling; ++i)
+        interpWindowedSincKernel(static_cast<double>(i)/static_cast<double>(sincKernelOversampling),
+                                 &sincKernelTable[i*SINC_KERNEL_SIZE]);
+#ifndef NDEBUG
+    char text[255];
+    sprintf(text, "Windowed sinc table generated with an oversampling of %i", sincKernelOversampling);
+    reg_print_msg_debug(text);
+#endif
+}
+/* *************************************************************** */
+int reg_getWindowedSincOversampling()
+{
+    return sincKernelOversampling;
+}
+/* *************************************************************** */
+/* The table is generated outside of any parallel region, by the functions
+ * that expose the sinc interpolation
+ */
+void reg_initWindowedSincTable()
+{
+    if(sincKernelOversampling>0 && sincKernelTable==NULL)
+        reg_setWindowedSincOversampling(sincKernelOversampling);
+}
+/* *************************************************************** */
+void interpWindowedSincKernelTable(double relative, double *basis)
+{
+    if(sincKernelTable==NULL)
+    {
+        interpWindowedSincKernel(relative, basis);
+        return;
+    }
+    if(relative<0.0) relative=0.0; //reg_rounding error
+    double position=relative*static_cast<double>(sincKernelOversampling);
+    int index=static_cast<int>(position);
+    if(index>=sincKernelOversampling) index=sincKernelOversampling-1;
+    double weight=position-static_cast<double>(index);
+    const double *first=&sincKernelTable[index*SINC_KERNEL_SIZE];
+    const double *second=&first[SINC_KERNEL_SIZE];
+    for(int i=0;i<SINC_KERNEL_SIZE;++i)
+        basis[i]=first[i]+weight*(second[i]-first[i]);
+}
 /* *************************************************************** */
 /* *************************************************************** */
 double interpWindowedSincKernel_Samp(double x, double kernelsize)
@@ -355,13 +425,56 @@ void reg_dti_resampling_postprocessing(nifti_image *inputImage,
     }
 }
 /* *************************************************************** */
-template<class FloatingTYPE, class FieldTYPE>
+template<class DTYPE>
+inline DTYPE reg_castResampledIntensity(double intensity, int datatype)
+{
+    switch(datatype)
+    {
+    case NIFTI_TYPE_FLOAT32:
+    case NIFTI_TYPE_FLOAT64:
+        return static_cast<DTYPE>(intensity);
+    case NIFTI_TYPE_UINT8:
+        if(intensity!=intensity)
+            intensity=0;
+        intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
+        return static_cast<DTYPE>(intensity>0?reg_round(intensity):0);
+    case NIFTI_TYPE_UINT16:
+        if(intensity!=intensity)
+            intensity=0;
+        intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
+        return static_cast<DTYPE>(intensity>0?reg_round(intensity):0);
+    case NIFTI_TYPE_UINT32:
+        if(intensity!=intensity)
+            intensity=0;
+        intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
+        return static_cast<DTYPE>(intensity>0?reg_round(intensity):0);
+    default:
+        if(intensity!=intensity)
+            intensity=0;
+        return static_cast<DTYPE>(reg_round(intensity));
+    }
+}
+/* *************************************************************** */
+/** Interpolation kernel selected at compile time: 0, 1, 3 or 4 correspond
+ * to nearest neighbor, linear, cubic spline or windowed sinc interpolation.
+ */
+template<int kernel>
+inline void interpKernel(double relative, double *basis)
+{
+    switch(kernel){
+    case 0: interpNearestNeighKernel(relative, basis); break;
+    case 1: interpLinearKernel(relative, basis); break;
+    case 4: interpWindowedSincKernelTable(relative, basis); break;
+    default: interpCubicSplineKernel(relative, basis); break;
+    }
+}
+/* *************************************************************** */
+template<class FloatingTYPE, class FieldTYPE, int kernel>
 void ResampleImage3D(nifti_image *floatingImage,
                      nifti_image *deformationField,
                      nifti_image *warpedImage,
                      int *mask,
-                     FieldTYPE paddingValue,
-                     int kernel)
+                     FieldTYPE paddingValue)
 {
 #ifdef _WIN32
     long  index;
@@ -385,32 +498,12 @@ void ResampleImage3D(nifti_image *floatingImage,
         floatingIJKMatrix=&(floatingImage->sto_ijk);
     else floatingIJKMatrix=&(floatingImage->qto_ijk);
 
-    // Define the kernel to use
-    int kernel_size;
-    int kernel_offset=0;
-    void (*kernelCompFctPtr)(double,double *);
-    switch(kernel){
-    case 0:
-        kernel_size=2;
-        kernelCompFctPtr=&interpNearestNeighKernel;
-        kernel_offset=0;
-        break; // nereast-neighboor interpolation
-    case 1:
-        kernel_size=2;
-        kernelCompFctPtr=&interpLinearKernel;
-        kernel_offset=0;
-        break; // linear interpolation
-    case 4:
-        kernel_size=SINC_KERNEL_SIZE;
-        kernelCompFctPtr=&interpWindowedSincKernel;
-        kernel_offset=SINC_KERNEL_RADIUS;
-        break; // sinc interpolation
-    default:
-        kernel_size=4;
-        kernelCompFctPtr=&interpCubicSplineKernel;
-        kernel_offset=1;
-        break; // cubic spline interpolation
-    }
+    // The kernel size is known at compile time so that the loops over the taps are unrolled
+    const int kernel_size = kernel==4?SINC_KERNEL_SIZE:(kernel==0||kernel==1?2:4);
+    const int kernel_offset = kernel==4?SINC_KERNEL_RADIUS:(kernel==0||kernel==1?0:1);
+    const int floatingDim[3]={floatingImage->nx, floatingImage->ny, floatingImage->nz};
+    const size_t floatingPlaneNumber = (size_t)floatingDim[0]*floatingDim[1];
+    const int datatype = floatingImage->datatype;
 
     // Iteration over the different volume along the 4th axis
     for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
@@ -424,19 +517,19 @@ void ResampleImage3D(nifti_image *floatingImage,
         FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
         FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
 
-        int a, b, c, Y, Z, previous[3];
+        int a, b, c, X, Y, Z, previous[3];
 
         FloatingTYPE *zPointer, *xyzPointer;
-        double xBasis[SINC_KERNEL_SIZE], yBasis[SINC_KERNEL_SIZE], zBasis[SINC_KERNEL_SIZE], relative[3];
+        double xBasis[kernel_size], yBasis[kernel_size], zBasis[kernel_size], relative[3];
         double xTempNewValue, yTempNewValue, intensity;
         float world[3], position[3];
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
     private(index, intensity, world, position, previous, xBasis, yBasis, zBasis, relative, \
-    a, b, c, Y, Z, zPointer, xyzPointer, xTempNewValue, yTempNewValue) \
+    a, b, c, X, Y, Z, zPointer, xyzPointer, xTempNewValue, yTempNewValue) \
     shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, floatingVoxelNumber, \
     deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ, maskPtr, \
-    floatingIJKMatrix, floatingImage, paddingValue, kernel_size, kernel_offset, kernelCompFctPtr)
+    floatingIJKMatrix, floatingDim, floatingPlaneNumber, datatype, paddingValue)
 #endif // _OPENMP
         for(index=0; index<warpedVoxelNumber; index++)
         {
@@ -460,61 +553,61 @@ void ResampleImage3D(nifti_image *floatingImage,
                 relative[1]=static_cast<double>(position[1])-static_cast<double>(previous[1]);
                 relative[2]=static_cast<double>(position[2])-static_cast<double>(previous[2]);
 
-                (*kernelCompFctPtr)(relative[0], xBasis);
-                (*kernelCompFctPtr)(relative[1], yBasis);
-                (*kernelCompFctPtr)(relative[2], zBasis);
+                interpKernel<kernel>(relative[0], xBasis);
+                interpKernel<kernel>(relative[1], yBasis);
+                interpKernel<kernel>(relative[2], zBasis);
                 previous[0]-=kernel_offset;
                 previous[1]-=kernel_offset;
                 previous[2]-=kernel_offset;
 
                 intensity=0.0;
-                if(-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingImage->nx &&
-                   -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingImage->ny &&
-                   -1<(previous[2]) && (previous[2]+kernel_size-1)<floatingImage->nz){
+                if(-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                   -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingDim[1] &&
+                   -1<(previous[2]) && (previous[2]+kernel_size-1)<floatingDim[2]){
+                   zPointer = &floatingIntensity[previous[2]*floatingPlaneNumber +
+                           previous[1]*floatingDim[0] + previous[0]];
                    for(c=0; c<kernel_size; c++)
                    {
-                      Z= previous[2]+c;
-                      zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
                       yTempNewValue=0.0;
                       for(b=0; b<kernel_size; b++)
                       {
-                         Y= previous[1]+b;
-                         xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
+                         xyzPointer = &zPointer[b*floatingDim[0]];
                          xTempNewValue=0.0;
                          for(a=0; a<kernel_size; a++)
                          {
-                            xTempNewValue +=  static_cast<double>(*xyzPointer++) * xBasis[a];
+                            xTempNewValue +=  static_cast<double>(xyzPointer[a]) * xBasis[a];
                          }
                          yTempNewValue += xTempNewValue * yBasis[b];
                       }
                       intensity += yTempNewValue * zBasis[c];
+                      zPointer += floatingPlaneNumber;
                    }
                 }
                 else{
                    for(c=0; c<kernel_size; c++)
                    {
                       Z= previous[2]+c;
-                      zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
                       yTempNewValue=0.0;
                       for(b=0; b<kernel_size; b++)
                       {
                          Y= previous[1]+b;
-                         xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
                          xTempNewValue=0.0;
                          for(a=0; a<kernel_size; a++)
                          {
-                            if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
-                               -1<Z && Z<floatingImage->nz &&
-                               -1<Y && Y<floatingImage->ny)
+                            X= previous[0]+a;
+                            if(-1<X && X<floatingDim[0] &&
+                               -1<Y && Y<floatingDim[1] &&
+                               -1<Z && Z<floatingDim[2])
                             {
-                               xTempNewValue +=  static_cast<double>(*xyzPointer) * xBasis[a];
+                               xTempNewValue +=  static_cast<double>(
+                                        floatingIntensity[Z*floatingPlaneNumber+Y*floatingDim[0]+X]) *
+                                     xBasis[a];
                             }
                             else
                             {
                                // paddingValue
                                xTempNewValue +=  static_cast<double>(paddingValue) * xBasis[a];
                             }
-                            xyzPointer++;
                          }
                          yTempNewValue += xTempNewValue * yBasis[b];
                       }
@@ -523,49 +616,17 @@ void ResampleImage3D(nifti_image *floatingImage,
                 }
             }
 
-            switch(floatingImage->datatype)
-            {
-            case NIFTI_TYPE_FLOAT32:
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
-                break;
-            case NIFTI_TYPE_FLOAT64:
-                warpedIntensity[index]=intensity;
-                break;
-            case NIFTI_TYPE_UINT8:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_UINT16:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_UINT32:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            default:
-                if(intensity!=intensity)
-                    intensity=0;
-                warpedIntensity[index]=static_cast<FloatingTYPE>(reg_round(intensity));
-                break;
-            }
+            warpedIntensity[index]=reg_castResampledIntensity<FloatingTYPE>(intensity, datatype);
         }
     }
 }
 /* *************************************************************** */
-template<class FloatingTYPE, class FieldTYPE>
+template<class FloatingTYPE, class FieldTYPE, int kernel>
 void ResampleImage2D(nifti_image *floatingImage,
                      nifti_image *deformationField,
                      nifti_image *warpedImage,
                      int *mask,
-                     FieldTYPE paddingValue,
-                     int kernel)
+                     FieldTYPE paddingValue)
 {
 #ifdef _WIN32
     long  index;
@@ -588,31 +649,11 @@ void ResampleImage2D(nifti_image *floatingImage,
         floatingIJKMatrix=&(floatingImage->sto_ijk);
     else floatingIJKMatrix=&(floatingImage->qto_ijk);
 
-    int kernel_size;
-    int kernel_offset=0;
-    void (*kernelCompFctPtr)(double,double *);
-    switch(kernel){
-    case 0:
-        kernel_size=2;
-        kernelCompFctPtr=&interpNearestNeighKernel;
-        kernel_offset=0;
-        break; // nereast-neighboor interpolation
-    case 1:
-        kernel_size=2;
-        kernelCompFctPtr=&interpLinearKernel;
-        kernel_offset=0;
-        break; // linear interpolation
-    case 4:
-        kernel_size=SINC_KERNEL_SIZE;
-        kernelCompFctPtr=&interpWindowedSincKernel;
-        kernel_offset=SINC_KERNEL_RADIUS;
-        break; // sinc interpolation
-    default:
-        kernel_size=4;
-        kernelCompFctPtr=&interpCubicSplineKernel;
-        kernel_offset=1;
-        break; // cubic spline interpolation
-    }
+    // The kernel size is known at compile time so that the loops over the taps are unrolled
+    const int kernel_size = kernel==4?SINC_KERNEL_SIZE:(kernel==0||kernel==1?2:4);
+    const int kernel_offset = kernel==4?SINC_KERNEL_RADIUS:(kernel==0||kernel==1?0:1);
+    const int floatingDim[2]={floatingImage->nx, floatingImage->ny};
+    const int datatype = floatingImage->datatype;
 
     // Iteration over the different volume along the 4th axis
     for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
@@ -625,20 +666,20 @@ void ResampleImage2D(nifti_image *floatingImage,
         FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
         FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
 
-        int a, b, Y, previous[2];
+        int a, b, X, Y, previous[2];
 
         FloatingTYPE *xyzPointer;
-        double xBasis[SINC_KERNEL_SIZE], yBasis[SINC_KERNEL_SIZE], relative[2];
+        double xBasis[kernel_size], yBasis[kernel_size], relative[2];
         double xTempNewValue, intensity;
         float world[3] = {0.0, 0.0, 0.0};
         float position[3] = {0.0, 0.0, 0.0};
 #if defined (_OPENMP)
 #pragma omp parallel for default(none) \
     private(index, intensity, world, position, previous, xBasis, yBasis, relative, \
-    a, b, Y, xyzPointer, xTempNewValue) \
+    a, b, X, Y, xyzPointer, xTempNewValue) \
     shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, floatingVoxelNumber, \
     deformationFieldPtrX, deformationFieldPtrY, maskPtr, \
-    floatingIJKMatrix, floatingImage, paddingValue, kernel_size, kernel_offset, kernelCompFctPtr)
+    floatingIJKMatrix, floatingDim, datatype, paddingValue)
 #endif // _OPENMP
         for(index=0; index<warpedVoxelNumber; index++)
         {
@@ -659,174 +700,1501 @@ void ResampleImage2D(nifti_image *floatingImage,
                 relative[0] = static_cast<double>(position[0])-static_cast<double>(previous[0]);
                 relative[1] = static_cast<double>(position[1])-static_cast<double>(previous[1]);
 
-                (*kernelCompFctPtr)(relative[0], xBasis);
-                (*kernelCompFctPtr)(relative[1], yBasis);
+                interpKernel<kernel>(relative[0], xBasis);
+                interpKernel<kernel>(relative[1], yBasis);
                 previous[0]-=kernel_offset;
                 previous[1]-=kernel_offset;
 
                 intensity=0.0;
-                for(b=0; b<kernel_size; b++)
-                {
-                    Y= previous[1]+b;
-                    xyzPointer = &floatingIntensity[Y*floatingImage->nx+previous[0]];
-                    xTempNewValue=0.0;
-                    for(a=0; a<kernel_size; a++)
+                if(-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                   -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingDim[1]){
+                    for(b=0; b<kernel_size; b++)
                     {
-                        if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
-                                -1<Y && Y<floatingImage->ny)
+                        xyzPointer = &floatingIntensity[(previous[1]+b)*floatingDim[0]+previous[0]];
+                        xTempNewValue=0.0;
+                        for(a=0; a<kernel_size; a++)
                         {
-                            xTempNewValue +=  static_cast<double>(*xyzPointer) * xBasis[a];
+                            xTempNewValue +=  static_cast<double>(xyzPointer[a]) * xBasis[a];
                         }
-                        else
+                        intensity += xTempNewValue * yBasis[b];
+                    }
+                }
+                else{
+                    for(b=0; b<kernel_size; b++)
+                    {
+                        Y= previous[1]+b;
+                        xTempNewValue=0.0;
+                        for(a=0; a<kernel_size; a++)
                         {
-                            // paddingValue
-                            xTempNewValue +=  static_cast<double>(paddingValue) * xBasis[a];
+                            X= previous[0]+a;
+                            if(-1<X && X<floatingDim[0] &&
+                               -1<Y && Y<floatingDim[1])
+                            {
+                                xTempNewValue +=  static_cast<double>(floatingIntensity[Y*floatingDim[0]+X]) *
+                                      xBasis[a];
+                            }
+                            else
+                            {
+                                // paddingValue
+                                xTempNewValue +=  static_cast<double>(paddingValue) * xBasis[a];
+                            }
                         }
-                        xyzPointer++;
+                        intensity += xTempNewValue * yBasis[b];
                     }
-                    intensity += xTempNewValue * yBasis[b];
                 }
 
-                switch(floatingImage->datatype)
-                {
-                case NIFTI_TYPE_FLOAT32:
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
-                    break;
-                case NIFTI_TYPE_FLOAT64:
-                    warpedIntensity[index]=intensity;
-                    break;
-                case NIFTI_TYPE_UINT8:
-                    intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                    break;
-                case NIFTI_TYPE_UINT16:
-                    intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                    break;
-                case NIFTI_TYPE_UINT32:
-                    intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                    break;
-                default:
-                    warpedIntensity[index]=static_cast<FloatingTYPE>(reg_round(intensity));
-                    break;
-                }
+                warpedIntensity[index]=reg_castResampledIntensity<FloatingTYPE>(intensity, datatype);
             }
         }
     }
 }
 /* *************************************************************** */
-/* *************************************************************** */
-
-/** This function resample a floating image into the referential
- * of a reference image by applying an affine transformation and
- * a deformation field. The affine transformation has to be in
- * real coordinate and the deformation field is in mm in the space
- * of the reference image.
- * interp can be either 0, 1 or 3 meaning nearest neighbor, linear
- * or cubic spline interpolation.
- * every voxel which is not fully in the floating image takes the
- * backgreg_round value. The dtIndicies are an array of size 6
- * that provides the position of the DT components (if there are any)
- * these values are set to -1 if there are not
- */
-template <class FieldTYPE, class FloatingTYPE>
-void reg_resampleImage2(nifti_image *floatingImage,
-                        nifti_image *warpedImage,
-                        nifti_image *deformationFieldImage,
-                        int *mask,
-                        int interp,
-                        FieldTYPE paddingValue,
-                        int *dtIndicies,
-                        mat33 * jacMat)
+template<class FloatingTYPE, class FieldTYPE>
+void ResampleImage(nifti_image *floatingImage,
+                   nifti_image *deformationField,
+                   nifti_image *warpedImage,
+                   int *mask,
+                   FieldTYPE paddingValue,
+                   int kernel)
 {
-    // The floating image data is copied in case one deal with DTI
-    void *originalFloatingData=NULL;
-    // The DTI are logged
-    reg_dti_resampling_preprocessing<FloatingTYPE>(floatingImage,
-                                                   &originalFloatingData,
-                                                   dtIndicies);
-
-    // The deformation field contains the position in the real world
-    if(deformationFieldImage->nz>1)
+    if(deformationField->nz>1)
     {
-        ResampleImage3D<FloatingTYPE,FieldTYPE>(floatingImage,
-                                                deformationFieldImage,
-                                                warpedImage,
-                                                mask,
-                                                paddingValue,
-                                                interp);
+        switch(kernel){
+        case 0:
+            ResampleImage3D<FloatingTYPE,FieldTYPE,0>(floatingImage, deformationField, warpedImage,
+                                                      mask, paddingValue);
+            break; // nereast-neighboor interpolation
+        case 1:
+            ResampleImage3D<FloatingTYPE,FieldTYPE,1>(floatingImage, deformationField, warpedImage,
+                                                      mask, paddingValue);
+            break; // linear interpolation
+        case 4:
+            ResampleImage3D<FloatingTYPE,FieldTYPE,4>(floatingImage, deformationField, warpedImage,
+                                                      mask, paddingValue);
+            break; // sinc interpolation
+        default:
+            ResampleImage3D<FloatingTYPE,FieldTYPE,3>(floatingImage, deformationField, warpedImage,
+                                                      mask, paddingValue);
+            break; // cubic spline interpolation
+        }
     }
     else
     {
-        ResampleImage2D<FloatingTYPE,FieldTYPE>(floatingImage,
-                                                deformationFieldImage,
-                                                warpedImage,
-                                                mask,
-                                                paddingValue,
-                                                interp);
+        switch(kernel){
+        case 0:
+            ResampleImage2D<FloatingTYPE,FieldTYPE,0>(floatingImage, deformationField, warpedImage,
+                                                      mask, paddingValue);
+            break; // nereast-neighboor interpolation
+        case 1:
+            ResampleImage2D<FloatingTYPE,FieldTYPE,1>(floatingImage, deformationField, warpedImage,
+                                                      mask, paddingValue);
+            break; // linear interpolation
+        case 4:
+            ResampleImage2D<FloatingTYPE,FieldTYPE,4>(floatingImage, deformationField, warpedImage,
+                                                      mask, paddingValue);
+            break; // sinc interpolation
+        default:
+            ResampleImage2D<FloatingTYPE,FieldTYPE,3>(floatingImage, deformationField, warpedImage,
+                                                      mask, paddingValue);
+            break; // cubic spline interpolation
+        }
     }
-    // The temporary logged floating array is deleted and the original restored
-    if(originalFloatingData!=NULL)
-    {
-        free(floatingImage->data);
-        floatingImage->data=originalFloatingData;
-        originalFloatingData=NULL;
+}
+/* *************************************************************** */
+/** Previous implementation of ResampleImage3D and ResampleImage2D, where the
+ * interpolation kernel is selected at runtime inside the voxel loop. It is
+ * only kept as a reference for reg_resampleImageReference and uses the same
+ * tabulated sinc weights as the templated kernels.
+ */
+template<class FloatingTYPE, class FieldTYPE>
+static void ResampleImage3D_Reference(nifti_image *floatingImage,
+                                      nifti_image *deformationField,
+                                      nifti_image *warpedImage,
+                                      int *mask,
+                                      FieldTYPE paddingValue,
+                                      int kernel)
+{
+#ifdef _WIN32
+    long  index;
+    long warpedVoxelNumber = (long)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    long floatingVoxelNumber = (long)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+#else
+    size_t  index;
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+#endif
+    FloatingTYPE *floatingIntensityPtr = static_cast<FloatingTYPE *>(floatingImage->data);
+    FloatingTYPE *warpedIntensityPtr = static_cast<FloatingTYPE *>(warpedImage->data);
+    FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
+    FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
+    FieldTYPE *deformationFieldPtrZ = &deformationFieldPtrY[warpedVoxelNumber];
+
+    int *maskPtr = &mask[0];
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+
+    // Define the kernel to use
+    int kernel_size;
+    int kernel_offset=0;
+    void (*kernelCompFctPtr)(double,double *);
+    switch(kernel){
+    case 0:
+        kernel_size=2;
+        kernelCompFctPtr=&interpNearestNeighKernel;
+        kernel_offset=0;
+        break; // nereast-neighboor interpolation
+    case 1:
+        kernel_size=2;
+        kernelCompFctPtr=&interpLinearKernel;
+        kernel_offset=0;
+        break; // linear interpolation
+    case 4:
+        kernel_size=SINC_KERNEL_SIZE;
+        kernelCompFctPtr=&interpWindowedSincKernelTable;
+        kernel_offset=SINC_KERNEL_RADIUS;
+        break; // sinc interpolation
+    default:
+        kernel_size=4;
+        kernelCompFctPtr=&interpCubicSplineKernel;
+        kernel_offset=1;
+        break; // cubic spline interpolation
+    }
+
+    // Iteration over the different volume along the 4th axis
+    for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
+    {
+#ifndef NDEBUG
+        char text[255];
+        sprintf(text, "3D resampling of volume number %zu",t);
+        reg_print_msg_debug(text);
+#endif
+
+        FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
+        FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
+
+        int a, b, c, Y, Z, previous[3];
+
+        FloatingTYPE *zPointer, *xyzPointer;
+        double xBasis[SINC_KERNEL_SIZE], yBasis[SINC_KERNEL_SIZE], zBasis[SINC_KERNEL_SIZE], relative[3];
+        double xTempNewValue, yTempNewValue, intensity;
+        float world[3], position[3];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(index, intensity, world, position, previous, xBasis, yBasis, zBasis, relative, \
+    a, b, c, Y, Z, zPointer, xyzPointer, xTempNewValue, yTempNewValue) \
+    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, floatingVoxelNumber, \
+    deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ, maskPtr, \
+    floatingIJKMatrix, floatingImage, paddingValue, kernel_size, kernel_offset, kernelCompFctPtr)
+#endif // _OPENMP
+        for(index=0; index<warpedVoxelNumber; index++)
+        {
+
+            intensity=paddingValue;
+
+            if((maskPtr[index])>-1)
+            {
+                world[0]=static_cast<float>(deformationFieldPtrX[index]);
+                world[1]=static_cast<float>(deformationFieldPtrY[index]);
+                world[2]=static_cast<float>(deformationFieldPtrZ[index]);
+
+                // real -> voxel; floating space
+                reg_mat44_mul(floatingIJKMatrix, world, position);
+
+                previous[0] = static_cast<int>(reg_floor(position[0]));
+                previous[1] = static_cast<int>(reg_floor(position[1]));
+                previous[2] = static_cast<int>(reg_floor(position[2]));
+
+                relative[0]=static_cast<double>(position[0])-static_cast<double>(previous[0]);
+                relative[1]=static_cast<double>(position[1])-static_cast<double>(previous[1]);
+                relative[2]=static_cast<double>(position[2])-static_cast<double>(previous[2]);
+
+                (*kernelCompFctPtr)(relative[0], xBasis);
+                (*kernelCompFctPtr)(relative[1], yBasis);
+                (*kernelCompFctPtr)(relative[2], zBasis);
+                previous[0]-=kernel_offset;
+                previous[1]-=kernel_offset;
+                previous[2]-=kernel_offset;
+
+                intensity=0.0;
+                if(-1<(previous[0]) && (previous[0]+kernel_size-1)<floatingImage->nx &&
+                   -1<(previous[1]) && (previous[1]+kernel_size-1)<floatingImage->ny &&
+                   -1<(previous[2]) && (previous[2]+kernel_size-1)<floatingImage->nz){
+                   for(c=0; c<kernel_size; c++)
+                   {
+                      Z= previous[2]+c;
+                      zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
+                      yTempNewValue=0.0;
+                      for(b=0; b<kernel_size; b++)
+                      {
+                         Y= previous[1]+b;
+                         xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
+                         xTempNewValue=0.0;
+                         for(a=0; a<kernel_size; a++)
+                         {
+                            xTempNewValue +=  static_cast<double>(*xyzPointer++) * xBasis[a];
+                         }
+                         yTempNewValue += xTempNewValue * yBasis[b];
+                      }
+                      intensity += yTempNewValue * zBasis[c];
+                   }
+                }
+                else{
+                   for(c=0; c<kernel_size; c++)
+                   {
+                      Z= previous[2]+c;
+                      zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
+                      yTempNewValue=0.0;
+                      for(b=0; b<kernel_size; b++)
+                      {
+                         Y= previous[1]+b;
+                         xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
+                         xTempNewValue=0.0;
+                         for(a=0; a<kernel_size; a++)
+                         {
+                            if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
+                               -1<Z && Z<floatingImage->nz &&
+                               -1<Y && Y<floatingImage->ny)
+                            {
+                               xTempNewValue +=  static_cast<double>(*xyzPointer) * xBasis[a];
+                            }
+                            else
+                            {
+                               // paddingValue
+                               xTempNewValue +=  static_cast<double>(paddingValue) * xBasis[a];
+                            }
+                            xyzPointer++;
+                         }
+                         yTempNewValue += xTempNewValue * yBasis[b];
+                      }
+                      intensity += yTempNewValue * zBasis[c];
+                   }
+                }
+            }
+
+            switch(floatingImage->datatype)
+            {
+            case NIFTI_TYPE_FLOAT32:
+                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
+                break;
+            case NIFTI_TYPE_FLOAT64:
+                warpedIntensity[index]=intensity;
+                break;
+            case NIFTI_TYPE_UINT8:
+                if(intensity!=intensity)
+                    intensity=0;
+                intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
+                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+                break;
+            case NIFTI_TYPE_UINT16:
+                if(intensity!=intensity)
+                    intensity=0;
+                intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
+                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+                break;
+            case NIFTI_TYPE_UINT32:
+                if(intensity!=intensity)
+                    intensity=0;
+                intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
+                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+                break;
+            default:
+                if(intensity!=intensity)
+                    intensity=0;
+                warpedIntensity[index]=static_cast<FloatingTYPE>(reg_round(intensity));
+                break;
+            }
+        }
+    }
+}
+/* *************************************************************** */
+template<class FloatingTYPE, class FieldTYPE>
+static void ResampleImage2D_Reference(nifti_image *floatingImage,
+                                      nifti_image *deformationField,
+                                      nifti_image *warpedImage,
+                                      int *mask,
+                                      FieldTYPE paddingValue,
+                                      int kernel)
+{
+#ifdef _WIN32
+    long  index;
+    long warpedVoxelNumber = (long)warpedImage->nx*warpedImage->ny;
+    long floatingVoxelNumber = (long)floatingImage->nx*floatingImage->ny;
+#else
+    size_t  index;
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny;
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny;
+#endif
+    FloatingTYPE *floatingIntensityPtr = static_cast<FloatingTYPE *>(floatingImage->data);
+    FloatingTYPE *warpedIntensityPtr = static_cast<FloatingTYPE *>(warpedImage->data);
+    FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
+    FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
+
+    int *maskPtr = &mask[0];
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+
+    int kernel_size;
+    int kernel_offset=0;
+    void (*kernelCompFctPtr)(double,double *);
+    switch(kernel){
+    case 0:
+        kernel_size=2;
+        kernelCompFctPtr=&interpNearestNeighKernel;
+        kernel_offset=0;
+        break; // nereast-neighboor interpolation
+    case 1:
+        kernel_size=2;
+        kernelCompFctPtr=&interpLinearKernel;
+        kernel_offset=0;
+        break; // linear interpolation
+    case 4:
+        kernel_size=SINC_KERNEL_SIZE;
+        kernelCompFctPtr=&interpWindowedSincKernelTable;
+        kernel_offset=SINC_KERNEL_RADIUS;
+        break; // sinc interpolation
+    default:
+        kernel_size=4;
+        kernelCompFctPtr=&interpCubicSplineKernel;
+        kernel_offset=1;
+        break; // cubic spline interpolation
+    }
+
+    // Iteration over the different volume along the 4th axis
+    for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
+    {
+#ifndef NDEBUG
+        char text[255];
+        sprintf(text, "2D resampling of volume number %zu",t);
+        reg_print_msg_debug(text);
+#endif
+        FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
+        FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
+
+        int a, b, Y, previous[2];
+
+        FloatingTYPE *xyzPointer;
+        double xBasis[SINC_KERNEL_SIZE], yBasis[SINC_KERNEL_SIZE], relative[2];
+        double xTempNewValue, intensity;
+        float world[3] = {0.0, 0.0, 0.0};
+        float position[3] = {0.0, 0.0, 0.0};
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(index, intensity, world, position, previous, xBasis, yBasis, relative, \
+    a, b, Y, xyzPointer, xTempNewValue) \
+    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, floatingVoxelNumber, \
+    deformationFieldPtrX, deformationFieldPtrY, maskPtr, \
+    floatingIJKMatrix, floatingImage, paddingValue, kernel_size, kernel_offset, kernelCompFctPtr)
+#endif // _OPENMP
+        for(index=0; index<warpedVoxelNumber; index++)
+        {
+
+            intensity=paddingValue;
+            if((maskPtr[index])>-1)
+            {
+                world[0] = static_cast<float>(deformationFieldPtrX[index]);
+                world[1] = static_cast<float>(deformationFieldPtrY[index]);
+                world[2] = 0;
+
+                // real -> voxel; floating space
+                reg_mat44_mul(floatingIJKMatrix, world, position);
+
+                previous[0] = static_cast<int>(reg_floor(position[0]));
+                previous[1] = static_cast<int>(reg_floor(position[1]));
+
+                relative[0] = static_cast<double>(position[0])-static_cast<double>(previous[0]);
+                relative[1] = static_cast<double>(position[1])-static_cast<double>(previous[1]);
+
+                (*kernelCompFctPtr)(relative[0], xBasis);
+                (*kernelCompFctPtr)(relative[1], yBasis);
+                previous[0]-=kernel_offset;
+                previous[1]-=kernel_offset;
+
+                intensity=0.0;
+                for(b=0; b<kernel_size; b++)
+                {
+                    Y= previous[1]+b;
+                    xyzPointer = &floatingIntensity[Y*floatingImage->nx+previous[0]];
+                    xTempNewValue=0.0;
+                    for(a=0; a<kernel_size; a++)
+                    {
+                        if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
+                                -1<Y && Y<floatingImage->ny)
+                        {
+                            xTempNewValue +=  static_cast<double>(*xyzPointer) * xBasis[a];
+                        }
+                        else
+                        {
+                            // paddingValue
+                            xTempNewValue +=  static_cast<double>(paddingValue) * xBasis[a];
+                        }
+                        xyzPointer++;
+                    }
+                    intensity += xTempNewValue * yBasis[b];
+                }
+
+                switch(floatingImage->datatype)
+                {
+                case NIFTI_TYPE_FLOAT32:
+                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
+                    break;
+                case NIFTI_TYPE_FLOAT64:
+                    warpedIntensity[index]=intensity;
+                    break;
+                case NIFTI_TYPE_UINT8:
+                    intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
+                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+                    break;
+                case NIFTI_TYPE_UINT16:
+                    intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
+                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+                    break;
+                case NIFTI_TYPE_UINT32:
+                    intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
+                    warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
+                    break;
+                default:
+                    warpedIntensity[index]=static_cast<FloatingTYPE>(reg_round(intensity));
+                    break;
+                }
+            }
+        }
+    }
+}
+/* *************************************************************** */
+template<class FloatingTYPE>
+static void ResampleImage_Reference(nifti_image *floatingImage,
+                                    nifti_image *deformationField,
+                                    nifti_image *warpedImage,
+                                    int *mask,
+                                    float paddingValue,
+                                    int kernel)
+{
+    if(deformationField->nz>1)
+        ResampleImage3D_Reference<FloatingTYPE,float>(floatingImage, deformationField, warpedImage,
+                                                      mask, paddingValue, kernel);
+    else ResampleImage2D_Reference<FloatingTYPE,float>(floatingImage, deformationField, warpedImage,
+                                                       mask, paddingValue, kernel);
+}
+/* *************************************************************** */
+/* *************************************************************** */
+
+/** This function resample a floating image into the referential
+ * of a reference image by applying an affine transformation and
+ * a deformation field. The affine transformation has to be in
+ * real coordinate and the deformation field is in mm in the space
+ * of the reference image.
+ * interp can be either 0, 1 or 3 meaning nearest neighbor, linear
+ * or cubic spline interpolation.
+ * every voxel which is not fully in the floating image takes the
+ * backgreg_round value. The dtIndicies are an array of size 6
+ * that provides the position of the DT components (if there are any)
+ * these values are set to -1 if there are not
+ */
+template <class FieldTYPE, class FloatingTYPE>
+void reg_resampleImage2(nifti_image *floatingImage,
+                        nifti_image *warpedImage,
+                        nifti_image *deformationFieldImage,
+                        int *mask,
+                        int interp,
+                        FieldTYPE paddingValue,
+                        int *dtIndicies,
+                        mat33 * jacMat)
+{
+    // The floating image data is copied in case one deal with DTI
+    void *originalFloatingData=NULL;
+    // The DTI are logged
+    reg_dti_resampling_preprocessing<FloatingTYPE>(floatingImage,
+                                                   &originalFloatingData,
+                                                   dtIndicies);
+
+    // The deformation field contains the position in the real world
+    ResampleImage<FloatingTYPE,FieldTYPE>(floatingImage,
+                                          deformationFieldImage,
+                                          warpedImage,
+                                          mask,
+                                          paddingValue,
+                                          interp);
+    // The temporary logged floating array is deleted and the original restored
+    if(originalFloatingData!=NULL)
+    {
+        free(floatingImage->data);
+        floatingImage->data=originalFloatingData;
+        originalFloatingData=NULL;
+    }
+
+    // The interpolated tensors are reoriented and exponentiated
+    reg_dti_resampling_postprocessing<FloatingTYPE>(warpedImage,
+                                                    mask,
+                                                    jacMat,
+                                                    dtIndicies);
+}
+/* *************************************************************** */
+void reg_resampleImage(nifti_image *floatingImage,
+                       nifti_image *warpedImage,
+                       nifti_image *deformationField,
+                       int *mask,
+                       int interp,
+                       float paddingValue,
+                       bool *dti_timepoint,
+                       mat33 * jacMat)
+{
+    // The windowed sinc table is generated before entering any parallel region
+    if(interp==4)
+        reg_initWindowedSincTable();
+
+    if(floatingImage->datatype != warpedImage->datatype)
+    {
+        reg_print_fct_error("reg_resampleImage");
+        reg_print_msg_error("The floating and warped image should have the same data type");
+        reg_exit();
+    }
+
+    if(floatingImage->nt != warpedImage->nt)
+    {
+        reg_print_fct_error("reg_resampleImage");
+        reg_print_msg_error("The floating and warped images have different dimension along the time axis");
+        reg_exit();
+    }
+
+    // Define the DTI indices if required
+    int dtIndicies[6];
+    for(int i=0; i<6; ++i) dtIndicies[i]=-1;
+    if(dti_timepoint!=NULL)
+    {
+        if(jacMat==NULL)
+        {
+            reg_print_fct_error("reg_resampleImage");
+            reg_print_msg_error("DTI resampling: No Jacobian matrix array has been provided");
+            reg_exit();
+        }
+        int j=0;
+        for(int i=0; i<floatingImage->nt; ++i)
+        {
+            if(dti_timepoint[i]==true)
+                dtIndicies[j++]=i;
+        }
+        if((floatingImage->nz>1 && j!=6) && (floatingImage->nz==1 && j!=3))
+        {
+            reg_print_fct_error("reg_resampleImage");
+            reg_print_msg_error("DTI resampling: Unexpected number of DTI components");
+            reg_exit();
+        }
+    }
+
+    // a mask array is created if no mask is specified
+    bool MrPropreRules = false;
+    if(mask==NULL)
+    {
+        // voxels in the background are set to negative value so 0 corresponds to active voxel
+        mask=(int *)calloc(warpedImage->nx*warpedImage->ny*warpedImage->nz,sizeof(int));
+        MrPropreRules = true;
+    }
+
+    switch ( deformationField->datatype )
+    {
+    case NIFTI_TYPE_FLOAT32:
+        switch ( floatingImage->datatype )
+        {
+        case NIFTI_TYPE_UINT8:
+            reg_resampleImage2<float,unsigned char>(floatingImage,
+                                                    warpedImage,
+                                                    deformationField,
+                                                    mask,
+                                                    interp,
+                                                    paddingValue,
+                                                    dtIndicies,
+                                                    jacMat);
+            break;
+        case NIFTI_TYPE_INT8:
+            reg_resampleImage2<float,char>(floatingImage,
+                                           warpedImage,
+                                           deformationField,
+                                           mask,
+                                           interp,
+                                           paddingValue,
+                                           dtIndicies,
+                                           jacMat);
+            break;
+        case NIFTI_TYPE_UINT16:
+            reg_resampleImage2<float,unsigned short>(floatingImage,
+                                                     warpedImage,
+                                                     deformationField,
+                                                     mask,
+                                                     interp,
+                                                     paddingValue,
+                                                     dtIndicies,
+                                                     jacMat);
+            break;
+        case NIFTI_TYPE_INT16:
+            reg_resampleImage2<float,short>(floatingImage,
+                                            warpedImage,
+                                            deformationField,
+                                            mask,
+                                            interp,
+                                            paddingValue,
+                                            dtIndicies,
+                                            jacMat);
+            break;
+        case NIFTI_TYPE_UINT32:
+            reg_resampleImage2<float,unsigned int>(floatingImage,
+                                                   warpedImage,
+                                                   deformationField,
+                                                   mask,
+                                                   interp,
+                                                   paddingValue,
+                                                   dtIndicies,
+                                                   jacMat);
+            break;
+        case NIFTI_TYPE_INT32:
+            reg_resampleImage2<float,int>(floatingImage,
+                                          warpedImage,
+                                          deformationField,
+                                          mask,
+                                          interp,
+                                          paddingValue,
+                                          dtIndicies,
+                                          jacMat);
+            break;
+        case NIFTI_TYPE_FLOAT32:
+            reg_resampleImage2<float,float>(floatingImage,
+                                            warpedImage,
+                                            deformationField,
+                                            mask,
+                                            interp,
+                                            paddingValue,
+                                            dtIndicies,
+                                            jacMat);
+            break;
+        case NIFTI_TYPE_FLOAT64:
+            reg_resampleImage2<float,double>(floatingImage,
+                                             warpedImage,
+                                             deformationField,
+                                             mask,
+                                             interp,
+                                             paddingValue,
+                                             dtIndicies,
+                                             jacMat);
+            break;
+        default:
+            printf("floating pixel type unsupported.");
+            break;
+        }
+        break;
+    case NIFTI_TYPE_FLOAT64:
+        switch ( floatingImage->datatype )
+        {
+        case NIFTI_TYPE_UINT8:
+            reg_resampleImage2<double,unsigned char>(floatingImage,
+                                                     warpedImage,
+                                                     deformationField,
+                                                     mask,
+                                                     interp,
+                                                     paddingValue,
+                                                     dtIndicies,
+                                                     jacMat);
+            break;
+        case NIFTI_TYPE_INT8:
+            reg_resampleImage2<double,char>(floatingImage,
+                                            warpedImage,
+                                            deformationField,
+                                            mask,
+                                            interp,
+                                            paddingValue,
+                                            dtIndicies,
+                                            jacMat);
+            break;
+        case NIFTI_TYPE_UINT16:
+            reg_resampleImage2<double,unsigned short>(floatingImage,
+                                                      warpedImage,
+                                                      deformationField,
+                                                      mask,
+                                                      interp,
+                                                      paddingValue,
+                                                      dtIndicies,
+                                                      jacMat);
+            break;
+        case NIFTI_TYPE_INT16:
+            reg_resampleImage2<double,short>(floatingImage,
+                                             warpedImage,
+                                             deformationField,
+                                             mask,
+                                             interp,
+                                             paddingValue,
+                                             dtIndicies,
+                                             jacMat);
+            break;
+        case NIFTI_TYPE_UINT32:
+            reg_resampleImage2<double,unsigned int>(floatingImage,
+                                                    warpedImage,
+                                                    deformationField,
+                                                    mask,
+                                                    interp,
+                                                    paddingValue,
+                                                    dtIndicies,
+                                                    jacMat );
+            break;
+        case NIFTI_TYPE_INT32:
+            reg_resampleImage2<double,int>(floatingImage,
+                                           warpedImage,
+                                           deformationField,
+                                           mask,
+                                           interp,
+                                           paddingValue,
+                                           dtIndicies,
+                                           jacMat);
+            break;
+        case NIFTI_TYPE_FLOAT32:
+            reg_resampleImage2<double,float>(floatingImage,
+                                             warpedImage,
+                                             deformationField,
+                                             mask,
+                                             interp,
+                                             paddingValue,
+                                             dtIndicies,
+                                             jacMat);
+            break;
+        case NIFTI_TYPE_FLOAT64:
+            reg_resampleImage2<double,double>(floatingImage,
+                                              warpedImage,
+                                              deformationField,
+                                              mask,
+                                              interp,
+                                              paddingValue,
+                                              dtIndicies,
+                                              jacMat);
+            break;
+        default:
+            printf("floating pixel type unsupported.");
+            break;
+        }
+        break;
+    default:
+        printf("Deformation field pixel type unsupported.");
+        break;
+    }
+    if(MrPropreRules==true)
+    {
+        free(mask);
+        mask=NULL;
+    }
+}
+/* *************************************************************** */
+void reg_resampleImageReference(nifti_image *floatingImage,
+                                nifti_image *warpedImage,
+                                nifti_image *deformationField,
+                                int *mask,
+                                int interp,
+                                float paddingValue)
+{
+    if(interp==4)
+        reg_initWindowedSincTable();
+
+    if(floatingImage->datatype != warpedImage->datatype ||
+       floatingImage->nt != warpedImage->nt)
+    {
+        reg_print_fct_error("reg_resampleImageReference");
+        reg_print_msg_error("The floating and warped images should have the same data type and time points");
+        reg_exit();
+    }
+    if(deformationField->datatype != NIFTI_TYPE_FLOAT32)
+    {
+        reg_print_fct_error("reg_resampleImageReference");
+        reg_print_msg_error("Only single precision deformation fields are supported");
+        reg_exit();
+    }
+
+    // a mask array is created if no mask is specified
+    bool MrPropreRules = false;
+    if(mask==NULL)
+    {
+        mask=(int *)calloc(warpedImage->nx*warpedImage->ny*warpedImage->nz,sizeof(int));
+        MrPropreRules = true;
+    }
+
+    switch ( floatingImage->datatype )
+    {
+    case NIFTI_TYPE_UINT8:
+        ResampleImage_Reference<unsigned char>(floatingImage, deformationField, warpedImage,
+                                               mask, paddingValue, interp);
+        break;
+    case NIFTI_TYPE_INT8:
+        ResampleImage_Reference<char>(floatingImage, deformationField, warpedImage,
+                                      mask, paddingValue, interp);
+        break;
+    case NIFTI_TYPE_UINT16:
+        ResampleImage_Reference<unsigned short>(floatingImage, deformationField, warpedImage,
+                                                mask, paddingValue, interp);
+        break;
+    case NIFTI_TYPE_INT16:
+        ResampleImage_Reference<short>(floatingImage, deformationField, warpedImage,
+                                       mask, paddingValue, interp);
+        break;
+    case NIFTI_TYPE_UINT32:
+        ResampleImage_Reference<unsigned int>(floatingImage, deformationField, warpedImage,
+                                              mask, paddingValue, interp);
+        break;
+    case NIFTI_TYPE_INT32:
+        ResampleImage_Reference<int>(floatingImage, deformationField, warpedImage,
+                                     mask, paddingValue, interp);
+        break;
+    case NIFTI_TYPE_FLOAT32:
+        ResampleImage_Reference<float>(floatingImage, deformationField, warpedImage,
+                                       mask, paddingValue, interp);
+        break;
+    case NIFTI_TYPE_FLOAT64:
+        ResampleImage_Reference<double>(floatingImage, deformationField, warpedImage,
+                                        mask, paddingValue, interp);
+        break;
+    default:
+        reg_print_fct_error("reg_resampleImageReference");
+        reg_print_msg_error("Unsupported floating image data type");
+        reg_exit();
+    }
+    if(MrPropreRules==true)
+    {
+        free(mask);
+        mask=NULL;
+    }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+#define BATCH_RESAMPLING_BLOCK 64
+/* *************************************************************** */
+/** Applies the positions and weights of a block of warped voxels to every
+ * volume of an image. The weights are stored tap by tap,
+ * basisBlock[axis][tap*BATCH_RESAMPLING_BLOCK+voxel], and the arithmetic
+ * matches ResampleImage3D and ResampleImage2D.
+ */
+template<class DTYPE, int kernel>
+void reg_applyBatchResamplingWeights(nifti_image *floatingImage,
+                                     nifti_image *warpedImage,
+                                     size_t firstIndex,
+                                     int blockSize,
+                                     int *mask,
+                                     int previousBlock[3][BATCH_RESAMPLING_BLOCK],
+                                     bool *insideBlock,
+                                     double basisBlock[3][SINC_KERNEL_SIZE*BATCH_RESAMPLING_BLOCK],
+                                     double paddingValue)
+{
+    const int kernel_size = kernel==4?SINC_KERNEL_SIZE:(kernel==0||kernel==1?2:4);
+    const bool is3D = warpedImage->nz>1;
+    const int zKernelSize = is3D?kernel_size:1;
+    const int floatingDim[3]={floatingImage->nx, floatingImage->ny, floatingImage->nz};
+    const size_t floatingPlaneNumber = (size_t)floatingDim[0]*floatingDim[1];
+    const size_t floatingVoxelNumber = floatingPlaneNumber*floatingDim[2];
+    const size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    const int datatype = floatingImage->datatype;
+    double zBasisPlane = 1.0;
+
+    DTYPE *floatingIntensity, *zPointer, *xyzPointer;
+    DTYPE *warpedIntensity;
+    double *xBasis, *yBasis, *zBasis;
+    double xTempNewValue, yTempNewValue, intensity;
+    int i, a, b, c, X, Y, Z;
+    size_t index;
+
+    for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; ++t)
+    {
+        floatingIntensity = &static_cast<DTYPE *>(floatingImage->data)[t*floatingVoxelNumber];
+        warpedIntensity = &static_cast<DTYPE *>(warpedImage->data)[t*warpedVoxelNumber];
+        for(i=0; i<blockSize; ++i)
+        {
+            index=firstIndex+i;
+            if(mask[index]<0)
+            {
+                // The 2D resampling leaves the masked voxels untouched
+                if(is3D)
+                    warpedIntensity[index]=reg_castResampledIntensity<DTYPE>(paddingValue, datatype);
+                continue;
+            }
+            xBasis=&basisBlock[0][i];
+            yBasis=&basisBlock[1][i];
+            zBasis=is3D?&basisBlock[2][i]:&zBasisPlane;
+            intensity=0.0;
+            if(insideBlock[i])
+            {
+                zPointer = &floatingIntensity[previousBlock[2][i]*floatingPlaneNumber +
+                        previousBlock[1][i]*floatingDim[0] + previousBlock[0][i]];
+                for(c=0; c<zKernelSize; c++)
+                {
+                    yTempNewValue=0.0;
+                    for(b=0; b<kernel_size; b++)
+                    {
+                        xyzPointer = &zPointer[b*floatingDim[0]];
+                        xTempNewValue=0.0;
+                        for(a=0; a<kernel_size; a++)
+                            xTempNewValue += static_cast<double>(xyzPointer[a]) *
+                                    xBasis[a*BATCH_RESAMPLING_BLOCK];
+                        yTempNewValue += xTempNewValue * yBasis[b*BATCH_RESAMPLING_BLOCK];
+                    }
+                    intensity += yTempNewValue * zBasis[c*BATCH_RESAMPLING_BLOCK];
+                    zPointer += floatingPlaneNumber;
+                }
+            }
+            else
+            {
+                for(c=0; c<zKernelSize; c++)
+                {
+                    Z= previousBlock[2][i]+c;
+                    yTempNewValue=0.0;
+                    for(b=0; b<kernel_size; b++)
+                    {
+                        Y= previousBlock[1][i]+b;
+                        xTempNewValue=0.0;
+                        for(a=0; a<kernel_size; a++)
+                        {
+                            X= previousBlock[0][i]+a;
+                            if(-1<X && X<floatingDim[0] &&
+                               -1<Y && Y<floatingDim[1] &&
+                               -1<Z && Z<floatingDim[2])
+                            {
+                                xTempNewValue += static_cast<double>(
+                                            floatingIntensity[Z*floatingPlaneNumber+Y*floatingDim[0]+X]) *
+                                        xBasis[a*BATCH_RESAMPLING_BLOCK];
+                            }
+                            else
+                            {
+                                // paddingValue
+                                xTempNewValue += paddingValue * xBasis[a*BATCH_RESAMPLING_BLOCK];
+                            }
+                        }
+                        yTempNewValue += xTempNewValue * yBasis[b*BATCH_RESAMPLING_BLOCK];
+                    }
+                    intensity += yTempNewValue * zBasis[c*BATCH_RESAMPLING_BLOCK];
+                }
+            }
+            warpedIntensity[index]=reg_castResampledIntensity<DTYPE>(intensity, datatype);
+        }
+    }
+}
+/* *************************************************************** */
+/** The warped voxels are processed by blocks. The floating positions and the
+ * interpolation weights of a block are computed once and are then applied to
+ * all the volumes of all the images before moving to the next block.
+ */
+template<class FieldTYPE, int kernel>
+void ResampleImageBatch(nifti_image **floatingImages,
+                        nifti_image **warpedImages,
+                        int imageNumber,
+                        nifti_image *deformationField,
+                        int *mask,
+                        FieldTYPE paddingValue)
+{
+    const int kernel_size = kernel==4?SINC_KERNEL_SIZE:(kernel==0||kernel==1?2:4);
+    const int kernel_offset = kernel==4?SINC_KERNEL_RADIUS:(kernel==0||kernel==1?0:1);
+    const bool is3D = deformationField->nz>1;
+    const int floatingDim[3]={floatingImages[0]->nx, floatingImages[0]->ny, floatingImages[0]->nz};
+#ifdef _WIN32
+    long blockIndex;
+    long warpedVoxelNumber = (long)deformationField->nx*deformationField->ny*deformationField->nz;
+    long blockNumber = (warpedVoxelNumber+BATCH_RESAMPLING_BLOCK-1)/BATCH_RESAMPLING_BLOCK;
+#else
+    size_t blockIndex;
+    size_t warpedVoxelNumber = (size_t)deformationField->nx*deformationField->ny*deformationField->nz;
+    size_t blockNumber = (warpedVoxelNumber+BATCH_RESAMPLING_BLOCK-1)/BATCH_RESAMPLING_BLOCK;
+#endif
+    FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
+    FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
+    FieldTYPE *deformationFieldPtrZ = is3D?&deformationFieldPtrY[warpedVoxelNumber]:NULL;
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImages[0]->sform_code>0)
+        floatingIJKMatrix=&(floatingImages[0]->sto_ijk);
+    else floatingIJKMatrix=&(floatingImages[0]->qto_ijk);
+
+    int i, n, blockSize, previousBlock[3][BATCH_RESAMPLING_BLOCK];
+    bool insideBlock[BATCH_RESAMPLING_BLOCK];
+    double basisBlock[3][SINC_KERNEL_SIZE*BATCH_RESAMPLING_BLOCK];
+    double basis[SINC_KERNEL_SIZE], relative;
+    float world[3], position[3];
+    size_t index, firstIndex;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(blockIndex, i, n, blockSize, previousBlock, insideBlock, basisBlock, basis, \
+    relative, world, position, index, firstIndex) \
+    shared(floatingImages, warpedImages, imageNumber, mask, paddingValue, kernel_size, \
+    kernel_offset, is3D, floatingDim, warpedVoxelNumber, blockNumber, deformationFieldPtrX, \
+    deformationFieldPtrY, deformationFieldPtrZ, floatingIJKMatrix)
+#endif // _OPENMP
+    for(blockIndex=0; blockIndex<blockNumber; ++blockIndex)
+    {
+        firstIndex = blockIndex*BATCH_RESAMPLING_BLOCK;
+        blockSize = BATCH_RESAMPLING_BLOCK;
+        if(firstIndex+blockSize>warpedVoxelNumber)
+            blockSize = warpedVoxelNumber-firstIndex;
+
+        // The positions and weights of the block are computed first
+        for(i=0; i<blockSize; ++i)
+        {
+            index=firstIndex+i;
+            if(mask[index]<0) continue;
+            world[0]=static_cast<float>(deformationFieldPtrX[index]);
+            world[1]=static_cast<float>(deformationFieldPtrY[index]);
+            world[2]=is3D?static_cast<float>(deformationFieldPtrZ[index]):0.f;
+
+            // real -> voxel; floating space
+            reg_mat44_mul(floatingIJKMatrix, world, position);
+
+            insideBlock[i]=true;
+            for(n=0; n<(is3D?3:2); ++n)
+            {
+                previousBlock[n][i] = static_cast<int>(reg_floor(position[n]));
+                relative = static_cast<double>(position[n]) -
+                        static_cast<double>(previousBlock[n][i]);
+                interpKernel<kernel>(relative, basis);
+                for(int a=0; a<kernel_size; ++a)
+                    basisBlock[n][a*BATCH_RESAMPLING_BLOCK+i]=basis[a];
+                previousBlock[n][i]-=kernel_offset;
+                if(previousBlock[n][i]<0 || previousBlock[n][i]+kernel_size-1>=floatingDim[n])
+                    insideBlock[i]=false;
+            }
+            if(!is3D) previousBlock[2][i]=0;
+        }
+
+        // The cached weights are applied to every volume of every image
+        for(n=0; n<imageNumber; ++n)
+        {
+            switch(floatingImages[n]->datatype)
+            {
+            case NIFTI_TYPE_UINT8:
+                reg_applyBatchResamplingWeights<unsigned char,kernel>
+                        (floatingImages[n], warpedImages[n], firstIndex, blockSize, mask,
+                         previousBlock, insideBlock, basisBlock, static_cast<double>(paddingValue));
+                break;
+            case NIFTI_TYPE_INT8:
+                reg_applyBatchResamplingWeights<char,kernel>
+                        (floatingImages[n], warpedImages[n], firstIndex, blockSize, mask,
+                         previousBlock, insideBlock, basisBlock, static_cast<double>(paddingValue));
+                break;
+            case NIFTI_TYPE_UINT16:
+                reg_applyBatchResamplingWeights<unsigned short,kernel>
+                        (floatingImages[n], warpedImages[n], firstIndex, blockSize, mask,
+                         previousBlock, insideBlock, basisBlock, static_cast<double>(paddingValue));
+                break;
+            case NIFTI_TYPE_INT16:
+                reg_applyBatchResamplingWeights<short,kernel>
+                        (floatingImages[n], warpedImages[n], firstIndex, blockSize, mask,
+                         previousBlock, insideBlock, basisBlock, static_cast<double>(paddingValue));
+                break;
+            case NIFTI_TYPE_UINT32:
+                reg_applyBatchResamplingWeights<unsigned int,kernel>
+                        (floatingImages[n], warpedImages[n], firstIndex, blockSize, mask,
+                         previousBlock, insideBlock, basisBlock, static_cast<double>(paddingValue));
+                break;
+            case NIFTI_TYPE_INT32:
+                reg_applyBatchResamplingWeights<int,kernel>
+                        (floatingImages[n], warpedImages[n], firstIndex, blockSize, mask,
+                         previousBlock, insideBlock, basisBlock, static_cast<double>(paddingValue));
+                break;
+            case NIFTI_TYPE_FLOAT32:
+                reg_applyBatchResamplingWeights<float,kernel>
+                        (floatingImages[n], warpedImages[n], firstIndex, blockSize, mask,
+                         previousBlock, insideBlock, basisBlock, static_cast<double>(paddingValue));
+                break;
+            case NIFTI_TYPE_FLOAT64:
+                reg_applyBatchResamplingWeights<double,kernel>
+                        (floatingImages[n], warpedImages[n], firstIndex, blockSize, mask,
+                         previousBlock, insideBlock, basisBlock, static_cast<double>(paddingValue));
+                break;
+            }
+        }
+    }
+}
+/* *************************************************************** */
+template<class FieldTYPE>
+void reg_resampleImageBatch2(nifti_image **floatingImages,
+                             nifti_image **warpedImages,
+                             int imageNumber,
+                             nifti_image *deformationField,
+                             int *mask,
+                             int interp,
+                             FieldTYPE paddingValue)
+{
+    switch(interp){
+    case 0:
+        ResampleImageBatch<FieldTYPE,0>(floatingImages, warpedImages, imageNumber,
+                                        deformationField, mask, paddingValue);
+        break; // nereast-neighboor interpolation
+    case 1:
+        ResampleImageBatch<FieldTYPE,1>(floatingImages, warpedImages, imageNumber,
+                                        deformationField, mask, paddingValue);
+        break; // linear interpolation
+    case 4:
+        ResampleImageBatch<FieldTYPE,4>(floatingImages, warpedImages, imageNumber,
+                                        deformationField, mask, paddingValue);
+        break; // sinc interpolation
+    default:
+        ResampleImageBatch<FieldTYPE,3>(floatingImages, warpedImages, imageNumber,
+                                        deformationField, mask, paddingValue);
+        break; // cubic spline interpolation
+    }
+}
+/* *************************************************************** */
+void reg_resampleImageBatch(nifti_image **floatingImages,
+                            nifti_image **warpedImages,
+                            int imageNumber,
+                            nifti_image *deformationField,
+                            int *mask,
+                            int interp,
+                            float paddingValue)
+{
+    // The windowed sinc table is generated before entering any parallel region
+    if(interp==4)
+        reg_initWindowedSincTable();
+
+    if(imageNumber<1)
+    {
+        reg_print_fct_error("reg_resampleImageBatch");
+        reg_print_msg_error("At least one image is expected");
+        reg_exit();
+    }
+    mat44 *floatingIJKMatrix = floatingImages[0]->sform_code>0?
+                &(floatingImages[0]->sto_ijk):&(floatingImages[0]->qto_ijk);
+    for(int n=0; n<imageNumber; ++n)
+    {
+        if(floatingImages[n]->datatype != warpedImages[n]->datatype)
+        {
+            reg_print_fct_error("reg_resampleImageBatch");
+            reg_print_msg_error("The floating and warped image should have the same data type");
+            reg_exit();
+        }
+        if(floatingImages[n]->nt*floatingImages[n]->nu != warpedImages[n]->nt*warpedImages[n]->nu)
+        {
+            reg_print_fct_error("reg_resampleImageBatch");
+            reg_print_msg_error("The floating and warped images have different dimension along the time axis");
+            reg_exit();
+        }
+        if(warpedImages[n]->nx != deformationField->nx ||
+                warpedImages[n]->ny != deformationField->ny ||
+                warpedImages[n]->nz != deformationField->nz)
+        {
+            reg_print_fct_error("reg_resampleImageBatch");
+            reg_print_msg_error("The warped images and the deformation field should have the same dimension");
+            reg_exit();
+        }
+        mat44 *currentIJKMatrix = floatingImages[n]->sform_code>0?
+                    &(floatingImages[n]->sto_ijk):&(floatingImages[n]->qto_ijk);
+        if(floatingImages[n]->nx != floatingImages[0]->nx ||
+                floatingImages[n]->ny != floatingImages[0]->ny ||
+                floatingImages[n]->nz != floatingImages[0]->nz ||
+                memcmp(currentIJKMatrix, floatingIJKMatrix, sizeof(mat44))!=0)
+        {
+            reg_print_fct_error("reg_resampleImageBatch");
+            reg_print_msg_error("All the floating images are expected to share the same space");
+            reg_exit();
+        }
+        switch(floatingImages[n]->datatype)
+        {
+        case NIFTI_TYPE_UINT8:
+        case NIFTI_TYPE_INT8:
+        case NIFTI_TYPE_UINT16:
+        case NIFTI_TYPE_INT16:
+        case NIFTI_TYPE_UINT32:
+        case NIFTI_TYPE_INT32:
+        case NIFTI_TYPE_FLOAT32:
+        case NIFTI_TYPE_FLOAT64:
+            break;
+        default:
+            reg_print_fct_error("reg_resampleImageBatch");
+            reg_print_msg_error("floating pixel type unsupported.");
+            reg_exit();
+        }
+    }
+
+    // a mask array is created if no mask is specified
+    bool MrPropreRules = false;
+    if(mask==NULL)
+    {
+        // voxels in the background are set to negative value so 0 corresponds to active voxel
+        mask=(int *)calloc(deformationField->nx*deformationField->ny*deformationField->nz,sizeof(int));
+        MrPropreRules = true;
+    }
+
+    switch(deformationField->datatype)
+    {
+    case NIFTI_TYPE_FLOAT32:
+        reg_resampleImageBatch2<float>(floatingImages, warpedImages, imageNumber,
+                                       deformationField, mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_FLOAT64:
+        reg_resampleImageBatch2<double>(floatingImages, warpedImages, imageNumber,
+                                        deformationField, mask, interp, paddingValue);
+        break;
+    default:
+        reg_print_fct_error("reg_resampleImageBatch");
+        reg_print_msg_error("Deformation field pixel type unsupported.");
+        reg_exit();
+    }
+    if(MrPropreRules==true)
+    {
+        free(mask);
+        mask=NULL;
+    }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+#define LABEL_RESAMPLING_MAX_TAP 64
+/* *************************************************************** */
+/** The interpolation weights of every tap are accumulated per label value in
+ * a small array, as a voxel can only see kernel_size^dim distinct labels. The
+ * label with the largest accumulated weight is kept. Taps outside of the
+ * floating image vote for the padding value unless it is NaN.
+ */
+template<class DTYPE, class FieldTYPE, int kernel>
+void ResampleLabelImage(nifti_image *floatingImage,
+                        nifti_image *deformationField,
+                        nifti_image *warpedImage,
+                        int *mask,
+                        FieldTYPE paddingValue)
+{
+#ifdef _WIN32
+    long  index;
+    long warpedVoxelNumber = (long)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+#else
+    size_t  index;
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+#endif
+    const size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+    DTYPE *floatingIntensityPtr = static_cast<DTYPE *>(floatingImage->data);
+    DTYPE *warpedIntensityPtr = static_cast<DTYPE *>(warpedImage->data);
+    const bool is3D = deformationField->nz>1;
+    FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
+    FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
+    FieldTYPE *deformationFieldPtrZ = is3D?&deformationFieldPtrY[warpedVoxelNumber]:NULL;
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+
+    const int kernel_size = kernel==0||kernel==1?2:4;
+    const int kernel_offset = kernel==0||kernel==1?0:1;
+    const int zKernelSize = is3D?kernel_size:1;
+    const int floatingDim[3]={floatingImage->nx, floatingImage->ny, floatingImage->nz};
+    const size_t floatingPlaneNumber = (size_t)floatingDim[0]*floatingDim[1];
+    const size_t volumeNumber = (size_t)warpedImage->nt*warpedImage->nu;
+    const bool paddingVotes = paddingValue==paddingValue;
+    // Integer labels can not be NaN, 0 is used instead
+    const DTYPE paddingLabel = paddingVotes?static_cast<DTYPE>(paddingValue):
+                                            (std::numeric_limits<DTYPE>::has_quiet_NaN?
+                                                 std::numeric_limits<DTYPE>::quiet_NaN():0);
+
+    int a, b, c, X, Y, Z, n, labelNumber, bestLabel, previous[3];
+    size_t t, tapIndex[LABEL_RESAMPLING_MAX_TAP];
+    double xBasis[4], yBasis[4], zBasis[4]={1.0, 0.0, 0.0, 0.0}, relative;
+    double tapWeight[LABEL_RESAMPLING_MAX_TAP], labelWeight[LABEL_RESAMPLING_MAX_TAP];
+    bool tapInside[LABEL_RESAMPLING_MAX_TAP];
+    DTYPE labelValue[LABEL_RESAMPLING_MAX_TAP], currentLabel;
+    int tapNumber;
+    float world[3], position[3];
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(index, a, b, c, X, Y, Z, n, labelNumber, bestLabel, previous, t, tapIndex, \
+    xBasis, yBasis, relative, tapWeight, labelWeight, tapInside, labelValue, \
+    currentLabel, tapNumber, world, position) \
+    firstprivate(zBasis) \
+    shared(floatingIntensityPtr, warpedIntensityPtr, warpedVoxelNumber, floatingVoxelNumber, \
+    deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ, mask, is3D, \
+    floatingIJKMatrix, kernel_size, kernel_offset, zKernelSize, floatingDim, \
+    floatingPlaneNumber, volumeNumber, paddingVotes, paddingLabel)
+#endif // _OPENMP
+    for(index=0; index<warpedVoxelNumber; index++)
+    {
+        if(mask[index]<0)
+        {
+            for(t=0; t<volumeNumber; ++t)
+                warpedIntensityPtr[t*warpedVoxelNumber+index]=paddingLabel;
+            continue;
+        }
+        world[0]=static_cast<float>(deformationFieldPtrX[index]);
+        world[1]=static_cast<float>(deformationFieldPtrY[index]);
+        world[2]=is3D?static_cast<float>(deformationFieldPtrZ[index]):0.f;
+
+        // real -> voxel; floating space
+        reg_mat44_mul(floatingIJKMatrix, world, position);
+
+        previous[0] = static_cast<int>(reg_floor(position[0]));
+        previous[1] = static_cast<int>(reg_floor(position[1]));
+        previous[2] = is3D?static_cast<int>(reg_floor(position[2])):0;
+        relative = static_cast<double>(position[0])-static_cast<double>(previous[0]);
+        interpKernel<kernel>(relative, xBasis);
+        relative = static_cast<double>(position[1])-static_cast<double>(previous[1]);
+        interpKernel<kernel>(relative, yBasis);
+        if(is3D)
+        {
+            relative = static_cast<double>(position[2])-static_cast<double>(previous[2]);
+            interpKernel<kernel>(relative, zBasis);
+            previous[2]-=kernel_offset;
+        }
+        previous[0]-=kernel_offset;
+        previous[1]-=kernel_offset;
+
+        // The weights and the floating indices of the taps are shared by all the volumes
+        tapNumber=0;
+        for(c=0; c<zKernelSize; c++)
+        {
+            Z= previous[2]+c;
+            for(b=0; b<kernel_size; b++)
+            {
+                Y= previous[1]+b;
+                for(a=0; a<kernel_size; a++)
+                {
+                    X= previous[0]+a;
+                    tapWeight[tapNumber]=xBasis[a]*yBasis[b]*zBasis[c];
+                    tapInside[tapNumber]=-1<X && X<floatingDim[0] &&
+                            -1<Y && Y<floatingDim[1] &&
+                            -1<Z && Z<floatingDim[2];
+                    tapIndex[tapNumber]=tapInside[tapNumber]?
+                                Z*floatingPlaneNumber+Y*floatingDim[0]+X:0;
+                    ++tapNumber;
+                }
+            }
+        }
+
+        for(t=0; t<volumeNumber; ++t)
+        {
+            // Sparse accumulation of the weights per label
+            labelNumber=0;
+            for(a=0; a<tapNumber; ++a)
+            {
+                if(tapWeight[a]==0) continue;
+                if(tapInside[a])
+                {
+                    currentLabel=floatingIntensityPtr[t*floatingVoxelNumber+tapIndex[a]];
+                    if(currentLabel!=currentLabel) continue;
+                }
+                else if(paddingVotes)
+                    currentLabel=paddingLabel;
+                else continue;
+                for(n=0; n<labelNumber; ++n)
+                {
+                    if(labelValue[n]==currentLabel)
+                        break;
+                }
+                if(n==labelNumber)
+                {
+                    labelValue[n]=currentLabel;
+                    labelWeight[n]=0;
+                    ++labelNumber;
+                }
+                labelWeight[n]+=tapWeight[a];
+            }
+            // Arg-max over the accumulated labels
+            bestLabel=-1;
+            for(n=0; n<labelNumber; ++n)
+            {
+                if(bestLabel<0 || labelWeight[n]>labelWeight[bestLabel])
+                    bestLabel=n;
+            }
+            warpedIntensityPtr[t*warpedVoxelNumber+index]=bestLabel<0?
+                        paddingLabel:labelValue[bestLabel];
+        }
+    }
+}
+/* *************************************************************** */
+template<class DTYPE, class FieldTYPE>
+void reg_resampleLabelImage2(nifti_image *floatingImage,
+                             nifti_image *warpedImage,
+                             nifti_image *deformationField,
+                             int *mask,
+                             int interp,
+                             FieldTYPE paddingValue)
+{
+    switch(interp){
+    case 0:
+        ResampleLabelImage<DTYPE,FieldTYPE,0>(floatingImage, deformationField, warpedImage,
+                                              mask, paddingValue);
+        break; // nereast-neighboor interpolation
+    case 1:
+        ResampleLabelImage<DTYPE,FieldTYPE,1>(floatingImage, deformationField, warpedImage,
+                                              mask, paddingValue);
+        break; // linear interpolation
+    default:
+        ResampleLabelImage<DTYPE,FieldTYPE,3>(floatingImage, deformationField, warpedImage,
+                                              mask, paddingValue);
+        break; // cubic spline interpolation
     }
-
-    // The interpolated tensors are reoriented and exponentiated
-    reg_dti_resampling_postprocessing<FloatingTYPE>(warpedImage,
-                                                    mask,
-                                                    jacMat,
-                                                    dtIndicies);
 }
 /* *************************************************************** */
-void reg_resampleImage(nifti_image *floatingImage,
-                       nifti_image *warpedImage,
-                       nifti_image *deformationField,
-                       int *mask,
-                       int interp,
-                       float paddingValue,
-                       bool *dti_timepoint,
-                       mat33 * jacMat)
+template<class FieldTYPE>
+void reg_resampleLabelImage1(nifti_image *floatingImage,
+                             nifti_image *warpedImage,
+                             nifti_image *deformationField,
+                             int *mask,
+                             int interp,
+                             FieldTYPE paddingValue)
+{
+    switch(floatingImage->datatype)
+    {
+    case NIFTI_TYPE_UINT8:
+        reg_resampleLabelImage2<unsigned char,FieldTYPE>
+                (floatingImage, warpedImage, deformationField, mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_INT8:
+        reg_resampleLabelImage2<char,FieldTYPE>
+                (floatingImage, warpedImage, deformationField, mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_UINT16:
+        reg_resampleLabelImage2<unsigned short,FieldTYPE>
+                (floatingImage, warpedImage, deformationField, mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_INT16:
+        reg_resampleLabelImage2<short,FieldTYPE>
+                (floatingImage, warpedImage, deformationField, mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_UINT32:
+        reg_resampleLabelImage2<unsigned int,FieldTYPE>
+                (floatingImage, warpedImage, deformationField, mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_INT32:
+        reg_resampleLabelImage2<int,FieldTYPE>
+                (floatingImage, warpedImage, deformationField, mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_FLOAT32:
+        reg_resampleLabelImage2<float,FieldTYPE>
+                (floatingImage, warpedImage, deformationField, mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_FLOAT64:
+        reg_resampleLabelImage2<double,FieldTYPE>
+                (floatingImage, warpedImage, deformationField, mask, interp, paddingValue);
+        break;
+    default:
+        reg_print_fct_error("reg_resampleLabelImage");
+        reg_print_msg_error("floating pixel type unsupported.");
+        reg_exit();
+    }
+}
+/* *************************************************************** */
+void reg_resampleLabelImage(nifti_image *floatingImage,
+                            nifti_image *warpedImage,
+                            nifti_image *deformationField,
+                            int *mask,
+                            int interp,
+                            float paddingValue)
 {
     if(floatingImage->datatype != warpedImage->datatype)
     {
-        reg_print_fct_error("reg_resampleImage");
+        reg_print_fct_error("reg_resampleLabelImage");
         reg_print_msg_error("The floating and warped image should have the same data type");
         reg_exit();
     }
-
-    if(floatingImage->nt != warpedImage->nt)
+    if(floatingImage->nt*floatingImage->nu != warpedImage->nt*warpedImage->nu)
     {
-        reg_print_fct_error("reg_resampleImage");
+        reg_print_fct_error("reg_resampleLabelImage");
         reg_print_msg_error("The floating and warped images have different dimension along the time axis");
         reg_exit();
     }
-
-    // Define the DTI indices if required
-    int dtIndicies[6];
-    for(int i=0; i<6; ++i) dtIndicies[i]=-1;
-    if(dti_timepoint!=NULL)
+    if(interp!=0 && interp!=1 && interp!=3)
     {
-        if(jacMat==NULL)
-        {
-            reg_print_fct_error("reg_resampleImage");
-            reg_print_msg_error("DTI resampling: No Jacobian matrix array has been provided");
-            reg_exit();
-        }
-        int j=0;
-        for(int i=0; i<floatingImage->nt; ++i)
-        {
-            if(dti_timepoint[i]==true)
-                dtIndicies[j++]=i;
-        }
-        if((floatingImage->nz>1 && j!=6) && (floatingImage->nz==1 && j!=3))
-        {
-            reg_print_fct_error("reg_resampleImage");
-            reg_print_msg_error("DTI resampling: Unexpected number of DTI components");
-            reg_exit();
-        }
+        reg_print_fct_error("reg_resampleLabelImage");
+        reg_print_msg_error("Only the nearest neighbour, linear and cubic spline weights are supported");
+        reg_exit();
     }
 
     // a mask array is created if no mask is specified
@@ -838,187 +2206,387 @@ void reg_resampleImage(nifti_image *floatingImage,
         MrPropreRules = true;
     }
 
-    switch ( deformationField->datatype )
+    switch(deformationField->datatype)
     {
     case NIFTI_TYPE_FLOAT32:
-        switch ( floatingImage->datatype )
+        reg_resampleLabelImage1<float>(floatingImage, warpedImage, deformationField,
+                                       mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_FLOAT64:
+        reg_resampleLabelImage1<double>(floatingImage, warpedImage, deformationField,
+                                        mask, interp, paddingValue);
+        break;
+    default:
+        reg_print_fct_error("reg_resampleLabelImage");
+        reg_print_msg_error("Deformation field pixel type unsupported.");
+        reg_exit();
+    }
+    if(MrPropreRules==true)
+    {
+        free(mask);
+        mask=NULL;
+    }
+}
+/* *************************************************************** */
+/* *************************************************************** */
+#define AFFINE_RESAMPLING_BLOCK 32
+/* *************************************************************** */
+/** Single precision interpolation weights for a block of consecutive voxels.
+ * The weights are stored tap by tap, basis[tap*AFFINE_RESAMPLING_BLOCK+voxel],
+ * so that the loops over the voxels of the block can be vectorised. The relative
+ * positions are obtained with reg_floor and are therefore never negative.
+ */
+void interpKernelBlock(int kernel,
+                       int voxelNumber,
+                       float *relative,
+                       float *basis)
+{
+    float *basis0=&basis[0];
+    float *basis1=&basis[AFFINE_RESAMPLING_BLOCK];
+    float *basis2=&basis[2*AFFINE_RESAMPLING_BLOCK];
+    float *basis3=&basis[3*AFFINE_RESAMPLING_BLOCK];
+    switch(kernel)
+    {
+    case 0: // nearest-neighbour interpolation
+        for(int i=0; i<voxelNumber; ++i)
         {
-        case NIFTI_TYPE_UINT8:
-            reg_resampleImage2<float,unsigned char>(floatingImage,
-                                                    warpedImage,
-                                                    deformationField,
-                                                    mask,
-                                                    interp,
-                                                    paddingValue,
-                                                    dtIndicies,
-                                                    jacMat);
-            break;
-        case NIFTI_TYPE_INT8:
-            reg_resampleImage2<float,char>(floatingImage,
-                                           warpedImage,
-                                           deformationField,
-                                           mask,
-                                           interp,
-                                           paddingValue,
-                                           dtIndicies,
-                                           jacMat);
-            break;
-        case NIFTI_TYPE_UINT16:
-            reg_resampleImage2<float,unsigned short>(floatingImage,
-                                                     warpedImage,
-                                                     deformationField,
-                                                     mask,
-                                                     interp,
-                                                     paddingValue,
-                                                     dtIndicies,
-                                                     jacMat);
-            break;
-        case NIFTI_TYPE_INT16:
-            reg_resampleImage2<float,short>(floatingImage,
-                                            warpedImage,
-                                            deformationField,
-                                            mask,
-                                            interp,
-                                            paddingValue,
-                                            dtIndicies,
-                                            jacMat);
-            break;
-        case NIFTI_TYPE_UINT32:
-            reg_resampleImage2<float,unsigned int>(floatingImage,
-                                                   warpedImage,
-                                                   deformationField,
-                                                   mask,
-                                                   interp,
-                                                   paddingValue,
-                                                   dtIndicies,
-                                                   jacMat);
-            break;
-        case NIFTI_TYPE_INT32:
-            reg_resampleImage2<float,int>(floatingImage,
-                                          warpedImage,
-                                          deformationField,
-                                          mask,
-                                          interp,
-                                          paddingValue,
-                                          dtIndicies,
-                                          jacMat);
-            break;
-        case NIFTI_TYPE_FLOAT32:
-            reg_resampleImage2<float,float>(floatingImage,
-                                            warpedImage,
-                                            deformationField,
-                                            mask,
-                                            interp,
-                                            paddingValue,
-                                            dtIndicies,
-                                            jacMat);
-            break;
-        case NIFTI_TYPE_FLOAT64:
-            reg_resampleImage2<float,double>(floatingImage,
-                                             warpedImage,
-                                             deformationField,
-                                             mask,
-                                             interp,
-                                             paddingValue,
-                                             dtIndicies,
-                                             jacMat);
-            break;
-        default:
-            printf("floating pixel type unsupported.");
-            break;
+            basis1[i] = relative[i]>=0.5f?1.f:0.f;
+            basis0[i] = 1.f-basis1[i];
+        }
+        break;
+    case 1: // linear interpolation
+        for(int i=0; i<voxelNumber; ++i)
+        {
+            basis1[i] = relative[i];
+            basis0[i] = 1.f-relative[i];
+        }
+        break;
+    case 4: // sinc interpolation
+        for(int i=0; i<voxelNumber; ++i)
+        {
+            double sincBasis[SINC_KERNEL_SIZE];
+            interpWindowedSincKernelTable(static_cast<double>(relative[i]), sincBasis);
+            for(int j=0; j<SINC_KERNEL_SIZE; ++j)
+                basis[j*AFFINE_RESAMPLING_BLOCK+i] = static_cast<float>(sincBasis[j]);
+        }
+        break;
+    default: // cubic spline interpolation
+        for(int i=0; i<voxelNumber; ++i)
+        {
+            float r = relative[i];
+            float FF = r*r;
+            basis0[i] = (r * ((2.f-r)*r - 1.f))/2.f;
+            basis1[i] = (FF * (3.f*r-5.f) + 2.f)/2.f;
+            basis2[i] = (r * ((4.f-3.f*r)*r + 1.f))/2.f;
+            basis3[i] = (r-1.f) * FF/2.f;
+        }
+        break;
+    }
+}
+/* *************************************************************** */
+/** Resampling through an affine transformation. The voxel to voxel
+ * matrix is applied once per scanline and the floating position is then
+ * incremented by its first column along the x-axis. The positions and
+ * the weights are evaluated by blocks of voxels before the intensities
+ * are gathered, and are shared by all the volumes along the 4th axis.
+ */
+template<class FloatingTYPE, int kernel_size>
+void ResampleImage_affine(nifti_image *floatingImage,
+                          nifti_image *warpedImage,
+                          double voxelToVoxel[4][4],
+                          int *mask,
+                          double paddingValue,
+                          int kernel,
+                          int kernel_offset)
+{
+    const bool is3D = warpedImage->nz>1;
+    const int zKernelSize = is3D?kernel_size:1;
+    const size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    const size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+    const size_t floatingPlaneNumber = (size_t)floatingImage->nx*floatingImage->ny;
+    const int floatingDim[3]={floatingImage->nx, floatingImage->ny, floatingImage->nz};
+    const int warpedDim[2]={warpedImage->nx, warpedImage->ny};
+    const int datatype = floatingImage->datatype;
+    const size_t volumeNumber = (size_t)warpedImage->nt*warpedImage->nu;
+    FloatingTYPE *floatingIntensityPtr = static_cast<FloatingTYPE *>(floatingImage->data);
+    FloatingTYPE *warpedIntensityPtr = static_cast<FloatingTYPE *>(warpedImage->data);
+    const FloatingTYPE paddingIntensity =
+            reg_castResampledIntensity<FloatingTYPE>(paddingValue, datatype);
+
+    // The scanline increment
+    const double step[3]={voxelToVoxel[0][0],
+                          voxelToVoxel[1][0],
+                          voxelToVoxel[2][0]};
+
+#ifdef _WIN32
+    long row;
+    long rowNumber = (long)warpedImage->ny*warpedImage->nz;
+#else
+    size_t row;
+    size_t rowNumber = (size_t)warpedImage->ny*warpedImage->nz;
+#endif
+    int x0, blockSize, i, a, b, c, t, n, Y, Z, X, previous[3];
+    int previousBlock[3][AFFINE_RESAMPLING_BLOCK];
+    float relativeBlock[3][AFFINE_RESAMPLING_BLOCK];
+    float basisBlock[3][SINC_KERNEL_SIZE*AFFINE_RESAMPLING_BLOCK];
+    double rowStart[3], position, intensity;
+    float xTempNewValue, yTempNewValue;
+    float xBasis[kernel_size], yBasis[kernel_size], zBasis[kernel_size];
+    float xAccumulator[kernel_size];
+    size_t index, voxelIndex;
+    bool inside;
+    FloatingTYPE *zPointer, *xyzPointer;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(row, x0, blockSize, i, a, b, c, t, n, Y, Z, X, previous, previousBlock, \
+    relativeBlock, basisBlock, rowStart, position, intensity, xTempNewValue, \
+    yTempNewValue, xBasis, yBasis, zBasis, xAccumulator, index, voxelIndex, \
+    inside, zPointer, xyzPointer) \
+    shared(rowNumber, floatingDim, warpedDim, datatype, voxelToVoxel, step, mask, \
+    kernel, kernel_offset, paddingValue, paddingIntensity, warpedVoxelNumber, \
+    floatingVoxelNumber, floatingPlaneNumber, volumeNumber, floatingIntensityPtr, \
+    warpedIntensityPtr, is3D, zKernelSize)
+#endif // _OPENMP
+    for(row=0; row<rowNumber; ++row)
+    {
+        const double y = static_cast<double>(row%warpedDim[1]);
+        const double z = static_cast<double>(row/warpedDim[1]);
+        for(n=0; n<3; ++n)
+            rowStart[n] = voxelToVoxel[n][1]*y + voxelToVoxel[n][2]*z + voxelToVoxel[n][3];
+        if(!is3D) rowStart[2]=0;
+
+        for(x0=0; x0<warpedDim[0]; x0+=AFFINE_RESAMPLING_BLOCK)
+        {
+            blockSize = warpedDim[0]-x0;
+            if(blockSize>AFFINE_RESAMPLING_BLOCK)
+                blockSize=AFFINE_RESAMPLING_BLOCK;
+
+            // The positions and weights of the block are computed first
+            for(n=0; n<(is3D?3:2); ++n)
+            {
+                for(i=0; i<blockSize; ++i)
+                {
+                    position = rowStart[n] + static_cast<double>(x0+i)*step[n];
+                    previousBlock[n][i] = static_cast<int>(reg_floor(position));
+                    relativeBlock[n][i] = static_cast<float>(position -
+                                                             static_cast<double>(previousBlock[n][i]));
+                }
+                interpKernelBlock(kernel, blockSize, relativeBlock[n], basisBlock[n]);
+            }
+
+            for(i=0; i<blockSize; ++i)
+            {
+                index = row*warpedDim[0]+x0+i;
+                if(mask[index]<0)
+                {
+                    // The 2D resampling leaves the masked voxels untouched
+                    if(is3D)
+                    {
+                        for(t=0; t<(int)volumeNumber; ++t)
+                            warpedIntensityPtr[t*warpedVoxelNumber+index]=paddingIntensity;
+                    }
+                    continue;
+                }
+                previous[0]=previousBlock[0][i]-kernel_offset;
+                previous[1]=previousBlock[1][i]-kernel_offset;
+                previous[2]=is3D?previousBlock[2][i]-kernel_offset:0;
+                for(a=0; a<kernel_size; ++a)
+                {
+                    xBasis[a]=basisBlock[0][a*AFFINE_RESAMPLING_BLOCK+i];
+                    yBasis[a]=basisBlock[1][a*AFFINE_RESAMPLING_BLOCK+i];
+                    zBasis[a]=is3D?basisBlock[2][a*AFFINE_RESAMPLING_BLOCK+i]:1.f;
+                }
+                inside = -1<previous[0] && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                        -1<previous[1] && (previous[1]+kernel_size-1)<floatingDim[1] &&
+                        -1<previous[2] && (previous[2]+zKernelSize-1)<floatingDim[2];
+                voxelIndex = previous[2]*floatingPlaneNumber +
+                        previous[1]*floatingDim[0] + previous[0];
+
+                for(t=0; t<(int)volumeNumber; ++t)
+                {
+                    intensity=0.0;
+                    if(inside)
+                    {
+                        // The rows are accumulated tap-wise so that the x-axis is
+                        // processed as one short vector
+                        for(a=0; a<kernel_size; ++a)
+                            xAccumulator[a]=0.f;
+                        zPointer = &floatingIntensityPtr[t*floatingVoxelNumber+voxelIndex];
+                        for(c=0; c<zKernelSize; ++c)
+                        {
+                            for(b=0; b<kernel_size; ++b)
+                            {
+                                xyzPointer = &zPointer[b*floatingDim[0]];
+                                yTempNewValue = yBasis[b]*zBasis[c];
+                                for(a=0; a<kernel_size; ++a)
+                                    xAccumulator[a] += static_cast<float>(xyzPointer[a]) * yTempNewValue;
+                            }
+                            zPointer += floatingPlaneNumber;
+                        }
+                        for(a=0; a<kernel_size; ++a)
+                            intensity += static_cast<double>(xAccumulator[a] * xBasis[a]);
+                    }
+                    else
+                    {
+                        for(c=0; c<zKernelSize; ++c)
+                        {
+                            Z = previous[2]+c;
+                            yTempNewValue=0.f;
+                            for(b=0; b<kernel_size; ++b)
+                            {
+                                Y = previous[1]+b;
+                                xTempNewValue=0.f;
+                                for(a=0; a<kernel_size; ++a)
+                                {
+                                    X = previous[0]+a;
+                                    if(-1<X && X<floatingDim[0] &&
+                                       -1<Y && Y<floatingDim[1] &&
+                                       -1<Z && Z<floatingDim[2])
+                                    {
+                                        xTempNewValue += static_cast<float>(
+                                                    floatingIntensityPtr[t*floatingVoxelNumber +
+                                                    Z*floatingPlaneNumber + Y*floatingDim[0] + X]) *
+                                                xBasis[a];
+                                    }
+                                    else xTempNewValue += static_cast<float>(paddingValue) * xBasis[a];
+                                }
+                                yTempNewValue += xTempNewValue * yBasis[b];
+                            }
+                            intensity += static_cast<double>(yTempNewValue * zBasis[c]);
+                        }
+                    }
+                    warpedIntensityPtr[t*warpedVoxelNumber+index] =
+                            reg_castResampledIntensity<FloatingTYPE>(intensity, datatype);
+                }
+            }
+        }
+    }
+}
+/* *************************************************************** */
+template<class FloatingTYPE>
+void reg_resampleImage_affine1(nifti_image *floatingImage,
+                               nifti_image *warpedImage,
+                               double voxelToVoxel[4][4],
+                               int *mask,
+                               int interp,
+                               double paddingValue)
+{
+    switch(interp)
+    {
+    case 0:
+    case 1:
+        ResampleImage_affine<FloatingTYPE,2>(floatingImage, warpedImage, voxelToVoxel,
+                                             mask, paddingValue, interp, 0);
+        break;
+    case 4:
+        ResampleImage_affine<FloatingTYPE,SINC_KERNEL_SIZE>(floatingImage, warpedImage, voxelToVoxel,
+                                                            mask, paddingValue, interp,
+                                                            SINC_KERNEL_RADIUS);
+        break;
+    default:
+        ResampleImage_affine<FloatingTYPE,4>(floatingImage, warpedImage, voxelToVoxel,
+                                             mask, paddingValue, 3, 1);
+        break;
+    }
+}
+/* *************************************************************** */
+void reg_resampleImage_affine(nifti_image *floatingImage,
+                              nifti_image *warpedImage,
+                              mat44 *affineTransformation,
+                              int *mask,
+                              int interp,
+                              float paddingValue)
+{
+    // The windowed sinc table is generated before entering any parallel region
+    if(interp==4)
+        reg_initWindowedSincTable();
+
+    if(floatingImage->datatype != warpedImage->datatype)
+    {
+        reg_print_fct_error("reg_resampleImage_affine");
+        reg_print_msg_error("The floating and warped image should have the same data type");
+        reg_exit();
+    }
+    if(floatingImage->nt*floatingImage->nu != warpedImage->nt*warpedImage->nu)
+    {
+        reg_print_fct_error("reg_resampleImage_affine");
+        reg_print_msg_error("The floating and warped images have different dimension along the time axis");
+        reg_exit();
+    }
+
+    // The voxel to voxel matrix is computed in double precision
+    mat44 *warpedMatrix = warpedImage->sform_code>0?
+                &(warpedImage->sto_xyz):&(warpedImage->qto_xyz);
+    mat44 *floatingIJKMatrix = floatingImage->sform_code>0?
+                &(floatingImage->sto_ijk):&(floatingImage->qto_ijk);
+    double temp[4][4], voxelToVoxel[4][4];
+    for(int i=0; i<4; ++i)
+    {
+        for(int j=0; j<4; ++j)
+        {
+            temp[i][j]=0;
+            for(int k=0; k<4; ++k)
+                temp[i][j] += static_cast<double>(affineTransformation->m[i][k]) *
+                        static_cast<double>(warpedMatrix->m[k][j]);
         }
-        break;
-    case NIFTI_TYPE_FLOAT64:
-        switch ( floatingImage->datatype )
+    }
+    for(int i=0; i<4; ++i)
+    {
+        for(int j=0; j<4; ++j)
         {
-        case NIFTI_TYPE_UINT8:
-            reg_resampleImage2<double,unsigned char>(floatingImage,
-                                                     warpedImage,
-                                                     deformationField,
-                                                     mask,
-                                                     interp,
-                                                     paddingValue,
-                                                     dtIndicies,
-                                                     jacMat);
-            break;
-        case NIFTI_TYPE_INT8:
-            reg_resampleImage2<double,char>(floatingImage,
-                                            warpedImage,
-                                            deformationField,
-                                            mask,
-                                            interp,
-                                            paddingValue,
-                                            dtIndicies,
-                                            jacMat);
-            break;
-        case NIFTI_TYPE_UINT16:
-            reg_resampleImage2<double,unsigned short>(floatingImage,
-                                                      warpedImage,
-                                                      deformationField,
-                                                      mask,
-                                                      interp,
-                                                      paddingValue,
-                                                      dtIndicies,
-                                                      jacMat);
-            break;
-        case NIFTI_TYPE_INT16:
-            reg_resampleImage2<double,short>(floatingImage,
-                                             warpedImage,
-                                             deformationField,
-                                             mask,
-                                             interp,
-                                             paddingValue,
-                                             dtIndicies,
-                                             jacMat);
-            break;
-        case NIFTI_TYPE_UINT32:
-            reg_resampleImage2<double,unsigned int>(floatingImage,
-                                                    warpedImage,
-                                                    deformationField,
-                                                    mask,
-                                                    interp,
-                                                    paddingValue,
-                                                    dtIndicies,
-                                                    jacMat );
-            break;
-        case NIFTI_TYPE_INT32:
-            reg_resampleImage2<double,int>(floatingImage,
-                                           warpedImage,
-                                           deformationField,
-                                           mask,
-                                           interp,
-                                           paddingValue,
-                                           dtIndicies,
-                                           jacMat);
-            break;
-        case NIFTI_TYPE_FLOAT32:
-            reg_resampleImage2<double,float>(floatingImage,
-                                             warpedImage,
-                                             deformationField,
-                                             mask,
-                                             interp,
-                                             paddingValue,
-                                             dtIndicies,
-                                             jacMat);
-            break;
-        case NIFTI_TYPE_FLOAT64:
-            reg_resampleImage2<double,double>(floatingImage,
-                                              warpedImage,
-                                              deformationField,
-                                              mask,
-                                              interp,
-                                              paddingValue,
-                                              dtIndicies,
-                                              jacMat);
-            break;
-        default:
-            printf("floating pixel type unsupported.");
-            break;
+            voxelToVoxel[i][j]=0;
+            for(int k=0; k<4; ++k)
+                voxelToVoxel[i][j] += static_cast<double>(floatingIJKMatrix->m[i][k]) * temp[k][j];
         }
+    }
+
+    // a mask array is created if no mask is specified
+    bool MrPropreRules = false;
+    if(mask==NULL)
+    {
+        // voxels in the background are set to negative value so 0 corresponds to active voxel
+        mask=(int *)calloc((size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz,sizeof(int));
+        MrPropreRules = true;
+    }
+
+    switch(floatingImage->datatype)
+    {
+    case NIFTI_TYPE_UINT8:
+        reg_resampleImage_affine1<unsigned char>(floatingImage, warpedImage, voxelToVoxel,
+                                                 mask, interp, paddingValue);
         break;
-    default:
-        printf("Deformation field pixel type unsupported.");
+    case NIFTI_TYPE_INT8:
+        reg_resampleImage_affine1<char>(floatingImage, warpedImage, voxelToVoxel,
+                                        mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_UINT16:
+        reg_resampleImage_affine1<unsigned short>(floatingImage, warpedImage, voxelToVoxel,
+                                                  mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_INT16:
+        reg_resampleImage_affine1<short>(floatingImage, warpedImage, voxelToVoxel,
+                                         mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_UINT32:
+        reg_resampleImage_affine1<unsigned int>(floatingImage, warpedImage, voxelToVoxel,
+                                                mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_INT32:
+        reg_resampleImage_affine1<int>(floatingImage, warpedImage, voxelToVoxel,
+                                       mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_FLOAT32:
+        reg_resampleImage_affine1<float>(floatingImage, warpedImage, voxelToVoxel,
+                                         mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_FLOAT64:
+        reg_resampleImage_affine1<double>(floatingImage, warpedImage, voxelToVoxel,
+                                          mask, interp, paddingValue);
         break;
+    default:
+        reg_print_fct_error("reg_resampleImage_affine");
+        reg_print_msg_error("Floating pixel type unsupported");
+        reg_exit();
     }
     if(MrPropreRules==true)
     {
@@ -1081,7 +2649,7 @@ void ResampleImage3D_PSF_Sinc(nifti_image *floatingImage,
         break; // linear interpolation
     case 4:
         kernel_size=SINC_KERNEL_SIZE;
-        kernelCompFctPtr=&interpWindowedSincKernel;
+        kernelCompFctPtr=&interpWindowedSincKernelTable;
         kernel_offset=SINC_KERNEL_RADIUS;
         break; // sinc interpolation
     default:
@@ -1283,42 +2851,423 @@ void ResampleImage3D_PSF_Sinc(nifti_image *floatingImage,
                     intensity=paddingValue;
                 }
             } // if in mask
-            switch(floatingImage->datatype)
+            warpedIntensity[index]=reg_castResampledIntensity<FloatingTYPE>(intensity, floatingImage->datatype);
+        }
+    }
+}
+
+/* *************************************************************** */
+/* *************************************************************** */
+#define PSF_MAX_SAMPLE_NUMBER 343
+#define PSF_JACOBIAN_QUANTISATION 0.01f
+#define PSF_CACHE_MAX_ENTRY_NUMBER 4096
+#define PSF_SEPARABLE_CORRELATION 0.05
+#define PSF_AFFINE_TOLERANCE 0.01
+#define PSF_SEPARABLE_VOXEL -2
+/* *************************************************************** */
+/** The reference (T) and floating (S) point spread functions are
+ * modelled as Gaussians whose full width at half maximum matches the
+ * voxel dimensions.
+ */
+void reg_getPSFCovariances(nifti_image *floatingImage,
+                           nifti_image *warpedImage,
+                           mat33 *T,
+                           mat33 *S)
+{
+    mat44 *warpedMatrix = &(warpedImage->qto_xyz);
+    if(warpedImage->sform_code>0)
+        warpedMatrix = &(warpedImage->sto_xyz);
+    mat44 *floatingMatrix = &(floatingImage->qto_xyz);
+    if(floatingImage->sform_code>0)
+        floatingMatrix = &(floatingImage->sto_xyz);
+
+    float fwhmToStd=2.355f;
+    for(int j=0; j<3; j++){
+        for(int i=0; i<3; i++){
+            T->m[i][j]=0;
+            S->m[i][j]=0;
+        }
+    }
+    for(int j=0; j<3; j++){
+        for(int i=0; i<3; i++){
+            T->m[j][j] += reg_pow2(warpedMatrix->m[i][j]);
+            S->m[j][j] += reg_pow2(floatingMatrix->m[i][j]);
+        }
+        T->m[j][j] = reg_pow2(sqrtf(T->m[j][j]) / fwhmToStd)/2.0f;
+        S->m[j][j] = reg_pow2(sqrtf(S->m[j][j]) / fwhmToStd)/2.0f;
+    }
+}
+/* *************************************************************** */
+/** Estimates the PSF to apply in the warped space from the local Jacobian
+ * matrix of the transformation. The PSF is returned through its eigen
+ * decomposition, its inverse and its determinant.
+ */
+void reg_getPSFShape(mat33 *jacobian,
+                     mat33 *T,
+                     mat33 *S,
+                     char algorithm,
+                     mat33 *TmS_EigVec,
+                     mat33 *TmS_EigVal,
+                     mat33 *invP,
+                     float *determinant)
+{
+    mat33 ASAt, A, TmS, TmS_EigVal_inv;
+    if(algorithm==0){
+
+        // T=P+A*S*At
+        A=nifti_mat33_inverse(*jacobian);
+
+        ASAt = A * (*S) * reg_mat33_trans(A);
+
+        TmS = (*T) - ASAt;
+        //reg_mat33_disp(&TmS, "matTmS");
+
+        reg_mat33_diagonalize(&TmS, TmS_EigVec, TmS_EigVal);
+
+        // If eigen values are less than 0, set them to 0.
+        // Also, invert the eigenvalues to estimate the inverse.
+        for(int m=0;m<3;m++){
+            for(int n=0;n<3;n++){
+                if(m==n){ // Set diagonals to max(val,0)
+                    TmS_EigVal->m[m][n]=TmS_EigVal->m[m][n]>0.000001f?TmS_EigVal->m[m][n]:0.000001f;
+                    TmS_EigVal_inv.m[m][n]=1.0f/TmS_EigVal->m[m][n];
+                }else{ // Set off-diagonal residuals to 0
+                    TmS_EigVal->m[m][n]=0;
+                    TmS_EigVal_inv.m[m][n]=0;
+                }
+            }
+        }
+
+        *invP= (*TmS_EigVec) * TmS_EigVal_inv * reg_mat33_trans(*TmS_EigVec);
+    }
+    else{
+
+        A=nifti_mat33_inverse(*jacobian);
+
+        ASAt =  A * (*S) * reg_mat33_trans(A);
+
+        mat33 S_EigVec, S_EigVal;
+
+        //                % rotate S
+        //                [ZS, DS] = eig(S);
+        reg_mat33_diagonalize(&ASAt, &S_EigVec, &S_EigVal);
+
+        //                T1 = ZS'*T*ZS;
+        mat33 T1 = reg_mat33_trans(S_EigVec) * (*T) * S_EigVec;
+
+        //                % Volume-preserving scale of S to make it isotropic
+        //                detS = prod(diag(DS));
+        float detASAt = S_EigVal.m[0][0]*S_EigVal.m[1][1]*S_EigVal.m[2][2];
+
+        //                factDetS = detS^(1/4);
+        float factDetS=powf(detASAt,0.25);
+
+        //                LambdaN = factDetS*diag(diag(DS).^(-1/2));
+        //                invLambdaN = diag(1./diag(LambdaN))
+        mat33 LambdaN,invLambdaN;
+        for(int m=0;m<3;m++){
+            for(int n=0;n<3;n++){
+                if(m==n){
+                    LambdaN.m[m][n]=factDetS*powf(S_EigVal.m[m][n],-0.5);
+                    invLambdaN.m[m][n]=1.0f/LambdaN.m[m][n];
+                }else{ // Set off-diagonal to 0
+                    LambdaN.m[m][n]=0;
+                    invLambdaN.m[m][n]=0;
+                }
+            }
+        }
+
+        //                T2 = LambdaN*T1*LambdaN';
+        mat33 T2 = LambdaN * T1 * reg_mat33_trans(LambdaN);
+
+        //                % Rotate to make thing axis-aligned
+        //                [ZT2, DT2] = eig(T2);
+        mat33 T2_EigVec, T2_EigVal;
+        reg_mat33_diagonalize(&T2, &T2_EigVec, &T2_EigVal);
+
+        //                % Optimal solution in the transformed axis-aligned space
+        //                DP2 = diag(max(sqrt(detS),diag(DT2)));
+        mat33 DP2;
+        for(int m=0;m<3;m++){
+            for(int n=0;n<3;n++){
+                if(m==n){
+                    DP2.m[m][n]= powf(factDetS,0.5)>(T2_EigVal.m[m][n])?powf(factDetS,0.5):(T2_EigVal.m[m][n]);
+                }else{ // Set off-diagonal to 0
+                    DP2.m[m][n]=0;
+                }
+            }
+        }
+
+        //                % Roll back the transforms
+        //                Q = ZS*invLambdaN*ZT2*DQ2*ZT2'*invLambdaN*ZS'
+        mat33 Q = S_EigVec * invLambdaN * T2_EigVec * DP2 * reg_mat33_trans(T2_EigVec) * invLambdaN * reg_mat33_trans(S_EigVec);
+        //                P=Q-S
+        TmS = Q - (*S);
+        *invP=nifti_mat33_inverse(TmS);
+        reg_mat33_diagonalize(&TmS, TmS_EigVec, TmS_EigVal);
+    }
+    *determinant = TmS_EigVal->m[0][0]*TmS_EigVal->m[1][1]*TmS_EigVal->m[2][2];
+    *determinant = *determinant<0.000001f?0.000001f:*determinant;
+}
+/* *************************************************************** */
+/** Samples the PSF on a regular grid defined in its eigen space. The
+ * offset (in mm) and the weight of every non-zero sample are stored
+ * consecutively in the samples array, which must hold
+ * 4*PSF_MAX_SAMPLE_NUMBER values. The number of samples is returned.
+ */
+int reg_getPSFSamples(mat33 *TmS_EigVec,
+                      mat33 *TmS_EigVal,
+                      mat33 *invP,
+                      float currentDeterminant,
+                      float *samples)
+{
+    float psf_eig[3], psf_xyz[3], psfKernelShift[3], curLambda, mahal, psfWeight;
+
+    // set sampling rate
+    float psfNumbSamples=3; // in standard deviations mm
+    float psfSampleSpacing=0.75; // in standard deviations mm
+    psfKernelShift[0]=TmS_EigVal->m[0][0]<0.01f?0.0f:(float)(psfNumbSamples)*psfSampleSpacing;
+    psfKernelShift[1]=TmS_EigVal->m[1][1]<0.01f?0.0f:(float)(psfNumbSamples)*psfSampleSpacing;
+    psfKernelShift[2]=TmS_EigVal->m[2][2]<0.01f?0.0f:(float)(psfNumbSamples)*psfSampleSpacing;
+
+    int sampleNumber=0;
+    // coordinates in eigen space
+    for(psf_eig[0]=-psfKernelShift[0];psf_eig[0]<=(psfKernelShift[0]); psf_eig[0]+=psfSampleSpacing)
+    {
+        for(psf_eig[1]=-psfKernelShift[1];psf_eig[1]<=(psfKernelShift[1]); psf_eig[1]+=psfSampleSpacing)
+        {
+            for(psf_eig[2]=-psfKernelShift[2];psf_eig[2]<=(psfKernelShift[2]); psf_eig[2]+=psfSampleSpacing)
             {
-            case NIFTI_TYPE_FLOAT32:
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
-                break;
-            case NIFTI_TYPE_FLOAT64:
-                warpedIntensity[index]=intensity;
-                break;
-            case NIFTI_TYPE_UINT8:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_UINT16:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_UINT32:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            default:
-                if(intensity!=intensity)
-                    intensity=0;
-                warpedIntensity[index]=static_cast<FloatingTYPE>(reg_round(intensity));
-                break;
+                // Distance threshold (only interpolate if distance is below 3 std)
+                if(sqrtf(psf_eig[0]*psf_eig[0]+psf_eig[1]*psf_eig[1]+psf_eig[2]*psf_eig[2])<=3){
+                    // Use the Eigen coordinates and convert them to XYZ
+                    // The new lambda per coordinate is eige_coordinate*sqrt(eigenVal)
+                    // as the sqrt(eigenVal) is equivalent to the STD
+                    psf_xyz[0]=0;
+                    psf_xyz[1]=0;
+                    psf_xyz[2]=0;
+                    for(int m=0;m<3;m++){
+                        curLambda=(float)(psf_eig[m])*sqrt(TmS_EigVal->m[m][m]);
+                        psf_xyz[0]+=curLambda*TmS_EigVec->m[0][m];
+                        psf_xyz[1]+=curLambda*TmS_EigVec->m[1][m];
+                        psf_xyz[2]+=curLambda*TmS_EigVec->m[2][m];
+                    }
+
+                    //mahal=0;
+                    mahal=psf_xyz[0]*invP->m[0][0]*psf_xyz[0]+
+                            psf_xyz[0]*invP->m[1][0]*psf_xyz[1]+
+                            psf_xyz[0]*invP->m[2][0]*psf_xyz[2]+
+                            psf_xyz[1]*invP->m[0][1]*psf_xyz[0]+
+                            psf_xyz[1]*invP->m[1][1]*psf_xyz[1]+
+                            psf_xyz[1]*invP->m[2][1]*psf_xyz[2]+
+                            psf_xyz[2]*invP->m[0][2]*psf_xyz[0]+
+                            psf_xyz[2]*invP->m[1][2]*psf_xyz[1]+
+                            psf_xyz[2]*invP->m[2][2]*psf_xyz[2];
+
+                    psfWeight=powf(2.f*M_PI,-3.f/2.f)*
+                            pow(currentDeterminant,-0.5f)*
+                            expf(-0.5f*mahal);
+
+                    if(psfWeight!=0.f){ // If the relative weight is above 0
+                        samples[4*sampleNumber  ]=psf_xyz[0];
+                        samples[4*sampleNumber+1]=psf_xyz[1];
+                        samples[4*sampleNumber+2]=psf_xyz[2];
+                        samples[4*sampleNumber+3]=psfWeight;
+                        ++sampleNumber;
+                    }
+                }
+            }
+        }
+    }
+    return sampleNumber;
+}
+/* *************************************************************** */
+/** Returns the interpolation kernel used to sample the floating image
+ * within the PSF resampling functions.
+ */
+void reg_getPSFKernel(int kernel,
+                      int *kernel_size,
+                      int *kernel_offset,
+                      void (**kernelCompFctPtr)(double,double *))
+{
+    switch(kernel){
+    case 0:
+        reg_print_fct_error("reg_getPSFKernel");
+        reg_print_msg_error("Not implemented for NN interpolation yet");
+        reg_exit();
+        *kernel_size=2;
+        *kernelCompFctPtr=&interpNearestNeighKernel;
+        *kernel_offset=0;
+        break; // nereast-neighboor interpolation
+    case 1:
+        *kernel_size=2;
+        *kernelCompFctPtr=&interpLinearKernel;
+        *kernel_offset=0;
+        break; // linear interpolation
+    case 4:
+        *kernel_size=SINC_KERNEL_SIZE;
+        *kernelCompFctPtr=&interpWindowedSincKernelTable;
+        *kernel_offset=SINC_KERNEL_RADIUS;
+        break; // sinc interpolation
+    default:
+        *kernel_size=4;
+        *kernelCompFctPtr=&interpCubicSplineKernel;
+        *kernel_offset=1;
+        break; // cubic spline interpolation
+    }
+}
+/* *************************************************************** */
+/** Interpolates the deformation field at a non-integer warped voxel
+ * position, defined by its lower corner and its relative position, and
+ * returns the floating intensity at the corresponding position. NaN is
+ * returned when the position falls outside of the deformation field.
+ */
+template<class FloatingTYPE, class FieldTYPE>
+inline double reg_getPSFSampleIntensity(nifti_image *floatingImage,
+                                        FloatingTYPE *floatingIntensity,
+                                        nifti_image *warpedImage,
+                                        FieldTYPE *deformationFieldPtrX,
+                                        FieldTYPE *deformationFieldPtrY,
+                                        FieldTYPE *deformationFieldPtrZ,
+                                        mat44 *floatingIJKMatrix,
+                                        void (*kernelCompFctPtr)(double,double *),
+                                        int kernel_size,
+                                        int kernel_offset,
+                                        FieldTYPE paddingValue,
+                                        size_t currentAPre,
+                                        size_t currentBPre,
+                                        size_t currentCPre,
+                                        float currentARel,
+                                        float currentBRel,
+                                        float currentCRel)
+{
+    size_t warpedLineNumber = (size_t)warpedImage->nx;
+    size_t warpedPlaneNumber = (size_t)warpedImage->nx*warpedImage->ny;
+    double xBasis[SINC_KERNEL_SIZE], yBasis[SINC_KERNEL_SIZE], zBasis[SINC_KERNEL_SIZE], relative[3];
+    double xTempNewValue, yTempNewValue, psfIntensity, psfWorld[3], position[3];
+    float resamplingWeightSum, resamplingWeight;
+    int Y, Z, previous[3];
+    size_t currentIndex;
+    FloatingTYPE *zPointer, *xyzPointer;
+
+    // Interpolate the PSF world coordinates
+    psfWorld[0]=0.0f;
+    psfWorld[1]=0.0f;
+    psfWorld[2]=0.0f;
+    resamplingWeightSum=0.0f;
+    bool fieldInside = (int)currentAPre>=0 && ((int)currentAPre+1)<warpedImage->nx &&
+            (int)currentBPre>=0 && ((int)currentBPre+1)<warpedImage->ny &&
+            (int)currentCPre>=0 && ((int)currentCPre+1)<warpedImage->nz;
+    for (int a=0;a<=1;a++){
+        for (int b=0;b<=1;b++){
+            for (int c=0;c<=1;c++){
+
+                if(fieldInside || (((int)currentAPre+a)>=0
+                        && ((int)currentBPre+b)>=0
+                        && ((int)currentCPre+c)>=0
+                        && ((int)currentAPre+a)<warpedImage->nx
+                        && ((int)currentBPre+b)<warpedImage->ny
+                        && ((int)currentCPre+c)<warpedImage->nz)){
+
+                    currentIndex=((size_t)currentAPre+(size_t)a)+
+                            ((size_t)currentBPre+(size_t)b)*warpedLineNumber+
+                            ((size_t)currentCPre+(size_t)c)*warpedPlaneNumber;
+
+                    resamplingWeight=fabs((float)(1-a)-currentARel)*
+                            fabs((float)(1-b)-currentBRel)*
+                            fabs((float)(1-c)-currentCRel);
+
+                    resamplingWeightSum+=resamplingWeight;
+
+                    psfWorld[0]+=static_cast<double>(resamplingWeight*deformationFieldPtrX[currentIndex]);
+                    psfWorld[1]+=static_cast<double>(resamplingWeight*deformationFieldPtrY[currentIndex]);
+                    psfWorld[2]+=static_cast<double>(resamplingWeight*deformationFieldPtrZ[currentIndex]);
+                }
             }
         }
     }
-}
 
+    if(resamplingWeightSum<=0.0f)
+        return std::numeric_limits<double>::quiet_NaN();
+
+    psfWorld[0]/=resamplingWeightSum;
+    psfWorld[1]/=resamplingWeightSum;
+    psfWorld[2]/=resamplingWeightSum;
+
+    // real -> voxel; floating space
+    reg_mat44_mul(floatingIJKMatrix, psfWorld, position);
+
+    previous[0] = static_cast<int>(reg_floor(position[0]));
+    previous[1] = static_cast<int>(reg_floor(position[1]));
+    previous[2] = static_cast<int>(reg_floor(position[2]));
+
+    relative[0]=position[0]-static_cast<double>(previous[0]);
+    relative[1]=position[1]-static_cast<double>(previous[1]);
+    relative[2]=position[2]-static_cast<double>(previous[2]);
+
+    (*kernelCompFctPtr)(relative[0], xBasis);
+    (*kernelCompFctPtr)(relative[1], yBasis);
+    (*kernelCompFctPtr)(relative[2], zBasis);
+    // The boundary checks are skipped when all the taps are within the floating image.
+    // The test is done before the offset is removed as undefined positions are cast to INT_MIN
+    bool floatingInside = previous[0]>=kernel_offset && previous[0]<floatingImage->nx-kernel_size+kernel_offset+1 &&
+            previous[1]>=kernel_offset && previous[1]<floatingImage->ny-kernel_size+kernel_offset+1 &&
+            previous[2]>=kernel_offset && previous[2]<floatingImage->nz-kernel_size+kernel_offset+1;
+    previous[0]-=kernel_offset;
+    previous[1]-=kernel_offset;
+    previous[2]-=kernel_offset;
+
+    psfIntensity=0.0;
+    if(floatingInside)
+    {
+        for(int c=0; c<kernel_size; c++)
+        {
+            zPointer = &floatingIntensity[(previous[2]+c)*floatingImage->nx*floatingImage->ny];
+            yTempNewValue=0.0;
+            for(int b=0; b<kernel_size; b++)
+            {
+                xyzPointer = &zPointer[(previous[1]+b)*floatingImage->nx+previous[0]];
+                xTempNewValue=0.0;
+                for(int a=0; a<kernel_size; a++)
+                    xTempNewValue +=  static_cast<double>(xyzPointer[a]) * xBasis[a];
+                yTempNewValue += xTempNewValue * yBasis[b];
+            }
+            psfIntensity += yTempNewValue * zBasis[c];
+        }
+        return psfIntensity;
+    }
+    for(int c=0; c<kernel_size; c++)
+    {
+        Z= previous[2]+c;
+        zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
+        yTempNewValue=0.0;
+        for(int b=0; b<kernel_size; b++)
+        {
+            Y= previous[1]+b;
+            xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
+            xTempNewValue=0.0;
+            for(int a=0; a<kernel_size; a++)
+            {
+                if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
+                        -1<Z && Z<floatingImage->nz &&
+                        -1<Y && Y<floatingImage->ny)
+                {
+                    xTempNewValue +=  static_cast<double>(*xyzPointer) * xBasis[a];
+                }
+                else
+                {
+                    // paddingValue
+                    if(!(paddingValue!=paddingValue))// paddingValue
+                        xTempNewValue +=  paddingValue * xBasis[a];
+                }
+                xyzPointer++;
+            }
+            yTempNewValue += xTempNewValue * yBasis[b];
+        }
+        psfIntensity += yTempNewValue * zBasis[c];
+    }
+    return psfIntensity;
+}
 /* *************************************************************** */
 /* *************************************************************** */
 template<class FloatingTYPE, class FieldTYPE>
@@ -1356,60 +3305,16 @@ void ResampleImage3D_PSF(nifti_image *floatingImage,
     if(floatingImage->sform_code>0)
         floatingIJKMatrix=&(floatingImage->sto_ijk);
     else floatingIJKMatrix=&(floatingImage->qto_ijk);
-    mat44 *warpedMatrix = &(warpedImage->qto_xyz);
-    if(warpedImage->sform_code>0)
-        warpedMatrix = &(warpedImage->sto_xyz);
-    mat44 *floatingMatrix = &(floatingImage->qto_xyz);
-    if(floatingImage->sform_code>0)
-        floatingMatrix = &(floatingImage->sto_xyz);
 
-    float fwhmToStd=2.355f;
     // T is the reference PSF and S is the floating PSF
     mat33 T, S;
-    for(int j=0; j<3; j++){
-        for(int i=0; i<3; i++){
-            T.m[i][j]=0;
-            S.m[i][j]=0;
-        }
-    }
-    for(int j=0; j<3; j++){
-        for(int i=0; i<3; i++){
-            T.m[j][j] += reg_pow2(warpedMatrix->m[i][j]);
-            S.m[j][j] += reg_pow2(floatingMatrix->m[i][j]);
-        }
-        T.m[j][j] = reg_pow2(sqrtf(T.m[j][j]) / fwhmToStd)/2.0f;
-        S.m[j][j] = reg_pow2(sqrtf(S.m[j][j]) / fwhmToStd)/2.0f;
-    }
+    reg_getPSFCovariances(floatingImage, warpedImage, &T, &S);
 
     // Define the kernel to use
     int kernel_size;
     int kernel_offset=0;
     void (*kernelCompFctPtr)(double,double *);
-    switch(kernel){
-    case 0:
-        reg_print_fct_error("ResampleImage3D_PSF");
-        reg_print_msg_error("Not implemented for NN interpolation yet");
-        reg_exit();
-        kernel_size=2;
-        kernelCompFctPtr=&interpNearestNeighKernel;
-        kernel_offset=0;
-        break; // nereast-neighboor interpolation
-    case 1:
-        kernel_size=2;
-        kernelCompFctPtr=&interpLinearKernel;
-        kernel_offset=0;
-        break; // linear interpolation
-    case 4:
-        kernel_size=SINC_KERNEL_SIZE;
-        kernelCompFctPtr=&interpWindowedSincKernel;
-        kernel_offset=SINC_KERNEL_RADIUS;
-        break; // sinc interpolation
-    default:
-        kernel_size=4;
-        kernelCompFctPtr=&interpCubicSplineKernel;
-        kernel_offset=1;
-        break; // cubic spline interpolation
-    }
+    reg_getPSFKernel(kernel, &kernel_size, &kernel_offset, &kernelCompFctPtr);
 
     // Iteration over the different volume along the 4th axis
     for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
@@ -1423,21 +3328,16 @@ void ResampleImage3D_PSF(nifti_image *floatingImage,
         FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
         FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
 
-        double xBasis[SINC_KERNEL_SIZE], yBasis[SINC_KERNEL_SIZE], zBasis[SINC_KERNEL_SIZE], relative[3];
-        int Y, Z, previous[3];
-
-        float psf_xyz[3];
+        float *psf_xyz, psfSamples[4*PSF_MAX_SAMPLE_NUMBER];
+        int psfSampleNumber;
 
-        mat33 P, invP, ASAt, A,TmS,TmS_EigVec,TmS_EigVec_trans,TmS_EigVal,TmS_EigVal_inv;
-        float currentDeterminant, psfKernelShift[3], psfSampleSpacing, psfWeightSum,curLambda;
-        float psfNumbSamples;
+        mat33 invP, TmS_EigVec, TmS_EigVal;
+        float currentDeterminant, psfWeightSum;
 
-        FloatingTYPE *zPointer, *xyzPointer;
-        double xTempNewValue, yTempNewValue, intensity, psfIntensity, psfWorld[3], position[3];
+        double intensity, psfIntensity;
         size_t currentA, currentB, currentC, currentAPre, currentBPre, currentCPre;
-        float  psf_eig[3],  mahal, psfWeight;
-        float currentARel, currentBRel, currentCRel, resamplingWeightSum, resamplingWeight;
-        size_t currentIndex;
+        float psfWeight;
+        float currentARel, currentBRel, currentCRel;
 
         for(index=0; index<warpedVoxelNumber; index++)
         {
@@ -1445,325 +3345,590 @@ void ResampleImage3D_PSF(nifti_image *floatingImage,
 
             if((maskPtr[index])>-1)
             {
-                if(algorithm==0){
-
-                    // T=P+A*S*At
-                    A=nifti_mat33_inverse(jacMat[index]);
-
-                    ASAt = A * S * reg_mat33_trans(A);
+                reg_getPSFShape(&jacMat[index], &T, &S, algorithm,
+                                &TmS_EigVec, &TmS_EigVal, &invP, &currentDeterminant);
+                psfSampleNumber = reg_getPSFSamples(&TmS_EigVec, &TmS_EigVal, &invP,
+                                                    currentDeterminant, psfSamples);
 
-                    TmS = T - ASAt;
-                    //reg_mat33_disp(&TmS, "matTmS");
+                // Get image coordinates of the centre
+                currentC=index/warpedPlaneNumber;
+                currentB=(index-currentC*warpedPlaneNumber)/warpedLineNumber;
+                currentA=(index-currentB*warpedLineNumber-currentC*warpedPlaneNumber);
 
-                    reg_mat33_diagonalize(&TmS, &TmS_EigVec, &TmS_EigVal);
+                //initialise weights
+                psfWeightSum=0.0f;
+                intensity=0.0f;
 
-                    // If eigen values are less than 0, set them to 0.
-                    // Also, invert the eigenvalues to estimate the inverse.
-                    for(int m=0;m<3;m++){
-                        for(int n=0;n<3;n++){
-                            if(m==n){ // Set diagonals to max(val,0)
-                                TmS_EigVal.m[m][n]=TmS_EigVal.m[m][n]>0.000001f?TmS_EigVal.m[m][n]:0.000001f;
-                                TmS_EigVal_inv.m[m][n]=1.0f/TmS_EigVal.m[m][n];
-                            }else{ // Set off-diagonal residuals to 0
-                                TmS_EigVal.m[m][n]=0;
-                                TmS_EigVal_inv.m[m][n]=0;
-                            }
-                        }
+                for(int s=0; s<psfSampleNumber; ++s)
+                {
+                    psf_xyz = &psfSamples[4*s];
+                    psfWeight = psfSamples[4*s+3];
+
+                    // Interpolate (trilinearly) the deformation field for non-integer positions
+                    currentAPre=(size_t)(currentA+(size_t)reg_floor(psf_xyz[0]/(float)warpedImage->pixdim[1]));
+                    currentARel=(float)currentA+(float)(psf_xyz[0]/(float)warpedImage->pixdim[1])-(float)(currentAPre);
+
+                    currentBPre=(size_t)(currentB+(size_t)reg_floor(psf_xyz[1]/(float)warpedImage->pixdim[2]));
+                    currentBRel=(float)currentB+(float)(psf_xyz[1]/(float)warpedImage->pixdim[2])-(float)(currentBPre);
+
+                    currentCPre=(size_t)(currentC+(size_t)reg_floor(psf_xyz[2]/(float)warpedImage->pixdim[3]));
+                    currentCRel=(float)currentC+(float)(psf_xyz[2]/(float)warpedImage->pixdim[3])-(float)(currentCPre);
+
+                    psfIntensity = reg_getPSFSampleIntensity<FloatingTYPE,FieldTYPE>
+                            (floatingImage, floatingIntensity, warpedImage,
+                             deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ,
+                             floatingIJKMatrix, kernelCompFctPtr, kernel_size, kernel_offset,
+                             paddingValue, currentAPre, currentBPre, currentCPre,
+                             currentARel, currentBRel, currentCRel);
+                    if(!(psfIntensity!=psfIntensity)){
+                        intensity+=psfWeight*psfIntensity;
+                        psfWeightSum+=psfWeight;
                     }
-
-                    TmS_EigVec_trans=reg_mat33_trans(TmS_EigVec);
-                    P= TmS_EigVec * TmS_EigVal * TmS_EigVec_trans;
-                    invP= TmS_EigVec * TmS_EigVal_inv * TmS_EigVec_trans;
-                    currentDeterminant = TmS_EigVal.m[0][0]*TmS_EigVal.m[1][1]*TmS_EigVal.m[2][2];
-                    currentDeterminant=currentDeterminant<0.000001f?0.000001f:currentDeterminant;
+                }
+                if(psfWeightSum>0){
+                    intensity/=psfWeightSum;
                 }
                 else{
+                    intensity=paddingValue;
+                }
+            } // if in mask
+            warpedIntensity[index]=reg_castResampledIntensity<FloatingTYPE>(intensity, floatingImage->datatype);
+        }
+    }
+}
 
-                    A=nifti_mat33_inverse(jacMat[index]);
-
-                    ASAt =  A * S * reg_mat33_trans(A);
-
-                    mat33 S_EigVec, S_EigVal;
-
-                    //                % rotate S
-                    //                [ZS, DS] = eig(S);
-                    reg_mat33_diagonalize(&ASAt, &S_EigVec, &S_EigVal);
-
-                    //                T1 = ZS'*T*ZS;
-                    mat33 T1 = reg_mat33_trans(S_EigVec) * T * S_EigVec;
-
-                    //                % Volume-preserving scale of S to make it isotropic
-                    //                detS = prod(diag(DS));
-                    float detASAt = S_EigVal.m[0][0]*S_EigVal.m[1][1]*S_EigVal.m[2][2];
+/* *************************************************************** */
+/** Structure holding a PSF sample whose position within the warped grid
+ * has been split into the lower corner used for the trilinear
+ * interpolation of the deformation field and the relative position.
+ */
+struct _reg_psfSample
+{
+    int shift[3];
+    float relative[3];
+    float weight;
+};
+/* *************************************************************** */
+void reg_getPSFSampleOffsets(float *psfSamples,
+                             int sampleNumber,
+                             nifti_image *warpedImage,
+                             _reg_psfSample *samples)
+{
+    float offset;
+    for(int s=0; s<sampleNumber; ++s)
+    {
+        for(int i=0; i<3; ++i)
+        {
+            offset = psfSamples[4*s+i]/(float)warpedImage->pixdim[i+1];
+            samples[s].shift[i] = static_cast<int>(reg_floor(offset));
+            samples[s].relative[i] = offset-static_cast<float>(samples[s].shift[i]);
+        }
+        samples[s].weight = psfSamples[4*s+3];
+    }
+}
+/* *************************************************************** */
+/** When the deformation field is affine, the PSF samples correspond to
+ * constant offsets in the floating voxel space. If the covariance of
+ * these offsets is aligned with the floating axes, the PSF is applied
+ * as three 1D convolutions of the floating image which is then resampled
+ * using a standard interpolation. The smoothed image is extended by the
+ * kernel radius so that positions close to the floating image border
+ * still gather the intensities of the neighbouring voxels. The function
+ * returns false when the covariance is not separable.
+ */
+template<class FloatingTYPE, class FieldTYPE>
+bool ResampleImage3D_PSF_Separable(nifti_image *floatingImage,
+                                   nifti_image *warpedImage,
+                                   nifti_image *deformationField,
+                                   int *mask,
+                                   FieldTYPE paddingValue,
+                                   int kernel,
+                                   mat33 *warpedToFloating,
+                                   _reg_psfSample *samples,
+                                   int sampleNumber)
+{
+    // Covariance of the PSF samples expressed in the floating voxel space
+    double covariance[3][3], weightSum=0, offset[3], warpedOffset[3];
+    for(int i=0; i<3; ++i)
+        for(int j=0; j<3; ++j)
+            covariance[i][j]=0;
+    for(int s=0; s<sampleNumber; ++s)
+    {
+        for(int i=0; i<3; ++i)
+            warpedOffset[i]=static_cast<double>(samples[s].shift[i]) +
+                    static_cast<double>(samples[s].relative[i]);
+        for(int i=0; i<3; ++i)
+            offset[i] = warpedToFloating->m[i][0]*warpedOffset[0] +
+                    warpedToFloating->m[i][1]*warpedOffset[1] +
+                    warpedToFloating->m[i][2]*warpedOffset[2];
+        for(int i=0; i<3; ++i)
+            for(int j=0; j<3; ++j)
+                covariance[i][j] += samples[s].weight * offset[i] * offset[j];
+        weightSum += samples[s].weight;
+    }
+    if(weightSum<=0) return false;
+    for(int i=0; i<3; ++i)
+        for(int j=0; j<3; ++j)
+            covariance[i][j] /= weightSum;
+    for(int i=0; i<3; ++i)
+        for(int j=i+1; j<3; ++j)
+            if(fabs(covariance[i][j]) > PSF_SEPARABLE_CORRELATION *
+                    sqrt(covariance[i][i]*covariance[j][j]))
+                return false;
 
-                    //                factDetS = detS^(1/4);
-                    float factDetS=powf(detASAt,0.25);
+#ifndef NDEBUG
+    char text[255];
+    sprintf(text, "Separable PSF variances in floating voxels: %g %g %g",
+            covariance[0][0], covariance[1][1], covariance[2][2]);
+    reg_print_msg_debug(text);
+#endif
 
-                    //                LambdaN = factDetS*diag(diag(DS).^(-1/2));
-                    //                invLambdaN = diag(1./diag(LambdaN))
-                    mat33 LambdaN,invLambdaN;
-                    for(int m=0;m<3;m++){
-                        for(int n=0;n<3;n++){
-                            if(m==n){
-                                LambdaN.m[m][n]=factDetS*powf(S_EigVal.m[m][n],-0.5);
-                                invLambdaN.m[m][n]=1.0f/LambdaN.m[m][n];
-                            }else{ // Set off-diagonal to 0
-                                LambdaN.m[m][n]=0;
-                                invLambdaN.m[m][n]=0;
-                            }
-                        }
-                    }
+    // One discrete kernel is defined per axis. Small variances are matched
+    // exactly using a three-tap kernel
+    int radius[3];
+    double *kernels[3];
+    for(int i=0; i<3; ++i)
+    {
+        double variance = covariance[i][i];
+        if(variance<1.e-4) radius[i]=0;
+        else if(variance<0.36) radius[i]=1;
+        else radius[i]=static_cast<int>(ceil(3.0*sqrt(variance)));
+        kernels[i]=(double *)malloc((2*radius[i]+1)*sizeof(double));
+        if(radius[i]==0)
+            kernels[i][0]=1.0;
+        else if(radius[i]==1 && variance<0.36)
+        {
+            kernels[i][0]=kernels[i][2]=variance/2.0;
+            kernels[i][1]=1.0-variance;
+        }
+        else
+        {
+            double kernelSum=0;
+            for(int k=-radius[i]; k<=radius[i]; ++k)
+            {
+                kernels[i][k+radius[i]]=exp(-0.5*static_cast<double>(k*k)/variance);
+                kernelSum += kernels[i][k+radius[i]];
+            }
+            for(int k=0; k<2*radius[i]+1; ++k)
+                kernels[i][k] /= kernelSum;
+        }
+    }
 
-                    //                T2 = LambdaN*T1*LambdaN';
-                    mat33 T2 = LambdaN * T1 * reg_mat33_trans(LambdaN);
+    // The padding is used outside of the floating image as in the exact PSF.
+    // A NaN padding is replaced by zero: the exact PSF also ignores the NaN
+    // padded taps, the warped voxels whose PSF falls outside of the floating
+    // image are then set to zero and not to NaN. Only the voxels outside of
+    // the mask receive the padding value
+    double padding = paddingValue==paddingValue?static_cast<double>(paddingValue):0.0;
+
+    // Single volume images used to smooth and resample every time point
+    nifti_image *smoothedImage = nifti_copy_nim_info(floatingImage);
+    smoothedImage->dim[0]=smoothedImage->ndim=3;
+    smoothedImage->dim[1]=smoothedImage->nx=floatingImage->nx+2*radius[0];
+    smoothedImage->dim[2]=smoothedImage->ny=floatingImage->ny+2*radius[1];
+    smoothedImage->dim[3]=smoothedImage->nz=floatingImage->nz+2*radius[2];
+    smoothedImage->dim[4]=smoothedImage->nt=1;
+    smoothedImage->dim[5]=smoothedImage->nu=1;
+    smoothedImage->nvox=(size_t)smoothedImage->nx*smoothedImage->ny*smoothedImage->nz;
+    smoothedImage->datatype=NIFTI_TYPE_FLOAT64;
+    smoothedImage->nbyper=sizeof(double);
+    smoothedImage->data=(void *)malloc(smoothedImage->nvox*smoothedImage->nbyper);
+    // Only the real to voxel matrix is used for resampling
+    mat44 smoothedIJKMatrix = floatingImage->sform_code>0?floatingImage->sto_ijk:floatingImage->qto_ijk;
+    for(int i=0; i<3; ++i)
+        smoothedIJKMatrix.m[i][3] += static_cast<float>(radius[i]);
+    smoothedImage->sto_ijk = smoothedImage->qto_ijk = smoothedIJKMatrix;
+    nifti_image *resampledImage = nifti_copy_nim_info(warpedImage);
+    resampledImage->dim[0]=resampledImage->ndim=3;
+    resampledImage->dim[4]=resampledImage->nt=1;
+    resampledImage->dim[5]=resampledImage->nu=1;
+    resampledImage->nvox=(size_t)resampledImage->nx*resampledImage->ny*resampledImage->nz;
+    resampledImage->datatype=NIFTI_TYPE_FLOAT64;
+    resampledImage->nbyper=sizeof(double);
+    resampledImage->data=(void *)malloc(resampledImage->nvox*resampledImage->nbyper);
+
+    const int floatingDim[3]={floatingImage->nx, floatingImage->ny, floatingImage->nz};
+    const size_t floatingVoxelNumber = (size_t)floatingDim[0]*floatingDim[1]*floatingDim[2];
+    const int smoothedDim[3]={smoothedImage->nx, smoothedImage->ny, smoothedImage->nz};
+    const size_t smoothedStride[3]={1, (size_t)smoothedDim[0], (size_t)smoothedDim[0]*smoothedDim[1]};
+    const size_t warpedVoxelNumber = resampledImage->nvox;
+    int maxDim = smoothedDim[0]>smoothedDim[1]?smoothedDim[0]:smoothedDim[1];
+    maxDim = maxDim>smoothedDim[2]?maxDim:smoothedDim[2];
+    double *lineBuffer = (double *)malloc(maxDim*sizeof(double));
 
-                    //                % Rotate to make thing axis-aligned
-                    //                [ZT2, DT2] = eig(T2);
-                    mat33 T2_EigVec, T2_EigVal;
-                    reg_mat33_diagonalize(&T2, &T2_EigVec, &T2_EigVal);
+    FloatingTYPE *floatingIntensityPtr = static_cast<FloatingTYPE *>(floatingImage->data);
+    FloatingTYPE *warpedIntensityPtr = static_cast<FloatingTYPE *>(warpedImage->data);
+    double *smoothedPtr = static_cast<double *>(smoothedImage->data);
+    double *resampledPtr = static_cast<double *>(resampledImage->data);
 
-                    //                % Optimal solution in the transformed axis-aligned space
-                    //                DP2 = diag(max(sqrt(detS),diag(DT2)));
-                    mat33 DP2;
-                    for(int m=0;m<3;m++){
-                        for(int n=0;n<3;n++){
-                            if(m==n){
-                                DP2.m[m][n]= powf(factDetS,0.5)>(T2_EigVal.m[m][n])?powf(factDetS,0.5):(T2_EigVal.m[m][n]);
-                            }else{ // Set off-diagonal to 0
-                                DP2.m[m][n]=0;
-                            }
+    for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
+    {
+        FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
+        FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
+        for(size_t i=0; i<smoothedImage->nvox; ++i)
+            smoothedPtr[i]=padding;
+        size_t floatingIndex=0;
+        for(int z=0; z<floatingDim[2]; ++z)
+            for(int y=0; y<floatingDim[1]; ++y)
+                for(int x=0; x<floatingDim[0]; ++x)
+                    smoothedPtr[(x+radius[0])*smoothedStride[0] +
+                            (y+radius[1])*smoothedStride[1] +
+                            (z+radius[2])*smoothedStride[2]] =
+                            static_cast<double>(floatingIntensity[floatingIndex++]);
+
+        // Separable convolution along every axis
+        for(int axis=0; axis<3; ++axis)
+        {
+            if(radius[axis]==0) continue;
+            // Iteration over all the lines along the current axis
+            int other1 = axis==0?1:0;
+            int other2 = axis==2?1:2;
+            for(int j=0; j<smoothedDim[other2]; ++j)
+            {
+                for(int i=0; i<smoothedDim[other1]; ++i)
+                {
+                    double *linePtr = &smoothedPtr[i*smoothedStride[other1] +
+                            j*smoothedStride[other2]];
+                    for(int x=0; x<smoothedDim[axis]; ++x)
+                        lineBuffer[x]=linePtr[x*smoothedStride[axis]];
+                    for(int x=0; x<smoothedDim[axis]; ++x)
+                    {
+                        double value=0;
+                        for(int k=-radius[axis]; k<=radius[axis]; ++k)
+                        {
+                            int X=x+k;
+                            if(-1<X && X<smoothedDim[axis])
+                                value += kernels[axis][k+radius[axis]] * lineBuffer[X];
+                            else value += kernels[axis][k+radius[axis]] * padding;
                         }
+                        linePtr[x*smoothedStride[axis]]=value;
                     }
+                }
+            }
+        }
 
-                    //                % Roll back the transforms
-                    //                Q = ZS*invLambdaN*ZT2*DQ2*ZT2'*invLambdaN*ZS'
-                    mat33 Q = S_EigVec * invLambdaN * T2_EigVec * DP2 * reg_mat33_trans(T2_EigVec) * invLambdaN * reg_mat33_trans(S_EigVec);
-                    //                P=Q-S
-                    TmS = Q - S;
-                    invP=nifti_mat33_inverse(TmS);
-                    reg_mat33_diagonalize(&TmS, &TmS_EigVec, &TmS_EigVal);
+        // The smoothed image is resampled using the standard interpolation
+        ResampleImage<double,FieldTYPE>(smoothedImage,
+                                        deformationField,
+                                        resampledImage,
+                                        mask,
+                                        static_cast<FieldTYPE>(padding),
+                                        kernel);
+        for(size_t index=0; index<warpedVoxelNumber; ++index)
+        {
+            warpedIntensity[index]=reg_castResampledIntensity<FloatingTYPE>
+                    (mask[index]>-1?resampledPtr[index]:static_cast<double>(paddingValue),
+                     floatingImage->datatype);
+        }
+    }
+    free(lineBuffer);
+    for(int i=0; i<3; ++i)
+        free(kernels[i]);
+    nifti_image_free(smoothedImage);
+    nifti_image_free(resampledImage);
+    return true;
+}
+/* *************************************************************** */
+/** Returns true if the deformation field is an affine function of the
+ * voxel coordinates. The linear part of the mapping from warped voxel to
+ * floating voxel coordinates is then returned.
+ */
+template<class FieldTYPE>
+bool reg_isPSFDeformationAffine(nifti_image *deformationField,
+                                mat44 *floatingIJKMatrix,
+                                mat33 *warpedToFloating)
+{
+    const int dim[3]={deformationField->nx, deformationField->ny, deformationField->nz};
+    const size_t voxelNumber=(size_t)dim[0]*dim[1]*dim[2];
+    FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
+    FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[voxelNumber];
+    FieldTYPE *deformationFieldPtrZ = &deformationFieldPtrY[voxelNumber];
+
+    // The floating voxel position of the first voxel and the gradient along
+    // each axis are extracted from the field
+    double world[3], origin[3], position[3];
+    size_t cornerIndex[3]={(size_t)dim[0]-1, (size_t)dim[0]*(dim[1]-1),
+                           (size_t)dim[0]*dim[1]*(dim[2]-1)};
+    world[0]=deformationFieldPtrX[0];
+    world[1]=deformationFieldPtrY[0];
+    world[2]=deformationFieldPtrZ[0];
+    reg_mat44_mul(floatingIJKMatrix, world, origin);
+    for(int d=0; d<3; ++d)
+    {
+        if(dim[d]<2) return false;
+        world[0]=deformationFieldPtrX[cornerIndex[d]];
+        world[1]=deformationFieldPtrY[cornerIndex[d]];
+        world[2]=deformationFieldPtrZ[cornerIndex[d]];
+        reg_mat44_mul(floatingIJKMatrix, world, position);
+        for(int i=0; i<3; ++i)
+            warpedToFloating->m[i][d]=static_cast<float>((position[i]-origin[i])/(double)(dim[d]-1));
+    }
 
-                    currentDeterminant = TmS_EigVal.m[0][0]*TmS_EigVal.m[1][1]*TmS_EigVal.m[2][2];
-                    currentDeterminant=currentDeterminant<0.000001f?0.000001f:currentDeterminant;
+    // Every voxel is checked against the affine prediction
+    size_t index=0;
+    for(int z=0; z<dim[2]; ++z)
+    {
+        for(int y=0; y<dim[1]; ++y)
+        {
+            for(int x=0; x<dim[0]; ++x)
+            {
+                world[0]=deformationFieldPtrX[index];
+                world[1]=deformationFieldPtrY[index];
+                world[2]=deformationFieldPtrZ[index];
+                reg_mat44_mul(floatingIJKMatrix, world, position);
+                for(int i=0; i<3; ++i)
+                {
+                    double predicted = origin[i] +
+                            warpedToFloating->m[i][0]*(double)x +
+                            warpedToFloating->m[i][1]*(double)y +
+                            warpedToFloating->m[i][2]*(double)z;
+                    if(fabs(predicted-position[i])>PSF_AFFINE_TOLERANCE)
+                        return false;
                 }
+                ++index;
+            }
+        }
+    }
+    return true;
+}
+/* *************************************************************** */
+/** PSF resampling where the samples are computed once per distinct
+ * quantised Jacobian matrix and stored in a cache. When the
+ * transformation is affine and the PSF is aligned with the floating
+ * axes, the PSF is applied separably.
+ */
+template<class FloatingTYPE, class FieldTYPE>
+void ResampleImage3D_PSF_Cached(nifti_image *floatingImage,
+                                nifti_image *deformationField,
+                                nifti_image *warpedImage,
+                                int *mask,
+                                FieldTYPE paddingValue,
+                                int kernel,
+                                mat33 * jacMat,
+                                char algorithm)
+{
+#ifdef _WIN32
+    long index;
+    long warpedVoxelNumber = (long)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    long floatingVoxelNumber = (long)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+#else
+    size_t index;
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx*floatingImage->ny*floatingImage->nz;
+#endif
+    FloatingTYPE *floatingIntensityPtr = static_cast<FloatingTYPE *>(floatingImage->data);
+    FloatingTYPE *warpedIntensityPtr = static_cast<FloatingTYPE *>(warpedImage->data);
+    FieldTYPE *deformationFieldPtrX = static_cast<FieldTYPE *>(deformationField->data);
+    FieldTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
+    FieldTYPE *deformationFieldPtrZ = &deformationFieldPtrY[warpedVoxelNumber];
+    const size_t warpedPlaneNumber = (size_t)warpedImage->nx*warpedImage->ny;
+    const size_t warpedLineNumber = (size_t)warpedImage->nx;
+    const int datatype = floatingImage->datatype;
 
-                // set sampling rate
-                psfNumbSamples=3; // in standard deviations mm
-                psfSampleSpacing=0.75; // in standard deviations mm
-                psfKernelShift[0]=TmS_EigVal.m[0][0]<0.01f?0.0f:(float)(psfNumbSamples)*psfSampleSpacing;
-                psfKernelShift[1]=TmS_EigVal.m[1][1]<0.01f?0.0f:(float)(psfNumbSamples)*psfSampleSpacing;
-                psfKernelShift[2]=TmS_EigVal.m[2][2]<0.01f?0.0f:(float)(psfNumbSamples)*psfSampleSpacing;
+    int *maskPtr = &mask[0];
 
-                // Get image coordinates of the centre
-                currentC=index/warpedPlaneNumber;
-                currentB=(index-currentC*warpedPlaneNumber)/warpedLineNumber;
-                currentA=(index-currentB*warpedLineNumber-currentC*warpedPlaneNumber);
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
 
-                //initialise weights
-                psfWeightSum=0.0f;
-                intensity=0.0f;
+    // T is the reference PSF and S is the floating PSF
+    mat33 T, S;
+    reg_getPSFCovariances(floatingImage, warpedImage, &T, &S);
 
-                // coordinates in eigen space
-                for(psf_eig[0]=-psfKernelShift[0];psf_eig[0]<=(psfKernelShift[0]); psf_eig[0]+=psfSampleSpacing)
+    // Define the kernel to use
+    int kernel_size;
+    int kernel_offset=0;
+    void (*kernelCompFctPtr)(double,double *);
+    reg_getPSFKernel(kernel, &kernel_size, &kernel_offset, &kernelCompFctPtr);
+
+    // The quantised Jacobian matrices are used as keys of the sample cache
+    std::map<std::vector<int>, int> cacheKeys;
+    std::vector<int> key(9), previousKey(9, 0);
+    std::vector<_reg_psfSample> cacheSamples;
+    std::vector<int> cacheStart;
+    std::vector<int> cacheSize;
+    int *voxelEntry = (int *)malloc(warpedVoxelNumber*sizeof(int));
+    int previousEntry=-1;
+    float psfSamples[4*PSF_MAX_SAMPLE_NUMBER];
+    _reg_psfSample entrySamples[PSF_MAX_SAMPLE_NUMBER];
+    mat33 quantisedJacobian, invP, TmS_EigVec, TmS_EigVal;
+    float currentDeterminant;
+    for(index=0; index<warpedVoxelNumber; index++)
+    {
+        voxelEntry[index]=-1;
+        if(maskPtr[index]<0) continue;
+        for(int i=0; i<3; ++i)
+            for(int j=0; j<3; ++j)
+                key[3*i+j]=static_cast<int>(reg_round(jacMat[index].m[i][j]/PSF_JACOBIAN_QUANTISATION));
+        // Neighbouring voxels often share the same entry
+        if(previousEntry>-1 && key==previousKey)
+        {
+            voxelEntry[index]=previousEntry;
+            continue;
+        }
+        std::map<std::vector<int>, int>::iterator it = cacheKeys.find(key);
+        if(it!=cacheKeys.end())
+            voxelEntry[index]=it->second;
+        else if(cacheKeys.size()<PSF_CACHE_MAX_ENTRY_NUMBER)
+        {
+            for(int i=0; i<3; ++i)
+                for(int j=0; j<3; ++j)
+                    quantisedJacobian.m[i][j]=static_cast<float>(key[3*i+j])*PSF_JACOBIAN_QUANTISATION;
+            reg_getPSFShape(&quantisedJacobian, &T, &S, algorithm,
+                            &TmS_EigVec, &TmS_EigVal, &invP, &currentDeterminant);
+            int sampleNumber = reg_getPSFSamples(&TmS_EigVec, &TmS_EigVal, &invP,
+                                                 currentDeterminant, psfSamples);
+            reg_getPSFSampleOffsets(psfSamples, sampleNumber, warpedImage, entrySamples);
+            voxelEntry[index]=cacheStart.size();
+            cacheKeys[key]=voxelEntry[index];
+            cacheStart.push_back(cacheSamples.size());
+            cacheSize.push_back(sampleNumber);
+            cacheSamples.insert(cacheSamples.end(), entrySamples, entrySamples+sampleNumber);
+        }
+        // The samples of voxels that do not fit in the cache are computed on the fly
+        previousKey=key;
+        previousEntry=voxelEntry[index];
+    }
+#ifndef NDEBUG
+    char text[255];
+    sprintf(text, "PSF cache: %zu entries for %zu samples", cacheStart.size(), cacheSamples.size());
+    reg_print_msg_debug(text);
+#endif
+
+    // The separable implementation is used when the transformation is affine.
+    // Close to the warped image border, the PSF samples fall outside of the
+    // deformation field and are handled voxel-wise as in the exact PSF
+    mat33 warpedToFloating;
+    if(cacheStart.size()>0 &&
+            reg_isPSFDeformationAffine<FieldTYPE>(deformationField, floatingIJKMatrix, &warpedToFloating))
+    {
+        int entry=-1;
+        for(index=0; index<warpedVoxelNumber && entry<0; index++)
+            entry=voxelEntry[index];
+        if(ResampleImage3D_PSF_Separable<FloatingTYPE,FieldTYPE>(floatingImage,
+                                                                warpedImage,
+                                                                deformationField,
+                                                                mask,
+                                                                paddingValue,
+                                                                kernel,
+                                                                &warpedToFloating,
+                                                                &cacheSamples[cacheStart[entry]],
+                                                                cacheSize[entry]))
+        {
+            int minShift[3]={0,0,0}, maxShift[3]={0,0,0};
+            for(int s=cacheStart[entry]; s<cacheStart[entry]+cacheSize[entry]; ++s)
+            {
+                for(int i=0; i<3; ++i)
                 {
-                    for(psf_eig[1]=-psfKernelShift[1];psf_eig[1]<=(psfKernelShift[1]); psf_eig[1]+=psfSampleSpacing)
-                    {
-                        for(psf_eig[2]=-psfKernelShift[2];psf_eig[2]<=(psfKernelShift[2]); psf_eig[2]+=psfSampleSpacing)
-                        {
-                            // Distance threshold (only interpolate if distance is below 3 std)
-                            if(sqrtf(psf_eig[0]*psf_eig[0]+psf_eig[1]*psf_eig[1]+psf_eig[2]*psf_eig[2])<=3){
-                                // Use the Eigen coordinates and convert them to XYZ
-                                // The new lambda per coordinate is eige_coordinate*sqrt(eigenVal)
-                                // as the sqrt(eigenVal) is equivalent to the STD
-                                psf_xyz[0]=0;
-                                psf_xyz[1]=0;
-                                psf_xyz[2]=0;
-                                for(int m=0;m<3;m++){
-                                    curLambda=(float)(psf_eig[m])*sqrt(TmS_EigVal.m[m][m]);
-                                    psf_xyz[0]+=curLambda*TmS_EigVec.m[0][m];
-                                    psf_xyz[1]+=curLambda*TmS_EigVec.m[1][m];
-                                    psf_xyz[2]+=curLambda*TmS_EigVec.m[2][m];
-                                }
+                    minShift[i]=minShift[i]<cacheSamples[s].shift[i]?minShift[i]:cacheSamples[s].shift[i];
+                    maxShift[i]=maxShift[i]>cacheSamples[s].shift[i]+1?maxShift[i]:cacheSamples[s].shift[i]+1;
+                }
+            }
+            index=0;
+            for(int z=0; z<warpedImage->nz; ++z)
+                for(int y=0; y<warpedImage->ny; ++y)
+                    for(int x=0; x<warpedImage->nx; ++x, ++index)
+                        if(x+minShift[0]>=0 && x+maxShift[0]<warpedImage->nx &&
+                                y+minShift[1]>=0 && y+maxShift[1]<warpedImage->ny &&
+                                z+minShift[2]>=0 && z+maxShift[2]<warpedImage->nz)
+                            voxelEntry[index]=PSF_SEPARABLE_VOXEL;
+        }
+    }
 
-                                //mahal=0;
-                                mahal=psf_xyz[0]*invP.m[0][0]*psf_xyz[0]+
-                                        psf_xyz[0]*invP.m[1][0]*psf_xyz[1]+
-                                        psf_xyz[0]*invP.m[2][0]*psf_xyz[2]+
-                                        psf_xyz[1]*invP.m[0][1]*psf_xyz[0]+
-                                        psf_xyz[1]*invP.m[1][1]*psf_xyz[1]+
-                                        psf_xyz[1]*invP.m[2][1]*psf_xyz[2]+
-                                        psf_xyz[2]*invP.m[0][2]*psf_xyz[0]+
-                                        psf_xyz[2]*invP.m[1][2]*psf_xyz[1]+
-                                        psf_xyz[2]*invP.m[2][2]*psf_xyz[2];
-
-                                psfWeight=powf(2.f*M_PI,-3.f/2.f)*
-                                        pow(currentDeterminant,-0.5f)*
-                                        expf(-0.5f*mahal);
-
-                                if(psfWeight!=0.f){ // If the relative weight is above 0
-                                    // Interpolate (trilinearly) the deformation field for non-integer positions
-                                    currentAPre=(size_t)(currentA+(size_t)reg_floor(psf_xyz[0]/(float)warpedImage->pixdim[1]));
-                                    currentARel=(float)currentA+(float)(psf_xyz[0]/(float)warpedImage->pixdim[1])-(float)(currentAPre);
-
-                                    currentBPre=(size_t)(currentB+(size_t)reg_floor(psf_xyz[1]/(float)warpedImage->pixdim[2]));
-                                    currentBRel=(float)currentB+(float)(psf_xyz[1]/(float)warpedImage->pixdim[2])-(float)(currentBPre);
-
-                                    currentCPre=(size_t)(currentC+(size_t)reg_floor(psf_xyz[2]/(float)warpedImage->pixdim[3]));
-                                    currentCRel=(float)currentC+(float)(psf_xyz[2]/(float)warpedImage->pixdim[3])-(float)(currentCPre);
-
-                                    // Interpolate the PSF world coordinates
-                                    psfWorld[0]=0.0f;
-                                    psfWorld[1]=0.0f;
-                                    psfWorld[2]=0.0f;
-                                    resamplingWeightSum=0.0f;
-                                    for (int a=0;a<=1;a++){
-                                        for (int b=0;b<=1;b++){
-                                            for (int c=0;c<=1;c++){
-
-                                                if(((int)currentAPre+a)>=0
-                                                        && ((int)currentBPre+b)>=0
-                                                        && ((int)currentCPre+c)>=0
-                                                        && ((int)currentAPre+a)<warpedImage->nx
-                                                        && ((int)currentBPre+b)<warpedImage->ny
-                                                        && ((int)currentCPre+c)<warpedImage->nz){
-
-                                                    currentIndex=((size_t)currentAPre+(size_t)a)+
-                                                            ((size_t)currentBPre+(size_t)b)*warpedLineNumber+
-                                                            ((size_t)currentCPre+(size_t)c)*warpedPlaneNumber;
-
-                                                    resamplingWeight=fabs((float)(1-a)-currentARel)*
-                                                            fabs((float)(1-b)-currentBRel)*
-                                                            fabs((float)(1-c)-currentCRel);
-
-                                                    resamplingWeightSum+=resamplingWeight;
-
-                                                    psfWorld[0]+=static_cast<double>(resamplingWeight*deformationFieldPtrX[currentIndex]);
-                                                    psfWorld[1]+=static_cast<double>(resamplingWeight*deformationFieldPtrY[currentIndex]);
-                                                    psfWorld[2]+=static_cast<double>(resamplingWeight*deformationFieldPtrZ[currentIndex]);
-                                                }
-                                            }
-                                        }
-                                    }
+    // Empty vectors are padded so that their data can be shared
+    if(cacheSamples.size()==0)
+    {
+        cacheSamples.resize(1);
+        cacheStart.push_back(0);
+        cacheSize.push_back(0);
+    }
+    _reg_psfSample *cacheSamplesPtr = &cacheSamples[0];
+    int *cacheStartPtr = &cacheStart[0];
+    int *cacheSizePtr = &cacheSize[0];
 
-                                    if(resamplingWeightSum>0.0f){
-                                        psfWorld[0]/=resamplingWeightSum;
-                                        psfWorld[1]/=resamplingWeightSum;
-                                        psfWorld[2]/=resamplingWeightSum;
+    // Iteration over the different volume along the 4th axis
+    for(size_t t=0; t<(size_t)warpedImage->nt*warpedImage->nu; t++)
+    {
+#ifndef NDEBUG
+        sprintf(text,"Cached PSF 3D resampling of volume number %zu",t);
+        reg_print_msg_debug(text);
+#endif
+        FloatingTYPE *warpedIntensity = &warpedIntensityPtr[t*warpedVoxelNumber];
+        FloatingTYPE *floatingIntensity = &floatingIntensityPtr[t*floatingVoxelNumber];
 
-                                        // real -> voxel; floating space
-                                        reg_mat44_mul(floatingIJKMatrix, psfWorld, position);
+        double intensity, psfIntensity, psfWeightSum;
+        size_t currentA, currentB, currentC;
+        int sampleNumber;
+        _reg_psfSample *samples;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(index, intensity, psfIntensity, psfWeightSum, currentA, currentB, currentC, \
+    sampleNumber, samples, psfSamples, entrySamples, invP, TmS_EigVec, TmS_EigVal, currentDeterminant) \
+    shared(floatingImage, warpedImage, floatingIntensity, warpedIntensity, warpedVoxelNumber, \
+    warpedPlaneNumber, warpedLineNumber, deformationFieldPtrX, deformationFieldPtrY, \
+    deformationFieldPtrZ, floatingIJKMatrix, kernelCompFctPtr, kernel_size, kernel_offset, \
+    paddingValue, maskPtr, voxelEntry, cacheSamplesPtr, cacheStartPtr, cacheSizePtr, \
+    jacMat, T, S, algorithm, datatype)
+#endif // _OPENMP
+        for(index=0; index<warpedVoxelNumber; index++)
+        {
+            // The voxel has already been resampled separably
+            if(voxelEntry[index]==PSF_SEPARABLE_VOXEL) continue;
 
-                                        previous[0] = static_cast<int>(reg_floor(position[0]));
-                                        previous[1] = static_cast<int>(reg_floor(position[1]));
-                                        previous[2] = static_cast<int>(reg_floor(position[2]));
+            intensity=paddingValue;
 
-                                        relative[0]=position[0]-static_cast<double>(previous[0]);
-                                        relative[1]=position[1]-static_cast<double>(previous[1]);
-                                        relative[2]=position[2]-static_cast<double>(previous[2]);
+            if(maskPtr[index]>-1)
+            {
+                if(voxelEntry[index]>-1)
+                {
+                    samples = &cacheSamplesPtr[cacheStartPtr[voxelEntry[index]]];
+                    sampleNumber = cacheSizePtr[voxelEntry[index]];
+                }
+                else
+                {
+                    reg_getPSFShape(&jacMat[index], &T, &S, algorithm,
+                                    &TmS_EigVec, &TmS_EigVal, &invP, &currentDeterminant);
+                    sampleNumber = reg_getPSFSamples(&TmS_EigVec, &TmS_EigVal, &invP,
+                                                     currentDeterminant, psfSamples);
+                    reg_getPSFSampleOffsets(psfSamples, sampleNumber, warpedImage, entrySamples);
+                    samples = entrySamples;
+                }
 
-                                        (*kernelCompFctPtr)(relative[0], xBasis);
-                                        (*kernelCompFctPtr)(relative[1], yBasis);
-                                        (*kernelCompFctPtr)(relative[2], zBasis);
-                                        previous[0]-=kernel_offset;
-                                        previous[1]-=kernel_offset;
-                                        previous[2]-=kernel_offset;
+                // Get image coordinates of the centre
+                currentC=index/warpedPlaneNumber;
+                currentB=(index-currentC*warpedPlaneNumber)/warpedLineNumber;
+                currentA=(index-currentB*warpedLineNumber-currentC*warpedPlaneNumber);
 
-                                        psfIntensity=0.0;
-                                        for(int c=0; c<kernel_size; c++)
-                                        {
-                                            Z= previous[2]+c;
-                                            zPointer = &floatingIntensity[Z*floatingImage->nx*floatingImage->ny];
-                                            yTempNewValue=0.0;
-                                            for(int b=0; b<kernel_size; b++)
-                                            {
-                                                Y= previous[1]+b;
-                                                xyzPointer = &zPointer[Y*floatingImage->nx+previous[0]];
-                                                xTempNewValue=0.0;
-                                                for(int a=0; a<kernel_size; a++)
-                                                {
-                                                    if(-1<(previous[0]+a) && (previous[0]+a)<floatingImage->nx &&
-                                                            -1<Z && Z<floatingImage->nz &&
-                                                            -1<Y && Y<floatingImage->ny)
-                                                    {
-                                                        xTempNewValue +=  static_cast<double>(*xyzPointer) * xBasis[a];
-                                                    }
-                                                    else
-                                                    {
-                                                        // paddingValue
-                                                        if(!(paddingValue!=paddingValue))// paddingValue
-                                                            xTempNewValue +=  paddingValue * xBasis[a];
-                                                    }
-                                                    xyzPointer++;
-                                                }
-                                                yTempNewValue += xTempNewValue * yBasis[b];
-                                            }
-                                            psfIntensity += yTempNewValue * zBasis[c];
-                                        }
-                                        if(!(psfIntensity!=psfIntensity)){
-                                            intensity+=psfWeight*psfIntensity;
-                                            psfWeightSum+=psfWeight;
-                                        }
-                                    }
-                                }
-                            }
-                        }
+                psfWeightSum=0.0;
+                intensity=0.0;
+                for(int s=0; s<sampleNumber; ++s)
+                {
+                    psfIntensity = reg_getPSFSampleIntensity<FloatingTYPE,FieldTYPE>
+                            (floatingImage, floatingIntensity, warpedImage,
+                             deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ,
+                             floatingIJKMatrix, kernelCompFctPtr, kernel_size, kernel_offset,
+                             paddingValue,
+                             currentA+(size_t)samples[s].shift[0],
+                             currentB+(size_t)samples[s].shift[1],
+                             currentC+(size_t)samples[s].shift[2],
+                             samples[s].relative[0],
+                             samples[s].relative[1],
+                             samples[s].relative[2]);
+                    if(!(psfIntensity!=psfIntensity)){
+                        intensity+=samples[s].weight*psfIntensity;
+                        psfWeightSum+=samples[s].weight;
                     }
                 }
-                if(psfWeightSum>0){
+                if(psfWeightSum>0)
                     intensity/=psfWeightSum;
-                }
-                else{
-                    intensity=paddingValue;
-                }
+                else intensity=paddingValue;
             } // if in mask
-            switch(floatingImage->datatype)
-            {
-            case NIFTI_TYPE_FLOAT32:
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
-                break;
-            case NIFTI_TYPE_FLOAT64:
-                warpedIntensity[index]=intensity;
-                break;
-            case NIFTI_TYPE_UINT8:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=255?reg_round(intensity):255); // 255=2^8-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_UINT16:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=65535?reg_round(intensity):65535); // 65535=2^16-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_UINT32:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=4294967295?reg_round(intensity):4294967295); // 4294967295=2^32-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity>0?reg_round(intensity):0);
-                break;
-            case NIFTI_TYPE_INT16:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=32767?reg_round(intensity):32767); // 32767=2^15-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
-                break;
-            case NIFTI_TYPE_INT32:
-                if(intensity!=intensity)
-                    intensity=0;
-                intensity=(intensity<=2147483647?reg_round(intensity):2147483647); // 2147483647=2^31-1
-                warpedIntensity[index]=static_cast<FloatingTYPE>(intensity);
-                break;
-            default:
-                if(intensity!=intensity)
-                    intensity=0;
-                warpedIntensity[index]=static_cast<FloatingTYPE>(reg_round(intensity));
-                break;
-            }
+            warpedIntensity[index]=reg_castResampledIntensity<FloatingTYPE>(intensity, datatype);
         }
     }
+    free(voxelEntry);
 }
-
 /* *************************************************************** */
 template <class FieldTYPE, class FloatingTYPE>
 void reg_resampleImage2_PSF(nifti_image *floatingImage,
@@ -1773,7 +3938,8 @@ void reg_resampleImage2_PSF(nifti_image *floatingImage,
                             int interp,
                             FieldTYPE paddingValue,
                             mat33 * jacMat,
-                            char algorithm)
+                            char algorithm,
+                            bool cachedPSF)
 {
 
     // The deformation field contains the position in the real world
@@ -1791,6 +3957,19 @@ void reg_resampleImage2_PSF(nifti_image *floatingImage,
                                                              paddingValue,
                                                              interp);
         }
+        else if(cachedPSF){
+#ifndef NDEBUG
+            std::cout<<"Running ResampleImage3D_PSF_Cached"<<std::endl;
+#endif
+            ResampleImage3D_PSF_Cached<FloatingTYPE,FieldTYPE>(floatingImage,
+                                                               deformationFieldImage,
+                                                               warpedImage,
+                                                               mask,
+                                                               paddingValue,
+                                                               interp,
+                                                               jacMat,
+                                                               algorithm);
+        }
         else{
 #ifndef NDEBUG
             std::cout<<"Running ResampleImage3D_PSF"<<std::endl;
@@ -1823,8 +4002,13 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                            int interp,
                            float paddingValue,
                            mat33 * jacMat,
-                           char algorithm)
+                           char algorithm,
+                           bool cachedPSF)
 {
+    // The windowed sinc table is generated before entering any parallel region
+    if(interp==4)
+        reg_initWindowedSincTable();
+
     if(floatingImage->datatype != warpedImage->datatype)
     {
         reg_print_fct_error("reg_resampleImage");
@@ -1861,7 +4045,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                         interp,
                                                         paddingValue,
                                                         jacMat,
-                                                        algorithm);
+                                                        algorithm,
+                                                        cachedPSF);
             break;
         case NIFTI_TYPE_INT8:
             reg_resampleImage2_PSF<float,char>(floatingImage,
@@ -1871,7 +4056,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                interp,
                                                paddingValue,
                                                jacMat,
-                                               algorithm);
+                                               algorithm,
+                                               cachedPSF);
             break;
         case NIFTI_TYPE_UINT16:
             reg_resampleImage2_PSF<float,unsigned short>(floatingImage,
@@ -1881,7 +4067,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                          interp,
                                                          paddingValue,
                                                          jacMat,
-                                                         algorithm);
+                                                         algorithm,
+                                                         cachedPSF);
             break;
         case NIFTI_TYPE_INT16:
             reg_resampleImage2_PSF<float,short>(floatingImage,
@@ -1891,7 +4078,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                 interp,
                                                 paddingValue,
                                                 jacMat,
-                                                algorithm);
+                                                algorithm,
+                                                cachedPSF);
             break;
         case NIFTI_TYPE_UINT32:
             reg_resampleImage2_PSF<float,unsigned int>(floatingImage,
@@ -1901,7 +4089,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                        interp,
                                                        paddingValue,
                                                        jacMat,
-                                                       algorithm);
+                                                       algorithm,
+                                                       cachedPSF);
             break;
         case NIFTI_TYPE_INT32:
             reg_resampleImage2_PSF<float,int>(floatingImage,
@@ -1911,7 +4100,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                               interp,
                                               paddingValue,
                                               jacMat,
-                                              algorithm);
+                                              algorithm,
+                                              cachedPSF);
             break;
         case NIFTI_TYPE_FLOAT32:
             reg_resampleImage2_PSF<float,float>(floatingImage,
@@ -1921,7 +4111,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                 interp,
                                                 paddingValue,
                                                 jacMat,
-                                                algorithm);
+                                                algorithm,
+                                                cachedPSF);
             break;
         case NIFTI_TYPE_FLOAT64:
             reg_resampleImage2_PSF<float,double>(floatingImage,
@@ -1931,7 +4122,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                  interp,
                                                  paddingValue,
                                                  jacMat,
-                                                 algorithm);
+                                                 algorithm,
+                                                 cachedPSF);
             break;
         default:
             printf("floating pixel type unsupported.");
@@ -1949,7 +4141,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                          interp,
                                                          paddingValue,
                                                          jacMat,
-                                                         algorithm);
+                                                         algorithm,
+                                                         cachedPSF);
             break;
         case NIFTI_TYPE_INT8:
             reg_resampleImage2_PSF<double,char>(floatingImage,
@@ -1959,7 +4152,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                 interp,
                                                 paddingValue,
                                                 jacMat,
-                                                algorithm);
+                                                algorithm,
+                                                cachedPSF);
             break;
         case NIFTI_TYPE_UINT16:
             reg_resampleImage2_PSF<double,unsigned short>(floatingImage,
@@ -1969,7 +4163,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                           interp,
                                                           paddingValue,
                                                           jacMat,
-                                                          algorithm);
+                                                          algorithm,
+                                                          cachedPSF);
             break;
         case NIFTI_TYPE_INT16:
             reg_resampleImage2_PSF<double,short>(floatingImage,
@@ -1979,7 +4174,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                  interp,
                                                  paddingValue,
                                                  jacMat,
-                                                 algorithm);
+                                                 algorithm,
+                                                 cachedPSF);
             break;
         case NIFTI_TYPE_UINT32:
             reg_resampleImage2_PSF<double,unsigned int>(floatingImage,
@@ -1989,7 +4185,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                         interp,
                                                         paddingValue,
                                                         jacMat,
-                                                        algorithm);
+                                                        algorithm,
+                                                        cachedPSF);
             break;
         case NIFTI_TYPE_INT32:
             reg_resampleImage2_PSF<double,int>(floatingImage,
@@ -1999,7 +4196,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                interp,
                                                paddingValue,
                                                jacMat,
-                                               algorithm);
+                                               algorithm,
+                                               cachedPSF);
             break;
         case NIFTI_TYPE_FLOAT32:
             reg_resampleImage2_PSF<double,float>(floatingImage,
@@ -2009,7 +4207,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                  interp,
                                                  paddingValue,
                                                  jacMat,
-                                                 algorithm);
+                                                 algorithm,
+                                                 cachedPSF);
             break;
         case NIFTI_TYPE_FLOAT64:
             reg_resampleImage2_PSF<double,double>(floatingImage,
@@ -2019,7 +4218,8 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                                                   interp,
                                                   paddingValue,
                                                   jacMat,
-                                                  algorithm);
+                                                  algorithm,
+                                                  cachedPSF);
             break;
         default:
             printf("floating pixel type unsupported.");
@@ -3381,6 +5581,396 @@ void reg_getImageGradient(nifti_image *floatingImage,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/** Basis and derivative weights shared by the fused resampling and
+ * gradient kernels. The linear derivative matches the one used in
+ * TrilinearImageGradient and BilinearImageGradient.
+ */
+template<int kernel>
+inline void interpKernelAndDerivative(double relative, double *basis, double *derivative)
+{
+    if(kernel==1){
+        interpLinearKernel(relative, basis);
+        derivative[0]=-1.0;
+        derivative[1]=1.0;
+    }
+    else interpCubicSplineKernel(relative, basis, derivative);
+}
+/* *************************************************************** */
+template<class DTYPE, int kernel>
+void ResampleImageAndGradient3D(nifti_image *floatingImage,
+                                nifti_image *deformationField,
+                                nifti_image *warpedImage,
+                                nifti_image *warImgGradient,
+                                int *mask,
+                                float paddingValue)
+{
+#ifdef _WIN32
+    long index;
+    long warpedVoxelNumber = (long)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+#else
+    size_t index;
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny*warpedImage->nz;
+#endif
+    DTYPE *floatingIntensity = static_cast<DTYPE *>(floatingImage->data);
+    DTYPE *warpedIntensity = static_cast<DTYPE *>(warpedImage->data);
+
+    DTYPE *deformationFieldPtrX = static_cast<DTYPE *>(deformationField->data);
+    DTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
+    DTYPE *deformationFieldPtrZ = &deformationFieldPtrY[warpedVoxelNumber];
+
+    DTYPE *warpedGradientPtrX = static_cast<DTYPE *>(warImgGradient->data);
+    DTYPE *warpedGradientPtrY = &warpedGradientPtrX[warpedVoxelNumber];
+    DTYPE *warpedGradientPtrZ = &warpedGradientPtrY[warpedVoxelNumber];
+
+    int *maskPtr = &mask[0];
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+
+#ifndef NDEBUG
+    reg_print_msg_debug("3D resampling and gradient computation in a single pass");
+#endif
+
+    const int kernel_size = kernel==1?2:4;
+    const int kernel_offset = kernel==1?0:1;
+    const int floatingDim[3]={floatingImage->nx, floatingImage->ny, floatingImage->nz};
+    const size_t floatingPlaneNumber = (size_t)floatingDim[0]*floatingDim[1];
+    const double padding = static_cast<double>(paddingValue);
+
+    int a, b, c, X, Y, Z, previous[3];
+    bool inside;
+    double xBasis[kernel_size], yBasis[kernel_size], zBasis[kernel_size];
+    double xDeriv[kernel_size], yDeriv[kernel_size], zDeriv[kernel_size];
+    double coeff, intensity, grad[3];
+    double xTempNewValue, yTempNewValue, xxTempNewValue, yyTempNewValue, zzTempNewValue;
+    DTYPE position[3], world[3];
+    DTYPE *zPointer, *xyzPointer;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(index, world, position, previous, xBasis, yBasis, zBasis, xDeriv, yDeriv, zDeriv, \
+    inside, coeff, intensity, grad, a, b, c, X, Y, Z, zPointer, xyzPointer, \
+    xTempNewValue, yTempNewValue, xxTempNewValue, yyTempNewValue, zzTempNewValue) \
+    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, maskPtr, floatingIJKMatrix, \
+    deformationFieldPtrX, deformationFieldPtrY, deformationFieldPtrZ, floatingDim, \
+    floatingPlaneNumber, padding, warpedGradientPtrX, warpedGradientPtrY, warpedGradientPtrZ)
+#endif // _OPENMP
+    for(index=0; index<warpedVoxelNumber; index++)
+    {
+        intensity=padding;
+        grad[0]=grad[1]=grad[2]=0.0;
+
+        if(maskPtr[index]>-1)
+        {
+            world[0]=deformationFieldPtrX[index];
+            world[1]=deformationFieldPtrY[index];
+            world[2]=deformationFieldPtrZ[index];
+
+            /* real -> voxel; floating space */
+            reg_mat44_mul(floatingIJKMatrix, world, position);
+
+            previous[0] = static_cast<int>(reg_floor(position[0]));
+            previous[1] = static_cast<int>(reg_floor(position[1]));
+            previous[2] = static_cast<int>(reg_floor(position[2]));
+
+            // The basis and derivative weights are computed once per axis
+            interpKernelAndDerivative<kernel>(position[0]-(DTYPE)previous[0], xBasis, xDeriv);
+            interpKernelAndDerivative<kernel>(position[1]-(DTYPE)previous[1], yBasis, yDeriv);
+            interpKernelAndDerivative<kernel>(position[2]-(DTYPE)previous[2], zBasis, zDeriv);
+            previous[0]-=kernel_offset;
+            previous[1]-=kernel_offset;
+            previous[2]-=kernel_offset;
+
+            inside = -1<previous[0] && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                    -1<previous[1] && (previous[1]+kernel_size-1)<floatingDim[1] &&
+                    -1<previous[2] && (previous[2]+kernel_size-1)<floatingDim[2];
+
+            intensity=0.0;
+            for(c=0; c<kernel_size; c++)
+            {
+                Z = previous[2]+c;
+                if(inside || (-1<Z && Z<floatingDim[2]))
+                {
+                    zPointer = &floatingIntensity[Z*floatingPlaneNumber];
+                    xxTempNewValue=0.0;
+                    yyTempNewValue=0.0;
+                    zzTempNewValue=0.0;
+                    for(b=0; b<kernel_size; b++)
+                    {
+                        Y = previous[1]+b;
+                        if(inside || (-1<Y && Y<floatingDim[1]))
+                        {
+                            xyzPointer = &zPointer[Y*floatingDim[0]+previous[0]];
+                            xTempNewValue=0.0;
+                            yTempNewValue=0.0;
+                            for(a=0; a<kernel_size; a++)
+                            {
+                                X = previous[0]+a;
+                                if(inside || (-1<X && X<floatingDim[0]))
+                                    coeff = static_cast<double>(xyzPointer[a]);
+                                else coeff = padding;
+                                xTempNewValue += coeff * xDeriv[a];
+                                yTempNewValue += coeff * xBasis[a];
+                            } // a
+                            xxTempNewValue += xTempNewValue * yBasis[b];
+                            yyTempNewValue += yTempNewValue * yDeriv[b];
+                            zzTempNewValue += yTempNewValue * yBasis[b];
+                        } // Y in range
+                        else
+                        {
+                            xxTempNewValue += padding * yBasis[b];
+                            yyTempNewValue += padding * yDeriv[b];
+                            zzTempNewValue += padding * yBasis[b];
+                        }
+                    } // b
+                    grad[0] += xxTempNewValue * zBasis[c];
+                    grad[1] += yyTempNewValue * zBasis[c];
+                    grad[2] += zzTempNewValue * zDeriv[c];
+                    intensity += zzTempNewValue * zBasis[c];
+                } // Z in range
+                else
+                {
+                    grad[0] += padding * zBasis[c];
+                    grad[1] += padding * zBasis[c];
+                    grad[2] += padding * zDeriv[c];
+                    intensity += padding * zBasis[c];
+                }
+            } // c
+
+            // The gradient follows the conventions of the dedicated gradient kernels:
+            // undefined values are set to zero with cubic spline interpolation and
+            // the linear gradient is only defined when all taps are in the image
+            // or when the padding value is not NaN
+            if(kernel==1)
+            {
+                if(!inside && padding!=padding)
+                    grad[0]=grad[1]=grad[2]=0.0;
+            }
+            else
+            {
+                grad[0]=grad[0]==grad[0]?grad[0]:0.0;
+                grad[1]=grad[1]==grad[1]?grad[1]:0.0;
+                grad[2]=grad[2]==grad[2]?grad[2]:0.0;
+            }
+        } // mask
+
+        warpedIntensity[index] = static_cast<DTYPE>(intensity);
+        warpedGradientPtrX[index] = static_cast<DTYPE>(grad[0]);
+        warpedGradientPtrY[index] = static_cast<DTYPE>(grad[1]);
+        warpedGradientPtrZ[index] = static_cast<DTYPE>(grad[2]);
+    }
+}
+/* *************************************************************** */
+template<class DTYPE, int kernel>
+void ResampleImageAndGradient2D(nifti_image *floatingImage,
+                                nifti_image *deformationField,
+                                nifti_image *warpedImage,
+                                nifti_image *warImgGradient,
+                                int *mask,
+                                float paddingValue)
+{
+#ifdef _WIN32
+    long index;
+    long warpedVoxelNumber = (long)warpedImage->nx*warpedImage->ny;
+#else
+    size_t index;
+    size_t warpedVoxelNumber = (size_t)warpedImage->nx*warpedImage->ny;
+#endif
+    DTYPE *floatingIntensity = static_cast<DTYPE *>(floatingImage->data);
+    DTYPE *warpedIntensity = static_cast<DTYPE *>(warpedImage->data);
+
+    DTYPE *deformationFieldPtrX = static_cast<DTYPE *>(deformationField->data);
+    DTYPE *deformationFieldPtrY = &deformationFieldPtrX[warpedVoxelNumber];
+
+    DTYPE *warpedGradientPtrX = static_cast<DTYPE *>(warImgGradient->data);
+    DTYPE *warpedGradientPtrY = &warpedGradientPtrX[warpedVoxelNumber];
+
+    int *maskPtr = &mask[0];
+
+    mat44 *floatingIJKMatrix;
+    if(floatingImage->sform_code>0)
+        floatingIJKMatrix=&(floatingImage->sto_ijk);
+    else floatingIJKMatrix=&(floatingImage->qto_ijk);
+
+#ifndef NDEBUG
+    reg_print_msg_debug("2D resampling and gradient computation in a single pass");
+#endif
+
+    const int kernel_size = kernel==1?2:4;
+    const int kernel_offset = kernel==1?0:1;
+    const int floatingDim[2]={floatingImage->nx, floatingImage->ny};
+    const double padding = static_cast<double>(paddingValue);
+
+    int a, b, X, Y, previous[2];
+    bool inside;
+    double xBasis[kernel_size], yBasis[kernel_size], xDeriv[kernel_size], yDeriv[kernel_size];
+    double coeff, intensity, grad[2], xTempNewValue, yTempNewValue;
+    DTYPE position[2];
+    DTYPE *xyPointer;
+#if defined (_OPENMP)
+#pragma omp parallel for default(none) \
+    private(index, position, previous, xBasis, yBasis, xDeriv, yDeriv, inside, coeff, \
+    intensity, grad, a, b, X, Y, xyPointer, xTempNewValue, yTempNewValue) \
+    shared(floatingIntensity, warpedIntensity, warpedVoxelNumber, maskPtr, floatingIJKMatrix, \
+    deformationFieldPtrX, deformationFieldPtrY, floatingDim, padding, \
+    warpedGradientPtrX, warpedGradientPtrY)
+#endif // _OPENMP
+    for(index=0; index<warpedVoxelNumber; index++)
+    {
+        grad[0]=grad[1]=0.0;
+
+        // As in ResampleImage2D, the intensities outside of the mask are left untouched
+        if(maskPtr[index]>-1)
+        {
+            /* real -> voxel; floating space */
+            position[0] = deformationFieldPtrX[index]*floatingIJKMatrix->m[0][0] +
+                    deformationFieldPtrY[index]*floatingIJKMatrix->m[0][1] +
+                    floatingIJKMatrix->m[0][3];
+            position[1] = deformationFieldPtrX[index]*floatingIJKMatrix->m[1][0] +
+                    deformationFieldPtrY[index]*floatingIJKMatrix->m[1][1] +
+                    floatingIJKMatrix->m[1][3];
+
+            previous[0] = static_cast<int>(reg_floor(position[0]));
+            previous[1] = static_cast<int>(reg_floor(position[1]));
+
+            interpKernelAndDerivative<kernel>(position[0]-(DTYPE)previous[0], xBasis, xDeriv);
+            interpKernelAndDerivative<kernel>(position[1]-(DTYPE)previous[1], yBasis, yDeriv);
+            previous[0]-=kernel_offset;
+            previous[1]-=kernel_offset;
+
+            inside = -1<previous[0] && (previous[0]+kernel_size-1)<floatingDim[0] &&
+                    -1<previous[1] && (previous[1]+kernel_size-1)<floatingDim[1];
+
+            intensity=0.0;
+            for(b=0; b<kernel_size; b++)
+            {
+                Y = previous[1]+b;
+                if(inside || (-1<Y && Y<floatingDim[1]))
+                {
+                    xyPointer = &floatingIntensity[Y*floatingDim[0]+previous[0]];
+                    xTempNewValue=0.0;
+                    yTempNewValue=0.0;
+                    for(a=0; a<kernel_size; a++)
+                    {
+                        X = previous[0]+a;
+                        if(inside || (-1<X && X<floatingDim[0]))
+                            coeff = static_cast<double>(xyPointer[a]);
+                        else coeff = padding;
+                        xTempNewValue += coeff * xDeriv[a];
+                        yTempNewValue += coeff * xBasis[a];
+                    } // a
+                    grad[0] += xTempNewValue * yBasis[b];
+                    grad[1] += yTempNewValue * yDeriv[b];
+                    intensity += yTempNewValue * yBasis[b];
+                } // Y in range
+                else
+                {
+                    grad[0] += padding * yBasis[b];
+                    grad[1] += padding * yDeriv[b];
+                    intensity += padding * yBasis[b];
+                }
+            } // b
+
+            grad[0]=grad[0]==grad[0]?grad[0]:0.0;
+            grad[1]=grad[1]==grad[1]?grad[1]:0.0;
+
+            warpedIntensity[index] = static_cast<DTYPE>(intensity);
+        } // mask
+
+        warpedGradientPtrX[index] = static_cast<DTYPE>(grad[0]);
+        warpedGradientPtrY[index] = static_cast<DTYPE>(grad[1]);
+    }
+}
+/* *************************************************************** */
+template<class DTYPE>
+void reg_resampleImageAndGradient1(nifti_image *floatingImage,
+                                   nifti_image *warpedImage,
+                                   nifti_image *warImgGradient,
+                                   nifti_image *deformationField,
+                                   int *mask,
+                                   int interp,
+                                   float paddingValue)
+{
+    if(deformationField->nz>1)
+    {
+        if(interp==1)
+            ResampleImageAndGradient3D<DTYPE,1>(floatingImage, deformationField, warpedImage,
+                                                warImgGradient, mask, paddingValue);
+        else ResampleImageAndGradient3D<DTYPE,3>(floatingImage, deformationField, warpedImage,
+                                                 warImgGradient, mask, paddingValue);
+    }
+    else
+    {
+        if(interp==1)
+            ResampleImageAndGradient2D<DTYPE,1>(floatingImage, deformationField, warpedImage,
+                                                warImgGradient, mask, paddingValue);
+        else ResampleImageAndGradient2D<DTYPE,3>(floatingImage, deformationField, warpedImage,
+                                                 warImgGradient, mask, paddingValue);
+    }
+}
+/* *************************************************************** */
+void reg_resampleImageAndGradient(nifti_image *floatingImage,
+                                  nifti_image *warpedImage,
+                                  nifti_image *warImgGradient,
+                                  nifti_image *deformationField,
+                                  int *mask,
+                                  int interp,
+                                  float paddingValue)
+{
+    // The single pass is only used when the warped values and the gradient share
+    // their basis weights and when all images share a floating point datatype.
+    // The dedicated functions are used otherwise
+    bool fused = (interp==1 || interp==3) &&
+            floatingImage->nt*floatingImage->nu==1 &&
+            warpedImage->nt*warpedImage->nu==1 &&
+            (floatingImage->datatype==NIFTI_TYPE_FLOAT32 ||
+             floatingImage->datatype==NIFTI_TYPE_FLOAT64) &&
+            warpedImage->datatype==floatingImage->datatype &&
+            warImgGradient->datatype==floatingImage->datatype &&
+            deformationField->datatype==floatingImage->datatype;
+    if(!fused)
+    {
+        reg_resampleImage(floatingImage,
+                          warpedImage,
+                          deformationField,
+                          mask,
+                          interp,
+                          paddingValue);
+        reg_getImageGradient(floatingImage,
+                             warImgGradient,
+                             deformationField,
+                             mask,
+                             interp,
+                             paddingValue,
+                             0);
+        return;
+    }
+
+    // a mask array is created if no mask is specified
+    bool MrPropreRule=false;
+    if(mask==NULL)
+    {
+        // voxels in the background are set to -1 so 0 will do the job here
+        mask=(int *)calloc(warpedImage->nx*warpedImage->ny*warpedImage->nz,sizeof(int));
+        MrPropreRule=true;
+    }
+
+    switch(floatingImage->datatype)
+    {
+    case NIFTI_TYPE_FLOAT32:
+        reg_resampleImageAndGradient1<float>(floatingImage, warpedImage, warImgGradient,
+                                             deformationField, mask, interp, paddingValue);
+        break;
+    case NIFTI_TYPE_FLOAT64:
+        reg_resampleImageAndGradient1<double>(floatingImage, warpedImage, warImgGradient,
+                                              deformationField, mask, interp, paddingValue);
+        break;
+    }
+    if(MrPropreRule==true) free(mask);
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template<class DTYPE>
 void reg_getImageGradient_symDiff_core(nifti_image *img,
                                        nifti_image *gradImg,
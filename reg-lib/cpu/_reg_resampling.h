@@ -42,6 +42,118 @@ void reg_resampleImage(nifti_image *floatingImage,
                        float paddingValue,
                        bool *dti_timepoint = NULL,
                        mat33 * jacMat = NULL);
+/** @brief Previous implementation of reg_resampleImage, where the interpolation kernel
+ * is selected inside the voxel loop instead of being a template parameter. It is kept to
+ * benchmark and validate the templated kernels and should produce the same output as
+ * reg_resampleImage. Diffusion tensors are not reoriented and the deformation field has to
+ * be in single precision.
+ * @param floatingImage Floating image that is interpolated
+ * @param warpedImage Warped image that is being generated
+ * @param deformationField Vector field image that contains the dense correspondences
+ * @param mask Array that contains information about the mask. Only voxel with mask value different
+ * from zero are being considered. If NULL, all voxels are considered
+ * @param interp Interpolation type. 0, 1, 3 or 4 correspond to nearest neighbor, linear,
+ * cubic or windowed sinc interpolation
+ * @param paddingValue Value to be used for padding when the correspondences are outside of the
+ * floating image space.
+ */
+extern "C++"
+void reg_resampleImageReference(nifti_image *floatingImage,
+                                nifti_image *warpedImage,
+                                nifti_image *deformationField,
+                                int *mask,
+                                int interp,
+                                float paddingValue);
+/** @brief This function resamples several floating images with the same deformation field.
+ * The floating position and the interpolation weights of every warped voxel are computed
+ * once and applied to all the volumes of all the images. The floating images are expected
+ * to share the same space, but can have different data types and numbers of volumes.
+ * The result matches a call to reg_resampleImage per image. Diffusion tensors are not
+ * reoriented.
+ * @param floatingImages Array of floating images that are interpolated
+ * @param warpedImages Array of warped images that are being generated, one per floating image
+ * @param imageNumber Number of floating and warped images
+ * @param deformationField Vector field image that contains the dense correspondences
+ * @param mask Array that contains information about the mask. Only voxel with mask value different
+ * from zero are being considered. If NULL, all voxels are considered
+ * @param interp Interpolation type. 0, 1, 3 or 4 correspond to nearest neighbor, linear,
+ * cubic or windowed sinc interpolation
+ * @param paddingValue Value to be used for padding when the correspondences are outside of the
+ * floating image space.
+ */
+extern "C++"
+void reg_resampleImageBatch(nifti_image **floatingImages,
+                            nifti_image **warpedImages,
+                            int imageNumber,
+                            nifti_image *deformationField,
+                            int *mask,
+                            int interp,
+                            float paddingValue);
+/** @brief This function resamples a label image into the space of a reference/warped image.
+ * The interpolation weights of the floating voxels surrounding each warped voxel are summed
+ * per label and the label with the largest sum is kept. Unlike nearest neighbour
+ * interpolation, the partial volume of every label is considered, and unlike a per-label
+ * probabilistic resampling, no image has to be allocated per label.
+ * @param floatingImage Floating label image that is interpolated
+ * @param warpedImage Warped label image that is being generated
+ * @param deformationField Vector field image that contains the dense correspondences
+ * @param mask Array that contains information about the mask. Only voxel with mask value different
+ * from zero are being considered. If NULL, all voxels are considered
+ * @param interp Interpolation weights. 0, 1 or 3 correspond to nearest neighbor, linear or
+ * cubic spline weights
+ * @param paddingValue Label used for the correspondences that are outside of the floating
+ * image space. If NaN, these correspondences are ignored
+ */
+extern "C++"
+void reg_resampleLabelImage(nifti_image *floatingImage,
+                            nifti_image *warpedImage,
+                            nifti_image *deformationField,
+                            int *mask,
+                            int interp,
+                            float paddingValue);
+/** @brief This function resamples a floating image into the space of a reference/warped image
+ * using an affine transformation. No deformation field is required: the voxel to voxel
+ * matrix is applied once per scanline and the position is then incremented along the x-axis.
+ * The interpolation weights are evaluated in single precision and are shared by all the
+ * volumes along the 4th and 5th axes. The result matches reg_resampleImage used with a
+ * deformation field generated by reg_affine_getDeformationField.
+ * @param floatingImage Floating image that is interpolated
+ * @param warpedImage Warped image that is being generated
+ * @param affineTransformation Affine transformation from the reference to the floating
+ * space, in real coordinates
+ * @param mask Array that contains information about the mask. Only voxel with mask value different
+ * from zero are being considered. If NULL, all voxels are considered
+ * @param interp Interpolation type. 0, 1, 3 or 4 correspond to nearest neighbor, linear,
+ * cubic or windowed sinc interpolation
+ * @param paddingValue Value to be used for padding when the correspondences are outside of the
+ * floating image space.
+ */
+extern "C++"
+void reg_resampleImage_affine(nifti_image *floatingImage,
+                              nifti_image *warpedImage,
+                              mat44 *affineTransformation,
+                              int *mask,
+                              int interp,
+                              float paddingValue);
+/** @brief This function resamples a floating image into the space of a
+ * reference/warped image while accounting for the point spread function
+ * (PSF) of both images. It is used to resample an image to a lower resolution.
+ * @param floatingImage Floating image that is interpolated
+ * @param warpedImage Warped image that is being generated
+ * @param deformationField Vector field image that contains the dense correspondences
+ * @param mask Array that contains information about the mask. Only voxel with mask value different
+ * from zero are being considered. If NULL, all voxels are considered
+ * @param interp Interpolation type. 1, 3 or 4 correspond to linear, cubic or windowed sinc
+ * interpolation
+ * @param paddingValue Value to be used for padding when the correspondences are outside of the
+ * floating image space.
+ * @param jacMat Jacobian matrices of the deformation field, one per voxel
+ * @param algorithm PSF estimation that minimises the matrix metric (0), the determinant (1) or
+ * that uses a sinc based PSF (2)
+ * @param cachedPSF If true, the PSF samples are computed once per distinct quantised Jacobian
+ * matrix instead of once per voxel. When the deformation field is affine, the PSF is applied as
+ * separable convolutions. The sinc based PSF (algorithm 2) is always computed exactly
+ */
 extern "C++"
 void reg_resampleImage_PSF(nifti_image *floatingImage,
                            nifti_image *warpedImage,
@@ -50,7 +162,21 @@ void reg_resampleImage_PSF(nifti_image *floatingImage,
                            int interp,
                            float paddingValue,
                            mat33 * jacMat,
-                           char algorithm);
+                           char algorithm,
+                           bool cachedPSF = false);
+/** @brief Set the number of samples per voxel used to tabulate the windowed sinc
+ * interpolation kernel (interp=4). The weights of intermediate positions are linearly
+ * interpolated from the table. An oversampling of 0 evaluates the kernel analytically.
+ * The table is shared by all the resampling functions and should not be modified while
+ * a resampling is running.
+ * @param oversampling Number of table entries between two consecutive voxels
+ */
+extern "C++"
+void reg_setWindowedSincOversampling(int oversampling);
+/** @brief Returns the oversampling used to tabulate the windowed sinc kernel
+ */
+extern "C++"
+int reg_getWindowedSincOversampling();
 
 
 extern "C++"
@@ -72,6 +198,33 @@ void reg_getImageGradient(nifti_image *floatingImage,
                           mat33 *jacMat = NULL,
                           nifti_image *warpedImage = NULL);
 
+/** @brief This function resamples a floating image into the space of a
+ * reference image and computes the spatial gradient of the warped image in
+ * a single traversal of the deformation field. The basis and derivative
+ * weights are shared between both outputs.
+ * The single pass is used for single volume images with linear or cubic
+ * spline interpolation when the floating, warped, gradient and deformation
+ * field images share a floating point datatype. Other inputs are handled
+ * by reg_resampleImage and reg_getImageGradient.
+ * @param floatingImage Floating image that is interpolated
+ * @param warpedImage Warped image that is being generated
+ * @param warImgGradient Gradient image of the warped image, in voxel space
+ * @param deformationField Vector field image that contains the dense correspondences
+ * @param mask Array that contains information about the mask. Only voxel with mask value different
+ * from zero are being considered. If NULL, all voxels are considered
+ * @param interp Interpolation type. 1 or 3 correspond to linear or cubic spline interpolation
+ * @param paddingValue Value to be used for padding when the correspondences are outside of the
+ * floating image space.
+ */
+extern "C++"
+void reg_resampleImageAndGradient(nifti_image *floatingImage,
+                                  nifti_image *warpedImage,
+                                  nifti_image *warImgGradient,
+                                  nifti_image *deformationField,
+                                  int *mask,
+                                  int interp,
+                                  float paddingValue);
+
 extern "C++"
 void reg_getImageGradient_symDiff(nifti_image* inputImg,
                                   nifti_image* gradImg,
@@ -709,6 +709,7 @@ void get_GridValues(int startX,
       else out=true;
       for(int Y=startY; Y<startY+range; Y++)
       {
+         bool outY=out;
          if(Y>-1 && Y<splineControlPoint->ny && out==false)
          {
             index = Y*splineControlPoint->nx;
@@ -716,10 +717,10 @@ void get_GridValues(int startX,
             yyPtr = &yPtr[index];
             zzPtr = &zPtr[index];
          }
-         else out=true;
+         else outY=true;
          for(int X=startX; X<startX+range; X++)
          {
-            if(X>-1 && X<splineControlPoint->nx && out==false)
+            if(X>-1 && X<splineControlPoint->nx && outY==false)
             {
                dispX[coord] = xxPtr[X];
                dispY[coord] = yyPtr[X];
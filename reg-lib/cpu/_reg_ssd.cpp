@@ -20,6 +20,7 @@ reg_ssd::reg_ssd()
    : reg_measure()
 {
    memset(this->normaliseTimePoint,0,255*sizeof(bool) );
+   memset(this->activeVoxelNumber,0,255*sizeof(double) );
 #ifndef NDEBUG
    reg_print_msg_debug("reg_ssd constructor called");
 #endif
@@ -297,7 +298,9 @@ void reg_getVoxelBasedSSDGradient(nifti_image *referenceImage,
                                   int *mask,
                                   int current_timepoint,
                                   double timepoint_weight,
-                                  nifti_image *localWeightSimImage
+                                  nifti_image *localWeightSimImage,
+                                  size_t voxelOffset,
+                                  double *activeVoxelNumber
                                   )
 {
    if(current_timepoint<0 || current_timepoint>=referenceImage->nt){
@@ -306,18 +309,22 @@ void reg_getVoxelBasedSSDGradient(nifti_image *referenceImage,
       reg_exit();
    }
    // Create pointers to the reference and warped images
+   // The gradient images may only cover a tile of the reference image
+   // that starts at the voxelOffset-th voxel
 #ifdef _WIN32
    long voxel;
-   long voxelNumber = (long)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+   long voxelNumber = (long)measureGradientImage->nx*measureGradientImage->ny*measureGradientImage->nz;
+   long referenceVoxelNumber = (long)referenceImage->nx*referenceImage->ny*referenceImage->nz;
 #else
    size_t voxel;
-   size_t voxelNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
+   size_t voxelNumber = (size_t)measureGradientImage->nx*measureGradientImage->ny*measureGradientImage->nz;
+   size_t referenceVoxelNumber = (size_t)referenceImage->nx*referenceImage->ny*referenceImage->nz;
 #endif
    // Pointers to the image data
    DTYPE *refImagePtr = static_cast<DTYPE *>(referenceImage->data);
-   DTYPE *currentRefPtr=&refImagePtr[current_timepoint*voxelNumber];
+   DTYPE *currentRefPtr=&refImagePtr[current_timepoint*referenceVoxelNumber];
    DTYPE *warImagePtr = static_cast<DTYPE *>(warpedImage->data);
-   DTYPE *currentWarPtr=&warImagePtr[current_timepoint*voxelNumber];
+   DTYPE *currentWarPtr=&warImagePtr[current_timepoint*referenceVoxelNumber];
 
    // Pointers to the spatial gradient of the warped image
    DTYPE *spatialGradPtrX = static_cast<DTYPE *>(warImgGradient->data);
@@ -344,16 +351,32 @@ void reg_getVoxelBasedSSDGradient(nifti_image *referenceImage,
 
    // find number of active voxels and correct weight
    double activeVoxel_num = 0.0;
-   for (voxel = 0; voxel < voxelNumber; voxel++)
+   if(activeVoxelNumber!=NULL && *activeVoxelNumber>0)
+      activeVoxel_num = *activeVoxelNumber;
+   else
    {
-      if (mask[voxel]>-1)
+      for (voxel = 0; voxel < referenceVoxelNumber; voxel++)
       {
-         if (currentRefPtr[voxel] == currentRefPtr[voxel] && currentWarPtr[voxel] == currentWarPtr[voxel])
-            activeVoxel_num += 1.0;
+         if (mask[voxel]>-1)
+         {
+            if (currentRefPtr[voxel] == currentRefPtr[voxel] && currentWarPtr[voxel] == currentWarPtr[voxel])
+               activeVoxel_num += 1.0;
+         }
       }
+      if(activeVoxelNumber!=NULL)
+         *activeVoxelNumber = activeVoxel_num;
    }
    double adjusted_weight = timepoint_weight / activeVoxel_num;
 
+   // The voxel based arrays are shifted to the first voxel of the tile
+   currentRefPtr = &currentRefPtr[voxelOffset];
+   currentWarPtr = &currentWarPtr[voxelOffset];
+   mask = &mask[voxelOffset];
+   if(jacDetPtr!=NULL)
+      jacDetPtr = &jacDetPtr[voxelOffset];
+   if(localWeightPtr!=NULL)
+      localWeightPtr = &localWeightPtr[voxelOffset];
+
    double refValue, warValue, common;
 
 #if defined (_OPENMP)
@@ -403,9 +426,9 @@ void reg_getVoxelBasedSSDGradient(nifti_image *referenceImage,
 }
 /* *************************************************************** */
 template void reg_getVoxelBasedSSDGradient<float>
-(nifti_image *,nifti_image *,nifti_image *,nifti_image *,nifti_image *, int *, int, double, nifti_image *);
+(nifti_image *,nifti_image *,nifti_image *,nifti_image *,nifti_image *, int *, int, double, nifti_image *, size_t, double *);
 template void reg_getVoxelBasedSSDGradient<double>
-(nifti_image *,nifti_image *,nifti_image *,nifti_image *,nifti_image *, int *, int, double, nifti_image *);
+(nifti_image *,nifti_image *,nifti_image *,nifti_image *,nifti_image *, int *, int, double, nifti_image *, size_t, double *);
 /* *************************************************************** */
 void reg_ssd::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
 {
@@ -425,6 +448,9 @@ void reg_ssd::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
       reg_print_msg_error("Input images are exepected to be of the same type");
       reg_exit();
    }
+   // The number of active voxels is counted when the first tile is processed
+   if(this->voxelBasedGradientOffset==0)
+      this->activeVoxelNumber[current_timepoint]=0;
    // Compute the gradient of the ssd for the forward transformation
    switch(dtype)
    {
@@ -438,7 +464,9 @@ void reg_ssd::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
              this->referenceMaskPointer,
              current_timepoint,
              this->timePointWeight[current_timepoint],
-             this->forwardLocalWeightSimImagePointer
+             this->forwardLocalWeightSimImagePointer,
+             this->voxelBasedGradientOffset,
+             &this->activeVoxelNumber[current_timepoint]
              );
       break;
    case NIFTI_TYPE_FLOAT64:
@@ -451,7 +479,9 @@ void reg_ssd::GetVoxelBasedSimilarityMeasureGradient(int current_timepoint)
              this->referenceMaskPointer,
              current_timepoint,
              this->timePointWeight[current_timepoint],
-             this->forwardLocalWeightSimImagePointer
+             this->forwardLocalWeightSimImagePointer,
+             this->voxelBasedGradientOffset,
+             &this->activeVoxelNumber[current_timepoint]
              );
       break;
    default:
@@ -43,6 +43,11 @@ public:
    virtual double GetSimilarityMeasureValue();
    /// @brief Compute the voxel based ssd gradient
    virtual void GetVoxelBasedSimilarityMeasureGradient(int current_timepoint);
+   /// @brief The forward gradient can be computed tile by tile
+   virtual bool SupportsVoxelBasedGradientTiles()
+   {
+      return true;
+   }
    /// @brief Here
    virtual void GetDiscretisedValue(nifti_image *controlPointGridImage,
                                     float *discretisedValue,
@@ -52,6 +57,7 @@ public:
    ~reg_ssd() {}
 protected:
    float currentValue[255];
+   double activeVoxelNumber[255];
 
 private:
    bool normaliseTimePoint[255];
@@ -93,6 +99,11 @@ double reg_getSSDValue(nifti_image *referenceImage,
  * pointer is set to NULL
  * @param mask Array that contains a mask to specify which voxel
  * should be considered. If set to NULL, all voxels are considered
+ * @param voxelOffset Index of the first reference voxel covered by the
+ * gradient images, which may only contain a tile of the reference image
+ * @param activeVoxelNumber If defined, the number of active voxels over
+ * the whole image is read from this value when positive. It is counted
+ * and stored in it otherwise
  */
 extern "C++" template <class DTYPE>
 void reg_getVoxelBasedSSDGradient(nifti_image *referenceImage,
@@ -103,6 +114,8 @@ void reg_getVoxelBasedSSDGradient(nifti_image *referenceImage,
                                   int *mask,
                                   int current_timepoint,
                                   double timepoint_weight,
-                                  nifti_image *localWeightImage
+                                  nifti_image *localWeightImage,
+                                  size_t voxelOffset = 0,
+                                  double *activeVoxelNumber = NULL
                                  );
 #endif
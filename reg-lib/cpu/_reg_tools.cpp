@@ -1100,6 +1100,344 @@ void reg_tools_divideValueToImage(nifti_image *img1,
 }
 /* *************************************************************** */
 /* *************************************************************** */
+/* Compute the coefficients of the fourth order recursive Gaussian filter
+ * from Deriche (INRIA RR-1893, 1993). The array contains the numerator
+ * of the causal pass [0-3], the numerator of the anti-causal pass [4-7]
+ * and the shared denominator [8-11]. The numerators are scaled so that
+ * the filter has a unit gain.
+ */
+static void reg_tools_getRecursiveGaussianCoefficients(double sigma,
+                                                       double *coefficients)
+{
+   double a0=1.680, a1=3.735, b0=1.783, b1=1.723;
+   double w0=0.6318, w1=1.997, c0=-0.6803, c1=-0.2598;
+   double cos0=cos(w0/sigma), sin0=sin(w0/sigma);
+   double cos1=cos(w1/sigma), sin1=sin(w1/sigma);
+   double exp0=exp(-b0/sigma), exp1=exp(-b1/sigma);
+
+   double *causal=&coefficients[0];
+   double *antiCausal=&coefficients[4];
+   double *denominator=&coefficients[8];
+   causal[0] = a0 + c0;
+   causal[1] = exp1*(c1*sin1-(c0+2.0*a0)*cos1) + exp0*(a1*sin0-(2.0*c0+a0)*cos0);
+   causal[2] = 2.0*exp0*exp1*((a0+c0)*cos1*cos0-a1*cos1*sin0-c1*cos0*sin1) +
+         c0*exp0*exp0 + a0*exp1*exp1;
+   causal[3] = exp1*exp0*exp0*(c1*sin1-c0*cos1) + exp0*exp1*exp1*(a1*sin0-a0*cos0);
+   denominator[0] = -2.0*exp1*cos1 - 2.0*exp0*cos0;
+   denominator[1] = 4.0*cos1*cos0*exp0*exp1 + exp1*exp1 + exp0*exp0;
+   denominator[2] = -2.0*cos0*exp0*exp1*exp1 - 2.0*cos1*exp1*exp0*exp0;
+   denominator[3] = exp0*exp0*exp1*exp1;
+   for(int i=0; i<3; ++i)
+      antiCausal[i] = causal[i+1] - denominator[i]*causal[0];
+   antiCausal[3] = -denominator[3]*causal[0];
+
+   // Normalise the filter gain
+   double numeratorSum=0, denominatorSum=1.0;
+   for(int i=0; i<4; ++i)
+   {
+      numeratorSum += causal[i] + antiCausal[i];
+      denominatorSum += denominator[i];
+   }
+   for(int i=0; i<4; ++i)
+   {
+      causal[i] *= denominatorSum/numeratorSum;
+      antiCausal[i] *= denominatorSum/numeratorSum;
+   }
+}
+/* *************************************************************** */
+/* Apply the recursive Gaussian filter in place to an intensity line and
+ * its associated density line. The values outside of the line are
+ * considered as zero, which does not require any boundary initialisation
+ * as both passes are applied in parallel.
+ */
+template <class DTYPE>
+static void reg_tools_recursiveGaussianLine(DTYPE *intensity,
+                                            float *density,
+                                            int length,
+                                            double *coefficients)
+{
+   double causalIntensity[2048];
+   double causalDensity[2048];
+   double *n=&coefficients[0];
+   double *m=&coefficients[4];
+   double *d=&coefficients[8];
+   // Causal pass
+   double xi[4]= {0,0,0,0}, yi[4]= {0,0,0,0};
+   double xd[4]= {0,0,0,0}, yd[4]= {0,0,0,0};
+   for(int i=0; i<length; ++i)
+   {
+      xi[3]=xi[2]; xi[2]=xi[1]; xi[1]=xi[0]; xi[0]=intensity[i];
+      xd[3]=xd[2]; xd[2]=xd[1]; xd[1]=xd[0]; xd[0]=density[i];
+      causalIntensity[i] = n[0]*xi[0] + n[1]*xi[1] + n[2]*xi[2] + n[3]*xi[3] -
+            d[0]*yi[0] - d[1]*yi[1] - d[2]*yi[2] - d[3]*yi[3];
+      causalDensity[i] = n[0]*xd[0] + n[1]*xd[1] + n[2]*xd[2] + n[3]*xd[3] -
+            d[0]*yd[0] - d[1]*yd[1] - d[2]*yd[2] - d[3]*yd[3];
+      yi[3]=yi[2]; yi[2]=yi[1]; yi[1]=yi[0]; yi[0]=causalIntensity[i];
+      yd[3]=yd[2]; yd[2]=yd[1]; yd[1]=yd[0]; yd[0]=causalDensity[i];
+   }
+   // Anti-causal pass
+   double antiIntensity, antiDensity;
+   for(int j=0; j<4; ++j)
+      xi[j]=yi[j]=xd[j]=yd[j]=0;
+   for(int i=length-1; i>=0; --i)
+   {
+      antiIntensity = m[0]*xi[0] + m[1]*xi[1] + m[2]*xi[2] + m[3]*xi[3] -
+            d[0]*yi[0] - d[1]*yi[1] - d[2]*yi[2] - d[3]*yi[3];
+      antiDensity = m[0]*xd[0] + m[1]*xd[1] + m[2]*xd[2] + m[3]*xd[3] -
+            d[0]*yd[0] - d[1]*yd[1] - d[2]*yd[2] - d[3]*yd[3];
+      xi[3]=xi[2]; xi[2]=xi[1]; xi[1]=xi[0]; xi[0]=intensity[i];
+      xd[3]=xd[2]; xd[2]=xd[1]; xd[1]=xd[0]; xd[0]=density[i];
+      yi[3]=yi[2]; yi[2]=yi[1]; yi[1]=yi[0]; yi[0]=antiIntensity;
+      yd[3]=yd[2]; yd[2]=yd[1]; yd[1]=yd[0]; yd[0]=antiDensity;
+      intensity[i]=static_cast<DTYPE>(causalIntensity[i]+antiIntensity);
+      density[i]=static_cast<float>(causalDensity[i]+antiDensity);
+   }
+}
+/* *************************************************************** */
+/// Number of adjacent lines convolved together along the y and z axes
+#define CONVOLUTION_STRIP_WIDTH 16
+/* Convolve the intensity and density images along the y or z axis. The
+ * lines along these axes are strided in memory, they are thus processed by
+ * strips of CONVOLUTION_STRIP_WIDTH adjacent lines, i.e. consecutive voxels
+ * along the x axis. Every line position of a strip is read and written as
+ * a contiguous block and the inner loops run over the strip width.
+ * The kernel is NULL for the mean filter and recursiveCoefficients is only
+ * used for the recursive Gaussian.
+ */
+template <class DTYPE>
+static void reg_tools_kernelConvolutionStrip(DTYPE *intensityPtr,
+                                             float *densityPtr,
+                                             int *imageDim,
+                                             int axis,
+                                             int radius,
+                                             float *kernel,
+                                             bool useRecursiveGaussian,
+                                             double *recursiveCoefficients)
+{
+   int lineLength = imageDim[axis];
+   size_t lineOffset, rowOffset;
+   int rowNumber;
+   if(axis==1)
+   {
+      lineOffset = imageDim[0];
+      rowOffset = (size_t)imageDim[0]*imageDim[1];
+      rowNumber = imageDim[2];
+   }
+   else
+   {
+      lineOffset = (size_t)imageDim[0]*imageDim[1];
+      rowOffset = imageDim[0];
+      rowNumber = imageDim[1];
+   }
+   int stripPerRow = (imageDim[0]+CONVOLUTION_STRIP_WIDTH-1)/CONVOLUTION_STRIP_WIDTH;
+   int stripNumber = stripPerRow*rowNumber;
+   int stripIndex;
+
+#if defined (_OPENMP)
+#pragma omp parallel default(none) \
+   shared(intensityPtr, densityPtr, imageDim, lineLength, lineOffset, rowOffset, \
+   stripPerRow, stripNumber, radius, kernel, useRecursiveGaussian, recursiveCoefficients) \
+   private(stripIndex)
+#endif
+   {
+      size_t bufferSize = (size_t)lineLength*CONVOLUTION_STRIP_WIDTH;
+      double *bufferIntensity = (double *)malloc(bufferSize*sizeof(double));
+      double *bufferDensity = (double *)malloc(bufferSize*sizeof(double));
+      double *resultIntensity = NULL;
+      double *resultDensity = NULL;
+      if(useRecursiveGaussian)
+      {
+         resultIntensity = (double *)malloc(bufferSize*sizeof(double));
+         resultDensity = (double *)malloc(bufferSize*sizeof(double));
+      }
+      double intensitySum[CONVOLUTION_STRIP_WIDTH];
+      double densitySum[CONVOLUTION_STRIP_WIDTH];
+      int c, k, lineIndex, width, shiftPre, shiftPst;
+      size_t startIndex, index;
+      double *bufferI, *bufferD;
+      double kernelValue;
+
+#if defined (_OPENMP)
+#pragma omp for
+#endif
+      for(stripIndex=0; stripIndex<stripNumber; ++stripIndex)
+      {
+         startIndex = (stripIndex/stripPerRow)*rowOffset +
+               (stripIndex%stripPerRow)*CONVOLUTION_STRIP_WIDTH;
+         width = imageDim[0] - (stripIndex%stripPerRow)*CONVOLUTION_STRIP_WIDTH;
+         if(width>CONVOLUTION_STRIP_WIDTH) width=CONVOLUTION_STRIP_WIDTH;
+
+         // Fetch the strip into the buffers, the unused columns are set to zero
+         for(lineIndex=0; lineIndex<lineLength; ++lineIndex)
+         {
+            index = startIndex + lineIndex*lineOffset;
+            bufferI = &bufferIntensity[lineIndex*CONVOLUTION_STRIP_WIDTH];
+            bufferD = &bufferDensity[lineIndex*CONVOLUTION_STRIP_WIDTH];
+            for(c=0; c<width; ++c)
+            {
+               bufferI[c] = intensityPtr[index+c];
+               bufferD[c] = densityPtr[index+c];
+            }
+            for(c=width; c<CONVOLUTION_STRIP_WIDTH; ++c)
+               bufferI[c] = bufferD[c] = 0;
+         }
+
+         if(useRecursiveGaussian)
+         {
+            double *n = &recursiveCoefficients[0];
+            double *m = &recursiveCoefficients[4];
+            double *d = &recursiveCoefficients[8];
+            // Causal pass
+            for(lineIndex=0; lineIndex<lineLength; ++lineIndex)
+            {
+               for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+                  intensitySum[c] = densitySum[c] = 0;
+               for(k=0; k<4 && k<=lineIndex; ++k)
+               {
+                  bufferI = &bufferIntensity[(lineIndex-k)*CONVOLUTION_STRIP_WIDTH];
+                  bufferD = &bufferDensity[(lineIndex-k)*CONVOLUTION_STRIP_WIDTH];
+                  for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+                  {
+                     intensitySum[c] += n[k]*bufferI[c];
+                     densitySum[c] += n[k]*bufferD[c];
+                  }
+               }
+               for(k=1; k<5 && k<=lineIndex; ++k)
+               {
+                  bufferI = &resultIntensity[(lineIndex-k)*CONVOLUTION_STRIP_WIDTH];
+                  bufferD = &resultDensity[(lineIndex-k)*CONVOLUTION_STRIP_WIDTH];
+                  for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+                  {
+                     intensitySum[c] -= d[k-1]*bufferI[c];
+                     densitySum[c] -= d[k-1]*bufferD[c];
+                  }
+               }
+               memcpy(&resultIntensity[lineIndex*CONVOLUTION_STRIP_WIDTH], intensitySum,
+                     CONVOLUTION_STRIP_WIDTH*sizeof(double));
+               memcpy(&resultDensity[lineIndex*CONVOLUTION_STRIP_WIDTH], densitySum,
+                     CONVOLUTION_STRIP_WIDTH*sizeof(double));
+            }
+            // Anti-causal pass, the causal results are replaced by the
+            // anti-causal ones once they have been saved
+            for(lineIndex=lineLength-1; lineIndex>=0; --lineIndex)
+            {
+               for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+                  intensitySum[c] = densitySum[c] = 0;
+               for(k=1; k<5 && lineIndex+k<lineLength; ++k)
+               {
+                  bufferI = &bufferIntensity[(lineIndex+k)*CONVOLUTION_STRIP_WIDTH];
+                  bufferD = &bufferDensity[(lineIndex+k)*CONVOLUTION_STRIP_WIDTH];
+                  for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+                  {
+                     intensitySum[c] += m[k-1]*bufferI[c];
+                     densitySum[c] += m[k-1]*bufferD[c];
+                  }
+                  bufferI = &resultIntensity[(lineIndex+k)*CONVOLUTION_STRIP_WIDTH];
+                  bufferD = &resultDensity[(lineIndex+k)*CONVOLUTION_STRIP_WIDTH];
+                  for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+                  {
+                     intensitySum[c] -= d[k-1]*bufferI[c];
+                     densitySum[c] -= d[k-1]*bufferD[c];
+                  }
+               }
+               index = startIndex + lineIndex*lineOffset;
+               bufferI = &resultIntensity[lineIndex*CONVOLUTION_STRIP_WIDTH];
+               bufferD = &resultDensity[lineIndex*CONVOLUTION_STRIP_WIDTH];
+               for(c=0; c<width; ++c)
+               {
+                  intensityPtr[index+c] = static_cast<DTYPE>(bufferI[c]+intensitySum[c]);
+                  densityPtr[index+c] = static_cast<float>(bufferD[c]+densitySum[c]);
+               }
+               memcpy(bufferI, intensitySum, CONVOLUTION_STRIP_WIDTH*sizeof(double));
+               memcpy(bufferD, densitySum, CONVOLUTION_STRIP_WIDTH*sizeof(double));
+            }
+         } // recursive Gaussian
+         else if(kernel!=NULL)
+         {
+            for(lineIndex=0; lineIndex<lineLength; ++lineIndex)
+            {
+               // Define the kernel boundaries
+               shiftPre = lineIndex - radius;
+               shiftPst = lineIndex + radius + 1;
+               if(shiftPre<0) shiftPre=0;
+               if(shiftPst>lineLength) shiftPst=lineLength;
+               for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+                  intensitySum[c] = densitySum[c] = 0;
+               for(k=shiftPre; k<shiftPst; ++k)
+               {
+                  kernelValue = kernel[k-lineIndex+radius];
+                  bufferI = &bufferIntensity[k*CONVOLUTION_STRIP_WIDTH];
+                  bufferD = &bufferDensity[k*CONVOLUTION_STRIP_WIDTH];
+                  for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+                  {
+                     intensitySum[c] += kernelValue*bufferI[c];
+                     densitySum[c] += kernelValue*bufferD[c];
+                  }
+               }
+               index = startIndex + lineIndex*lineOffset;
+               for(c=0; c<width; ++c)
+               {
+                  intensityPtr[index+c] = static_cast<DTYPE>(intensitySum[c]);
+                  densityPtr[index+c] = static_cast<float>(densitySum[c]);
+               }
+            }
+         } // kernel convolution
+         else
+         {
+            // Mean filtering using a running sum along the lines
+            for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+               intensitySum[c] = densitySum[c] = 0;
+            for(k=0; k<radius && k<lineLength; ++k)
+            {
+               bufferI = &bufferIntensity[k*CONVOLUTION_STRIP_WIDTH];
+               bufferD = &bufferDensity[k*CONVOLUTION_STRIP_WIDTH];
+               for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+               {
+                  intensitySum[c] += bufferI[c];
+                  densitySum[c] += bufferD[c];
+               }
+            }
+            for(lineIndex=0; lineIndex<lineLength; ++lineIndex)
+            {
+               shiftPst = lineIndex + radius;
+               if(shiftPst<lineLength)
+               {
+                  bufferI = &bufferIntensity[shiftPst*CONVOLUTION_STRIP_WIDTH];
+                  bufferD = &bufferDensity[shiftPst*CONVOLUTION_STRIP_WIDTH];
+                  for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+                  {
+                     intensitySum[c] += bufferI[c];
+                     densitySum[c] += bufferD[c];
+                  }
+               }
+               shiftPre = lineIndex - radius - 1;
+               if(shiftPre>-1)
+               {
+                  bufferI = &bufferIntensity[shiftPre*CONVOLUTION_STRIP_WIDTH];
+                  bufferD = &bufferDensity[shiftPre*CONVOLUTION_STRIP_WIDTH];
+                  for(c=0; c<CONVOLUTION_STRIP_WIDTH; ++c)
+                  {
+                     intensitySum[c] -= bufferI[c];
+                     densitySum[c] -= bufferD[c];
+                  }
+               }
+               index = startIndex + lineIndex*lineOffset;
+               for(c=0; c<width; ++c)
+               {
+                  intensityPtr[index+c] = static_cast<DTYPE>(intensitySum[c]);
+                  densityPtr[index+c] = static_cast<float>(densitySum[c]);
+               }
+            }
+         } // mean filter
+      } // strips
+      free(bufferIntensity);
+      free(bufferDensity);
+      if(resultIntensity!=NULL) free(resultIntensity);
+      if(resultDensity!=NULL) free(resultDensity);
+   } // parallel region
+}
+/* *************************************************************** */
+/* *************************************************************** */
 template <class DTYPE>
 void reg_tools_kernelConvolution_core(nifti_image *image,
                                       float *sigma,
@@ -1177,8 +1515,17 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                }
                if(radius>0)
                {
+                  // Large Gaussian kernels are approximated using a recursive filter
+                  bool useRecursiveGaussian = kernelType==GAUSSIAN_KERNEL &&
+                        temp>RECURSIVE_GAUSSIAN_MIN_SIGMA;
+                  double recursiveCoefficients[12];
+                  if(useRecursiveGaussian)
+                     reg_tools_getRecursiveGaussianCoefficients(temp,
+                                                                recursiveCoefficients);
                   // Allocate the kernel
-                  float kernel[4096];
+                  float *kernel = NULL;
+                  if(!useRecursiveGaussian && kernelType!=MEAN_KERNEL)
+                     kernel = (float *)malloc((2*radius+1)*sizeof(float));
                   double kernelSum=0;
                   // Fill the kernel
                   if(kernelType==CUBIC_SPLINE_KERNEL)
@@ -1194,7 +1541,7 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                         kernelSum += kernel[i+radius];
                      }
                   }
-                  else if(kernelType==GAUSSIAN_KERNEL)
+                  else if(kernelType==GAUSSIAN_KERNEL && !useRecursiveGaussian)
                   {
                      // Compute the Gaussian kernel
                      for(int i=-radius; i<=radius; i++)
@@ -1215,39 +1562,32 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                         kernelSum += kernel[radius+i];
                      }
                   }
-                  else if(kernelType==MEAN_KERNEL && imageDim[2]==1)
-                  {
-                     // Compute the mean kernel
-                     for(int i=-radius; i<=radius; i++)
-                     {
-                        kernel[radius+i]= 1.f;
-                        kernelSum += kernel[radius+i];
-                     }
-                  }
-                  // No kernel is required for the mean filtering
+                  // No kernel is required for the mean filtering as it relies on a running sum
                   // No need for kernel normalisation as this is handle by the density function
 #ifndef NDEBUG
                   char text[255];
                   sprintf(text, "Convolution type[%i] dim[%i] tp[%i] radius[%i] kernelSum[%g]", kernelType, n, t, radius, kernelSum);
                   reg_print_msg_debug(text);
 #endif
-                  int planeNumber, planeIndex, lineOffset;
-                  int lineIndex, shiftPre, shiftPst, k;
-                  switch(n)
+                  // The y and z axes are processed by strips of adjacent lines
+                  if(n>0)
                   {
-                  case 0:
-                     planeNumber=imageDim[1]*imageDim[2];
-                     lineOffset  = 1;
-                     break;
-                  case 1:
-                     planeNumber = imageDim[0]*imageDim[2];
-                     lineOffset  = imageDim[0];
-                     break;
-                  case 2:
-                     planeNumber = imageDim[0]*imageDim[1];
-                     lineOffset  = planeNumber;
-                     break;
+                     reg_tools_kernelConvolutionStrip<DTYPE>(intensityPtr,
+                                                             densityPtr,
+                                                             imageDim,
+                                                             n,
+                                                             radius,
+                                                             kernel,
+                                                             useRecursiveGaussian,
+                                                             recursiveCoefficients);
+                     if(kernel!=NULL)
+                        free(kernel);
+                     continue;
                   }
+                  // Only the x axis is left, its lines are contiguous in memory
+                  int planeNumber = imageDim[1]*imageDim[2];
+                  int lineOffset = 1;
+                  int planeIndex, lineIndex, shiftPre, shiftPst, k;
 
                   size_t realIndex;
                   float *kernelPtr, kernelValue;
@@ -1272,7 +1612,7 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
 #ifdef _USE_SSE
 #pragma omp parallel for default(none) \
    shared(imageDim, intensityPtr, densityPtr, radius, kernel, lineOffset, n, \
-   planeNumber,kernelSum) \
+   planeNumber,kernelSum,useRecursiveGaussian,recursiveCoefficients) \
    private(realIndex,currentIntensityPtr,currentDensityPtr,lineIndex,bufferIntensity, \
    bufferDensity,shiftPre,shiftPst,kernelPtr,kernelValue,densitySum,intensitySum, \
    k, bufferIntensitycur,bufferDensitycur, planeIndex, \
@@ -1280,7 +1620,7 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
 #else
 #pragma omp parallel for default(none) \
    shared(imageDim, intensityPtr, densityPtr, radius, kernel, lineOffset, n, \
-   planeNumber,kernelSum) \
+   planeNumber,kernelSum,useRecursiveGaussian,recursiveCoefficients) \
    private(realIndex,currentIntensityPtr,currentDensityPtr,lineIndex,bufferIntensity, \
    bufferDensity,shiftPre,shiftPst,kernelPtr,kernelValue,densitySum,intensitySum, \
    k, bufferIntensitycur,bufferDensitycur, planeIndex)
@@ -1289,23 +1629,7 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                   // Loop over the different voxel
                   for(planeIndex=0; planeIndex<planeNumber; ++planeIndex)
                   {
-
-                     switch(n)
-                     {
-                     case 0:
-                        realIndex = planeIndex * imageDim[0];
-                        break;
-                     case 1:
-                        realIndex = (planeIndex/imageDim[0]) *
-                              imageDim[0]*imageDim[1] +
-                              planeIndex%imageDim[0];
-                        break;
-                     case 2:
-                        realIndex = planeIndex;
-                        break;
-                     default:
-                        realIndex=0;
-                     }
+                     realIndex = planeIndex * imageDim[0];
                      // Fetch the current line into a stack buffer
                      currentIntensityPtr= &intensityPtr[realIndex];
                      currentDensityPtr  = &densityPtr[realIndex];
@@ -1316,7 +1640,20 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                         currentIntensityPtr       += lineOffset;
                         currentDensityPtr         += lineOffset;
                      }
-                     if(kernelSum>0)
+                     if(useRecursiveGaussian)
+                     {
+                        reg_tools_recursiveGaussianLine<DTYPE>(bufferIntensity,
+                                                               bufferDensity,
+                                                               imageDim[n],
+                                                               recursiveCoefficients);
+                        for(lineIndex=0; lineIndex<imageDim[n]; ++lineIndex)
+                        {
+                           intensityPtr[realIndex] = bufferIntensity[lineIndex];
+                           densityPtr[realIndex] = bufferDensity[lineIndex];
+                           realIndex += lineOffset;
+                        }
+                     } // recursive Gaussian
+                     else if(kernelSum>0)
                      {
                         // Perform the kernel convolution along 1 line
                         for(lineIndex=0; lineIndex<imageDim[n]; ++lineIndex)
@@ -1386,39 +1723,31 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                      } // kernel sum
                      else
                      {
-                        for(lineIndex=1; lineIndex<imageDim[n]; ++lineIndex)
+                        // Mean filtering using a running sum along the line: every
+                        // voxel costs one addition and one subtraction independently
+                        // of the kernel radius
+                        bufferIntensitycur = 0;
+                        bufferDensitycur = 0;
+                        for(k=0; k<radius && k<imageDim[n]; ++k)
                         {
-                           bufferIntensity[lineIndex]+=bufferIntensity[lineIndex-1];
-                           bufferDensity[lineIndex]+=bufferDensity[lineIndex-1];
+                           bufferIntensitycur += bufferIntensity[k];
+                           bufferDensitycur += bufferDensity[k];
                         }
-                        shiftPre = -radius - 1;
-                        shiftPst = radius;
-                        for(lineIndex=0; lineIndex<imageDim[n]; ++lineIndex,++shiftPre,++shiftPst)
+                        for(lineIndex=0; lineIndex<imageDim[n]; ++lineIndex)
                         {
-                           if(shiftPre>-1)
+                           // Enter the voxel at the front of the window
+                           shiftPst = lineIndex + radius;
+                           if(shiftPst<imageDim[n])
                            {
-                              if(shiftPst<imageDim[n])
-                              {
-                                 bufferIntensitycur = bufferIntensity[shiftPre]-bufferIntensity[shiftPst];
-                                 bufferDensitycur = bufferDensity[shiftPre]-bufferDensity[shiftPst];
-                              }
-                              else
-                              {
-                                 bufferIntensitycur = bufferIntensity[shiftPre]-bufferIntensity[imageDim[n]-1];
-                                 bufferDensitycur = bufferDensity[shiftPre]-bufferDensity[imageDim[n]-1];
-                              }
+                              bufferIntensitycur += bufferIntensity[shiftPst];
+                              bufferDensitycur += bufferDensity[shiftPst];
                            }
-                           else
+                           // Remove the voxel that left the back of the window
+                           shiftPre = lineIndex - radius - 1;
+                           if(shiftPre>-1)
                            {
-                              if(shiftPst<imageDim[n])
-                              {
-                                 bufferIntensitycur = -bufferIntensity[shiftPst];
-                                 bufferDensitycur = -bufferDensity[shiftPst];
-                              }
-                              else{
-                                 bufferIntensitycur = 0;
-                                 bufferDensitycur = 0;
-                              }
+                              bufferIntensitycur -= bufferIntensity[shiftPre];
+                              bufferDensitycur -= bufferDensity[shiftPre];
                            }
                            intensityPtr[realIndex]=static_cast<DTYPE>(bufferIntensitycur);
                            densityPtr[realIndex]=static_cast<float>(bufferDensitycur);
@@ -1427,6 +1756,8 @@ void reg_tools_kernelConvolution_core(nifti_image *image,
                         } // line convolution of mean filter
                      } // No kernel computation
                   } // pixel in starting plane
+                  if(kernel!=NULL)
+                     free(kernel);
                } // radius > 0
             } // active axis
          } // axes
@@ -26,6 +26,10 @@ typedef enum
    CUBIC_SPLINE_KERNEL
 } NREG_CONV_KERNEL_TYPE;
 
+/// Standard deviation, in voxel, above which the Gaussian convolution
+/// relies on a recursive filter instead of an explicit kernel
+#define RECURSIVE_GAUSSIAN_MIN_SIGMA 8.0
+
 /* *************************************************************** */
 /** @brief This function check some header parameters and correct them in
  * case of error. For example no dimension is lower than one. The scl_sclope
@@ -82,7 +86,9 @@ void reg_getRealImageSpacing(nifti_image *image,
 /** @brief Smooth an image using a Gaussian kernel
  * @param image Image to be smoothed
  * @param sigma Standard deviation of the Gaussian kernel
- * to use. The kernel is bounded between +/- 3 sigma.
+ * to use. The kernel is bounded between +/- 3 sigma. When sigma is larger
+ * than RECURSIVE_GAUSSIAN_MIN_SIGMA voxels, the Gaussian is approximated
+ * using the recursive filter from Deriche and is not bounded.
  * @param axis Boolean array to specify which axis have to be
  * smoothed. The array follow the dim array of the nifti header.
  */
@@ -0,0 +1,83 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteMatrix.h"
+#include "_reg_globalTrans.h"
+#include "_reg_resampling.h"
+#include "_reg_tools.h"
+
+#define EPS 0.0001
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <floImage> <affineMatrix> <order>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputImageName = argv[1];
+    char *inputMatFileName = argv[2];
+    int interpolation = atoi(argv[3]);
+
+    // Read the input floating image
+    nifti_image *floatingImage = reg_io_ReadImageFile(inputImageName);
+    if (floatingImage == NULL) {
+        reg_print_msg_error("The input floating image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(floatingImage);
+    reg_intensityRescale(floatingImage, 0, 0.f, 1.f);
+
+    // Read the input affine matrix
+    mat44 *inputMatrix = (mat44 *)malloc(sizeof(mat44));
+    reg_tool_ReadAffineFile(inputMatrix, inputMatFileName);
+
+    // Generate the deformation field corresponding to the affine transformation
+    nifti_image *deformationField = nifti_copy_nim_info(floatingImage);
+    deformationField->ndim = deformationField->dim[0] = 5;
+    deformationField->nt = deformationField->dim[4] = 1;
+    deformationField->nu = deformationField->dim[5] = floatingImage->nz > 1 ? 3 : 2;
+    deformationField->nvox = (size_t)deformationField->nx * deformationField->ny *
+            deformationField->nz * deformationField->nu;
+    deformationField->data = (void *)calloc(deformationField->nvox, deformationField->nbyper);
+    reg_affine_getDeformationField(inputMatrix, deformationField);
+
+    // Resample the floating image with and without the deformation field
+    nifti_image *expectedWarped = nifti_copy_nim_info(floatingImage);
+    expectedWarped->data = (void *)malloc(expectedWarped->nvox * expectedWarped->nbyper);
+    reg_resampleImage(floatingImage,
+                      expectedWarped,
+                      deformationField,
+                      NULL,
+                      interpolation,
+                      0.f);
+    nifti_image *affineWarped = nifti_copy_nim_info(floatingImage);
+    affineWarped->data = (void *)malloc(affineWarped->nvox * affineWarped->nbyper);
+    reg_resampleImage_affine(floatingImage,
+                             affineWarped,
+                             inputMatrix,
+                             NULL,
+                             interpolation,
+                             0.f);
+
+    // Compute the difference between both warped images
+    reg_tools_substractImageToImage(expectedWarped, affineWarped, expectedWarped);
+    reg_tools_abs_image(expectedWarped);
+    double max_difference = reg_tools_getMaxValue(expectedWarped, -1);
+
+    nifti_image_free(floatingImage);
+    nifti_image_free(deformationField);
+    nifti_image_free(expectedWarped);
+    nifti_image_free(affineWarped);
+    free(inputMatrix);
+
+    if (max_difference > EPS){
+        fprintf(stderr, "reg_test_affine_resampling error too large: %g (>%g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_affine_resampling ok: %g (<%g)\n",
+            max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
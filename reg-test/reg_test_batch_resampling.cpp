@@ -0,0 +1,117 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_resampling.h"
+#include "_reg_tools.h"
+
+#define EPS 0.000001
+#define VOLUME_NUMBER 5
+
+nifti_image *createWarpedImage(nifti_image *deformationField,
+                               nifti_image *floatingImage)
+{
+    nifti_image *warpedImage = nifti_copy_nim_info(floatingImage);
+    warpedImage->nx = warpedImage->dim[1] = deformationField->nx;
+    warpedImage->ny = warpedImage->dim[2] = deformationField->ny;
+    warpedImage->nz = warpedImage->dim[3] = deformationField->nz;
+    warpedImage->nvox = (size_t)warpedImage->nx * warpedImage->ny *
+            warpedImage->nz * warpedImage->nt * warpedImage->nu;
+    warpedImage->data = (void *)calloc(warpedImage->nvox, warpedImage->nbyper);
+    return warpedImage;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <floImage> <inputDefField> <order>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputImageName = argv[1];
+    char *inputDefImageName = argv[2];
+    int interpolation = atoi(argv[3]);
+
+    // Read the input floating image
+    nifti_image *floatingImage = reg_io_ReadImageFile(inputImageName);
+    if (floatingImage == NULL) {
+        reg_print_msg_error("The input floating image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(floatingImage);
+    // Read the input deformation field image image
+    nifti_image *inputDeformationField = reg_io_ReadImageFile(inputDefImageName);
+    if (inputDeformationField == NULL) {
+        reg_print_msg_error("The input deformation field image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(inputDeformationField);
+
+    // Generate a 4D series and a label image that share the floating space
+    size_t voxelNumber = (size_t)floatingImage->nx * floatingImage->ny * floatingImage->nz;
+    nifti_image *seriesImage = nifti_copy_nim_info(floatingImage);
+    seriesImage->ndim = seriesImage->dim[0] = 4;
+    seriesImage->nt = seriesImage->dim[4] = VOLUME_NUMBER;
+    seriesImage->nvox = voxelNumber * VOLUME_NUMBER;
+    seriesImage->data = (void *)malloc(seriesImage->nvox * seriesImage->nbyper);
+    nifti_image *labelImage = nifti_copy_nim_info(floatingImage);
+    labelImage->datatype = NIFTI_TYPE_UINT8;
+    labelImage->nbyper = sizeof(unsigned char);
+    labelImage->data = (void *)malloc(labelImage->nvox * labelImage->nbyper);
+    float *floatingPtr = static_cast<float *>(floatingImage->data);
+    float *seriesPtr = static_cast<float *>(seriesImage->data);
+    unsigned char *labelPtr = static_cast<unsigned char *>(labelImage->data);
+    for (size_t i = 0; i < voxelNumber; ++i) {
+        for (int t = 0; t < VOLUME_NUMBER; ++t)
+            seriesPtr[t*voxelNumber+i] = floatingPtr[i] * (1.f + 0.1f * t);
+        labelPtr[i] = static_cast<unsigned char>(static_cast<int>(fabs(floatingPtr[i])) % 8);
+    }
+    nifti_image *floatingImages[2] = {seriesImage, labelImage};
+
+    // Resample the images one by one and as a batch
+    nifti_image *expectedWarped[2], *batchWarped[2];
+    for (int n = 0; n < 2; ++n) {
+        expectedWarped[n] = createWarpedImage(inputDeformationField, floatingImages[n]);
+        batchWarped[n] = createWarpedImage(inputDeformationField, floatingImages[n]);
+        reg_resampleImage(floatingImages[n],
+                          expectedWarped[n],
+                          inputDeformationField,
+                          NULL,
+                          interpolation,
+                          0.f);
+    }
+    reg_resampleImageBatch(floatingImages,
+                           batchWarped,
+                           2,
+                           inputDeformationField,
+                           NULL,
+                           interpolation,
+                           0.f);
+
+    // Compute the difference between both warped images
+    double max_difference = 0;
+    for (int n = 0; n < 2; ++n) {
+        reg_tools_changeDatatype<float>(expectedWarped[n]);
+        reg_tools_changeDatatype<float>(batchWarped[n]);
+        reg_tools_substractImageToImage(expectedWarped[n], batchWarped[n], expectedWarped[n]);
+        reg_tools_abs_image(expectedWarped[n]);
+        max_difference = std::max(max_difference,
+                                  (double)reg_tools_getMaxValue(expectedWarped[n], -1));
+        nifti_image_free(expectedWarped[n]);
+        nifti_image_free(batchWarped[n]);
+    }
+
+    nifti_image_free(floatingImage);
+    nifti_image_free(inputDeformationField);
+    nifti_image_free(seriesImage);
+    nifti_image_free(labelImage);
+
+    if (max_difference > EPS){
+        fprintf(stderr, "reg_test_batch_resampling error too large: %g (>%g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_batch_resampling ok: %g (<%g)\n",
+            max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans_regul.h"
+#include "_reg_tools.h"
+
+#define EPS 0.0001
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <inputGrid>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputGridName = argv[1];
+
+    // Read the control point grid
+    nifti_image *controlPointGrid = reg_io_ReadImageFile(inputGridName);
+    if (controlPointGrid == NULL) {
+        reg_print_msg_error("The control point grid image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(controlPointGrid);
+
+    // Compute the bending energy and its gradient with the existing functions
+    nifti_image *expectedGradient = nifti_copy_nim_info(controlPointGrid);
+    expectedGradient->data = (void *)calloc(expectedGradient->nvox, expectedGradient->nbyper);
+    double expectedValue = reg_spline_approxBendingEnergy(controlPointGrid);
+    reg_spline_approxBendingEnergyGradient(controlPointGrid, expectedGradient, 1.f);
+
+    // Compute the bending energy and its gradient using the stencil
+    nifti_image *obtainedGradient = nifti_copy_nim_info(controlPointGrid);
+    obtainedGradient->data = (void *)calloc(obtainedGradient->nvox, obtainedGradient->nbyper);
+    double obtainedValue = reg_spline_approxBendingEnergyStencil(controlPointGrid, obtainedGradient, 1.f);
+    double valueOnly = reg_spline_approxBendingEnergyStencil(controlPointGrid, NULL, 1.f);
+
+    // Compute the gradient only, the returned value is expected to be zero
+    nifti_image *gradientOnly = nifti_copy_nim_info(controlPointGrid);
+    gradientOnly->data = (void *)calloc(gradientOnly->nvox, gradientOnly->nbyper);
+    double skippedValue = reg_spline_approxBendingEnergyStencil(controlPointGrid, gradientOnly, 1.f, false);
+    bool sameGradient = skippedValue == 0. &&
+          memcmp(gradientOnly->data, obtainedGradient->data, gradientOnly->nvox*gradientOnly->nbyper) == 0;
+
+    // The errors are normalised by the expected values
+    double value_difference = fabs(obtainedValue - expectedValue) / expectedValue;
+    double valueOnly_difference = fabs(valueOnly - obtainedValue) / expectedValue;
+    nifti_image *diff_field = nifti_copy_nim_info(obtainedGradient);
+    diff_field->data = (void *)malloc(diff_field->nvox*diff_field->nbyper);
+    reg_tools_substractImageToImage(obtainedGradient, expectedGradient, diff_field);
+    reg_tools_abs_image(diff_field);
+    reg_tools_abs_image(expectedGradient);
+    double gradient_difference = reg_tools_getMaxValue(diff_field, -1) /
+          reg_tools_getMaxValue(expectedGradient, -1);
+
+    // Free allocated images
+    nifti_image_free(gradientOnly);
+    nifti_image_free(diff_field);
+    nifti_image_free(obtainedGradient);
+    nifti_image_free(expectedGradient);
+    nifti_image_free(controlPointGrid);
+
+    if (value_difference > EPS || valueOnly_difference > EPS){
+        fprintf(stderr, "reg_test_bendingEnergy value error too large: %g ( > %g)\n",
+                value_difference>valueOnly_difference?value_difference:valueOnly_difference, EPS);
+        return EXIT_FAILURE;
+    }
+    if (!sameGradient){
+        fprintf(stderr, "reg_test_bendingEnergy error: the gradient differs when the value is not computed\n");
+        return EXIT_FAILURE;
+    }
+    if (gradient_difference > EPS){
+        fprintf(stderr, "reg_test_bendingEnergy gradient error too large: %g ( > %g)\n",
+                gradient_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_bendingEnergy ok: %g %g (<%g)\n",
+            value_difference, gradient_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteGzip.h"
+
+/* Compare the header and the data of two images */
+bool reg_test_sameImage(nifti_image *image1, nifti_image *image2)
+{
+    if (image1 == NULL || image2 == NULL ||
+            image1->datatype != image2->datatype ||
+            image1->nvox != image2->nvox)
+        return false;
+    for (int i = 0; i < 8; ++i)
+        if (image1->dim[i] != image2->dim[i])
+            return false;
+    return memcmp(image1->data, image2->data, image1->nvox * image1->nbyper) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <inputImage> <compressedNiftiImage>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputImageName = argv[1];
+    char *compressedImageName = argv[2];
+
+    // Read the input image
+    nifti_image *inputImage = reg_io_ReadImageFile(inputImageName);
+    if (inputImage == NULL) {
+        reg_print_msg_error("The input image could not be read");
+        return EXIT_FAILURE;
+    }
+
+    // The input volume is repeated along the time axis so that the data
+    // are split into several members, the last one being incomplete
+    size_t volumeSize = (size_t)inputImage->nx * inputImage->ny *
+            inputImage->nz * inputImage->nbyper;
+    int volumeNumber = (int)(3 * REG_GZIP_BLOCK_SIZE / volumeSize) + 2;
+    nifti_image *image = nifti_copy_nim_info(inputImage);
+    image->dim[0] = image->ndim = 4;
+    image->dim[4] = image->nt = volumeNumber;
+    image->dim[5] = image->nu = 1;
+    image->nvox = (size_t)image->nx * image->ny * image->nz * image->nt;
+    image->data = (void *)malloc(image->nvox * image->nbyper);
+    for (int t = 0; t < volumeNumber; ++t)
+        memcpy(&static_cast<char *>(image->data)[t * volumeSize], inputImage->data, volumeSize);
+    nifti_image_free(inputImage);
+
+    // The compressed single file images are written by reg_io_writeBlockGzipNifti
+    reg_io_WriteImageFile(image, compressedImageName);
+    bool blockGzip = reg_io_isBlockGzipFile(compressedImageName);
+
+    // The image is read back in parallel and with the nifti library
+    nifti_image *readImage = reg_io_ReadImageFile(compressedImageName);
+    nifti_image *niftiImage = nifti_image_read(compressedImageName, true);
+    bool sameRead = reg_test_sameImage(image, readImage);
+    bool sameNifti = reg_test_sameImage(image, niftiImage);
+
+    // Free allocated images
+    if (niftiImage != NULL)
+        nifti_image_free(niftiImage);
+    if (readImage != NULL)
+        nifti_image_free(readImage);
+    nifti_image_free(image);
+
+    if (!blockGzip || !sameRead || !sameNifti){
+        fprintf(stderr, "reg_test_blockGzip error: the compressed image differs from the input image (block gzip: %i, read: %i, nifti: %i)\n",
+                blockGzip, sameRead, sameNifti);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_blockGzip ok: %i volumes\n", volumeNumber);
+#endif
+
+    return EXIT_SUCCESS;
+}
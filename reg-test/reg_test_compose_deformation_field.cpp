@@ -45,14 +45,37 @@ int main(int argc, char **argv)
                         test_field,
                         NULL);
 
+   // Compose the same field twice using a chain and two compositions
+   nifti_image *chain_field=nifti_copy_nim_info(inputDeformationField);
+   chain_field->data=(void *)malloc(chain_field->nvox*chain_field->nbyper);
+   memcpy(chain_field->data, test_field->data, chain_field->nvox*chain_field->nbyper);
+   nifti_image *twice_field=nifti_copy_nim_info(inputDeformationField);
+   twice_field->data=(void *)malloc(twice_field->nvox*twice_field->nbyper);
+   memcpy(twice_field->data, test_field->data, twice_field->nvox*twice_field->nbyper);
+   nifti_image *chain[2]={inputDeformationField, inputDeformationField};
+   reg_defField_composeChain(chain, 2, chain_field, NULL);
+   reg_defField_compose(inputDeformationField, twice_field, NULL);
+   reg_defField_compose(inputDeformationField, twice_field, NULL);
+   reg_tools_substractImageToImage(twice_field,chain_field,chain_field);
+   reg_tools_abs_image(chain_field);
+   double max_chain_difference=reg_tools_getMaxValue(chain_field, -1);
+
    // Compute the difference between the computed and inputed deformation field
    reg_tools_substractImageToImage(inputComFieldImage,test_field,test_field);
    reg_tools_abs_image(test_field);
-   double max_difference=reg_tools_getMaxValue(test_field);
+   double max_difference=reg_tools_getMaxValue(test_field, -1);
 
    nifti_image_free(inputDeformationField);
    nifti_image_free(inputComFieldImage);
    nifti_image_free(test_field);
+   nifti_image_free(chain_field);
+   nifti_image_free(twice_field);
+
+   if(max_chain_difference>EPS){
+      fprintf(stderr, "reg_test_compose_deformation_field chain error too large: %g (>%g)\n",
+              max_chain_difference, EPS);
+      return EXIT_FAILURE;
+   }
 
    if(max_difference>EPS){
       fprintf(stderr, "reg_test_compose_deformation_field error too large: %g (>%g)\n",
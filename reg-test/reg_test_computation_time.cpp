@@ -7,14 +7,17 @@
 //#define COMPUTE_DEF_SPLINE
 //#define COMPUTE_DEF_COMP
 #define COMPUTE_RESAMPLING
+#define COMPUTE_RESAMPLING_ORDER
 #define COMPUTE_SP_GRAD
 #define COMPUTE_NMI
+#define COMPUTE_NMI_SCALING
 #define COMPUTE_NMI_GRAD
 #define COMPUTE_BE
 #define COMPUTE_BE_GRAD
 #define COMPUTE_LE
 #define COMPUTE_LE_GRAD
 #define COMPUTE_VOX_GRID_CONV
+#define COMPUTE_CONVOLUTION
 
 int main(int argc, char **argv)
 {
@@ -188,6 +191,29 @@ int main(int argc, char **argv)
            total_time/(float)nmi_iteration, total_time);
 #endif
 
+#if defined (COMPUTE_NMI_SCALING) && defined (_OPENMP)
+    // Compute the NMI using an increasing number of threads
+#ifdef ONLY_ONE_ITERATION
+    const int nmi_scaling_iteration=1;
+#else
+    const int nmi_scaling_iteration=150;
+#endif
+    const int max_thread_number=omp_get_max_threads();
+    double single_thread_time=0;
+    for(int thread_number=1;thread_number<=max_thread_number;thread_number*=2){
+        omp_set_num_threads(thread_number);
+        double start_wtime=omp_get_wtime();
+        for(int i=0;i<nmi_scaling_iteration;++i)
+            nmi->GetSimilarityMeasureValue();
+        double scaling_time=omp_get_wtime()-start_wtime;
+        if(thread_number==1) single_thread_time=scaling_time;
+        printf("Compute NMI with %i thread(s) in %g second(s) per iteration [speedup %g]\n",
+               thread_number, scaling_time/(double)nmi_scaling_iteration,
+               single_thread_time/scaling_time);
+    }
+    omp_set_num_threads(max_thread_number);
+#endif
+
 #ifdef COMPUTE_RESAMPLING
     // Warp the floating image the NMI
 #ifdef ONLY_ONE_ITERATION
@@ -209,6 +235,88 @@ int main(int argc, char **argv)
            total_time/(float)resample_iteration, total_time);
 #endif
 
+#ifdef COMPUTE_RESAMPLING_ORDER
+    // Compare the templated resampling kernels with the previous runtime-dispatched
+    // ones for floating images of different datatypes and every interpolation order
+#ifdef ONLY_ONE_ITERATION
+    const int resample_order_iteration=1;
+#else
+    const int resample_order_iteration=15;
+#endif
+    reg_affine_getDeformationField(&affine,
+                                   defFieldOne,
+                                   false,
+                                   mask);
+    const int resample_datatype[3]={NIFTI_TYPE_UINT8, NIFTI_TYPE_INT16, NIFTI_TYPE_FLOAT32};
+    const char *resample_datatype_name[3]={"uchar","short","float"};
+    const int resample_order[4]={0,1,3,4};
+    for(int d=0;d<3;++d){
+       nifti_image *typedFloating = nifti_copy_nim_info(inputImageTwo);
+       typedFloating->datatype = resample_datatype[d];
+       typedFloating->nbyper = resample_datatype[d]==NIFTI_TYPE_UINT8?1:
+             (resample_datatype[d]==NIFTI_TYPE_INT16?2:4);
+       typedFloating->data = (void *)malloc(typedFloating->nvox*typedFloating->nbyper);
+       float *inputPtr = static_cast<float *>(inputImageTwo->data);
+       float minValue = reg_tools_getMinValue(inputImageTwo, -1);
+       float maxValue = reg_tools_getMaxValue(inputImageTwo, -1);
+       for(size_t i=0;i<typedFloating->nvox;++i){
+          float value = inputPtr[i]==inputPtr[i]?
+                   255.f*(inputPtr[i]-minValue)/(maxValue-minValue):0.f;
+          switch(resample_datatype[d]){
+          case NIFTI_TYPE_UINT8:
+             static_cast<unsigned char *>(typedFloating->data)[i]=static_cast<unsigned char>(value);
+             break;
+          case NIFTI_TYPE_INT16:
+             static_cast<short *>(typedFloating->data)[i]=static_cast<short>(value);
+             break;
+          default:
+             static_cast<float *>(typedFloating->data)[i]=value;
+             break;
+          }
+       }
+       nifti_image *typedWarped = nifti_copy_nim_info(typedFloating);
+       typedWarped->data = (void *)malloc(typedWarped->nvox*typedWarped->nbyper);
+       nifti_image *referenceWarped = nifti_copy_nim_info(typedFloating);
+       referenceWarped->data = (void *)malloc(referenceWarped->nvox*referenceWarped->nbyper);
+       for(int o=0;o<4;++o){
+          time(&start);
+          for(int i=0;i<resample_order_iteration;++i)
+             reg_resampleImageReference(typedFloating,
+                                        referenceWarped,
+                                        defFieldOne,
+                                        mask,
+                                        resample_order[o],
+                                        0.f);
+          time(&end);
+          total_time=end-start;
+          printf("Reference resampling %s image with order %i in %g second(s) per iteration [%g]\n",
+                 resample_datatype_name[d], resample_order[o],
+                 total_time/(float)resample_order_iteration, total_time);
+          time(&start);
+          for(int i=0;i<resample_order_iteration;++i)
+             reg_resampleImage(typedFloating,
+                               typedWarped,
+                               defFieldOne,
+                               mask,
+                               resample_order[o],
+                               0.f);
+          time(&end);
+          total_time=end-start;
+          printf("Templated resampling %s image with order %i in %g second(s) per iteration [%g]\n",
+                 resample_datatype_name[d], resample_order[o],
+                 total_time/(float)resample_order_iteration, total_time);
+          if(memcmp(typedWarped->data, referenceWarped->data,
+                    typedWarped->nvox*typedWarped->nbyper)!=0){
+             reg_print_msg_error("The templated and reference resampling differ");
+             return EXIT_FAILURE;
+          }
+       }
+       nifti_image_free(referenceWarped);
+       nifti_image_free(typedFloating);
+       nifti_image_free(typedWarped);
+    }
+#endif
+
 #ifdef COMPUTE_BE
     // Compute the bending energy
 #ifdef ONLY_ONE_ITERATION
@@ -383,6 +491,38 @@ int main(int argc, char **argv)
            total_time/(float)voxel_to_grid_iteration, total_time);
 #endif
 
+#ifdef COMPUTE_CONVOLUTION
+    // Compute the Gaussian convolution along every axis independently and
+    // along all axes
+#ifdef ONLY_ONE_ITERATION
+    const int convolution_iteration=1;
+#else
+    const int convolution_iteration=15;
+#endif
+    const char *convolution_axis_name[4]={"x","y","z","all"};
+    for(int a=0;a<4;++a){
+       if(a==2 && warpedImage->nz==1) continue;
+       bool convolution_axis[3]={a==0||a==3, a==1||a==3, a==2||a==3};
+       float convolution_sigma[1]={-3.f};
+       time(&start);
+       for(int i=0;i<convolution_iteration;++i){
+          memcpy(warpedImage->data, inputImageOne->data,
+                 warpedImage->nvox*warpedImage->nbyper);
+          reg_tools_kernelConvolution(warpedImage,
+                                      convolution_sigma,
+                                      GAUSSIAN_KERNEL,
+                                      mask,
+                                      NULL, // all volumes are considered as active
+                                      convolution_axis);
+       }
+       time(&end);
+       total_time=end-start;
+       printf("Gaussian convolution along %s axis in %g second(s) per iteration [%g]\n",
+              convolution_axis_name[a],
+              total_time/(float)convolution_iteration, total_time);
+    }
+#endif
+
     free(mask);
 
     nifti_image_free(defFieldOne);
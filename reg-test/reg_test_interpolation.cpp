@@ -14,6 +14,7 @@
 
 #define EPS 0.000001
 #define EPS_SINGLE 0.0001
+#define EPS_SINC 0.00001
 
 void test(AladinContent *con, const unsigned int interp, int platformCode) {
 
@@ -85,6 +86,20 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    // The sinc interpolation uses a tabulated kernel. The expected warped image is
+    // generated with the analytic kernel and the input warped image only defines the space
+    if(interpolation==4){
+        int oversampling = reg_getWindowedSincOversampling();
+        reg_setWindowedSincOversampling(0);
+        reg_resampleImage(floatingImage,
+                          warpedImage,
+                          inputDeformationField,
+                          NULL,
+                          interpolation,
+                          std::numeric_limits<float>::quiet_NaN());
+        reg_setWindowedSincOversampling(oversampling);
+    }
+
     // Initialize a deformation field image
     nifti_image *test_warped=nifti_copy_nim_info(warpedImage);
     test_warped->data=(void *)malloc(test_warped->nvox*test_warped->nbyper);
@@ -117,6 +132,11 @@ int main(int argc, char **argv)
     if(isDouble == 0) {
         proper_eps = EPS_SINGLE;
     }
+    if(interpolation==4) {
+        // The tabulated kernel error is relative to the intensity range
+        proper_eps = EPS_SINC * (reg_tools_getMaxValue(floatingImage, -1) -
+                                 reg_tools_getMinValue(floatingImage, -1));
+    }
 
     con->setCurrentWarped(test_warped);
     con->setCurrentDeformationField(inputDeformationField);
@@ -0,0 +1,70 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_tools.h"
+
+#define EPS 0.001
+
+int main(int argc, char **argv)
+{
+   if(argc!=2)
+   {
+      fprintf(stderr, "Usage: %s <inputDefField>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   char *inputDefFieldImageName=argv[1];
+
+   // Read the input deformation field image image
+   nifti_image *inputDeformationField = reg_io_ReadImageFile(inputDefFieldImageName);
+   if(inputDeformationField==NULL){
+      reg_print_msg_error("The input deformation field image could not be read");
+      return EXIT_FAILURE;
+   }
+   if(inputDeformationField->nz<2){
+      reg_print_msg_error("The multiresolution inversion only supports 3D deformation fields");
+      return EXIT_FAILURE;
+   }
+
+   // Invert the deformation field using the multiresolution scheme
+   nifti_image *inverse_field=nifti_copy_nim_info(inputDeformationField);
+   inverse_field->data=(void *)malloc(inverse_field->nvox*inverse_field->nbyper);
+   reg_defFieldInvertMultigrid(inputDeformationField,
+                               inverse_field,
+                               1.0e-4f,
+                               50);
+
+   // Compose the input field with its inverse
+   nifti_image *test_field=nifti_copy_nim_info(inverse_field);
+   test_field->data=(void *)malloc(test_field->nvox*test_field->nbyper);
+   memcpy(test_field->data, inverse_field->data, test_field->nvox*test_field->nbyper);
+   reg_defField_compose(inputDeformationField,
+                        test_field,
+                        NULL);
+
+   // Create an identity deformation field
+   nifti_image *identity_field=nifti_copy_nim_info(inputDeformationField);
+   identity_field->data=(void *)calloc(identity_field->nvox,identity_field->nbyper);
+   reg_getDeformationFromDisplacement(identity_field);
+
+   // Compute the residual |phi(inv(x)) - x|
+   reg_tools_substractImageToImage(test_field,identity_field,test_field);
+   reg_tools_abs_image(test_field);
+   double mean_residual=reg_tools_getMeanValue(test_field);
+
+   nifti_image_free(inputDeformationField);
+   nifti_image_free(inverse_field);
+   nifti_image_free(test_field);
+   nifti_image_free(identity_field);
+
+   if(mean_residual>EPS){
+      fprintf(stderr, "reg_test_invert_deformation_field residual too large: %g (>%g)\n",
+              mean_residual, EPS);
+      return EXIT_FAILURE;
+   }
+#ifndef NDEBUG
+   fprintf(stdout, "reg_test_invert_deformation_field ok: %g (<%g)\n",
+           mean_residual, EPS);
+#endif
+
+   return EXIT_SUCCESS;
+}
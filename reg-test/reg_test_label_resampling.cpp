@@ -0,0 +1,119 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_resampling.h"
+#include "_reg_tools.h"
+
+#define LABEL_NUMBER 8
+#define EPS 0.000001
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <floImage> <inputDefField> <order>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputImageName = argv[1];
+    char *inputDefImageName = argv[2];
+    int interpolation = atoi(argv[3]);
+
+    // Read the input floating image
+    nifti_image *floatingImage = reg_io_ReadImageFile(inputImageName);
+    if (floatingImage == NULL) {
+        reg_print_msg_error("The input floating image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(floatingImage);
+    reg_intensityRescale(floatingImage, 0, 0.f, 1.f);
+    // Read the input deformation field image image
+    nifti_image *inputDeformationField = reg_io_ReadImageFile(inputDefImageName);
+    if (inputDeformationField == NULL) {
+        reg_print_msg_error("The input deformation field image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(inputDeformationField);
+
+    // Generate a label image from the intensities
+    size_t floatingVoxelNumber = (size_t)floatingImage->nx * floatingImage->ny * floatingImage->nz;
+    float *floatingPtr = static_cast<float *>(floatingImage->data);
+    for (size_t i = 0; i < floatingVoxelNumber; ++i)
+        floatingPtr[i] = std::min(floorf(floatingPtr[i] * LABEL_NUMBER), (float)(LABEL_NUMBER - 1));
+
+    // Resample the label image
+    nifti_image *warpedImage = nifti_copy_nim_info(floatingImage);
+    warpedImage->nx = warpedImage->dim[1] = inputDeformationField->nx;
+    warpedImage->ny = warpedImage->dim[2] = inputDeformationField->ny;
+    warpedImage->nz = warpedImage->dim[3] = inputDeformationField->nz;
+    warpedImage->nvox = (size_t)warpedImage->nx * warpedImage->ny * warpedImage->nz;
+    warpedImage->data = (void *)calloc(warpedImage->nvox, warpedImage->nbyper);
+    reg_resampleLabelImage(floatingImage,
+                           warpedImage,
+                           inputDeformationField,
+                           NULL,
+                           interpolation,
+                           std::numeric_limits<float>::quiet_NaN());
+
+    // Resample one probability map per label and keep the most probable label
+    size_t warpedVoxelNumber = warpedImage->nvox;
+    float *bestProbability = (float *)malloc(warpedVoxelNumber * sizeof(float));
+    float *secondProbability = (float *)malloc(warpedVoxelNumber * sizeof(float));
+    float *bestLabel = (float *)malloc(warpedVoxelNumber * sizeof(float));
+    for (size_t i = 0; i < warpedVoxelNumber; ++i) {
+        bestProbability[i] = secondProbability[i] = 0.f;
+        bestLabel[i] = std::numeric_limits<float>::quiet_NaN();
+    }
+    nifti_image *labelImage = nifti_copy_nim_info(floatingImage);
+    labelImage->data = (void *)malloc(labelImage->nvox * labelImage->nbyper);
+    nifti_image *probabilityImage = nifti_copy_nim_info(warpedImage);
+    probabilityImage->data = (void *)malloc(probabilityImage->nvox * probabilityImage->nbyper);
+    float *labelPtr = static_cast<float *>(labelImage->data);
+    float *probabilityPtr = static_cast<float *>(probabilityImage->data);
+    for (int l = 0; l < LABEL_NUMBER; ++l) {
+        for (size_t i = 0; i < floatingVoxelNumber; ++i)
+            labelPtr[i] = floatingPtr[i] == l ? 1.f : 0.f;
+        reg_resampleImage(labelImage,
+                          probabilityImage,
+                          inputDeformationField,
+                          NULL,
+                          interpolation,
+                          0.f);
+        for (size_t i = 0; i < warpedVoxelNumber; ++i) {
+            if (probabilityPtr[i] > bestProbability[i]) {
+                secondProbability[i] = bestProbability[i];
+                bestProbability[i] = probabilityPtr[i];
+                bestLabel[i] = l;
+            }
+            else if (probabilityPtr[i] > secondProbability[i])
+                secondProbability[i] = probabilityPtr[i];
+        }
+    }
+
+    // Count the voxels with a different label, ties are ignored
+    size_t mismatchNumber = 0;
+    float *warpedPtr = static_cast<float *>(warpedImage->data);
+    for (size_t i = 0; i < warpedVoxelNumber; ++i) {
+        if (bestProbability[i] - secondProbability[i] < EPS)
+            continue;
+        if (warpedPtr[i] != bestLabel[i])
+            ++mismatchNumber;
+    }
+
+    nifti_image_free(floatingImage);
+    nifti_image_free(inputDeformationField);
+    nifti_image_free(warpedImage);
+    nifti_image_free(labelImage);
+    nifti_image_free(probabilityImage);
+    free(bestProbability);
+    free(secondProbability);
+    free(bestLabel);
+
+    if (mismatchNumber > 0){
+        fprintf(stderr, "reg_test_label_resampling %zu voxels differ from the probabilistic resampling\n",
+                mismatchNumber);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_label_resampling ok\n");
+#endif
+
+    return EXIT_SUCCESS;
+}
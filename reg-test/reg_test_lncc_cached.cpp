@@ -0,0 +1,112 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_globalTrans.h"
+#include "_reg_resampling.h"
+#include "_reg_lncc.h"
+#include "_reg_tools.h"
+
+#define EPS 1e-10
+
+/* Duplicate an image and its data */
+nifti_image *reg_test_copyImage(nifti_image *image)
+{
+    nifti_image *copy = nifti_copy_nim_info(image);
+    copy->data = (void *)malloc(copy->nvox * copy->nbyper);
+    memcpy(copy->data, image->data, copy->nvox * copy->nbyper);
+    return copy;
+}
+
+/* LNCC measure that recomputes the reference local statistics at every call */
+class reg_test_lncc : public reg_lncc
+{
+public:
+    double GetUncachedSimilarityMeasureValue()
+    {
+        this->ClearCachedStatistics();
+        return this->GetSimilarityMeasureValue();
+    }
+};
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <refImage>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+
+    // Read the input reference image
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(referenceImage);
+
+    // The measures rescale their input images, every measure uses its own copies
+    nifti_image *cachedRefImage = reg_test_copyImage(referenceImage);
+    nifti_image *cachedFloImage = reg_test_copyImage(referenceImage);
+    nifti_image *uncachedRefImage = reg_test_copyImage(referenceImage);
+    nifti_image *uncachedFloImage = reg_test_copyImage(referenceImage);
+    nifti_image *warpedImage = reg_test_copyImage(referenceImage);
+    int *mask = (int *)calloc(referenceImage->nvox, sizeof(int));
+
+    reg_lncc *cachedMeasure = new reg_lncc();
+    reg_test_lncc *uncachedMeasure = new reg_test_lncc();
+    cachedMeasure->SetTimepointWeight(0, 1.);
+    uncachedMeasure->SetTimepointWeight(0, 1.);
+    cachedMeasure->InitialiseMeasure(cachedRefImage, cachedFloImage, mask, warpedImage, NULL, NULL);
+    uncachedMeasure->InitialiseMeasure(uncachedRefImage, uncachedFloImage, mask, warpedImage, NULL, NULL);
+
+    // Create the deformation field
+    nifti_image *deformationField = nifti_copy_nim_info(referenceImage);
+    deformationField->ndim = deformationField->dim[0] = 5;
+    deformationField->nt = deformationField->dim[4] = 1;
+    deformationField->nu = deformationField->dim[5] = referenceImage->nz > 1 ? 3 : 2;
+    deformationField->nvox = (size_t)deformationField->nx * deformationField->ny *
+            deformationField->nz * deformationField->nu;
+    deformationField->data = (void *)calloc(deformationField->nvox, deformationField->nbyper);
+
+    // The floating image is translated along x so that it only partly overlaps
+    // the reference image. Every translation is evaluated twice to check that
+    // the cached statistics are reused and that they are updated when the
+    // overlap changes
+    const float translation[6] = {0.25f, 0.25f, 0.4f, 0.4f, 0.f, 0.25f};
+    double max_difference = 0.;
+    for (int it = 0; it < 6; ++it) {
+        mat44 affine;
+        reg_mat44_eye(&affine);
+        affine.m[0][3] = translation[it] * referenceImage->nx * referenceImage->dx;
+        reg_affine_getDeformationField(&affine, deformationField, false, mask);
+        reg_resampleImage(cachedFloImage, warpedImage, deformationField, mask, 1,
+                          std::numeric_limits<float>::quiet_NaN());
+
+        double cachedValue = cachedMeasure->GetSimilarityMeasureValue();
+        double uncachedValue = uncachedMeasure->GetUncachedSimilarityMeasureValue();
+        double difference = fabs(cachedValue - uncachedValue) / fabs(uncachedValue);
+        max_difference = difference > max_difference ? difference : max_difference;
+    }
+
+    // Free allocated images and arrays
+    delete cachedMeasure;
+    delete uncachedMeasure;
+    free(mask);
+    nifti_image_free(deformationField);
+    nifti_image_free(warpedImage);
+    nifti_image_free(uncachedFloImage);
+    nifti_image_free(uncachedRefImage);
+    nifti_image_free(cachedFloImage);
+    nifti_image_free(cachedRefImage);
+    nifti_image_free(referenceImage);
+
+    if (max_difference > EPS){
+        fprintf(stderr, "reg_test_lncc_cached error too large: %g ( > %g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_lncc_cached ok: %g (<%g)\n", max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
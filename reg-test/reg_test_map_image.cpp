@@ -0,0 +1,60 @@
+#include "_reg_ReadWriteImage.h"
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <inputImage> <uncompressedNiftiImage>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputImageName = argv[1];
+    char *mappedImageName = argv[2];
+
+    // Read the input image and save it as an uncompressed nifti image
+    nifti_image *inputImage = reg_io_ReadImageFile(inputImageName);
+    if (inputImage == NULL) {
+        reg_print_msg_error("The input image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_io_WriteImageFile(inputImage, mappedImageName);
+    nifti_image_free(inputImage);
+
+    // The uncompressed image is read and memory mapped
+    nifti_image *expectedImage = reg_io_ReadImageFile(mappedImageName);
+    nifti_image *mappedImage = reg_io_MapImageFile(mappedImageName);
+    if (expectedImage == NULL || mappedImage == NULL) {
+        reg_print_msg_error("The uncompressed image could not be read");
+        return EXIT_FAILURE;
+    }
+
+    // Both images are expected to have the same header and data
+    bool sameHeader = expectedImage->datatype == mappedImage->datatype &&
+            expectedImage->nvox == mappedImage->nvox;
+    for (int i = 0; i < 8; ++i)
+        sameHeader = sameHeader && expectedImage->dim[i] == mappedImage->dim[i];
+    bool sameData = sameHeader &&
+            memcmp(expectedImage->data, mappedImage->data,
+                   expectedImage->nvox * expectedImage->nbyper) == 0;
+
+    // A modification of the mapped data must not be written back to the file
+    memset(mappedImage->data, 0, mappedImage->nbyper);
+    reg_io_FreeImage(mappedImage);
+    mappedImage = reg_io_MapImageFile(mappedImageName);
+    bool sameFile = mappedImage != NULL &&
+            memcmp(expectedImage->data, mappedImage->data, expectedImage->nbyper) == 0;
+
+    // Free allocated images
+    reg_io_FreeImage(mappedImage);
+    reg_io_FreeImage(expectedImage);
+
+    if (!sameHeader || !sameData || !sameFile){
+        fprintf(stderr, "reg_test_map_image error: the mapped image differs from the read image (header: %i, data: %i, file: %i)\n",
+                sameHeader, sameData, sameFile);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_map_image ok\n");
+#endif
+
+    return EXIT_SUCCESS;
+}
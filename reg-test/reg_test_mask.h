@@ -0,0 +1,17 @@
+#ifndef _REG_TEST_MASK_H
+#define _REG_TEST_MASK_H
+
+#include "nifti1_io.h"
+
+/* Allocate a mask over the spatial grid of an image where the voxels of the
+ * first quarter along x are excluded. The returned array is freed by the caller */
+inline int *reg_test_createQuarterMask(nifti_image *image)
+{
+    size_t voxelNumber = (size_t)image->nx * image->ny * image->nz;
+    int *mask = (int *)malloc(voxelNumber * sizeof(int));
+    for (size_t i = 0; i < voxelNumber; ++i)
+        mask[i] = (int)(i % image->nx) < image->nx / 4 ? -1 : 0;
+    return mask;
+}
+
+#endif // _REG_TEST_MASK_H
@@ -0,0 +1,106 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_resampling.h"
+#include "_reg_nmi.h"
+#include "_reg_tools.h"
+
+#define EPS 1e-6
+
+/* Duplicate an image and its data */
+nifti_image *reg_test_copyImage(nifti_image *image)
+{
+    nifti_image *copy = nifti_copy_nim_info(image);
+    copy->data = (void *)malloc(copy->nvox * copy->nbyper);
+    memcpy(copy->data, image->data, copy->nvox * copy->nbyper);
+    return copy;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <refImage> <inputGrid>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputCPPFileName = argv[2];
+
+    // Read the input reference image and control point grid
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(referenceImage);
+    if (referenceImage->nt * referenceImage->nu != 1) {
+        reg_print_msg_error("The input reference image is expected to have one channel");
+        return EXIT_FAILURE;
+    }
+    nifti_image *cppImage = reg_io_ReadImageFile(inputCPPFileName);
+    if (cppImage == NULL) {
+        reg_print_msg_error("The control point grid image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(cppImage);
+
+    // The measure rescales its input images, it uses its own copies
+    nifti_image *floatingImage = reg_test_copyImage(referenceImage);
+    nifti_image *warpedImage = reg_test_copyImage(referenceImage);
+    int *mask = (int *)calloc(referenceImage->nvox, sizeof(int));
+
+    reg_multichannel_nmi *measure = new reg_multichannel_nmi();
+    measure->SetTimepointWeight(0, 1.);
+    measure->InitialiseMeasure(referenceImage, floatingImage, mask, warpedImage, NULL, NULL);
+
+    // Warp the rescaled floating image with NaN padding
+    nifti_image *deformationField = nifti_copy_nim_info(referenceImage);
+    deformationField->ndim = deformationField->dim[0] = 5;
+    deformationField->nt = deformationField->dim[4] = 1;
+    deformationField->nu = deformationField->dim[5] = referenceImage->nz > 1 ? 3 : 2;
+    deformationField->nvox = (size_t)deformationField->nx * deformationField->ny *
+            deformationField->nz * deformationField->nu;
+    deformationField->data = (void *)calloc(deformationField->nvox, deformationField->nbyper);
+    reg_spline_getDeformationField(cppImage, deformationField, mask, false, true);
+    reg_resampleImage(floatingImage, warpedImage, deformationField, mask, 1,
+                      std::numeric_limits<float>::quiet_NaN());
+
+    double multichannelValue = measure->GetSimilarityMeasureValue();
+
+    // The single channel NMI is computed on the same rescaled images
+    double timePointWeight[1] = {1.};
+    unsigned short referenceBinNumber[1] = {68};
+    unsigned short floatingBinNumber[1] = {68};
+    unsigned short totalBinNumber[1] = {68 * 68 + 68 + 68};
+    double *jointHistogramLog[1], *jointHistogramPro[1], *entropyValues[1];
+    jointHistogramLog[0] = (double *)calloc(totalBinNumber[0], sizeof(double));
+    jointHistogramPro[0] = (double *)calloc(totalBinNumber[0], sizeof(double));
+    entropyValues[0] = (double *)calloc(4, sizeof(double));
+    reg_getNMIValue<float>(referenceImage, warpedImage, timePointWeight,
+                           referenceBinNumber, floatingBinNumber, totalBinNumber,
+                           jointHistogramLog, jointHistogramPro, entropyValues, mask);
+    double singleChannelValue = (entropyValues[0][0] + entropyValues[0][1]) / entropyValues[0][2];
+    double max_difference = fabs(multichannelValue - singleChannelValue) / fabs(singleChannelValue);
+
+    // Free allocated images and arrays
+    free(entropyValues[0]);
+    free(jointHistogramPro[0]);
+    free(jointHistogramLog[0]);
+    delete measure;
+    free(mask);
+    nifti_image_free(deformationField);
+    nifti_image_free(warpedImage);
+    nifti_image_free(floatingImage);
+    nifti_image_free(cppImage);
+    nifti_image_free(referenceImage);
+
+    if (max_difference != max_difference || max_difference > EPS){
+        fprintf(stderr, "reg_test_multichannel_nmi error too large: %g ( > %g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_multichannel_nmi ok: %g (<%g)\n", max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_f3d.h"
+#include "_reg_localTrans.h"
+#include "_reg_resampling.h"
+#include "_reg_nmi.h"
+#include "_reg_tools.h"
+
+#define EPS 1e-10
+
+/* Duplicate an image and its data */
+nifti_image *reg_test_copyImage(nifti_image *image)
+{
+    nifti_image *copy = nifti_copy_nim_info(image);
+    copy->data = (void *)malloc(copy->nvox * copy->nbyper);
+    memcpy(copy->data, image->data, copy->nvox * copy->nbyper);
+    return copy;
+}
+
+/* Registration object that gives access to the steps of an optimiser
+ * iteration on the first level */
+class reg_test_f3d : public reg_f3d<float>
+{
+public:
+    reg_test_f3d(nifti_image *referenceImage, nifti_image *controlPointGrid, bool incremental)
+        : reg_f3d<float>(referenceImage->nt, referenceImage->nt)
+    {
+        this->SetReferenceImage(referenceImage);
+        this->SetFloatingImage(referenceImage);
+        this->SetControlPointGridImage(controlPointGrid);
+        this->SetLevelNumber(1);
+        this->SetLevelToPerform(1);
+        this->DoNotPrintOutInformation();
+        this->UseNMISetReferenceBinNumber(0, 64);
+        this->UseNMISetFloatingBinNumber(0, 64);
+        if (incremental)
+            this->UseIncrementalNMI();
+        this->Initialise();
+        // The first level is initialised as done in reg_base<T>::Run()
+        this->currentLevel = 0;
+        this->currentReference = this->referencePyramid[0];
+        this->currentFloating = this->floatingPyramid[0];
+        this->currentMask = this->maskPyramid[0];
+        this->AllocateWarped();
+        this->AllocateDeformationField();
+        this->AllocateWarpedGradient();
+        this->InitialiseCurrentLevel();
+        this->AllocateVoxelBasedMeasureGradient();
+        this->AllocateTransformationGradient();
+        this->InitialiseSimilarity();
+        this->SetOptimiser();
+    }
+    /* Evaluate a trial step along the normalised gradient and restore the
+     * best control point positions, as done by a failed line search */
+    double EvaluateTrialStep(float step)
+    {
+        this->GetObjectiveFunctionGradient();
+        this->NormaliseGradient();
+        this->UpdateParameters(step);
+        double value = this->GetObjectiveFunctionValue();
+        this->optimiser->RestoreBestDOF();
+        return value;
+    }
+    nifti_image *GetGradient()
+    {
+        this->GetObjectiveFunctionGradient();
+        return this->transformationGradient;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <refImage> <inputGrid>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputCPPFileName = argv[2];
+
+    // Read the input reference image and control point grid
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(referenceImage);
+    nifti_image *cppImage = reg_io_ReadImageFile(inputCPPFileName);
+    if (cppImage == NULL) {
+        reg_print_msg_error("The control point grid image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(cppImage);
+
+    // The measures rescale their input images, every measure uses its own copies
+    nifti_image *incRefImage = reg_test_copyImage(referenceImage);
+    nifti_image *incFloImage = reg_test_copyImage(referenceImage);
+    nifti_image *fullRefImage = reg_test_copyImage(referenceImage);
+    nifti_image *fullFloImage = reg_test_copyImage(referenceImage);
+    nifti_image *warpedImage = reg_test_copyImage(referenceImage);
+    int *mask = (int *)calloc(referenceImage->nvox, sizeof(int));
+
+    reg_nmi *incMeasure = new reg_nmi();
+    reg_nmi *fullMeasure = new reg_nmi();
+    incMeasure->SetTimepointWeight(0, 1.);
+    fullMeasure->SetTimepointWeight(0, 1.);
+    incMeasure->InitialiseMeasure(incRefImage, incFloImage, mask, warpedImage, NULL, NULL);
+    fullMeasure->InitialiseMeasure(fullRefImage, fullFloImage, mask, warpedImage, NULL, NULL);
+
+    // Every tile of the incremental measure is a control point cell
+    float tileSpacing[3];
+    tileSpacing[0] = cppImage->dx / referenceImage->dx;
+    tileSpacing[1] = cppImage->dy / referenceImage->dy;
+    tileSpacing[2] = referenceImage->nz > 1 ? cppImage->dz / referenceImage->dz : 1.f;
+    incMeasure->SetIncrementalTileSpacing(tileSpacing);
+
+    // Create the deformation field
+    nifti_image *deformationField = nifti_copy_nim_info(referenceImage);
+    deformationField->ndim = deformationField->dim[0] = 5;
+    deformationField->nt = deformationField->dim[4] = 1;
+    deformationField->nu = deformationField->dim[5] = referenceImage->nz > 1 ? 3 : 2;
+    deformationField->nvox = (size_t)deformationField->nx * deformationField->ny *
+            deformationField->nz * deformationField->nu;
+    deformationField->data = (void *)calloc(deformationField->nvox, deformationField->nbyper);
+
+    // The previous grid is used to flag the moved control points
+    float *previousGrid = (float *)malloc(cppImage->nvox * sizeof(float));
+    float *gridPtr = static_cast<float *>(cppImage->data);
+    size_t nodeNumber = (size_t)cppImage->nx * cppImage->ny * cppImage->nz;
+
+    double max_value_difference = 0., max_histogram_difference = 0.;
+    int binNumber = incMeasure->GetReferenceBinNumber()[0] * incMeasure->GetFloatingBinNumber()[0] +
+            incMeasure->GetReferenceBinNumber()[0] + incMeasure->GetFloatingBinNumber()[0];
+    for (int it = 0; it < 5; ++it) {
+        memcpy(previousGrid, gridPtr, cppImage->nvox * sizeof(float));
+        // A few control points are moved, the first node is moved once to
+        // check the boundary tiles and no node is moved at the last iteration
+        if (it < 4) {
+            for (int n = 0; n < 4; ++n) {
+                size_t node = it == 0 && n == 0 ? 0 : ((size_t)it * 7919 + (size_t)n * 104729) % nodeNumber;
+                for (int d = 0; d < cppImage->nu; ++d)
+                    gridPtr[node + d * nodeNumber] += (d % 2 == 0 ? 0.7f : -0.4f) * cppImage->dx;
+            }
+            incMeasure->SetModifiedControlPoints(cppImage, previousGrid);
+        }
+
+        // Warp the floating image with NaN padding
+        reg_spline_getDeformationField(cppImage, deformationField, mask, false, true);
+        reg_resampleImage(incFloImage, warpedImage, deformationField, mask, 1,
+                          std::numeric_limits<float>::quiet_NaN());
+
+        // Compare the incremental and full evaluations
+        double incValue = incMeasure->GetSimilarityMeasureValue();
+        double fullValue = fullMeasure->GetSimilarityMeasureValue();
+        double value_difference = fabs(incValue - fullValue) / fabs(fullValue);
+        max_value_difference = value_difference > max_value_difference ? value_difference : max_value_difference;
+        double *incHistogram = incMeasure->GetForwardJointHistogramPro()[0];
+        double *fullHistogram = fullMeasure->GetForwardJointHistogramPro()[0];
+        for (int b = 0; b < binNumber; ++b) {
+            double histogram_difference = fabs(incHistogram[b] - fullHistogram[b]);
+            max_histogram_difference = histogram_difference > max_histogram_difference ?
+                        histogram_difference : max_histogram_difference;
+        }
+    }
+
+    // The gradient computed after a rejected trial step has to match the
+    // gradient of a full evaluation for the restored control point grid
+    reg_test_f3d *fullF3D = new reg_test_f3d(referenceImage, cppImage, false);
+    reg_test_f3d *incF3D = new reg_test_f3d(referenceImage, cppImage, true);
+    float *fullGradPtr = static_cast<float *>(fullF3D->GetGradient()->data);
+    incF3D->EvaluateTrialStep(cppImage->dx);
+    nifti_image *incGradient = incF3D->GetGradient();
+    float *incGradPtr = static_cast<float *>(incGradient->data);
+    double max_gradient = 0., max_gradient_difference = 0.;
+    for (size_t i = 0; i < incGradient->nvox; ++i)
+        max_gradient = fabs(fullGradPtr[i]) > max_gradient ? fabs(fullGradPtr[i]) : max_gradient;
+    for (size_t i = 0; i < incGradient->nvox; ++i) {
+        double gradient_difference = fabs(fullGradPtr[i] - incGradPtr[i]) / max_gradient;
+        max_gradient_difference = gradient_difference > max_gradient_difference ?
+                    gradient_difference : max_gradient_difference;
+    }
+    // The gradient histograms do not alter the incremental cache, the next
+    // trial step has to match a full evaluation
+    double fullTrialValue = fullF3D->EvaluateTrialStep(0.5f * cppImage->dx);
+    double incTrialValue = incF3D->EvaluateTrialStep(0.5f * cppImage->dx);
+    double trial_difference = fabs(incTrialValue - fullTrialValue) / fabs(fullTrialValue);
+    max_value_difference = trial_difference > max_value_difference ? trial_difference : max_value_difference;
+    delete incF3D;
+    delete fullF3D;
+
+    // Free allocated images and arrays
+    delete incMeasure;
+    delete fullMeasure;
+    free(previousGrid);
+    free(mask);
+    nifti_image_free(deformationField);
+    nifti_image_free(warpedImage);
+    nifti_image_free(fullFloImage);
+    nifti_image_free(fullRefImage);
+    nifti_image_free(incFloImage);
+    nifti_image_free(incRefImage);
+    nifti_image_free(cppImage);
+    nifti_image_free(referenceImage);
+
+    if (max_value_difference > EPS){
+        fprintf(stderr, "reg_test_nmi_incremental value error too large: %g ( > %g)\n",
+                max_value_difference, EPS);
+        return EXIT_FAILURE;
+    }
+    if (max_histogram_difference > EPS){
+        fprintf(stderr, "reg_test_nmi_incremental histogram error too large: %g ( > %g)\n",
+                max_histogram_difference, EPS);
+        return EXIT_FAILURE;
+    }
+    if (max_gradient == 0. || max_gradient_difference > EPS){
+        fprintf(stderr, "reg_test_nmi_incremental gradient error too large: %g ( > %g)\n",
+                max_gradient_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_nmi_incremental ok: %g %g %g (<%g)\n",
+            max_value_difference, max_histogram_difference, max_gradient_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
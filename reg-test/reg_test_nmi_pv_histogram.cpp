@@ -0,0 +1,137 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_resampling.h"
+#include "_reg_nmi.h"
+#include "_reg_tools.h"
+#include "reg_test_mask.h"
+
+#define EPS 0.00001
+#define REF_BIN_NUMBER 64
+#define FLO_BIN_NUMBER 48
+
+/* Cubic B-spline kernel */
+double reg_test_cubicSpline(double x)
+{
+    x = fabs(x);
+    if (x < 1.)
+        return (3. * x * x * x - 6. * x * x + 4.) / 6.;
+    if (x < 2.)
+        return (2. - x) * (2. - x) * (2. - x) / 6.;
+    return 0.;
+}
+
+/* Rescale the intensities of an image so that they cover the range
+ * [-2, binNumber+1], a part of the voxels is then outside of the histogram */
+void reg_test_rescaleIntensities(nifti_image *image, int binNumber)
+{
+    float minValue = reg_tools_getMinValue(image, -1);
+    float maxValue = reg_tools_getMaxValue(image, -1);
+    float *imagePtr = static_cast<float *>(image->data);
+    for (size_t i = 0; i < image->nvox; ++i)
+        imagePtr[i] = -2.f + (binNumber + 3.f) * (imagePtr[i] - minValue) / (maxValue - minValue);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <refImage> <inputDefField>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputDefImageName = argv[2];
+
+    // Read the input reference image
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(referenceImage);
+    // Read the input deformation field image image
+    nifti_image *inputDeformationField = reg_io_ReadImageFile(inputDefImageName);
+    if (inputDeformationField == NULL) {
+        reg_print_msg_error("The input deformation field image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(inputDeformationField);
+
+    size_t voxelNumber = (size_t)referenceImage->nx * referenceImage->ny * referenceImage->nz;
+    // The masked out voxels must not contribute to the histogram
+    int *mask = reg_test_createQuarterMask(referenceImage);
+
+    // The warped image is padded with NaN values
+    nifti_image *warpedImage = nifti_copy_nim_info(referenceImage);
+    warpedImage->data = (void *)calloc(warpedImage->nvox, warpedImage->nbyper);
+    reg_resampleImage(referenceImage, warpedImage, inputDeformationField, NULL, 1,
+                      std::numeric_limits<float>::quiet_NaN());
+    reg_test_rescaleIntensities(referenceImage, REF_BIN_NUMBER);
+    reg_test_rescaleIntensities(warpedImage, FLO_BIN_NUMBER);
+
+    // Compute the Parzen window histogram
+    _reg_nmiPVBuffer pvBuffer;
+    pvBuffer.voxelNumber = voxelNumber;
+    pvBuffer.refFirstBin = (short *)malloc(voxelNumber * sizeof(short));
+    pvBuffer.warFirstBin = (short *)malloc(voxelNumber * sizeof(short));
+    for (int k = 0; k < 3; ++k) {
+        pvBuffer.refWeight[k] = (float *)malloc(voxelNumber * sizeof(float));
+        pvBuffer.warWeight[k] = (float *)malloc(voxelNumber * sizeof(float));
+        pvBuffer.warDerivative[k] = (float *)malloc(voxelNumber * sizeof(float));
+    }
+    double *jointHistogram = (double *)malloc(REF_BIN_NUMBER * FLO_BIN_NUMBER * sizeof(double));
+    reg_getNMIPVHistogram<float>(referenceImage, warpedImage, 0, REF_BIN_NUMBER, FLO_BIN_NUMBER,
+                                 mask, &pvBuffer, jointHistogram);
+
+    // The expected histogram is filled by evaluating the kernel for every bin
+    double *expectedHistogram = (double *)calloc(REF_BIN_NUMBER * FLO_BIN_NUMBER, sizeof(double));
+    float *referencePtr = static_cast<float *>(referenceImage->data);
+    float *warpedPtr = static_cast<float *>(warpedImage->data);
+    for (size_t i = 0; i < voxelNumber; ++i) {
+        if (mask[i] < 0 || referencePtr[i] != referencePtr[i] || warpedPtr[i] != warpedPtr[i])
+            continue;
+        for (int w = 0; w < FLO_BIN_NUMBER; ++w) {
+            double warWeight = reg_test_cubicSpline(warpedPtr[i] - w);
+            if (warWeight == 0)
+                continue;
+            for (int r = 0; r < REF_BIN_NUMBER; ++r)
+                expectedHistogram[r + w * REF_BIN_NUMBER] +=
+                        reg_test_cubicSpline(referencePtr[i] - r) * warWeight;
+        }
+    }
+
+    // The difference is relative to the largest bin
+    double max_value = 0., max_difference = 0.;
+    for (int b = 0; b < REF_BIN_NUMBER * FLO_BIN_NUMBER; ++b)
+        max_value = expectedHistogram[b] > max_value ? expectedHistogram[b] : max_value;
+    for (int b = 0; b < REF_BIN_NUMBER * FLO_BIN_NUMBER; ++b) {
+        double difference = fabs(jointHistogram[b] - expectedHistogram[b]) / max_value;
+        if (difference != difference)
+            difference = std::numeric_limits<double>::infinity();
+        max_difference = difference > max_difference ? difference : max_difference;
+    }
+
+    // Free allocated images and arrays
+    free(expectedHistogram);
+    free(jointHistogram);
+    for (int k = 0; k < 3; ++k) {
+        free(pvBuffer.refWeight[k]);
+        free(pvBuffer.warWeight[k]);
+        free(pvBuffer.warDerivative[k]);
+    }
+    free(pvBuffer.refFirstBin);
+    free(pvBuffer.warFirstBin);
+    nifti_image_free(warpedImage);
+    free(mask);
+    nifti_image_free(inputDeformationField);
+    nifti_image_free(referenceImage);
+
+    if (max_difference > EPS){
+        fprintf(stderr, "reg_test_nmi_pv_histogram error too large: %g ( > %g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_nmi_pv_histogram ok: %g (<%g)\n", max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_resampling.h"
+#include "_reg_nmi.h"
+#include "_reg_tools.h"
+
+#define EPS 1e-10
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <refImage> <inputGrid>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputCPPFileName = argv[2];
+
+    // Read the input reference image and control point grid
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(referenceImage);
+    nifti_image *cppImage = reg_io_ReadImageFile(inputCPPFileName);
+    if (cppImage == NULL) {
+        reg_print_msg_error("The control point grid image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(cppImage);
+
+    // The reference image is warped to obtain a second image
+    nifti_image *warpedImage = nifti_copy_nim_info(referenceImage);
+    warpedImage->data = (void *)calloc(warpedImage->nvox, warpedImage->nbyper);
+    nifti_image *deformationField = nifti_copy_nim_info(referenceImage);
+    deformationField->ndim = deformationField->dim[0] = 5;
+    deformationField->nt = deformationField->dim[4] = 1;
+    deformationField->nu = deformationField->dim[5] = referenceImage->nz > 1 ? 3 : 2;
+    deformationField->nvox = (size_t)deformationField->nx * deformationField->ny *
+            deformationField->nz * deformationField->nu;
+    deformationField->data = (void *)calloc(deformationField->nvox, deformationField->nbyper);
+    reg_spline_getDeformationField(cppImage, deformationField, NULL, false, true);
+    reg_resampleImage(referenceImage, warpedImage, deformationField, NULL, 1,
+                      std::numeric_limits<float>::quiet_NaN());
+
+    // The bin numbers are not all multiples of the SSE and AVX2 vector widths
+    // and the reference and floating bin numbers differ
+    const int binNumbers[4][2] = {{68, 68}, {17, 33}, {64, 5}, {3, 70}};
+    size_t voxelNumber = (size_t)referenceImage->nx * referenceImage->ny * referenceImage->nz;
+    NREG_SIMD_TYPE detectedSupport = reg_getSIMDSupport();
+
+    double max_entropy_difference = 0., max_histogram_difference = 0.;
+    for (int b = 0; b < 4; ++b) {
+        int refBinNumber = binNumbers[b][0];
+        int floBinNumber = binNumbers[b][1];
+        int totalBinNumber = refBinNumber * floBinNumber + refBinNumber + floBinNumber;
+
+        // Fill the joint histogram from the rescaled images
+        nifti_image *refBinImage = nifti_copy_nim_info(referenceImage);
+        refBinImage->data = (void *)malloc(refBinImage->nvox * refBinImage->nbyper);
+        memcpy(refBinImage->data, referenceImage->data, refBinImage->nvox * refBinImage->nbyper);
+        reg_intensityRescale(refBinImage, 0, 2.f, refBinNumber - 3);
+        nifti_image *floBinImage = nifti_copy_nim_info(warpedImage);
+        floBinImage->data = (void *)malloc(floBinImage->nvox * floBinImage->nbyper);
+        memcpy(floBinImage->data, warpedImage->data, floBinImage->nvox * floBinImage->nbyper);
+        reg_intensityRescale(floBinImage, 0, 2.f, floBinNumber - 3);
+        float *refBinPtr = static_cast<float *>(refBinImage->data);
+        float *floBinPtr = static_cast<float *>(floBinImage->data);
+        double *histogram = (double *)calloc(totalBinNumber, sizeof(double));
+        for (size_t i = 0; i < voxelNumber; ++i) {
+            if (refBinPtr[i] == refBinPtr[i] && floBinPtr[i] == floBinPtr[i])
+                ++histogram[static_cast<int>(floBinPtr[i]) * refBinNumber + static_cast<int>(refBinPtr[i])];
+        }
+        nifti_image_free(refBinImage);
+        nifti_image_free(floBinImage);
+
+        // The scalar implementation is used as reference
+        double *expectedPro = (double *)malloc(totalBinNumber * sizeof(double));
+        double *expectedLog = (double *)malloc(totalBinNumber * sizeof(double));
+        double expectedEntropies[4];
+        memcpy(expectedPro, histogram, totalBinNumber * sizeof(double));
+        reg_getNMIEntropies(expectedPro, expectedLog, expectedEntropies,
+                            refBinNumber, floBinNumber, true, NO_SIMD);
+
+        // Every instruction set supported by the CPU is compared to the reference
+        double *pro = (double *)malloc(totalBinNumber * sizeof(double));
+        double *log = (double *)malloc(totalBinNumber * sizeof(double));
+        double entropies[4];
+        for (int simd = NO_SIMD; simd <= detectedSupport; ++simd) {
+            memcpy(pro, histogram, totalBinNumber * sizeof(double));
+            reg_getNMIEntropies(pro, log, entropies, refBinNumber, floBinNumber,
+                                true, (NREG_SIMD_TYPE)simd);
+            for (int e = 0; e < 4; ++e) {
+                double difference = fabs(entropies[e] - expectedEntropies[e]) / fabs(expectedEntropies[e]);
+                if (difference != difference)
+                    difference = std::numeric_limits<double>::infinity();
+                max_entropy_difference = difference > max_entropy_difference ?
+                            difference : max_entropy_difference;
+            }
+            for (int i = 0; i < totalBinNumber; ++i) {
+                double difference = fabs(pro[i] - expectedPro[i]);
+                if (difference != difference)
+                    difference = std::numeric_limits<double>::infinity();
+                max_histogram_difference = difference > max_histogram_difference ?
+                            difference : max_histogram_difference;
+            }
+        }
+
+        free(log);
+        free(pro);
+        free(expectedLog);
+        free(expectedPro);
+        free(histogram);
+    }
+
+    // Free allocated images
+    nifti_image_free(deformationField);
+    nifti_image_free(warpedImage);
+    nifti_image_free(cppImage);
+    nifti_image_free(referenceImage);
+
+    if (max_entropy_difference > EPS){
+        fprintf(stderr, "reg_test_nmi_simd entropy error too large: %g ( > %g)\n",
+                max_entropy_difference, EPS);
+        return EXIT_FAILURE;
+    }
+    if (max_histogram_difference > EPS){
+        fprintf(stderr, "reg_test_nmi_simd histogram error too large: %g ( > %g)\n",
+                max_histogram_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_nmi_simd ok: %g %g (<%g), instruction set up to %i tested\n",
+            max_entropy_difference, max_histogram_difference, EPS, (int)detectedSupport);
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteMatrix.h"
+#include "_reg_globalTrans.h"
+#include "_reg_localTrans_jac.h"
+#include "_reg_resampling.h"
+#include "_reg_tools.h"
+
+#define EPS_MEAN 0.005
+#define EPS_MAX 0.1
+
+int main(int argc, char **argv)
+{
+    if (argc != 6) {
+        fprintf(stderr, "Usage: %s <floImage> <inputTransformation> <transType> <order> <psfAlgorithm>\n", argv[0]);
+        fprintf(stderr, "<transType>\t0 - affine matrix, 1 - deformation field\n");
+        return EXIT_FAILURE;
+    }
+
+    char *inputImageName = argv[1];
+    char *inputTransName = argv[2];
+    int transType = atoi(argv[3]);
+    int interpolation = atoi(argv[4]);
+    char psfAlgorithm = (char)atoi(argv[5]);
+
+    // Read the input floating image
+    nifti_image *floatingImage = reg_io_ReadImageFile(inputImageName);
+    if (floatingImage == NULL) {
+        reg_print_msg_error("The input floating image could not be read");
+        return EXIT_FAILURE;
+    }
+    if (floatingImage->nz < 2) {
+        reg_print_msg_error("The PSF resampling is only implemented for 3D images");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(floatingImage);
+    reg_intensityRescale(floatingImage, 0, 0.f, 1.f);
+
+    // Read the input transformation
+    mat44 *inputMatrix = NULL;
+    nifti_image *inputDeformationField = NULL;
+    if (transType == 0) {
+        inputMatrix = (mat44 *)malloc(sizeof(mat44));
+        reg_tool_ReadAffineFile(inputMatrix, inputTransName);
+    }
+    else {
+        inputDeformationField = reg_io_ReadImageFile(inputTransName);
+        if (inputDeformationField == NULL) {
+            reg_print_msg_error("The input deformation field image could not be read");
+            return EXIT_FAILURE;
+        }
+        reg_tools_changeDatatype<float>(inputDeformationField);
+    }
+
+    // Define a reference space with half the resolution of the floating image
+    nifti_image *referenceImage = nifti_copy_nim_info(floatingImage);
+    referenceImage->nx = referenceImage->dim[1] = floatingImage->nx / 2;
+    referenceImage->ny = referenceImage->dim[2] = floatingImage->ny / 2;
+    referenceImage->nz = referenceImage->dim[3] = floatingImage->nz / 2;
+    referenceImage->dx = referenceImage->pixdim[1] = 2.f * floatingImage->dx;
+    referenceImage->dy = referenceImage->pixdim[2] = 2.f * floatingImage->dy;
+    referenceImage->dz = referenceImage->pixdim[3] = 2.f * floatingImage->dz;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            referenceImage->qto_xyz.m[i][j] *= 2.f;
+            referenceImage->sto_xyz.m[i][j] *= 2.f;
+        }
+    }
+    referenceImage->qto_ijk = nifti_mat44_inverse(referenceImage->qto_xyz);
+    referenceImage->sto_ijk = nifti_mat44_inverse(referenceImage->sto_xyz);
+    referenceImage->nvox = (size_t)referenceImage->nx * referenceImage->ny *
+            referenceImage->nz * referenceImage->nt;
+    size_t voxelNumber = (size_t)referenceImage->nx * referenceImage->ny *
+            referenceImage->nz;
+
+    // Generate the deformation field and its Jacobian matrices
+    nifti_image *deformationField = nifti_copy_nim_info(referenceImage);
+    deformationField->ndim = deformationField->dim[0] = 5;
+    deformationField->nt = deformationField->dim[4] = 1;
+    deformationField->nu = deformationField->dim[5] = 3;
+    deformationField->nvox = voxelNumber * deformationField->nu;
+    deformationField->data = (void *)calloc(deformationField->nvox, deformationField->nbyper);
+    if (transType == 0)
+        reg_affine_getDeformationField(inputMatrix, deformationField);
+    else {
+        // The input deformation field is defined in the space of the floating
+        // image. It is linearly interpolated at the reference voxel positions
+        mat44 identity;
+        reg_mat44_eye(&identity);
+        nifti_image *positionField = nifti_copy_nim_info(deformationField);
+        positionField->data = (void *)calloc(positionField->nvox, positionField->nbyper);
+        reg_affine_getDeformationField(&identity, positionField);
+        reg_resampleImage(inputDeformationField, deformationField, positionField, NULL, 1, 0.f);
+        nifti_image_free(positionField);
+    }
+    mat33 *jacobian = (mat33 *)malloc(voxelNumber * sizeof(mat33));
+    reg_defField_getJacobianMatrix(deformationField, jacobian);
+
+    // Resample the floating image with the exact and the cached PSF
+    nifti_image *exactWarped = nifti_copy_nim_info(referenceImage);
+    exactWarped->data = (void *)calloc(exactWarped->nvox, exactWarped->nbyper);
+    reg_resampleImage_PSF(floatingImage,
+                          exactWarped,
+                          deformationField,
+                          NULL,
+                          interpolation,
+                          0.f,
+                          jacobian,
+                          psfAlgorithm,
+                          false);
+    nifti_image *cachedWarped = nifti_copy_nim_info(referenceImage);
+    cachedWarped->data = (void *)calloc(cachedWarped->nvox, cachedWarped->nbyper);
+    reg_resampleImage_PSF(floatingImage,
+                          cachedWarped,
+                          deformationField,
+                          NULL,
+                          interpolation,
+                          0.f,
+                          jacobian,
+                          psfAlgorithm,
+                          true);
+
+    // Compute the difference between both warped images
+    reg_tools_substractImageToImage(exactWarped, cachedWarped, exactWarped);
+    reg_tools_abs_image(exactWarped);
+    double max_difference = reg_tools_getMaxValue(exactWarped, -1);
+    double mean_difference = reg_tools_getMeanValue(exactWarped);
+
+    nifti_image_free(floatingImage);
+    nifti_image_free(referenceImage);
+    nifti_image_free(deformationField);
+    nifti_image_free(exactWarped);
+    nifti_image_free(cachedWarped);
+    free(jacobian);
+    if (inputMatrix != NULL)
+        free(inputMatrix);
+    if (inputDeformationField != NULL)
+        nifti_image_free(inputDeformationField);
+
+    if (mean_difference > EPS_MEAN || max_difference > EPS_MAX){
+        fprintf(stderr, "reg_test_psf_cached error too large: mean %g (>%g) max %g (>%g)\n",
+                mean_difference, EPS_MEAN, max_difference, EPS_MAX);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_psf_cached ok: mean %g (<%g) max %g (<%g)\n",
+            mean_difference, EPS_MEAN, max_difference, EPS_MAX);
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,132 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_tools.h"
+
+#define EPS 0.005
+
+/* Explicit masked Gaussian convolution bounded between +/- 3 sigma. The
+ * intensity and the density are convolved along every axis and the result
+ * is normalised by the density, as in reg_tools_kernelConvolution.
+ */
+void explicitGaussianConvolution(nifti_image *image,
+                                 double sigma,
+                                 int *mask)
+{
+    size_t voxelNumber = (size_t)image->nx*image->ny*image->nz;
+    double *intensityPtr = static_cast<double *>(image->data);
+    double *densityPtr = (double *)malloc(voxelNumber*sizeof(double));
+    double *bufferIntensity = (double *)malloc(voxelNumber*sizeof(double));
+    double *bufferDensity = (double *)malloc(voxelNumber*sizeof(double));
+    for(size_t i=0; i<voxelNumber; ++i)
+    {
+        densityPtr[i] = (mask[i]>-1 && intensityPtr[i]==intensityPtr[i])?1.:0.;
+        if(densityPtr[i]==0) intensityPtr[i]=0;
+    }
+    int radius = static_cast<int>(sigma*3.0);
+    int dim[3] = {image->nx, image->ny, image->nz};
+    int offset[3] = {1, image->nx, image->nx*image->ny};
+    for(int n=0; n<3; ++n)
+    {
+        if(dim[n]<2) continue;
+        memcpy(bufferIntensity, intensityPtr, voxelNumber*sizeof(double));
+        memcpy(bufferDensity, densityPtr, voxelNumber*sizeof(double));
+        for(int z=0; z<dim[2]; ++z)
+        {
+            for(int y=0; y<dim[1]; ++y)
+            {
+                for(int x=0; x<dim[0]; ++x)
+                {
+                    int position[3] = {x, y, z};
+                    size_t index = x + offset[1]*y + offset[2]*z;
+                    double intensitySum=0, densitySum=0;
+                    for(int k=-radius; k<=radius; ++k)
+                    {
+                        int p = position[n]+k;
+                        if(p<0 || p>=dim[n]) continue;
+                        double weight = exp(-(double)(k*k)/(2.0*sigma*sigma));
+                        intensitySum += weight * bufferIntensity[index+k*offset[n]];
+                        densitySum += weight * bufferDensity[index+k*offset[n]];
+                    }
+                    intensityPtr[index] = intensitySum;
+                    densityPtr[index] = densitySum;
+                }
+            }
+        }
+    }
+    for(size_t i=0; i<voxelNumber; ++i)
+    {
+        if(mask[i]>-1) intensityPtr[i] /= densityPtr[i];
+        else intensityPtr[i] = std::numeric_limits<double>::quiet_NaN();
+    }
+    free(densityPtr);
+    free(bufferIntensity);
+    free(bufferDensity);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <refImage> <sigmaInVoxel>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputImageName = argv[1];
+    float sigma = atof(argv[2]);
+    if(sigma<=RECURSIVE_GAUSSIAN_MIN_SIGMA) {
+        reg_print_msg_error("The standard deviation does not trigger the recursive filter");
+        return EXIT_FAILURE;
+    }
+
+    // Read the input reference image
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<double>(referenceImage);
+    reg_intensityRescale(referenceImage, 0, 0.f, 1.f);
+    size_t voxelNumber = (size_t)referenceImage->nx *
+            referenceImage->ny * referenceImage->nz;
+
+    // Mask out one voxel in seven to exercise the density normalisation
+    int *mask = (int *)calloc(voxelNumber, sizeof(int));
+    for(size_t i=0; i<voxelNumber; i+=7)
+        mask[i]=-1;
+
+    // Compute the explicit and the recursive convolutions
+    nifti_image *expectedImage = nifti_copy_nim_info(referenceImage);
+    expectedImage->data = (void *)malloc(expectedImage->nvox*expectedImage->nbyper);
+    memcpy(expectedImage->data, referenceImage->data, expectedImage->nvox*expectedImage->nbyper);
+    explicitGaussianConvolution(expectedImage, sigma, mask);
+
+    float sigmaValue[1] = {-sigma};
+    reg_tools_kernelConvolution(referenceImage,
+                                sigmaValue,
+                                GAUSSIAN_KERNEL,
+                                mask);
+
+    // Compare both results over the mask
+    double max_difference = 0;
+    double *expectedPtr = static_cast<double *>(expectedImage->data);
+    double *computedPtr = static_cast<double *>(referenceImage->data);
+    for(size_t i=0; i<voxelNumber; ++i)
+    {
+        if(mask[i]>-1)
+            max_difference = std::max(max_difference, fabs(expectedPtr[i]-computedPtr[i]));
+    }
+
+    nifti_image_free(referenceImage);
+    nifti_image_free(expectedImage);
+    free(mask);
+
+    if (max_difference > EPS){
+        fprintf(stderr, "reg_test_recursiveConvolution error too large: %g (>%g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_recursiveConvolution ok: %g (<%g)\n",
+            max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
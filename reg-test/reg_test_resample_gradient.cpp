@@ -0,0 +1,120 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_resampling.h"
+#include "_reg_tools.h"
+#include "reg_test_mask.h"
+
+#define EPS 0.00001
+
+/* Returns the maximal absolute difference between two images of the same
+ * size relative to the largest absolute value of the first image. Two NaN
+ * values are considered equal */
+double reg_test_maxDifference(nifti_image *image1, nifti_image *image2)
+{
+    float *ptr1 = static_cast<float *>(image1->data);
+    float *ptr2 = static_cast<float *>(image2->data);
+    double max_value = 0., max_difference = 0.;
+    for (size_t i = 0; i < image1->nvox; ++i)
+        if (ptr1[i] == ptr1[i])
+            max_value = fabs(ptr1[i]) > max_value ? fabs(ptr1[i]) : max_value;
+    for (size_t i = 0; i < image1->nvox; ++i) {
+        if (ptr1[i] != ptr1[i] || ptr2[i] != ptr2[i]) {
+            if (ptr1[i] == ptr1[i] || ptr2[i] == ptr2[i])
+                return std::numeric_limits<double>::infinity();
+            continue;
+        }
+        double difference = fabs(ptr1[i] - ptr2[i]) / max_value;
+        max_difference = difference > max_difference ? difference : max_difference;
+    }
+    return max_difference;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <floImage> <inputDefField> <order>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputImageName = argv[1];
+    char *inputDefImageName = argv[2];
+    int interpolation = atoi(argv[3]);
+
+    // Read the input floating image
+    nifti_image *floatingImage = reg_io_ReadImageFile(inputImageName);
+    if (floatingImage == NULL) {
+        reg_print_msg_error("The input floating image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(floatingImage);
+    // Read the input deformation field image image
+    nifti_image *inputDeformationField = reg_io_ReadImageFile(inputDefImageName);
+    if (inputDeformationField == NULL) {
+        reg_print_msg_error("The input deformation field image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(inputDeformationField);
+
+    // The fused gradient must skip the masked out voxels, as the separate calls do
+    size_t voxelNumber = (size_t)inputDeformationField->nx * inputDeformationField->ny *
+            inputDeformationField->nz;
+    int *mask = reg_test_createQuarterMask(inputDeformationField);
+
+    // Allocate the warped images and their gradients
+    nifti_image *warpedImage[2], *gradientImage[2];
+    for (int i = 0; i < 2; ++i) {
+        warpedImage[i] = nifti_copy_nim_info(floatingImage);
+        warpedImage[i]->nx = warpedImage[i]->dim[1] = inputDeformationField->nx;
+        warpedImage[i]->ny = warpedImage[i]->dim[2] = inputDeformationField->ny;
+        warpedImage[i]->nz = warpedImage[i]->dim[3] = inputDeformationField->nz;
+        warpedImage[i]->nvox = voxelNumber;
+        warpedImage[i]->data = (void *)calloc(warpedImage[i]->nvox, warpedImage[i]->nbyper);
+        gradientImage[i] = nifti_copy_nim_info(inputDeformationField);
+        gradientImage[i]->data = (void *)calloc(gradientImage[i]->nvox, gradientImage[i]->nbyper);
+    }
+
+    // The warped image and its gradient are computed separately and in a single pass
+    float paddingValue = std::numeric_limits<float>::quiet_NaN();
+    reg_resampleImage(floatingImage,
+                      warpedImage[0],
+                      inputDeformationField,
+                      mask,
+                      interpolation,
+                      paddingValue);
+    reg_getImageGradient(floatingImage,
+                         gradientImage[0],
+                         inputDeformationField,
+                         mask,
+                         interpolation,
+                         paddingValue,
+                         0);
+    reg_resampleImageAndGradient(floatingImage,
+                                 warpedImage[1],
+                                 gradientImage[1],
+                                 inputDeformationField,
+                                 mask,
+                                 interpolation,
+                                 paddingValue);
+    double max_warped_difference = reg_test_maxDifference(warpedImage[0], warpedImage[1]);
+    double max_gradient_difference = reg_test_maxDifference(gradientImage[0], gradientImage[1]);
+
+    // Free allocated images and arrays
+    for (int i = 0; i < 2; ++i) {
+        nifti_image_free(warpedImage[i]);
+        nifti_image_free(gradientImage[i]);
+    }
+    free(mask);
+    nifti_image_free(floatingImage);
+    nifti_image_free(inputDeformationField);
+
+    if (max_warped_difference > EPS || max_gradient_difference > EPS){
+        fprintf(stderr, "reg_test_resample_gradient error too large: %g %g ( > %g)\n",
+                max_warped_difference, max_gradient_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_resample_gradient ok: %g %g (<%g)\n",
+            max_warped_difference, max_gradient_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,160 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_ReadWriteMatrix.h"
+#include "_reg_localTrans.h"
+#include "_reg_globalTrans.h"
+#include "_reg_resampling.h"
+#include "_reg_tools.h"
+#include "reg_test_mask.h"
+
+#define EPS 0.0001
+
+/* Set the header of the slab [firstSlice, firstSlice+sliceNumber[ of an image,
+ * as done in reg_resample */
+void reg_test_setSlabHeader(nifti_image *slabImage,
+                            nifti_image *image,
+                            int firstSlice,
+                            int sliceNumber)
+{
+    slabImage->dim[3] = slabImage->nz = sliceNumber;
+    slabImage->nvox = (size_t)slabImage->nx * slabImage->ny *
+            slabImage->nz * slabImage->nt * slabImage->nu;
+    for (int i = 0; i < 3; ++i) {
+        slabImage->qto_xyz.m[i][3] = image->qto_xyz.m[i][3] + firstSlice * image->qto_xyz.m[i][2];
+        slabImage->sto_xyz.m[i][3] = image->sto_xyz.m[i][3] + firstSlice * image->sto_xyz.m[i][2];
+    }
+    slabImage->qto_ijk = nifti_mat44_inverse(slabImage->qto_xyz);
+    slabImage->sto_ijk = nifti_mat44_inverse(slabImage->sto_xyz);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 6) {
+        fprintf(stderr, "Usage: %s <refImage> <inputTransformation> <transType> <slabSize> <outputImage>\n", argv[0]);
+        fprintf(stderr, "<transType>\t0 - affine matrix, 1 - cubic spline grid\n");
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputTransName = argv[2];
+    int transType = atoi(argv[3]);
+    int slabSize = atoi(argv[4]);
+    char *outputImageName = argv[5];
+
+    // Read the input reference image, which is also used as floating image
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(referenceImage);
+    if (referenceImage->nz < 2 || slabSize < 2 || referenceImage->nz % slabSize == 0) {
+        reg_print_msg_error("A 3D image and a slab size that does not divide the slice number are expected");
+        return EXIT_FAILURE;
+    }
+
+    // Read the input transformation
+    mat44 affineTransformation;
+    nifti_image *cppImage = NULL;
+    if (transType == 0)
+        reg_tool_ReadAffineFile(&affineTransformation, inputTransName);
+    else {
+        cppImage = reg_io_ReadImageFile(inputTransName);
+        if (cppImage == NULL) {
+            reg_print_msg_error("The control point grid image could not be read");
+            return EXIT_FAILURE;
+        }
+        reg_tools_changeDatatype<float>(cppImage);
+    }
+
+    // Each slab uses its own section of the full image mask
+    size_t sliceVoxelNumber = (size_t)referenceImage->nx * referenceImage->ny;
+    int *mask = reg_test_createQuarterMask(referenceImage);
+
+    // Create the deformation field of the full image
+    nifti_image *deformationField = nifti_copy_nim_info(referenceImage);
+    deformationField->ndim = deformationField->dim[0] = 5;
+    deformationField->nt = deformationField->dim[4] = 1;
+    deformationField->nu = deformationField->dim[5] = 3;
+    deformationField->nvox = (size_t)deformationField->nx * deformationField->ny *
+            deformationField->nz * deformationField->nu;
+    deformationField->intent_p1 = DEF_FIELD;
+    deformationField->data = (void *)calloc(deformationField->nvox, deformationField->nbyper);
+    if (transType == 0)
+        reg_affine_getDeformationField(&affineTransformation, deformationField, false, NULL);
+    else reg_spline_getDeformationField(cppImage, deformationField, NULL, false, true);
+
+    // The expected image is resampled over the full image
+    nifti_image *expectedImage = nifti_copy_nim_info(referenceImage);
+    expectedImage->data = (void *)calloc(expectedImage->nvox, expectedImage->nbyper);
+    reg_resampleImage(referenceImage, expectedImage, deformationField, mask, 3, 0.f);
+
+    // The image is resampled and written slab by slab. A last single slice
+    // is appended to the previous slab, as done in reg_resample
+    nifti_image *warpedImage = nifti_copy_nim_info(referenceImage);
+    znzFile outputFile = reg_io_OpenImageFileForWriting(warpedImage, outputImageName);
+    nifti_image *warpedSlab = nifti_copy_nim_info(referenceImage);
+    reg_test_setSlabHeader(warpedSlab, referenceImage, 0, slabSize + 1);
+    warpedSlab->data = (void *)calloc(warpedSlab->nvox, warpedSlab->nbyper);
+    nifti_image *deformationFieldSlab = nifti_copy_nim_info(deformationField);
+    reg_test_setSlabHeader(deformationFieldSlab, referenceImage, 0, slabSize + 1);
+    deformationFieldSlab->data = (void *)calloc(deformationFieldSlab->nvox, deformationFieldSlab->nbyper);
+    int sliceNumber = 0;
+    for (int firstSlice = 0, slab = 0; firstSlice < referenceImage->nz; firstSlice += sliceNumber, ++slab) {
+        sliceNumber = slabSize < referenceImage->nz - firstSlice ? slabSize : referenceImage->nz - firstSlice;
+        if (referenceImage->nz - firstSlice - sliceNumber == 1)
+            ++sliceNumber;
+        reg_test_setSlabHeader(warpedSlab, referenceImage, firstSlice, sliceNumber);
+        int *slabMask = &mask[firstSlice * sliceVoxelNumber];
+        if (transType == 0)
+            reg_resampleImage_affine(referenceImage, warpedSlab, &affineTransformation, slabMask, 3, 0.f);
+        else {
+            // Every other slab, the field is computed with and without the full image mask
+            reg_test_setSlabHeader(deformationFieldSlab, referenceImage, firstSlice, sliceNumber);
+            reg_spline_getDeformationFieldSlab(cppImage, deformationFieldSlab, firstSlice,
+                                               slab % 2 == 0 ? mask : NULL, true);
+            reg_resampleImage(referenceImage, warpedSlab, deformationFieldSlab, slabMask, 3, 0.f);
+        }
+        reg_io_WriteImageData(outputFile, warpedSlab->data, warpedSlab->nvox * warpedSlab->nbyper);
+    }
+    reg_io_CloseImageFile(outputFile);
+
+    // The written image is read back and compared to the expected image
+    nifti_image *writtenImage = reg_io_ReadImageFile(outputImageName);
+    double max_difference = std::numeric_limits<double>::infinity();
+    if (writtenImage != NULL && writtenImage->nvox == expectedImage->nvox &&
+            writtenImage->datatype == expectedImage->datatype) {
+        float *writtenPtr = static_cast<float *>(writtenImage->data);
+        float *expectedPtr = static_cast<float *>(expectedImage->data);
+        // The difference is relative to the intensity range
+        float range = reg_tools_getMaxValue(expectedImage, -1) - reg_tools_getMinValue(expectedImage, -1);
+        max_difference = 0.;
+        for (size_t i = 0; i < expectedImage->nvox; ++i) {
+            double difference = fabs(writtenPtr[i] - expectedPtr[i]) / range;
+            max_difference = difference > max_difference ? difference : max_difference;
+        }
+    }
+
+    // Free allocated images and arrays
+    if (writtenImage != NULL)
+        nifti_image_free(writtenImage);
+    nifti_image_free(deformationFieldSlab);
+    nifti_image_free(warpedSlab);
+    nifti_image_free(warpedImage);
+    nifti_image_free(expectedImage);
+    nifti_image_free(deformationField);
+    free(mask);
+    if (cppImage != NULL)
+        nifti_image_free(cppImage);
+    nifti_image_free(referenceImage);
+
+    if (max_difference > EPS){
+        fprintf(stderr, "reg_test_slab_resampling error too large: %g ( > %g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_slab_resampling ok: %g (<%g)\n", max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_tools.h"
+
+#define EPS 0.0001
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <refImage> <inputGrid>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputCPPFileName = argv[2];
+
+    // Read the input reference image and control point grid
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    nifti_image *cppImage = reg_io_ReadImageFile(inputCPPFileName);
+    if (cppImage == NULL) {
+        reg_print_msg_error("The control point grid image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(cppImage);
+    if (referenceImage->nz < 2) {
+        reg_print_msg_error("The tile kernels only support 3D grids");
+        return EXIT_FAILURE;
+    }
+
+    // The field widths are not all multiples of the AVX2 and AVX-512 vector
+    // widths and the second spacing prevents the use of the lookup table
+    int widths[7] = {3, 8, 15, 16, 17, 33, referenceImage->nx};
+    float spacingRatios[2] = {1.f, 0.7f};
+    NREG_SIMD_TYPE detectedSupport = reg_getSIMDSupport();
+
+    double max_difference = 0.;
+    for (int s = 0; s < 2; ++s) {
+        for (int w = 0; w < 7; ++w) {
+            // Create the deformation fields
+            nifti_image *field = nifti_copy_nim_info(referenceImage);
+            field->ndim = field->dim[0] = 5;
+            field->nx = field->dim[1] = widths[w];
+            field->nt = field->dim[4] = 1;
+            field->nu = field->dim[5] = 3;
+            for (int d = 1; d < 4; ++d)
+                field->pixdim[d] *= spacingRatios[s];
+            field->dx = field->pixdim[1];
+            field->dy = field->pixdim[2];
+            field->dz = field->pixdim[3];
+            field->datatype = NIFTI_TYPE_FLOAT32;
+            field->nbyper = sizeof(float);
+            field->nvox = (size_t)field->nx * field->ny * field->nz * field->nu;
+            size_t voxelNumber = (size_t)field->nx * field->ny * field->nz;
+            nifti_image *expectedField = nifti_copy_nim_info(field);
+            expectedField->data = (void *)calloc(expectedField->nvox, expectedField->nbyper);
+            field->data = (void *)calloc(field->nvox, field->nbyper);
+
+            // The first row of every slice and a voxel out of seven are outside of the mask
+            int *mask = (int *)malloc(voxelNumber * sizeof(int));
+            for (size_t i = 0; i < voxelNumber; ++i)
+                mask[i] = (i / field->nx) % field->ny == 0 || i % 7 == 0 ? -1 : 0;
+
+            // The per-voxel evaluation is used as reference
+            reg_spline_getDeformationField(cppImage, expectedField, mask, false, true, true);
+            float *expectedPtr = static_cast<float *>(expectedField->data);
+
+            // Every instruction set supported by the CPU is compared to the reference
+            for (int simd = NO_SIMD; simd <= detectedSupport; ++simd) {
+                reg_setMaximalSIMDSupport((NREG_SIMD_TYPE)simd);
+                memset(field->data, 0, field->nvox * field->nbyper);
+                reg_spline_getDeformationField(cppImage, field, mask, false, true);
+                float *fieldPtr = static_cast<float *>(field->data);
+                for (size_t i = 0; i < voxelNumber; ++i) {
+                    if (mask[i] < 0)
+                        continue;
+                    for (int d = 0; d < 3; ++d) {
+                        double difference = fabs(fieldPtr[d * voxelNumber + i] -
+                                                 expectedPtr[d * voxelNumber + i]);
+                        if (difference != difference)
+                            difference = std::numeric_limits<double>::infinity();
+                        max_difference = difference > max_difference ? difference : max_difference;
+                    }
+                }
+            }
+            reg_setMaximalSIMDSupport(AVX512_SIMD);
+
+            free(mask);
+            nifti_image_free(expectedField);
+            nifti_image_free(field);
+        }
+    }
+
+    // Free allocated images
+    nifti_image_free(cppImage);
+    nifti_image_free(referenceImage);
+
+    if (max_difference > EPS){
+        fprintf(stderr, "reg_test_spline_simd error too large: %g ( > %g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_spline_simd ok: %g (<%g), instruction set up to %i tested\n",
+            max_difference, EPS, (int)detectedSupport);
+#endif
+
+    return EXIT_SUCCESS;
+}
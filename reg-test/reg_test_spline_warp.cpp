@@ -0,0 +1,105 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_resampling.h"
+#include "_reg_tools.h"
+#include "reg_test_mask.h"
+
+#define EPS 0.000001
+#define VOLUME_NUMBER 2
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <refImage> <inputGrid> <order>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputCPPFileName = argv[2];
+    int interpolation = atoi(argv[3]);
+
+    // Read the input reference image and control point grid
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(referenceImage);
+    nifti_image *cppImage = reg_io_ReadImageFile(inputCPPFileName);
+    if (cppImage == NULL) {
+        reg_print_msg_error("The control point grid image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(cppImage);
+
+    // The floating image is a series built from the reference image
+    size_t voxelNumber = (size_t)referenceImage->nx * referenceImage->ny * referenceImage->nz;
+    nifti_image *floatingImage = nifti_copy_nim_info(referenceImage);
+    floatingImage->ndim = floatingImage->dim[0] = 4;
+    floatingImage->nt = floatingImage->dim[4] = VOLUME_NUMBER;
+    floatingImage->nvox = voxelNumber * VOLUME_NUMBER;
+    floatingImage->data = (void *)malloc(floatingImage->nvox * floatingImage->nbyper);
+    float *referencePtr = static_cast<float *>(referenceImage->data);
+    float *floatingPtr = static_cast<float *>(floatingImage->data);
+    for (size_t i = 0; i < voxelNumber; ++i)
+        for (int t = 0; t < VOLUME_NUMBER; ++t)
+            floatingPtr[t * voxelNumber + i] = referencePtr[i] * (1.f + 0.1f * t);
+
+    // The fused path must leave the masked out voxels untouched, as the field path does
+    int *mask = reg_test_createQuarterMask(referenceImage);
+
+    // The expected image is resampled using the full deformation field
+    nifti_image *deformationField = nifti_copy_nim_info(referenceImage);
+    deformationField->ndim = deformationField->dim[0] = 5;
+    deformationField->nt = deformationField->dim[4] = 1;
+    deformationField->nu = deformationField->dim[5] = referenceImage->nz > 1 ? 3 : 2;
+    deformationField->nvox = voxelNumber * deformationField->nu;
+    deformationField->intent_p1 = DEF_FIELD;
+    deformationField->data = (void *)calloc(deformationField->nvox, deformationField->nbyper);
+    reg_spline_getDeformationField(cppImage, deformationField, mask, false, true);
+    nifti_image *expectedImage = nifti_copy_nim_info(floatingImage);
+    expectedImage->data = (void *)calloc(expectedImage->nvox, expectedImage->nbyper);
+    float paddingValue = std::numeric_limits<float>::quiet_NaN();
+    reg_resampleImage(floatingImage, expectedImage, deformationField, mask,
+                      interpolation, paddingValue);
+
+    // The warped image is computed without storing the deformation field
+    nifti_image *warpedImage = nifti_copy_nim_info(floatingImage);
+    warpedImage->data = (void *)calloc(warpedImage->nvox, warpedImage->nbyper);
+    reg_spline_getWarpedImage(cppImage, floatingImage, warpedImage, mask,
+                              interpolation, paddingValue, true);
+
+    // Both images are compared, two NaN values are considered equal
+    float *expectedPtr = static_cast<float *>(expectedImage->data);
+    float *warpedPtr = static_cast<float *>(warpedImage->data);
+    double max_difference = 0.;
+    for (size_t i = 0; i < expectedImage->nvox; ++i) {
+        if (expectedPtr[i] != expectedPtr[i] || warpedPtr[i] != warpedPtr[i]) {
+            if (expectedPtr[i] == expectedPtr[i] || warpedPtr[i] == warpedPtr[i])
+                max_difference = std::numeric_limits<double>::infinity();
+            continue;
+        }
+        double difference = fabs(expectedPtr[i] - warpedPtr[i]);
+        max_difference = difference > max_difference ? difference : max_difference;
+    }
+
+    // Free allocated images and arrays
+    nifti_image_free(warpedImage);
+    nifti_image_free(expectedImage);
+    nifti_image_free(deformationField);
+    nifti_image_free(floatingImage);
+    free(mask);
+    nifti_image_free(cppImage);
+    nifti_image_free(referenceImage);
+
+    if (max_difference > EPS){
+        fprintf(stderr, "reg_test_spline_warp error too large: %g ( > %g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_spline_warp ok: %g (<%g)\n", max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
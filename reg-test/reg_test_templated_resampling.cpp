@@ -0,0 +1,102 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_resampling.h"
+#include "_reg_tools.h"
+
+#define EPS 0.000001
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <refImage> <inputGrid> <order>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputCPPFileName = argv[2];
+    int interpolation = atoi(argv[3]);
+
+    // Read the input reference image and control point grid
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(referenceImage);
+    nifti_image *cppImage = reg_io_ReadImageFile(inputCPPFileName);
+    if (cppImage == NULL) {
+        reg_print_msg_error("The control point grid image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(cppImage);
+
+    // The deformation field is generated from the control point grid
+    size_t voxelNumber = (size_t)referenceImage->nx * referenceImage->ny * referenceImage->nz;
+    nifti_image *deformationField = nifti_copy_nim_info(referenceImage);
+    deformationField->ndim = deformationField->dim[0] = 5;
+    deformationField->nt = deformationField->dim[4] = 1;
+    deformationField->nu = deformationField->dim[5] = referenceImage->nz > 1 ? 3 : 2;
+    deformationField->nvox = voxelNumber * deformationField->nu;
+    deformationField->intent_p1 = DEF_FIELD;
+    deformationField->data = (void *)calloc(deformationField->nvox, deformationField->nbyper);
+    reg_spline_getDeformationField(cppImage, deformationField, NULL, false, true);
+
+    // The templated and the reference kernels are compared for every floating datatype
+    const int datatype[3] = {NIFTI_TYPE_UINT8, NIFTI_TYPE_INT16, NIFTI_TYPE_FLOAT32};
+    float minValue = reg_tools_getMinValue(referenceImage, -1);
+    float maxValue = reg_tools_getMaxValue(referenceImage, -1);
+    double max_difference = 0.;
+    for (int d = 0; d < 3; ++d) {
+        nifti_image *floatingImage = nifti_copy_nim_info(referenceImage);
+        floatingImage->data = (void *)malloc(floatingImage->nvox * floatingImage->nbyper);
+        float *referencePtr = static_cast<float *>(referenceImage->data);
+        float *floatingPtr = static_cast<float *>(floatingImage->data);
+        for (size_t i = 0; i < voxelNumber; ++i)
+            floatingPtr[i] = referencePtr[i] == referencePtr[i] ?
+                    255.f * (referencePtr[i] - minValue) / (maxValue - minValue) : 0.f;
+        switch (datatype[d]) {
+        case NIFTI_TYPE_UINT8:
+            reg_tools_changeDatatype<unsigned char>(floatingImage);
+            break;
+        case NIFTI_TYPE_INT16:
+            reg_tools_changeDatatype<short>(floatingImage, NIFTI_TYPE_INT16);
+            break;
+        }
+        nifti_image *expectedImage = nifti_copy_nim_info(floatingImage);
+        expectedImage->data = (void *)calloc(expectedImage->nvox, expectedImage->nbyper);
+        reg_resampleImageReference(floatingImage, expectedImage, deformationField, NULL,
+                                   interpolation, 0.f);
+        nifti_image *warpedImage = nifti_copy_nim_info(floatingImage);
+        warpedImage->data = (void *)calloc(warpedImage->nvox, warpedImage->nbyper);
+        reg_resampleImage(floatingImage, warpedImage, deformationField, NULL,
+                          interpolation, 0.f);
+
+        reg_tools_changeDatatype<float>(expectedImage);
+        reg_tools_changeDatatype<float>(warpedImage);
+        float *expectedPtr = static_cast<float *>(expectedImage->data);
+        float *warpedPtr = static_cast<float *>(warpedImage->data);
+        for (size_t i = 0; i < voxelNumber; ++i) {
+            double difference = fabs(expectedPtr[i] - warpedPtr[i]);
+            max_difference = difference > max_difference ? difference : max_difference;
+        }
+        nifti_image_free(expectedImage);
+        nifti_image_free(warpedImage);
+        nifti_image_free(floatingImage);
+    }
+
+    // Free allocated images
+    nifti_image_free(deformationField);
+    nifti_image_free(cppImage);
+    nifti_image_free(referenceImage);
+
+    if (max_difference > EPS){
+        fprintf(stderr, "reg_test_templated_resampling error too large: %g ( > %g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_templated_resampling ok: %g (<%g)\n", max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
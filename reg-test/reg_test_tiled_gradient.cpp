@@ -0,0 +1,137 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_f3d.h"
+#include "_reg_tools.h"
+
+#define EPS 0.0001
+
+/* Registration object that gives access to the tile size and to the node
+ * based gradient of the measure of similarity */
+class reg_test_f3d : public reg_f3d<float>
+{
+public:
+    reg_test_f3d(nifti_image *referenceImage, nifti_image *controlPointGrid, int measureType)
+        : reg_f3d<float>(referenceImage->nt, referenceImage->nt)
+    {
+        this->SetReferenceImage(referenceImage);
+        this->SetFloatingImage(referenceImage);
+        this->SetControlPointGridImage(controlPointGrid);
+        this->SetLevelNumber(1);
+        this->SetLevelToPerform(1);
+        this->DoNotPrintOutInformation();
+        if (measureType == 0)
+            this->UseSSD(0, true);
+        else {
+            this->UseNMISetReferenceBinNumber(0, 64);
+            this->UseNMISetFloatingBinNumber(0, 64);
+        }
+    }
+    /* Use the tiled execution mode with tiles of tileSliceNumber slices */
+    void UseTiles(int tileSliceNumber)
+    {
+        this->UseTiledExecution();
+        this->tiledExecutionVoxelNumber = (size_t)tileSliceNumber *
+                this->inputReference->nx * this->inputReference->ny;
+    }
+    nifti_image *GetNodeGradient()
+    {
+        return this->reg_test_getSimilarityMeasureGradient();
+    }
+};
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <refImage> <inputGrid> <measureType>\n", argv[0]);
+        fprintf(stderr, "<measureType>\t0 - SSD, 1 - NMI\n");
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputCPPFileName = argv[2];
+    int measureType = atoi(argv[3]);
+
+    // Read the input reference image and control point grid
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(referenceImage);
+    nifti_image *cppImage = reg_io_ReadImageFile(inputCPPFileName);
+    if (cppImage == NULL) {
+        reg_print_msg_error("The control point grid image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(cppImage);
+    if (referenceImage->nz < 2) {
+        reg_print_msg_error("The tiled execution mode only supports 3D images");
+        return EXIT_FAILURE;
+    }
+
+    // The gradient is first computed over the full image
+    reg_test_f3d *fullF3D = new reg_test_f3d(referenceImage, cppImage, measureType);
+    nifti_image *fullGradient = fullF3D->GetNodeGradient();
+    float *fullPtr = static_cast<float *>(fullGradient->data);
+    double max_gradient = 0.;
+    for (size_t i = 0; i < fullGradient->nvox; ++i)
+        max_gradient = fabs(fullPtr[i]) > max_gradient ? fabs(fullPtr[i]) : max_gradient;
+
+    // The tiles of 7 slices end in the middle of the control point cells and
+    // the tiles of 2 slices leave a single slice that is merged with the last tile
+    int tileSliceNumbers[2] = {7, 2};
+    double max_difference = 0.;
+    bool tiled = true;
+    for (int i = 0; i < 2; ++i) {
+        reg_test_f3d *tiledF3D = new reg_test_f3d(referenceImage, cppImage, measureType);
+        tiledF3D->UseTiles(tileSliceNumbers[i]);
+        nifti_image *tiledGradient = tiledF3D->GetNodeGradient();
+        tiled = tiled && tiledF3D->GetTiledExecutionStatus();
+        float *tiledPtr = static_cast<float *>(tiledGradient->data);
+        for (size_t n = 0; n < fullGradient->nvox; ++n) {
+            double difference = fabs(fullPtr[n] - tiledPtr[n]) / max_gradient;
+            max_difference = difference > max_difference ? difference : max_difference;
+        }
+        delete tiledF3D;
+    }
+
+    // The tiled execution mode is only used when the estimated memory usage
+    // exceeds the budget, and the tiles are then reduced to fit the budget
+    int fullMemory = fullF3D->CheckMemoryMB();
+    reg_test_f3d *largeBudgetF3D = new reg_test_f3d(referenceImage, cppImage, measureType);
+    largeBudgetF3D->SetMaximalMemoryUsage((size_t)fullMemory + 1);
+    bool budgetChoice = largeBudgetF3D->CheckMemoryMB() == fullMemory &&
+            !largeBudgetF3D->GetTiledExecutionStatus();
+    delete largeBudgetF3D;
+    if (fullMemory > 1) {
+        reg_test_f3d *smallBudgetF3D = new reg_test_f3d(referenceImage, cppImage, measureType);
+        smallBudgetF3D->SetMaximalMemoryUsage((size_t)fullMemory - 1);
+        int tiledMemory = smallBudgetF3D->CheckMemoryMB();
+        budgetChoice = budgetChoice && smallBudgetF3D->GetTiledExecutionStatus() &&
+                tiledMemory < fullMemory;
+        delete smallBudgetF3D;
+    }
+
+    // Free allocated object and images
+    delete fullF3D;
+    nifti_image_free(cppImage);
+    nifti_image_free(referenceImage);
+
+    if (!tiled) {
+        fprintf(stderr, "reg_test_tiled_gradient error: the tiled execution mode was disabled\n");
+        return EXIT_FAILURE;
+    }
+    if (!budgetChoice) {
+        fprintf(stderr, "reg_test_tiled_gradient error: the tiled execution mode does not follow the memory budget\n");
+        return EXIT_FAILURE;
+    }
+    if (max_gradient == 0. || max_difference > EPS) {
+        fprintf(stderr, "reg_test_tiled_gradient error too large: %g ( > %g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_tiled_gradient ok: %g (<%g)\n", max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
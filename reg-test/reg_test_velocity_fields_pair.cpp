@@ -0,0 +1,121 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_tools.h"
+
+#define EPS 0.000001
+
+/* Duplicate an image and its data */
+nifti_image *reg_test_copyImage(nifti_image *image)
+{
+    nifti_image *copy = nifti_copy_nim_info(image);
+    copy->data = (void *)malloc(copy->nvox * copy->nbyper);
+    memcpy(copy->data, image->data, copy->nvox * copy->nbyper);
+    return copy;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <refImage> <inputGrid> <squaringNumber>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputCPPFileName = argv[2];
+    int squaringNumber = atoi(argv[3]);
+
+    // Read the input reference image
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    // Read the input control point grid image
+    nifti_image *cppImage = reg_io_ReadImageFile(inputCPPFileName);
+    if (cppImage == NULL) {
+        reg_print_msg_error("The control point grid image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(cppImage);
+    // The control point grid is used as the forward velocity grid and its
+    // opposite as the backward velocity grid
+    nifti_free_extensions(cppImage);
+    cppImage->intent_p1 = SPLINE_VEL_GRID;
+    cppImage->intent_p2 = squaringNumber;
+    nifti_image *forwardGrid[2], *backwardGrid[2];
+    forwardGrid[0] = reg_test_copyImage(cppImage);
+    forwardGrid[1] = reg_test_copyImage(cppImage);
+    reg_getDisplacementFromDeformation(cppImage);
+    reg_tools_multiplyValueToImage(cppImage, cppImage, -1.f);
+    reg_getDeformationFromDisplacement(cppImage);
+    backwardGrid[0] = reg_test_copyImage(cppImage);
+    backwardGrid[1] = reg_test_copyImage(cppImage);
+
+    // Create the deformation fields
+    nifti_image *forwardField[2], *backwardField[2];
+    nifti_image *field = nifti_copy_nim_info(referenceImage);
+    field->dim[0] = field->ndim = 5;
+    field->dim[4] = field->nt = 1;
+    field->dim[5] = field->nu = referenceImage->nz > 1 ? 3 : 2;
+    field->nvox = (size_t)field->nx * field->ny * field->nz * field->nu;
+    field->datatype = NIFTI_TYPE_FLOAT32;
+    field->nbyper = sizeof(float);
+    field->scl_slope = 1.f;
+    field->scl_inter = 0.f;
+    for (int i = 0; i < 2; ++i) {
+        forwardField[i] = nifti_copy_nim_info(field);
+        forwardField[i]->data = (void *)calloc(forwardField[i]->nvox, forwardField[i]->nbyper);
+        backwardField[i] = nifti_copy_nim_info(field);
+        backwardField[i]->data = (void *)calloc(backwardField[i]->nvox, backwardField[i]->nbyper);
+    }
+    nifti_image_free(field);
+
+    // Exponentiate the velocity grids one by one and jointly, without
+    // updating the number of squaring steps
+    reg_spline_getDefFieldFromVelocityGrid(forwardGrid[0], forwardField[0], false);
+    reg_spline_getDefFieldFromVelocityGrid(backwardGrid[0], backwardField[0], false);
+    reg_spline_getDefFieldsFromVelocityGrids(forwardGrid[1], backwardGrid[1],
+                                             forwardField[1], backwardField[1], false);
+
+    // Compare the fields
+    double max_difference = 0.;
+    nifti_image *fields[2][2] = {{forwardField[0], forwardField[1]},
+                                 {backwardField[0], backwardField[1]}};
+    for (int f = 0; f < 2; ++f) {
+        float *expectedPtr = static_cast<float *>(fields[f][0]->data);
+        float *jointPtr = static_cast<float *>(fields[f][1]->data);
+        for (size_t i = 0; i < fields[f][0]->nvox; ++i) {
+            double difference = fabs(expectedPtr[i] - jointPtr[i]);
+            if (difference != difference)
+                difference = std::numeric_limits<double>::infinity();
+            max_difference = difference > max_difference ? difference : max_difference;
+        }
+    }
+    bool sameStepNumber = forwardGrid[1]->intent_p2 == squaringNumber &&
+            backwardGrid[1]->intent_p2 == squaringNumber;
+
+    // Free allocated images
+    for (int i = 0; i < 2; ++i) {
+        nifti_image_free(forwardGrid[i]);
+        nifti_image_free(backwardGrid[i]);
+        nifti_image_free(forwardField[i]);
+        nifti_image_free(backwardField[i]);
+    }
+    nifti_image_free(cppImage);
+    nifti_image_free(referenceImage);
+
+    if (!sameStepNumber) {
+        fprintf(stderr, "reg_test_velocity_fields_pair error: the number of squaring steps has been modified\n");
+        return EXIT_FAILURE;
+    }
+    if (max_difference > EPS){
+        fprintf(stderr, "reg_test_velocity_fields_pair error too large: %g ( > %g)\n",
+                max_difference, EPS);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_velocity_fields_pair ok: %g (<%g)\n", max_difference, EPS);
+#endif
+
+    return EXIT_SUCCESS;
+}
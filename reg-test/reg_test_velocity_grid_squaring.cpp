@@ -0,0 +1,238 @@
+#include "_reg_ReadWriteImage.h"
+#include "_reg_localTrans.h"
+#include "_reg_resampling.h"
+#include "_reg_tools.h"
+
+#define EPS 0.1
+#define EPS_GRAD 0.05
+
+// Returns 0.5 * sum |phi(x) - x|^2, with phi the dense or grid squaring
+// exponential of the velocity grid, and stores phi(x) - x in the
+// displacement image if provided
+double getObjectiveValue(nifti_image *velocityGrid,
+                         nifti_image *field,
+                         nifti_image *displacement,
+                         bool gridSquaring)
+{
+    if (gridSquaring)
+        reg_spline_getDefFieldFromVelocityGridSquaring(velocityGrid, field, false);
+    else reg_spline_getDefFieldFromVelocityGrid(velocityGrid, field, false);
+    reg_getDisplacementFromDeformation(field);
+    double value = 0;
+    float *fieldPtr = static_cast<float *>(field->data);
+    for (size_t i = 0; i < field->nvox; ++i)
+        value += 0.5 * (double)fieldPtr[i] * fieldPtr[i];
+    if (displacement != NULL)
+        memcpy(displacement->data, field->data, field->nvox * field->nbyper);
+    return value;
+}
+
+// The gradient of 0.5 * sum |phi(x) - x|^2 is exponentiated as in reg_f3d2,
+// using the intermediate fields of the backward velocity grid computed with
+// the same exponentiation as the value
+void getObjectiveGradient(nifti_image *velocityGrid,
+                          nifti_image *gradient,
+                          bool gridSquaring)
+{
+    int squaringNumber = static_cast<int>(fabsf(velocityGrid->intent_p2));
+    nifti_image **intermediateFields = (nifti_image **)malloc((squaringNumber + 1) * sizeof(nifti_image *));
+    for (int i = 0; i <= squaringNumber; ++i) {
+        intermediateFields[i] = nifti_copy_nim_info(gradient);
+        intermediateFields[i]->data = (void *)calloc(gradient->nvox, gradient->nbyper);
+    }
+    nifti_image *backwardGrid = nifti_copy_nim_info(velocityGrid);
+    backwardGrid->data = (void *)malloc(backwardGrid->nvox * backwardGrid->nbyper);
+    memcpy(backwardGrid->data, velocityGrid->data, backwardGrid->nvox * backwardGrid->nbyper);
+    reg_getDisplacementFromDeformation(backwardGrid);
+    reg_tools_multiplyValueToImage(backwardGrid, backwardGrid, -1.f);
+    reg_getDeformationFromDisplacement(backwardGrid);
+    backwardGrid->intent_p1 = SPLINE_VEL_GRID;
+    backwardGrid->intent_p2 = velocityGrid->intent_p2;
+    if (gridSquaring)
+        reg_spline_getIntermediateDefFieldFromVelGridSquaring(backwardGrid, intermediateFields);
+    else reg_spline_getIntermediateDefFieldFromVelGrid(backwardGrid, intermediateFields);
+
+    nifti_image *tempGradient = nifti_copy_nim_info(gradient);
+    tempGradient->data = (void *)calloc(tempGradient->nvox, tempGradient->nbyper);
+    nifti_image *tempField = nifti_copy_nim_info(gradient);
+    tempField->data = (void *)calloc(tempField->nvox, tempField->nbyper);
+    getObjectiveValue(velocityGrid, tempField, gradient, gridSquaring);
+    for (int i = 0; i < squaringNumber; ++i) {
+        reg_resampleGradient(gradient, tempGradient, intermediateFields[i], 1, 0.f);
+        reg_tools_addImageToImage(tempGradient, gradient, gradient);
+    }
+    reg_tools_divideValueToImage(gradient, gradient, powf(2.f, (float)squaringNumber));
+
+    for (int i = 0; i <= squaringNumber; ++i)
+        nifti_image_free(intermediateFields[i]);
+    free(intermediateFields);
+    nifti_image_free(backwardGrid);
+    nifti_image_free(tempGradient);
+    nifti_image_free(tempField);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <refImage> <inputGrid>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *inputRefImageName = argv[1];
+    char *inputCPPFileName = argv[2];
+
+    // Read the input reference image
+    nifti_image *referenceImage = reg_io_ReadImageFile(inputRefImageName);
+    if (referenceImage == NULL) {
+        reg_print_msg_error("The input reference image could not be read");
+        return EXIT_FAILURE;
+    }
+    // Read the input control point grid image
+    nifti_image *cppImage = reg_io_ReadImageFile(inputCPPFileName);
+    if (cppImage == NULL) {
+        reg_print_msg_error("The control point grid image could not be read");
+        return EXIT_FAILURE;
+    }
+    reg_tools_changeDatatype<float>(cppImage);
+    // The control point grid is used as a velocity grid
+    nifti_free_extensions(cppImage);
+    cppImage->intent_p1 = SPLINE_VEL_GRID;
+    cppImage->intent_p2 = 0;
+
+    // Create the deformation fields
+    nifti_image *denseField = nifti_copy_nim_info(referenceImage);
+    denseField->dim[0] = denseField->ndim = 5;
+    denseField->dim[4] = denseField->nt = 1;
+    denseField->dim[5] = denseField->nu = referenceImage->nz > 1 ? 3 : 2;
+    denseField->nvox = (size_t)denseField->nx * denseField->ny *
+            denseField->nz * denseField->nu;
+    denseField->datatype = NIFTI_TYPE_FLOAT32;
+    denseField->nbyper = sizeof(float);
+    denseField->scl_slope = 1.f;
+    denseField->scl_inter = 0.f;
+    denseField->data = (void *)calloc(denseField->nvox, denseField->nbyper);
+    nifti_image *gridField = nifti_copy_nim_info(denseField);
+    gridField->data = (void *)calloc(gridField->nvox, gridField->nbyper);
+
+    // Exponentiate the velocity grid using the dense and the grid squaring
+    nifti_image *denseGrid = nifti_copy_nim_info(cppImage);
+    denseGrid->data = (void *)malloc(denseGrid->nvox * denseGrid->nbyper);
+    memcpy(denseGrid->data, cppImage->data, denseGrid->nvox * denseGrid->nbyper);
+    reg_spline_getDefFieldFromVelocityGrid(denseGrid, denseField, true);
+    cppImage->intent_p2 = denseGrid->intent_p2;
+    reg_spline_getDefFieldFromVelocityGridSquaring(cppImage, gridField, false);
+
+    // The last intermediate field used to exponentiate the gradient has to
+    // match the grid squaring exponential used to compute the value
+    int squaringNumber = static_cast<int>(fabsf(cppImage->intent_p2));
+    nifti_image **intermediateFields = (nifti_image **)malloc((squaringNumber + 1) * sizeof(nifti_image *));
+    for (int i = 0; i <= squaringNumber; ++i) {
+        intermediateFields[i] = nifti_copy_nim_info(denseField);
+        intermediateFields[i]->data = (void *)calloc(denseField->nvox, denseField->nbyper);
+    }
+    reg_spline_getIntermediateDefFieldFromVelGridSquaring(cppImage, intermediateFields);
+    float *lastPtr = static_cast<float *>(intermediateFields[squaringNumber]->data);
+    double maxIntermediateDiff = 0;
+    for (size_t i = 0; i < gridField->nvox; ++i)
+        maxIntermediateDiff = std::max(maxIntermediateDiff,
+                                       (double)fabsf(lastPtr[i] - static_cast<float *>(gridField->data)[i]));
+
+    for (int i = 0; i <= squaringNumber; ++i)
+        nifti_image_free(intermediateFields[i]);
+    free(intermediateFields);
+
+    // The gradient obtained with the grid squaring is compared with the one
+    // obtained with the dense exponentiation. The grid squaring only
+    // approximates the dense exponential, the difference between both
+    // gradients grows with the magnitude and roughness of the velocity field.
+    // It is about 2% for the test grids and is bounded by EPS_GRAD relative
+    // to the norm of the dense gradient
+    nifti_image *denseGradient = nifti_copy_nim_info(denseField);
+    denseGradient->data = (void *)calloc(denseGradient->nvox, denseGradient->nbyper);
+    getObjectiveGradient(denseGrid, denseGradient, false);
+    nifti_image *gridGradient = nifti_copy_nim_info(denseField);
+    gridGradient->data = (void *)calloc(gridGradient->nvox, gridGradient->nbyper);
+    getObjectiveGradient(cppImage, gridGradient, true);
+    float *denseGradientPtr = static_cast<float *>(denseGradient->data);
+    float *gridGradientPtr = static_cast<float *>(gridGradient->data);
+    double gradientNorm = 0, gradientDiffNorm = 0;
+    for (size_t i = 0; i < denseGradient->nvox; ++i) {
+        gradientNorm += (double)denseGradientPtr[i] * denseGradientPtr[i];
+        gradientDiffNorm += reg_pow2((double)gridGradientPtr[i] - denseGradientPtr[i]);
+    }
+    double gradientError = sqrt(gradientDiffNorm) / std::max(sqrt(gradientNorm), 1.e-6);
+    nifti_image_free(denseGradient);
+    nifti_image_free(gridGradient);
+
+    // An identity velocity grid defined in the real space, as the symmetric
+    // grids used by reg_f3d2, has to be exponentiated into an identity field
+    nifti_image *forwardGrid = NULL, *symBackwardGrid = NULL;
+    float gridSpacing[3] = {5.f * referenceImage->dx, 5.f * referenceImage->dy, 5.f * referenceImage->dz};
+    reg_createSymmetricControlPointGrids<float>(&forwardGrid, &symBackwardGrid,
+                                                referenceImage, referenceImage,
+                                                NULL, gridSpacing);
+    forwardGrid->intent_p1 = SPLINE_VEL_GRID;
+    forwardGrid->intent_p2 = cppImage->intent_p2;
+    reg_spline_getDefFieldFromVelocityGridSquaring(forwardGrid, gridField, false);
+    reg_getDisplacementFromDeformation(gridField);
+    double maxIdentityDiff = 0;
+    for (size_t i = 0; i < gridField->nvox; ++i)
+        maxIdentityDiff = std::max(maxIdentityDiff,
+                                   (double)fabsf(static_cast<float *>(gridField->data)[i]));
+    nifti_image_free(forwardGrid);
+    nifti_image_free(symBackwardGrid);
+    reg_spline_getDefFieldFromVelocityGridSquaring(cppImage, gridField, false);
+
+    // Compute the mean and maximal distances between both fields, in voxel
+    size_t voxelNumber = (size_t)denseField->nx * denseField->ny * denseField->nz;
+    float *densePtr = static_cast<float *>(denseField->data);
+    float *gridPtr = static_cast<float *>(gridField->data);
+    float minSpacing = std::min(referenceImage->dx, referenceImage->dy);
+    if (referenceImage->nz > 1)
+        minSpacing = std::min(minSpacing, referenceImage->dz);
+    double meanDistance = 0, maxDistance = 0;
+    for (size_t i = 0; i < voxelNumber; ++i) {
+        double distance = 0;
+        for (int d = 0; d < denseField->nu; ++d) {
+            double diff = densePtr[i + d * voxelNumber] - gridPtr[i + d * voxelNumber];
+            distance += diff * diff;
+        }
+        distance = sqrt(distance) / minSpacing;
+        meanDistance += distance;
+        maxDistance = std::max(maxDistance, distance);
+    }
+    meanDistance /= (double)voxelNumber;
+
+    nifti_image_free(referenceImage);
+    nifti_image_free(cppImage);
+    nifti_image_free(denseGrid);
+    nifti_image_free(denseField);
+    nifti_image_free(gridField);
+
+    if (meanDistance > EPS){
+        fprintf(stderr, "reg_test_velocity_grid_squaring mean distance of %g voxel (max %g) between the dense and grid squaring\n",
+                meanDistance, maxDistance);
+        return EXIT_FAILURE;
+    }
+    if (maxIdentityDiff > 1.e-3 * minSpacing){
+        fprintf(stderr, "reg_test_velocity_grid_squaring maximal displacement of %g from an identity symmetric velocity grid\n",
+                maxIdentityDiff);
+        return EXIT_FAILURE;
+    }
+    if (maxIntermediateDiff > 1.e-4){
+        fprintf(stderr, "reg_test_velocity_grid_squaring maximal difference of %g between the last intermediate field and the grid squaring\n",
+                maxIntermediateDiff);
+        return EXIT_FAILURE;
+    }
+    if (gradientError > EPS_GRAD){
+        fprintf(stderr, "reg_test_velocity_grid_squaring relative difference of %g between the grid squaring and dense gradients\n",
+                gradientError);
+        return EXIT_FAILURE;
+    }
+#ifndef NDEBUG
+    fprintf(stdout, "reg_test_velocity_grid_squaring ok: mean %g max %g, gradient %g\n", meanDistance, maxDistance,
+            gradientError);
+#endif
+
+    return EXIT_SUCCESS;
+}